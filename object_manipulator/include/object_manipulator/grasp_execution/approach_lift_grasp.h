@@ -41,6 +41,8 @@
 
 #include <trajectory_msgs/JointTrajectory.h>
 
+#include <algorithm>
+
 #include "object_manipulator/tools/grasp_marker_publisher.h"
 
 namespace object_manipulator {
@@ -120,14 +122,39 @@ protected:
 
   //! Function used to check for interrupts
   boost::function<bool()> interrupt_function_;
+
+  //! How many feasible grasps the caller should hand over at once, so that failed attempts can be retried right away
+  unsigned int retry_candidates_;
+
+  //! Set by performGrasp() if its grasp failed, but left the hand empty and the arm clear of the object
+  /*! Such a failure may have disturbed the object, so continuation_possible is not set, but 
+    the remaining grasps of the same batch can still be tried after re-validation. */
+  bool retry_possible_;
+
+  //! Checks that a grasp tested before an earlier attempt can still be started in the current planning scene
+  /*! Only the start of the approach trajectory is checked, as that is where move arm has to take 
+    the arm; the rest is checked again by the executors as it is carried out. */
+  virtual bool revalidateGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                               const object_manipulation_msgs::Grasp &grasp,
+                               const GraspExecutionInfo &execution_info);
 public:
-  GraspPerformer() : marker_publisher_(NULL) {}
+  GraspPerformer() : marker_publisher_(NULL), retry_candidates_(1), retry_possible_(false) {}
 
   //! Attempts to perform a set of grasps
+  /*! Grasps that did not pass testing are skipped. Stops at the first grasp that succeeds, or whose 
+    failure leaves no possibility of continuing, and shrinks execution_info to the grasps it got to. 
+    Every grasp after the first attempt is re-validated against the current planning scene first. */
   virtual void performGrasps(const object_manipulation_msgs::PickupGoal &pickup_goal,
                              const std::vector<object_manipulation_msgs::Grasp> &grasps,
                              std::vector<GraspExecutionInfo> &execution_info);
 
+  //! Sets how many feasible grasps should be handed to performGrasps() at once, if that many are ready
+  /*! The first one is attempted; the others are kept ready, with the trajectories computed by the 
+    tester, and tried right away if it fails. */
+  void setRetryCandidates(unsigned int retry_candidates){retry_candidates_ = std::max(retry_candidates, 1u);}
+
+  unsigned int getRetryCandidates() const {return retry_candidates_;}
+
   //! Sets the marker publisher to be used
   void setMarkerPublisher(GraspMarkerPublisher *pub){marker_publisher_ = pub;}
 
@@ -280,6 +307,11 @@ out of the way, and grasp.
 */
 class UnsafeGraspPerformer : public ReactiveGraspPerformer {
 protected:
+  //! Collisions are ignored anyway, so nothing needs to be re-validated
+  virtual bool revalidateGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                               const object_manipulation_msgs::Grasp &grasp,
+                               const GraspExecutionInfo &execution_info) {return true;}
+
   virtual object_manipulation_msgs::GraspResult 
   approachAndGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal,
                    const object_manipulation_msgs::Grasp &grasp,
@@ -36,7 +36,20 @@
 #ifndef _GRASP_TESTER_FAST_
 #define _GRASP_TESTER_FAST_
 
+#include <algorithm>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include "object_manipulator/grasp_execution/approach_lift_grasp.h"
+#include "object_manipulator/tools/tester_workspace.h"
+#include "object_manipulator/tools/posture_plan.h"
+#include "object_manipulator/tools/pose_batch.h"
+#include "object_manipulator/tools/ik_cache.h"
+#include "object_manipulator/tools/ik_seed_chains.h"
+#include "object_manipulator/tools/tester_stats.h"
+#include "object_manipulator/tools/batch_marker_publisher.h"
 #include <arm_kinematics_constraint_aware/arm_kinematics_solver_constraint_aware.h>
 #include <pluginlib/class_loader.h>
 
@@ -73,6 +86,10 @@ inline geometry_msgs::Vector3 doNegate(const geometry_msgs::Vector3& vec) {
 
 class GraspTesterFast : public GraspTester
 {
+public:
+  //! Number of contacts found between each pair of bodies, in alphabetical order
+  typedef std::map<std::pair<std::string, std::string>, unsigned int> ContactSummary;
+
 protected:
   virtual void testGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal,
                          const object_manipulation_msgs::Grasp &grasp,
@@ -82,26 +99,276 @@ protected:
   virtual std::vector<arm_navigation_msgs::LinkPadding> 
     linkPaddingForGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal);
 
-  bool getInterpolatedIK(const std::string& arm_name,
+  //! The collision configurations (allowed collisions and link padding) used by the test stages
+  enum TestStage {GRASP_COLLISION_STAGE, LIFT_COLLISION_STAGE, PREGRASP_COLLISION_STAGE, 
+                  IK_STAGE, FINAL_PREGRASP_STAGE, FINAL_LIFT_STAGE};
+
+  //! The allowed collision matrices used by the test stages, derived from the planning scene for a pickup goal
+  struct CollisionMatrices
+  {
+    //! Collisions disabled for all links not in the arm being used
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm_;
+    //! Also allows the end effector to touch the object, and the support surface if the goal says so
+    collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_disable_acm_;
+    //! group_disable_acm_, with collisions for the arm links disabled too
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm_;
+    //! object_support_disable_acm_, with collisions for the arm links disabled too
+    collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_all_arm_disable_acm_;
+  };
+
+  //! The parts of a pickup goal that the collision matrices depend on
+  struct CollisionMatricesKey
+  {
+    std::string arm_name_;
+    std::string collision_object_name_;
+    std::string collision_support_surface_name_;
+    bool allow_gripper_support_collision_;
+
+    bool operator<(const CollisionMatricesKey &other) const;
+  };
+
+  //! Everything about a call to testGrasps that is shared by all the grasps being tested
+  /*! Filled in once by the calling thread, then only read by the stages, except for the entries 
+    of execution_info_ (and the markers and contacts) belonging to the grasp being tested. */
+  struct GraspTestBatch
+  {
+    const object_manipulation_msgs::PickupGoal *pickup_goal_;
+    const std::vector<object_manipulation_msgs::Grasp> *grasps_;
+    std::vector<GraspExecutionInfo> *execution_info_;
+    bool return_on_first_hit_;
+
+    //! The world frame pose of the gripper for each grasp, and at the lift and pre-grasp
+    PoseBatch grasp_poses_;
+    PoseBatch lift_poses_;
+    PoseBatch pre_grasp_poses_;
+    //! False if the grasps could not be converted to the world frame
+    bool grasp_poses_valid_;
+
+    std::string gripper_frame_;
+    std::vector<std::string> end_effector_links_;
+
+    //! Holds the planning scene state as base state, and the hand postures of all grasps
+    PosturePlan posture_plan_;
+    std::vector<size_t> pre_grasp_postures_;
+    std::vector<size_t> grasp_postures_;
+    size_t arm_joints_;
+
+    boost::shared_ptr<const CollisionMatrices> collision_matrices_;
+    std::vector<arm_navigation_msgs::LinkPadding> grasp_link_padding_;
+
+    bool in_object_frame_;
+    tf::Transform obj_pose_;
+    std_msgs::Header target_header_;
+    std_msgs::Header world_header_;
+
+    tf::Vector3 pregrasp_dir_;
+    tf::Vector3 lift_dir_;
+
+    //! Where to look up and store IK results; NULL if not caching
+    IKCache *ik_cache_;
+    boost::uint64_t scene_hash_;
+    //! The sensed collision map the batch is tested in; cached failures only stand if found in the same one
+    boost::uint64_t collision_map_hash_;
+    //! For each grasp, hash of everything other than the pose and the scene that its IK results depend on
+    std::vector<boost::uint64_t> ik_context_hashes_;
+    //! IK results found for the grasps, added to the cache once the whole batch is done
+    IKCache::Pending ik_cache_pending_;
+
+    //! The chains IK is solved along when seeding from neighbouring grasps
+    IKSeedChains seed_chains_;
+    //! For each grasp, the arm joints IK was seeded with, if not the planning scene ones
+    std::vector< std::vector<double> > ik_seeds_;
+    //! For each grasp, the IK solution found; only kept when seeding from neighbouring grasps
+    std::vector< std::vector<double> > ik_solutions_;
+
+    //! Whether to build debug markers; decided once per call
+    bool visualize_;
+    //! For each grasp, robot markers showing where it failed
+    std::vector<visualization_msgs::MarkerArray> robot_markers_;
+
+    //! Whether to enumerate the contacts of failed collision checks; decided once per call
+    bool collect_contacts_;
+    //! For each grasp, the contacts found by its failed collision checks
+    std::vector<ContactSummary> contacts_;
+  };
+
+  bool getInterpolatedIK(const GraspTestBatch &batch,
+                         TesterWorkspace &workspace,
+                         const std::string& arm_name,
                          const tf::Transform& first_pose,
                          const tf::Vector3& direction,
                          const double& distance,
                          const std::vector<double>& ik_solution,
                          const bool& reverse, 
                          const bool& premultiply,
-                         trajectory_msgs::JointTrajectory& traj);
+                         trajectory_msgs::JointTrajectory& traj,
+                         arm_navigation_msgs::ArmNavigationErrorCodes& error_code);
+
+  //! Computes the collision matrices for a pickup goal from the current matrix of the collision models
+  /*! Leaves cm with collisions disabled for all links not in the arm being used. */
+  boost::shared_ptr<const CollisionMatrices> 
+    computeCollisionMatrices(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                             planning_environment::CollisionModels* cm,
+                             const std::vector<std::string> &end_effector_links);
+
+  //! Returns the collision matrices for a pickup goal, from the cache if possible
+  boost::shared_ptr<const CollisionMatrices> 
+    getCollisionMatrices(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                         planning_environment::CollisionModels* cm,
+                         const std::vector<std::string> &end_effector_links);
+
+  //! Applies the allowed collision matrix and link padding needed by a test stage
+  void configureStage(const GraspTestBatch &batch, TesterWorkspace &workspace, int stage);
+
+  //! Adds the contacts in the current workspace state to those of grasp i, if collecting contacts
+  void recordContacts(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Adds the contacts of all the grasps of the batch to contact_summary_
+  void summarizeContacts(GraspTestBatch &batch);
+
+  //! Records markers of the gripper in its current workspace state for grasp i, if visualizing
+  void addRobotMarkers(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                       float r, float g, float b, const std::string &ns);
+
+  //! Adds the grasp markers and the robot markers of the batch to markers, if visualizing
+  /*! ns_prefix goes in front of every marker namespace, so that several batches can be shown at once. */
+  void addMarkers(GraspTestBatch &batch, const std::string &ns_prefix, visualization_msgs::MarkerArray &markers);
+
+  //! Checks the gripper alone at the grasp pose, in the pre-grasp posture
+  void testGraspCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the gripper alone at the lift pose, in the grasp posture
+  void testLiftCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the gripper alone at the pre-grasp pose, in the pre-grasp posture
+  void testPregraspCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Computes IK for the grasp and the interpolated IK trajectories for approach and lift
+  /*! Uses the IK cache, if there is one. */
+  void testGraspIK(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Runs testGraspIK along chain c of the batch, seeding each grasp from its neighbours
+  void testGraspIKChain(GraspTestBatch &batch, TesterWorkspace &workspace, size_t c);
+
+  //! Does the actual work for testGraspIK, starting from the seed already set in the workspace state
+  /*! error_code is that of the IK or interpolated IK call that failed, if any. */
+  void solveGraspIK(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                    const geometry_msgs::PoseStamped &base_link_grasp_pose,
+                    std::vector<double> &ik_solution,
+                    arm_navigation_msgs::ArmNavigationErrorCodes &error_code);
+
+  //! Whether a cached IK result for grasp i still holds in the planning scene of the workspace
+  /*! The cache is not keyed on the sensed obstacles, so a cached solution and its trajectories are checked 
+    for collisions again, and a cached failure only stands in the collision map it was found in. */
+  bool cachedIKHolds(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i, const IKCache::Entry &entry);
+
+  //! Whether the arm at the given joint values is in collision, with the hand in the given posture
+  /*! values is scratch space for the state values. */
+  bool armInCollision(const GraspTestBatch &batch, TesterWorkspace &workspace, const std::vector<double> &arm_values,
+                      size_t hand_posture, std::vector<double> &values);
+
+  //! Checks the start of the approach trajectory against the default collision matrix and padding
+  void testFinalPregrasp(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the end of the lift trajectory, with the hand in the given posture of the posture plan
+  void testFinalLift(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i, size_t hand_posture);
+
+  //! Runs the test of the given stage for grasp indices[job]
+  void testGraspInStage(GraspTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                        TesterWorkspace &workspace, size_t job);
+
+  //! Runs one test stage over the grasps in [begin, end) that have not failed yet
+  void runStage(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                size_t begin, size_t end);
+
+  //! Returns the workspaces to test in: either the given serial one, or one per worker thread
+  std::vector<TesterWorkspace*> getWorkspaces(TesterWorkspace *serial_workspace);
+
+  //! Fills in everything about a batch that does not depend on the workspaces it is tested in
+  /*! Leaves cm with the allowed collision matrix of the batch; the caller restores it. */
+  void prepareBatch(GraspTestBatch &batch,
+                    const object_manipulation_msgs::PickupGoal &pickup_goal,
+                    const std::vector<object_manipulation_msgs::Grasp> &grasps,
+                    std::vector<GraspExecutionInfo> &execution_info,
+                    bool return_on_first_hit,
+                    planning_environment::CollisionModels* cm,
+                    planning_models::KinematicState* state);
+
+  //! Readies the workspaces for a batch; all but the serial one get the base state of its posture plan
+  void resetWorkspaces(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces,
+                       TesterWorkspace *serial_workspace);
+
+  //! Runs all the test stages of a prepared batch
+  /*! When returning on the first hit, truncates the execution info after the first success. */
+  void runBatch(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces);
+
+  //! How a batch run by runBatchInThread ended
+  struct BatchOutcome
+  {
+    bool interrupted_;
+    std::string error_;
+    //! How long running the batch took
+    double seconds_;
+    BatchOutcome() : interrupted_(false), seconds_(0.0) {}
+  };
+
+  //! Runs a batch, recording instead of throwing any exception, so it can be the body of a thread
+  void runBatchInThread(GraspTestBatch *batch, const std::vector<TesterWorkspace*> *workspaces,
+                        BatchOutcome *outcome);
+
+  //! Adds the IK results of a tested batch to the cache and its contacts to the summary, and records its stats
+  /*! seconds is how long setting up and testing the batch took. */
+  void finishBatch(GraspTestBatch &batch, double seconds);
 
   //arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* right_arm_solver_;
 
-  std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*> ik_solver_map_;
+  IKSolverMap ik_solver_map_;
   //std::map<std::string, pr2_arm_kinematics::PR2ArmIKSolverConstraintAware*> ik_solver_map_;
   
   double consistent_angle_;
   unsigned int num_points_;
   unsigned int redundancy_;
+
+  //! The number of worker threads used for testing; 1 means everything is tested serially
+  unsigned int num_threads_;
+
+  //! How many grasps are taken through all the stages at a time when returning on the first hit
+  unsigned int first_hit_window_;
+
+  //! Whether IK is seeded with the solutions for neighbouring grasps, and how near they must be
+  bool seed_propagation_;
+  double seed_distance_;
+
+  //! Whether to collect contacts even when the manipulation logger is not at debug level
+  bool diagnose_;
+
+  //! The contacts found during the last call to testGrasps
+  ContactSummary contact_summary_;
+
+  //! Private workspaces for parallel testing, created on first use
+  TesterWorkerPool worker_pool_;
+
+  //! Collision matrices computed for previous pickup goals
+  /*! Only used when testing against the planning scene of the MechanismInterface; emptied whenever 
+    the MechanismInterface installs a new planning scene. */
+  std::map<CollisionMatricesKey, boost::shared_ptr<const CollisionMatrices> > collision_matrices_cache_;
+
+  //! The planning scene revision the cached collision matrices were computed for
+  unsigned int collision_matrices_revision_;
+
+  boost::mutex collision_matrices_mutex_;
+
+  //! Optional cache of IK results, possibly shared with other testers
+  boost::shared_ptr<IKCache> ik_cache_;
+
+  //! Reachability maps used to reject grasps before running IK, by arm name
+  ReachabilityMaps reachability_maps_;
+
+  //! Timing and outcomes of all calls to testGrasps
+  TesterStatsRecorder stats_;
   
-  ros::Publisher vis_marker_array_publisher_;
-  ros::Publisher vis_marker_publisher_;
+  //! Publishes the debug markers of each call to testGrasps as a single batch
+  BatchMarkerPublisher marker_publisher_;
 
   planning_environment::CollisionModels* getCollisionModels();
   planning_models::KinematicState* getPlanningSceneState();
@@ -123,16 +390,100 @@ protected:
     state_ = state;
   }
 
+  //! Sets the number of worker threads used to test grasps
+  /*! Each worker gets its own copy of the collision models and IK solvers, so the first parallel 
+    call is slow. Parallel testing needs the planning scene of the MechanismInterface; if this 
+    tester was given its own collision models or planning scene state it always tests serially.
+    Results are the same regardless of the number of threads, also when using an IK cache, since 
+    the IK results found during a call are only added to it once the call is done.
+  */
+  void setNumThreads(unsigned int num_threads) {
+    num_threads_ = std::max(num_threads, 1u);
+  }
+
+  //! Sets how many grasps are tested at a time when returning on the first hit
+  /*! When returning on the first hit, grasps are pulled in order, window_size at a time, and each 
+    window is taken through all the test stages before moving on to the next one. Small windows avoid 
+    testing grasps past the first feasible one; larger ones reduce the cost of switching between 
+    stages. The window is never smaller than the number of threads. Feasibility testing of all grasps 
+    (return_on_first_hit == false) always runs each stage over all the grasps at once.
+  */
+  void setFirstHitWindow(unsigned int window_size) {
+    first_hit_window_ = std::max(window_size, 1u);
+  }
+
+  //! Sets whether to seed IK with the solutions found for neighbouring grasps
+  /*! By default IK for every grasp starts from the current arm configuration. With seed propagation, 
+    grasps are solved along nearest-neighbour chains instead (see IKSeedChains), each seeded with the 
+    last solution found along its chain for a grasp within max_distance (meters, plus 0.1 m per 
+    radian of rotation). This finds more solutions closer to each other in less time when grasps 
+    come in clusters. Results do not depend on the number of threads, but when returning on the 
+    first hit they do depend on the first hit window, as chains never span two windows.
+  */
+  void setSeedPropagation(bool enabled, double max_distance = 0.05) {
+    seed_propagation_ = enabled;
+    seed_distance_ = max_distance;
+  }
+
+  //! Sets whether to enumerate the contacts behind failed collision checks
+  /*! Contacts are always enumerated if the manipulation logger is at debug level. Enumerating contacts 
+    costs a full collision query per failure, so it is off by default. */
+  void setDiagnose(bool diagnose) {
+    diagnose_ = diagnose;
+  }
+
+  //! The contacts behind the failed collision checks of the last call to testGrasps
+  /*! Empty unless contacts were being collected. */
+  const ContactSummary& getContactSummary() const {return contact_summary_;}
+
+  //! Sets a cache for IK results; pass an empty pointer to stop caching
+  /*! The cache is only used when testing against the planning scene of the MechanismInterface. */
+  void setIKCache(boost::shared_ptr<IKCache> ik_cache) {
+    ik_cache_ = ik_cache;
+  }
+
+  //! Sets the reachability maps used to reject grasps without running IK
+  void setReachabilityMaps(const ReachabilityMaps &reachability_maps) {
+    reachability_maps_ = selectReachabilityMaps(reachability_maps, ik_solver_map_);
+  }
+
+  //! Timing and outcomes accumulated over all calls to testGrasps since the last reset
+  TesterStats getStats() const {return stats_.getStats();}
+
+  void resetStats() {stats_.reset();}
+
   void getGroupJoints(const std::string& group_name,
                       std::vector<std::string>& group_links);
   
   void getGroupLinks(const std::string& group_name,
                      std::vector<std::string>& group_links);
 
+  //! Tests a list of grasps for a pickup goal
+  /*! Locks the planning scene mutex of the MechanismInterface while setting up, but lets go of it 
+    while the worker workspaces run, as they have collision models of their own. When testing in the 
+    calling thread, the lock is held throughout. */
   virtual void testGrasps(const object_manipulation_msgs::PickupGoal &pickup_goal,
                           const std::vector<object_manipulation_msgs::Grasp> &grasps,
                           std::vector<GraspExecutionInfo> &execution_info,
                           bool return_on_first_hit);
+
+  //! Tests a list of grasps for each of several pickup goals, typically the same object with different arms
+  /*! Equivalent to calling testGrasps for each goal in turn, but the goals are tested concurrently, 
+    each in its own thread and on its own share of the worker workspaces (at least one each, even 
+    if that means more workspaces than the number of threads set). getContactSummary() covers all 
+    the goals afterwards. The planning scene mutex is locked as in testGrasps. Falls back to 
+    testing the goals one after the other if this tester was given its own collision models or 
+    planning scene state.
+  */
+  void testGraspsForArms(const std::vector<object_manipulation_msgs::PickupGoal> &pickup_goals,
+                         const std::vector< std::vector<object_manipulation_msgs::Grasp> > &grasps,
+                         std::vector< std::vector<GraspExecutionInfo> > &execution_info,
+                         bool return_on_first_hit);
+
+  //! Whether this tester has an IK solver for the given arm
+  bool canTestArm(const std::string &arm_name) const {
+    return ik_solver_map_.find(arm_name) != ik_solver_map_.end();
+  }
 };
 
 } //namespace object_manipulator
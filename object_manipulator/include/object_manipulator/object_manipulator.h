@@ -36,15 +36,24 @@
 #include <ros/ros.h>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+
+#include <deque>
 
 #include <actionlib/server/simple_action_server.h>
 
 #include <object_manipulation_msgs/PickupAction.h>
+#include <object_manipulation_msgs/PickupFeasibilityAction.h>
 #include <object_manipulation_msgs/PlaceAction.h>
 #include <object_manipulation_msgs/GraspPlanningAction.h>
 
 #include "object_manipulator/tools/service_action_wrappers.h"
 #include "object_manipulator/tools/mechanism_interface.h"
+#include "object_manipulator/tools/tester_stats.h"
+#include "object_manipulator/grasp_execution/approach_lift_grasp.h"
 
 namespace object_manipulator{
 
@@ -56,68 +65,197 @@ class UnsafeGraspExecutor;
 class GraspMarkerPublisher;
 
 class GraspTesterFast;
+class PlaceTesterFast;
+class IKCache;
 
 class GraspTester;
 class GraspPerformer;
 class PlaceTester;
 class PlacePerformer;
 
+//! An immutable run of consecutive grasps from a GraspContainer
+/*! Copies of a batch share the same grasps, which stay valid for as long as any copy exists, 
+  regardless of what happens to the container. */
+class GraspBatch
+{
+private:
+  boost::shared_ptr<const std::vector<object_manipulation_msgs::Grasp> > grasps_;
+  size_t first_index_;
+
+public:
+  GraspBatch() : first_index_(0) {}
+
+  GraspBatch(const boost::shared_ptr<const std::vector<object_manipulation_msgs::Grasp> > &grasps, 
+             size_t first_index) : grasps_(grasps), first_index_(first_index) {}
+
+  //! The grasps in this batch
+  const std::vector<object_manipulation_msgs::Grasp>& grasps() const;
+
+  size_t size() const {return grasps_ ? grasps_->size() : 0;}
+
+  bool empty() const {return size() == 0;}
+
+  //! The position in the container of the first grasp in this batch
+  size_t firstIndex() const {return first_index_;}
+};
+
+//! Append-only store for the grasps of a pickup, filled by one producer and read by any number of consumers
+/*! Grasps are kept in immutable segments, one per call to addGrasps(), and handed out as shared 
+  GraspBatch views. Adding only copies the grasps that are new (and nothing at all if the whole 
+  list is new and comes in a shared message); reading a whole segment is free, and a range that 
+  spans several segments is copied once, outside of the lock. The mutex only guards the list of 
+  segment pointers. 
+
+  Consumers can block in waitForGrasps() until new grasps arrive or the producer calls close(). */
 class GraspContainer
 {
 private:
-  std::vector<object_manipulation_msgs::Grasp> grasps_;
+  typedef boost::shared_ptr<const std::vector<object_manipulation_msgs::Grasp> > Segment;
+
+  //! The segments, in order, and the container position of the first grasp in each
+  std::vector<Segment> segments_;
+  std::vector<size_t> segment_starts_;
+
+  //! Total number of grasps in all segments
+  size_t size_;
+
+  //! Set when no more grasps will be added until the next clear()
+  bool closed_;
+
+  //! Incremented by clear(); producers identify themselves with it, so that late arrivals are dropped
+  unsigned int generation_;
+
   boost::mutex mutex_;
+  boost::condition_variable grasps_cond_;
+
+  //! Returns the grasps from start to the end; must be called with the lock held, and gives up the lock
+  GraspBatch collect(size_t start, boost::mutex::scoped_lock &lock);
+
+  //! Appends a segment, provided that the container is still at the given generation and holds start grasps
+  void append(const Segment &segment, size_t start, unsigned int generation);
 
 public:
+  GraspContainer() : size_(0), closed_(false), generation_(0) {}
+
   size_t size() 
   {
     boost::mutex::scoped_lock lock(mutex_);
-    return grasps_.size();
+    return size_;
   }
 
-  std::vector<object_manipulation_msgs::Grasp> getGrasps(size_t start) 
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    std::vector<object_manipulation_msgs::Grasp> ret_grasps;
-    if (start >= grasps_.size()) return ret_grasps;
-    std::vector<object_manipulation_msgs::Grasp>::iterator it = grasps_.begin();
-    for(size_t i=0; i<start; i++) it++;
-    ret_grasps.insert(ret_grasps.begin(), it, grasps_.end());
-    return ret_grasps;
-  }
+  //! Returns all grasps from position start on, or an empty batch if there are none
+  GraspBatch getGrasps(size_t start);
 
-  void addGrasps(const std::vector<object_manipulation_msgs::Grasp> &new_grasps)
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    if (new_grasps.size() <= grasps_.size())
-    {
-      ROS_WARN("No new grasps to add to container");
-    }
-    std::vector<object_manipulation_msgs::Grasp>::const_iterator it = new_grasps.begin();
-    for (size_t i=0; i<grasps_.size(); i++) it++;
-    grasps_.insert(grasps_.end(), it, new_grasps.end());
-  }
+  //! Like getGrasps(), but first waits for at most timeout for grasps beyond start to arrive
+  /*! Returns right away if there already are such grasps, or if the container is closed. */
+  GraspBatch waitForGrasps(size_t start, ros::Duration timeout);
 
-  void clear()
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    grasps_.clear();
-  }
+  //! Adds the grasps of a list that are beyond the ones already in the container
+  /*! Planners report all their grasps so far with every update, so only the tail of the list is 
+    new. The list is shared rather than copied if all of it is new. Grasps are dropped if the 
+    container has been cleared since the given generation was returned by clear(). */
+  void addGrasps(const boost::shared_ptr<const std::vector<object_manipulation_msgs::Grasp> > &new_grasps,
+                 unsigned int generation);
+
+  //! Same as above, for a list that can not be shared
+  void addGrasps(const std::vector<object_manipulation_msgs::Grasp> &new_grasps, unsigned int generation);
+
+  //! Tells consumers that no more grasps are coming for the given generation, waking up any waiting ones
+  void close(unsigned int generation);
 
-  void popFrontGrasps(size_t n)
+  bool isClosed()
   {
-    if (n==0) return;
     boost::mutex::scoped_lock lock(mutex_);
-    if (n>grasps_.size())
-    {
-      ROS_WARN("Grasp container requested to pop more grasps than it has");
-      grasps_.clear();
-      return;
-    }
-    std::vector<object_manipulation_msgs::Grasp>::iterator it = grasps_.begin();
-    for(size_t i=0; i<n; i++) it++;
-    grasps_.erase(grasps_.begin(), it);
+    return closed_;
   }
+
+  //! Drops all grasps and reopens the container; batches handed out before remain valid
+  /*! Returns the new generation, to be passed in by whoever adds grasps from now on. */
+  unsigned int clear();
+};
+
+//! A grasp that has been through the grasp tester, along with what is needed to perform it
+struct TestedGrasp
+{
+  //! The batch the grasp came in; the grasp itself is not copied
+  GraspBatch batch_;
+
+  //! The position of the grasp in the batch
+  size_t index_;
+
+  GraspExecutionInfo execution_info_;
+
+  const object_manipulation_msgs::Grasp& grasp() const {return batch_.grasps().at(index_);}
+};
+
+//! Grasps tested for a pickup goal before it is performed, as when choosing the arm
+struct PriorGraspTests
+{
+  //! Tested grasps that will not be tried again, and their results, for the front of the pickup result
+  std::vector<object_manipulation_msgs::Grasp> attempted_grasps_;
+  std::vector<object_manipulation_msgs::GraspResult> attempted_grasp_results_;
+
+  //! Results for the first desired grasps of the goal, tested against the installed planning scene
+  std::vector<GraspExecutionInfo> tested_;
+};
+
+//! Hands grasps over, in the order they were tested, from a thread testing them to the one performing them
+/*! The testing thread is started with start(), pushes every grasp it has tested, and calls finish() 
+  when it is done, one way or another. It should use interrupted() as the interrupt function of its 
+  grasp tester, so that it stops as soon as the consumer calls stop() or the interrupt function 
+  given to the queue fires. The destructor stops the testing thread and waits for it. */
+class TestedGraspQueue
+{
+public:
+  //! How testing went; anything but TESTING means the testing thread will push no more grasps
+  enum Outcome {TESTING, DONE, INTERRUPTED, MOVE_ARM_STUCK, ERROR};
+
+private:
+  std::deque<TestedGrasp> grasps_;
+
+  Outcome outcome_;
+
+  //! The error message if outcome_ is ERROR
+  std::string error_;
+
+  //! Set by the consumer when it no longer needs grasps
+  bool stop_requested_;
+
+  //! Checked by interrupted() in addition to stop_requested_
+  boost::function<bool()> interrupt_function_;
+
+  boost::thread *testing_thread_;
+
+  boost::mutex mutex_;
+  boost::condition_variable grasps_cond_;
+
+public:
+  TestedGraspQueue(boost::function<bool()> interrupt_function) : outcome_(TESTING), stop_requested_(false),
+    interrupt_function_(interrupt_function), testing_thread_(NULL) {}
+
+  ~TestedGraspQueue();
+
+  //! Runs the given function, which is expected to fill this queue, in a new thread
+  void start(boost::function<void()> testing_function);
+
+  //! Called by the testing thread for every grasp it has tested
+  void push(const GraspBatch &batch, size_t index, const GraspExecutionInfo &execution_info);
+
+  //! Called by the testing thread when it will not push any more grasps
+  void finish(Outcome outcome, const std::string &error = "");
+
+  //! Moves all grasps tested so far to the end of tested, waiting for at most timeout if there are none yet
+  /*! Returns false if there were none; check getOutcome() to see if more are coming. */
+  bool popAll(std::deque<TestedGrasp> &tested, ros::Duration timeout);
+
+  //! How testing went so far; error is set if the outcome is ERROR
+  Outcome getOutcome(std::string &error);
+
+  //! Tells the testing thread to stop as soon as possible
+  void stop();
+
+  //! Whether the testing thread should stop; meant to be used as the interrupt function of its tester
+  bool interrupted();
 };
 
 //! Oversees the grasping app; bundles together functionality in higher level calls
@@ -150,10 +288,22 @@ private:
   GraspPerformer* standard_grasp_performer_;
   GraspPerformer* reactive_grasp_performer_;
   GraspPerformer* unsafe_grasp_performer_;
-  PlaceTester* standard_place_tester_;
+  PlaceTesterFast* standard_place_tester_;
   PlacePerformer* standard_place_performer_;
   PlacePerformer* reactive_place_performer_;
 
+  //! IK results shared by the fast grasp and place testers, or empty if not caching
+  boost::shared_ptr<IKCache> ik_cache_;
+
+  //! Where the IK cache is loaded from on startup and saved to periodically and on shutdown; empty for none
+  std::string ik_cache_file_;
+
+  //! The revision of the IK cache last saved to ik_cache_file_
+  size_t ik_cache_saved_revision_;
+
+  //! Triggers periodic saving of the IK cache, so that a crash does not lose it
+  ros::Timer ik_cache_save_timer_;
+
   //! Instance of the grasp executor with approach
   GraspExecutorWithApproach* grasp_executor_with_approach_;
 
@@ -182,20 +332,107 @@ private:
   //! A thread safe place to hold grasps returned by the planning action as feedback
   GraspContainer grasp_container_;
 
+  //! Serializes pickup() and pickupFeasibility(), which share the grasp testers and planner clients
+  boost::mutex pickup_mutex_;
+
+  //! The arms considered for a pickup goal that does not name an arm, in order of preference on ties
+  std::vector<std::string> any_arm_names_;
+
+  //! The grasp planning action to be used for the given object
+  std::string selectGraspPlanner(const object_manipulation_msgs::GraspableObject &target);
+
+  //! Sends a goal to the given grasp planning action, without waiting for the result
+  void sendGraspPlanningGoal(const object_manipulation_msgs::PickupGoal &pickup_goal, 
+                             const std::string &planner_action);
+
+  //! Waits for the result of the last goal sent to the given grasp planning action
+  /*! Returns false if planning failed. Throws InterruptRequestedException if interrupt_function 
+    fires in the meantime. */
+  bool waitForGraspPlanning(const std::string &planner_action, boost::function<bool()> interrupt_function,
+                            std::vector<object_manipulation_msgs::Grasp> &grasps);
+
+  //! Publishes the statistics of the testers as diagnostics
+  ros::Publisher diagnostics_pub_;
+
+  //! Triggers periodic publication of the tester statistics
+  ros::Timer diagnostics_timer_;
+
+  //! Runs in the background during pickup, testing grasps from the grasp container as they come in
+  /*! Installs the planning scene from planning_scene_fetch first, then tests every batch of grasps 
+    in the container. When returning on the first hit, testing resumes right after each grasp that 
+    passes, so later grasps are tested while that one is being performed. Everything tested goes 
+    into tested_grasps. The first grasps in the container, as many as there are entries in 
+    pretested, are not tested again; their entries are pushed as they are. */
+  void testGraspsInBackground(object_manipulation_msgs::PickupGoal::ConstPtr pickup_goal, 
+                              GraspTester *grasp_tester,
+                              actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+                              TestedGraspQueue *tested_grasps, PlanningSceneFetch planning_scene_fetch,
+                              std::vector<GraspExecutionInfo> pretested);
+
+  //! Performs a pickup goal that names its arm; the caller holds pickup_mutex_
+  /*! prior holds whatever was tested before, as by chooseArm(); pass an empty one if nothing was. */
+  void pickupWithArm(const object_manipulation_msgs::PickupGoal::ConstPtr &pickup_goal,
+                     actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+                     const PriorGraspTests &prior);
+
+  //! Picks the arm for a pickup goal that does not name one
+  /*! Plans grasps for each of the any_arm_names_, then tests the grasp sets of all the arms 
+    concurrently, each up to its first feasible grasp. The arm whose first feasible grasp has the 
+    highest success probability wins. Returns a copy of the goal for that arm, with the grasps to 
+    try starting at the feasible one. What was tested goes into prior, for pickupWithArm() to 
+    report and not test again. If no arm will do, or anything goes wrong, sets the outcome of the 
+    action and returns an empty pointer. */
+  object_manipulation_msgs::PickupGoal::ConstPtr 
+    chooseArm(const object_manipulation_msgs::PickupGoal::ConstPtr &pickup_goal,
+              actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+              PriorGraspTests &prior);
+
+  //! Saves the IK cache to ik_cache_file_, if anything changed since the last time
+  void saveIKCache();
+
+  //! Timer callback for saveIKCache()
+  void saveIKCacheCallback(const ros::TimerEvent &event) {saveIKCache();}
+
+  //! Publishes the current statistics of the grasp and place testers and of the planning scene cache
+  void publishTesterStats(const ros::TimerEvent &event);
+
 public:
   //! Initializes ros clients as needed
   ObjectManipulator();
 
   ~ObjectManipulator();
 
+  //! Connects to the grasp planning actions that pickup may use, waiting at most timeout (0 meaning forever)
+  /*! Those are the default cluster and database planners, or the default probabilistic planner if it 
+    is in use. The names of the planners not found are added to missing; pickup still waits for 
+    them on first use. Returns true if all were found. */
+  bool warmUpGraspPlanners(ros::Duration timeout, std::vector<std::string> &missing);
+
   //! Attempts to grasp the specified object
+  /*! If the goal does not name an arm, the best arm is chosen first, see chooseArm(). */
   void pickup(const object_manipulation_msgs::PickupGoal::ConstPtr &pickup_goal,
 	      actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server);
 
+  //! Tests the grasps for a number of objects in one go, and suggests an order in which to pick them up
+  /*! Works like a feasibility-only pickup for each object, but the planning scene is set up once 
+    for all of them, and grasp planning for each object runs while the grasps for the previous one 
+    are being tested. Feasible objects are suggested in decreasing order of their number of 
+    feasible grasps: those are the easiest to pick up, and taking them out of the way first can 
+    only make room for the others. */
+  void pickupFeasibility(const object_manipulation_msgs::PickupFeasibilityGoal::ConstPtr &goal,
+                         actionlib::SimpleActionServer<object_manipulation_msgs::PickupFeasibilityAction> 
+                         *action_server);
+
   //! Attempts to place the specified object
   void place(const object_manipulation_msgs::PlaceGoal::ConstPtr &place_goal,
 	     actionlib::SimpleActionServer<object_manipulation_msgs::PlaceAction> *action_server);
 
+  //! Timing and outcomes of all grasp tests since startup
+  TesterStats getGraspTesterStats() const;
+
+  //! Timing and outcomes of all place tests since startup
+  TesterStats getPlaceTesterStats() const;
+
   //! Provides feedback on the currently tested list of grasps
   void graspFeedback(actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
                      size_t tested_grasps, size_t current_grasp);
@@ -204,11 +441,12 @@ public:
   void placeFeedback(actionlib::SimpleActionServer<object_manipulation_msgs::PlaceAction> *action_server,
                      size_t tested_places, size_t total_places, size_t current_place);
 
-  //! Saves the grasps provided as feedback by planning action
-  void graspPlanningFeedbackCallback(const object_manipulation_msgs::GraspPlanningFeedbackConstPtr &feedback);
+  //! Saves the grasps provided as feedback by planning action into the given generation of the grasp container
+  void graspPlanningFeedbackCallback(unsigned int generation,
+                                     const object_manipulation_msgs::GraspPlanningFeedbackConstPtr &feedback);
 
-  //! Saves the grasps provided as result by planning action
-  void graspPlanningDoneCallback(const actionlib::SimpleClientGoalState& state,
+  //! Saves the grasps provided as result by planning action, then closes the grasp container
+  void graspPlanningDoneCallback(unsigned int generation, const actionlib::SimpleClientGoalState& state,
                                  const object_manipulation_msgs::GraspPlanningResultConstPtr &result);
 
 };
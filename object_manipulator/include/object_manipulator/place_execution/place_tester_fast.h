@@ -36,7 +36,15 @@
 #ifndef _PLACE_TESTER_FAST_
 #define _PLACE_TESTER_FAST_
 
+#include <algorithm>
+
 #include "object_manipulator/place_execution/descend_retreat_place.h"
+#include "object_manipulator/tools/posture_plan.h"
+#include "object_manipulator/tools/pose_batch.h"
+#include "object_manipulator/tools/ik_cache.h"
+#include "object_manipulator/tools/ik_seed_chains.h"
+#include "object_manipulator/tools/tester_workspace.h"
+#include "object_manipulator/tools/tester_stats.h"
 #include <arm_kinematics_constraint_aware/arm_kinematics_solver_constraint_aware.h>
 //#include <pr2_arm_kinematics_constraint_aware/pr2_arm_ik_solver_constraint_aware.h>
 
@@ -67,21 +75,149 @@ protected:
   void getGroupLinks(const std::string& group_name,
                      std::vector<std::string>& group_links);
 
-  bool getInterpolatedIK(const std::string& arm_name,
+  //! The collision configurations (allowed collisions and link padding) used by the test stages
+  enum TestStage {PLACE_COLLISION_STAGE, PREPLACE_COLLISION_STAGE, RETREAT_COLLISION_STAGE,
+                  IK_STAGE, FINAL_PREPLACE_STAGE, FINAL_RETREAT_STAGE};
+
+  //! Everything about a call to testPlaces that is shared by all the place locations being tested
+  /*! Filled in once by the calling thread, then only read by the stages, except for the entries 
+    of execution_info_ belonging to the location being tested. */
+  struct PlaceTestBatch
+  {
+    const object_manipulation_msgs::PlaceGoal *place_goal_;
+    const std::vector<geometry_msgs::PoseStamped> *place_locations_;
+    std::vector<PlaceExecutionInfo> *execution_info_;
+    bool return_on_first_hit_;
+
+    //! The world frame pose of the gripper for each location, and at the pre-place and the retreat
+    PoseBatch place_poses_;
+    PoseBatch approach_poses_;
+    PoseBatch retreat_poses_;
+    //! False for the locations that could not be converted to the world frame
+    std::vector<bool> place_pose_valid_;
+
+    std::string gripper_frame_;
+
+    //! Holds the planning scene state as base state
+    PosturePlan posture_plan_;
+    size_t arm_joints_;
+    //! The gripper opened after the place
+    size_t post_grasp_posture_;
+    //! The gripper as it currently is, holding the object
+    size_t grasp_posture_;
+
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm_;
+    collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_disable_acm_;
+    collision_space::EnvironmentModel::AllowedCollisionMatrix object_all_arm_disable_acm_;
+    collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_all_arm_disable_acm_;
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm_;
+    std::vector<arm_navigation_msgs::LinkPadding> place_link_padding_;
+
+    std_msgs::Header world_header_;
+    tf::Vector3 approach_dir_;
+    tf::Vector3 retreat_dir_;
+
+    //! Where to look up and store IK results; NULL if not caching
+    IKCache *ik_cache_;
+    boost::uint64_t scene_hash_;
+    //! The sensed collision map the batch is tested in; cached failures only stand if found in the same one
+    boost::uint64_t collision_map_hash_;
+    //! Hash of everything other than the pose and the scene that the IK results depend on
+    boost::uint64_t context_hash_;
+    //! IK results found for the locations, added to the cache once the whole batch is done
+    IKCache::Pending ik_cache_pending_;
+
+    //! The chains IK is solved along when seeding from neighbouring locations
+    IKSeedChains seed_chains_;
+    //! For each location, the arm joints IK was seeded with, if not the planning scene ones
+    std::vector< std::vector<double> > ik_seeds_;
+    //! For each location, the IK solution found; only kept when seeding from neighbouring locations
+    std::vector< std::vector<double> > ik_solutions_;
+  };
+
+  bool getInterpolatedIK(const PlaceTestBatch &batch,
+                         TesterWorkspace &workspace,
                          const tf::Transform& first_pose,
                          const tf::Vector3& direction,
                          const double& distance,
                          const std::vector<double>& ik_solution,
                          const bool& reverse, 
                          const bool& premultiply,
-                         trajectory_msgs::JointTrajectory& traj);
+                         trajectory_msgs::JointTrajectory& traj,
+                         arm_navigation_msgs::ArmNavigationErrorCodes& error_code);
+
+  //! Puts the workspace state back to the planning scene state, with the gripper in the given posture
+  void resetState(const PlaceTestBatch &batch, TesterWorkspace &workspace, size_t posture);
+
+  //! Applies the allowed collision matrix and link padding needed by a test stage
+  void configureStage(const PlaceTestBatch &batch, TesterWorkspace &workspace, int stage);
+
+  //! Checks the gripper alone at the place pose, in the post-grasp posture
+  void testPlaceCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the gripper alone at the pre-place pose, in the planning scene posture
+  void testPreplaceCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the gripper alone at the retreat pose, in the post-grasp posture
+  void testRetreatCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Computes IK for a place pose and the descend and retreat trajectories, using the IK cache if there is one
+  void testPlaceIK(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Runs testPlaceIK along chain c of the batch, seeding each location from its neighbours
+  void testPlaceIKChain(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t c);
+
+  //! Does the actual work for testPlaceIK, starting from the seed already set in the workspace state
+  /*! Returns 0 on success, or the PlaceLocationResult code for the step that failed, in which case 
+    error_code is that of the IK or interpolated IK call that failed. */
+  int solvePlaceIK(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                   const geometry_msgs::PoseStamped& base_link_place_pose,
+                   std::vector<double>& ik_solution,
+                   arm_navigation_msgs::ArmNavigationErrorCodes& error_code);
+
+  //! Whether a cached IK result still holds in the planning scene of the workspace
+  /*! The cache is not keyed on the sensed obstacles, so a cached solution and its trajectories are checked 
+    for collisions again, and a cached failure only stands in the collision map it was found in. */
+  bool cachedIKHolds(PlaceTestBatch &batch, TesterWorkspace &workspace, const IKCache::Entry &entry);
+
+  //! Whether the arm at the given joint values is in collision, with the gripper in the given posture
+  /*! values is scratch space for the state values. */
+  bool armInCollision(const PlaceTestBatch &batch, TesterWorkspace &workspace, const std::vector<double> &arm_values,
+                      size_t posture, std::vector<double> &values);
+
+  //! Checks the start of the descend trajectory against the default collision matrix and padding
+  void testFinalPreplace(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Checks the end of the retreat trajectory, with the gripper in the post-grasp posture
+  void testFinalRetreat(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Runs the test of the given stage for location indices[job]
+  void testPlaceInStage(PlaceTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                        TesterWorkspace &workspace, size_t job);
+
+  //! Runs one test stage over the locations in [begin, end) that have not failed yet
+  void runStage(PlaceTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                size_t begin, size_t end);
+
+  //! Returns the workspaces to test in: either the given serial one, or one per worker thread
+  std::vector<TesterWorkspace*> getWorkspaces(TesterWorkspace *serial_workspace);
     
-  std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*> ik_solver_map_;
+  IKSolverMap ik_solver_map_;
   //std::map<std::string, pr2_arm_kinematics::PR2ArmIKSolverConstraintAware*> ik_solver_map_;
   
   double consistent_angle_;
   unsigned int num_points_;
   unsigned int redundancy_;
+
+  //! The number of worker threads used for testing; 1 means everything is tested serially
+  unsigned int num_threads_;
+
+  //! Whether IK is seeded with the solutions for neighbouring locations, and how near they must be
+  bool seed_propagation_;
+  double seed_distance_;
+
+  //! Private workspaces for parallel testing, created on first use
+  TesterWorkerPool worker_pool_;
   
   ros::Publisher vis_marker_array_publisher_;
   ros::Publisher vis_marker_publisher_;
@@ -92,6 +228,15 @@ protected:
   planning_environment::CollisionModels* cm_;
   planning_models::KinematicState* state_;
 
+  //! Optional cache of IK results, possibly shared with other testers
+  boost::shared_ptr<IKCache> ik_cache_;
+
+  //! Reachability maps used to reject place locations before running IK, by arm name
+  ReachabilityMaps reachability_maps_;
+
+  //! Timing and outcomes of all calls to testPlaces
+  TesterStatsRecorder stats_;
+
  public:
   //! Also adds a grasp marker at the pre-grasp location
   PlaceTesterFast(planning_environment::CollisionModels* cm = NULL,
@@ -103,6 +248,40 @@ protected:
     state_ = state;
   }
 
+  //! Sets the number of worker threads used to test place locations
+  /*! Same as for GraspTesterFast: each worker gets its own copy of the collision models and IK 
+    solvers, parallel testing needs the planning scene of the MechanismInterface, and results are 
+    the same regardless of the number of threads, also when using an IK cache. When returning on 
+    the first hit, locations go through IK and the final checks num_threads at a time.
+  */
+  void setNumThreads(unsigned int num_threads) {
+    num_threads_ = std::max(num_threads, 1u);
+  }
+
+  //! Sets whether to seed IK with the solutions found for neighbouring place locations
+  /*! Same as for GraspTesterFast; when returning on the first hit, chains never span two windows, 
+    so the solutions found then depend on the number of threads. */
+  void setSeedPropagation(bool enabled, double max_distance = 0.05) {
+    seed_propagation_ = enabled;
+    seed_distance_ = max_distance;
+  }
+
+  //! Sets a cache for IK results; pass an empty pointer to stop caching
+  /*! The cache is only used when testing against the planning scene of the MechanismInterface. */
+  void setIKCache(boost::shared_ptr<IKCache> ik_cache) {
+    ik_cache_ = ik_cache;
+  }
+
+  //! Sets the reachability maps used to reject place locations without running IK
+  void setReachabilityMaps(const ReachabilityMaps &reachability_maps) {
+    reachability_maps_ = selectReachabilityMaps(reachability_maps, ik_solver_map_);
+  }
+
+  //! Timing and outcomes accumulated over all calls to testPlaces since the last reset
+  TesterStats getStats() const {return stats_.getStats();}
+
+  void resetStats() {stats_.reset();}
+
   void testPlaces(const object_manipulation_msgs::PlaceGoal &place_goal,
                   const std::vector<geometry_msgs::PoseStamped> &place_locations,
                   std::vector<PlaceExecutionInfo> &execution_info,
@@ -0,0 +1,97 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _BATCH_MARKER_PUBLISHER_H_
+#define _BATCH_MARKER_PUBLISHER_H_
+
+#include <string>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <ros/ros.h>
+
+#include <visualization_msgs/MarkerArray.h>
+
+namespace object_manipulator {
+
+//! Publishes debug markers produced by the testers in batches, off the calling thread
+/*! Callers check active() before building any markers, so nothing is computed when no one is 
+  listening or visualization is turned off. A whole batch is then handed over with publish(), and 
+  sent out as a single MarkerArray by a background thread, at most max_rate times per second. If 
+  a new batch arrives before the previous one went out, the previous one is dropped.
+
+  Visualization can be turned on and off at run time through the boolean private parameter 
+  tester_visualization (default true); the maximum rate is read from tester_visualization_rate 
+  (default 2 Hz) on construction.
+*/
+class BatchMarkerPublisher
+{
+ private:
+  ros::Publisher publisher_;
+
+  //! Minimum time between two batches, in seconds
+  double min_period_;
+
+  //! The batch waiting to be published
+  visualization_msgs::MarkerArray pending_;
+  bool has_pending_;
+
+  bool shutdown_;
+
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+
+  //! Publishes the pending batches, waiting out the minimum period between them
+  boost::thread *publishing_thread_;
+
+  void publishingThread();
+
+ public:
+  //! Advertises the given MarkerArray topic in the root namespace
+  BatchMarkerPublisher(const std::string &topic);
+
+  //! Joins the publishing thread; pending markers are dropped
+  ~BatchMarkerPublisher();
+
+  //! Whether visualization is turned on and someone is listening
+  bool active() const;
+
+  //! Hands over a batch of markers to be published; the batch is emptied
+  void publish(visualization_msgs::MarkerArray &markers);
+};
+
+} //namespace object_manipulator
+
+#endif
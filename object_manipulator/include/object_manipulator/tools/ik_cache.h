@@ -0,0 +1,192 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _IK_CACHE_H_
+#define _IK_CACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <geometry_msgs/Pose.h>
+#include <trajectory_msgs/JointTrajectory.h>
+
+namespace object_manipulator {
+
+//! Remembers the outcome of IK queries made by the fast testers, with least-recently-used eviction
+/*! An entry is keyed by the arm group, the goal pose in the base frame of the IK solver quantized 
+  to a grid, a scene hash and a hash of everything else the tester's IK stage depends on (hand 
+  postures, approach and lift distances, allowed collisions, padding...). Poses falling in the same 
+  grid cell share an entry, so the resolution should be well below what matters for execution.
+
+  The scene hash combines the parts of the planning scene that stay put between requests (see 
+  MechanismInterface::getPlanningSceneHash()) with the quantized start state of the arm, as built 
+  by sceneHash(). It deliberately leaves out the sensed collision map and the rest of the robot 
+  state, which change with every planning scene and would keep entries from ever being reused.
+  Users of the cache have to make up for that: a successful entry's solution and trajectories must be 
+  checked against the current planning scene before they are used, and failures must only be stored 
+  if IK found no solution rather than running into an obstacle. Even then the solver may have run 
+  out of solutions because of obstacles, so failures carry the hash of the collision map they were 
+  found in (see MechanismInterface::getCollisionMapHash()) and only stand while it stays the same.
+
+  Entries store the failure code of the IK stage (0 if it succeeded), the seed and the solution, and 
+  up to two interpolated trajectories (approach/lift when grasping, descend/retreat when placing). 
+  The cache can be saved to and loaded from a file so that a restarted node starts warm; the file 
+  is in native byte order and meant to be read back on the same machine.
+
+  All member functions are thread-safe.
+*/
+class IKCache
+{
+ public:
+  struct Key
+  {
+    std::string group_;
+    //! Quantized position (x, y, z) and orientation (x, y, z, w)
+    boost::int32_t cell_[7];
+    boost::uint64_t scene_hash_;
+    boost::uint64_t context_hash_;
+
+    bool operator<(const Key &other) const;
+  };
+
+  struct Entry
+  {
+    //! 0 if IK and both interpolated trajectories were found, otherwise the tester's failure code
+    int result_code_;
+    //! The arm joint values IK was seeded with
+    std::vector<double> seed_;
+    //! The arm joint values found by IK, if any
+    std::vector<double> solution_;
+    trajectory_msgs::JointTrajectory first_trajectory_;
+    trajectory_msgs::JointTrajectory second_trajectory_;
+    //! For failures, the hash of the sensed collision map they were found in
+    boost::uint64_t collision_map_hash_;
+
+    Entry() : result_code_(0), collision_map_hash_(0) {}
+  };
+
+  //! Entries held back while a batch of candidates is tested, one slot per candidate; see insert(Pending&)
+  /*! Different slots may be filled from different threads at the same time. */
+  class Pending
+  {
+    friend class IKCache;
+    std::vector< std::pair<Key, Entry> > entries_;
+    std::vector<char> filled_;
+
+   public:
+    //! Empties all slots and makes room for size candidates
+    void reset(size_t size);
+
+    //! Holds back the entry for candidate i
+    void set(size_t i, const Key &key, const Entry &entry);
+  };
+
+ private:
+  typedef std::list< std::pair<Key, Entry> > EntryList;
+
+  //! Entries, most recently used first
+  EntryList entries_;
+  std::map<Key, EntryList::iterator> index_;
+
+  size_t capacity_;
+  double position_resolution_;
+  double orientation_resolution_;
+
+  double joint_resolution_;
+
+  size_t hits_;
+  size_t misses_;
+
+  //! Incremented whenever entries are added or removed
+  size_t revision_;
+
+  mutable boost::mutex mutex_;
+
+  //! Inserts or replaces an entry; must be called with the mutex locked
+  void insertLocked(const Key &key, const Entry &entry);
+
+ public:
+  //! position_resolution in meters; orientation_resolution and joint_resolution in radians
+  IKCache(size_t capacity, double position_resolution = 0.001, double orientation_resolution = 0.01,
+          double joint_resolution = 0.01);
+
+  //! Combines the hash of the static planning scene with the start state of the arm
+  /*! Joint values are quantized to the joint resolution, so that the noise in the joint states does 
+    not keep entries from being reused while the arm stands still. */
+  boost::uint64_t sceneHash(boost::uint64_t static_scene_hash, const std::vector<double> &arm_joint_values) const;
+
+  //! Builds the key for a pose expressed in the base frame of the IK solver for group
+  Key makeKey(const std::string &group, const geometry_msgs::Pose &base_frame_pose,
+              boost::uint64_t scene_hash, boost::uint64_t context_hash) const;
+
+  //! Copies the entry for key into entry and marks it as most recently used; false if not found
+  bool lookup(const Key &key, Entry &entry);
+
+  //! Adds or replaces the entry for key, evicting the least recently used entry if full
+  void insert(const Key &key, const Entry &entry);
+
+  //! Adds the entries held back for a batch in candidate order, then empties all slots
+  /*! The testers hold back what they find until a whole batch is done, so that lookups during the 
+    batch only see entries from before it. Otherwise two candidates in the same grid cell would share 
+    whichever result got in first, which with several threads depends on timing. */
+  void insert(Pending &pending);
+
+  void clear();
+
+  size_t size() const;
+
+  //! The number of successful and failed lookups so far
+  void getStats(size_t &hits, size_t &misses) const;
+
+  //! Changes whenever entries are added or removed; tells whether the cache needs saving again
+  size_t getRevision() const;
+
+  //! Writes all entries to a file; returns false on failure
+  /*! The entries are written to a temporary file first, which then replaces the given one, so an 
+    interrupted save leaves the previous file intact. */
+  bool save(const std::string &filename) const;
+
+  //! Adds the entries from a file written by save(); returns false on failure
+  /*! All lengths read from the file are checked against what is left of it, so a damaged file is 
+    rejected rather than read past its end. Entries read before the damage are kept. */
+  bool load(const std::string &filename);
+};
+
+} //namespace object_manipulator
+
+#endif
@@ -0,0 +1,100 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _IK_SEED_CHAINS_H_
+#define _IK_SEED_CHAINS_H_
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "object_manipulator/tools/pose_batch.h"
+
+namespace object_manipulator {
+
+//! Orders IK candidates so that each one can be seeded with the solution found for a nearby one
+/*! Candidates coming from a grasp database or a place location generator are often only a few 
+  millimeters or degrees apart, so the solution for one is a much better IK seed for the next than 
+  the current arm configuration. The candidates are linked greedily into nearest-neighbour chains, 
+  starting each chain from the first candidate not yet used, in the original order. A chain ends 
+  where the nearest remaining candidate is further than the maximum distance. 
+
+  Within a chain, each candidate is seeded with the last solution found along the chain, if that 
+  solution is for a pose within the maximum distance; otherwise, and for the first candidate of 
+  every chain, the caller's default seed is used. Chains only depend on the poses, so each can be 
+  solved as a single job on any worker thread without changing the results.
+
+  Pose distance is the distance between positions plus rotation_weight times the angle between the 
+  orientations, in meters. Building the chains takes quadratic time in the number of candidates, 
+  which is negligible next to running IK on them.
+*/
+class IKSeedChains
+{
+ private:
+  //! The poses of all candidates, by candidate index
+  const PoseBatch *poses_;
+
+  std::vector< std::vector<size_t> > chains_;
+
+  double max_distance_;
+  double rotation_weight_;
+
+ public:
+  IKSeedChains(double max_distance = 0.05, double rotation_weight = 0.1) : 
+    poses_(NULL), max_distance_(max_distance), rotation_weight_(rotation_weight) {}
+
+  //! Builds the chains over the given candidates, whose poses are entries of poses
+  /*! poses must outlive the chains. */
+  void build(const PoseBatch &poses, const std::vector<size_t> &candidates);
+
+  //! The number of chains built
+  size_t size() const {return chains_.size();}
+
+  //! The candidate indices in a chain, in the order they should be solved in
+  const std::vector<size_t>& chain(size_t c) const {return chains_[c];}
+
+  //! The distance between the poses of two candidates
+  double distance(size_t i, size_t j) const;
+
+  //! Solves the candidates of a chain in order, setting each one's seed before solving it
+  /*! solve(i) must solve candidate i using seeds[i] as seed if it is not empty, and leave the 
+    solution in solutions[i], or leave it empty if none was found. Only the entries for candidates 
+    in the chain are written. */
+  void solveChain(size_t c, std::vector< std::vector<double> > &seeds,
+                  const std::vector< std::vector<double> > &solutions,
+                  boost::function<void(size_t)> solve) const;
+};
+
+} //namespace object_manipulator
+
+#endif
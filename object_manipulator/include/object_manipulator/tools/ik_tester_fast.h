@@ -36,9 +36,19 @@
 #ifndef _IK_TESTER_FAST_
 #define _IK_TESTER_FAST_
 
+#include <algorithm>
+
+#include <boost/function.hpp>
+
 #include <arm_kinematics_constraint_aware/arm_kinematics_solver_constraint_aware.h>
 #include <pluginlib/class_loader.h>
 
+#include "object_manipulator/tools/tester_workspace.h"
+#include "object_manipulator/tools/posture_plan.h"
+#include "object_manipulator/tools/pose_batch.h"
+#include "object_manipulator/tools/ik_seed_chains.h"
+#include "object_manipulator/tools/tester_stats.h"
+
 namespace object_manipulator {
 
 //! Checks a batch of IK queries at once
@@ -54,10 +64,82 @@ inline geometry_msgs::Vector3 doNegate(const geometry_msgs::Vector3& vec) {
 class IKTesterFast
 {
 protected:
-  
-  std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*> ik_solver_map_;
+
+  //! The collision configurations used by the test stages
+  enum TestStage {COLLISION_STAGE, IK_STAGE};
+
+  //! Everything about a call to testIKSet that is shared by all the poses being tested
+  /*! Filled in once by the calling thread, then only read by the stages, except for the entries 
+    belonging to the pose being tested. */
+  struct IKTestBatch
+  {
+    std::string arm_name_;
+    const std::vector<geometry_msgs::PoseStamped> *test_poses_;
+    std::vector<sensor_msgs::JointState> *solutions_;
+    std::vector<arm_navigation_msgs::ArmNavigationErrorCodes> *error_codes_;
+    //! Whether results are reported to the result function as soon as they are known
+    bool report_;
+
+    std::string gripper_frame_;
+    std_msgs::Header world_header_;
+    PosturePlan posture_plan_;
+    size_t arm_joints_;
+
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm_;
+    collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm_;
+
+    //! For each pose, the pose in the world frame, computed during the collision stage
+    PoseBatch world_poses_;
+    //! For each pose, whether it could be converted to the world frame
+    std::vector<char> converted_;
+
+    //! The chains IK is solved along when seeding from neighbouring poses
+    IKSeedChains seed_chains_;
+    //! For each pose, the arm joints IK was seeded with, if not the planning scene ones
+    std::vector< std::vector<double> > ik_seeds_;
+    //! For each pose, the IK solution found; only kept when seeding from neighbouring poses
+    std::vector< std::vector<double> > ik_solutions_;
+  };
+
+  //! Applies the allowed collision matrix needed by a test stage
+  void configureStage(const IKTestBatch &batch, TesterWorkspace &workspace, int stage);
+
+  //! Checks the gripper alone at the requested pose
+  void testIKCollision(IKTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Runs collision-aware IK for the whole arm
+  void testIK(IKTestBatch &batch, TesterWorkspace &workspace, size_t i);
+
+  //! Runs testIK along chain c of the batch, seeding each pose from its neighbours
+  void testIKChain(IKTestBatch &batch, TesterWorkspace &workspace, size_t c);
+
+  //! Runs the test of the given stage for pose i, and reports its result if it is final
+  void testPoseInStage(IKTestBatch &batch, int stage, TesterWorkspace &workspace, size_t i);
+
+  //! Runs the test of the given stage for pose indices[job]
+  void testIKInStage(IKTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                     TesterWorkspace &workspace, size_t job);
+
+  //! Runs one test stage over the poses in [begin, end) that are still pending
+  void runStage(IKTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                size_t begin, size_t end);
+
+  //! Returns the workspaces to test in: either the given serial one, or one per worker thread
+  std::vector<TesterWorkspace*> getWorkspaces(TesterWorkspace *serial_workspace);
+
+  IKSolverMap ik_solver_map_;
   
   unsigned int redundancy_;
+
+  //! The number of worker threads used for testing; 1 means everything is tested serially
+  unsigned int num_threads_;
+
+  //! Whether IK is seeded with the solutions for neighbouring poses, and how near they must be
+  bool seed_propagation_;
+  double seed_distance_;
+
+  //! Private workspaces for parallel testing, created on first use
+  TesterWorkerPool worker_pool_;
   
   ros::Publisher vis_marker_array_publisher_;
   ros::Publisher vis_marker_publisher_;
@@ -68,6 +150,18 @@ protected:
   planning_environment::CollisionModels* cm_;
   planning_models::KinematicState* state_;
 
+  //! Reachability maps used to reject poses before running IK, by arm name
+  ReachabilityMaps reachability_maps_;
+
+  //! Timing and outcomes of all calls to testIKSet
+  TesterStatsRecorder stats_;
+
+  //! Function used to check for interrupts
+  boost::function<bool()> interrupt_function_;
+
+  //! Called with the index of each pose whose result is known
+  boost::function<void(size_t)> result_function_;
+
  public:
 
   pluginlib::ClassLoader<kinematics::KinematicsBase> kinematics_loader_;
@@ -81,6 +175,42 @@ protected:
     state_ = state;
   }
 
+  //! Sets the number of worker threads used to test poses
+  /*! Same as for GraspTesterFast: each worker gets its own copy of the collision models and IK 
+    solvers, parallel testing needs the planning scene of the MechanismInterface, and results are 
+    the same regardless of the number of threads. */
+  void setNumThreads(unsigned int num_threads) {
+    num_threads_ = std::max(num_threads, 1u);
+  }
+
+  //! Sets whether to seed IK with the solutions found for neighbouring poses
+  /*! Same as for GraspTesterFast; when returning on the first hit, chains never span two windows, 
+    so the solutions found then depend on the number of threads. */
+  void setSeedPropagation(bool enabled, double max_distance = 0.05) {
+    seed_propagation_ = enabled;
+    seed_distance_ = max_distance;
+  }
+
+  //! Sets the reachability maps used to reject poses without running IK
+  void setReachabilityMaps(const ReachabilityMaps &reachability_maps) {
+    reachability_maps_ = selectReachabilityMaps(reachability_maps, ik_solver_map_);
+  }
+
+  //! Sets the interrupt function; testIKSet throws an InterruptRequestedException if it returns true
+  void setInterruptFunction(boost::function<bool()> f) {interrupt_function_ = f;}
+
+  //! Sets a function to be called with the index of each pose as soon as its result is final
+  /*! The entries of the solutions and error codes passed to testIKSet for that index can be read 
+    from the moment the function is called. Without return_on_first_hit, the function is called 
+    from the testing threads, possibly concurrently, and in no particular order; with it, the 
+    function is called from the calling thread, in order, and never for poses after the first hit. */
+  void setResultFunction(boost::function<void(size_t)> f) {result_function_ = f;}
+
+  //! Timing and outcomes accumulated over all calls to testIKSet since the last reset
+  TesterStats getStats() const {return stats_.getStats();}
+
+  void resetStats() {stats_.reset();}
+
   void getGroupJoints(const std::string& group_name,
                       std::vector<std::string>& group_links);
   
@@ -35,6 +35,9 @@
 
 #include <ros/ros.h>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+
 #include <actionlib/client/simple_action_client.h>
 
 #include <tf/transform_listener.h>
@@ -69,6 +72,10 @@
 #include <interpolated_ik_motion_planner/SetInterpolatedIKMotionPlanParams.h>
 
 #include <arm_navigation_msgs/AttachedCollisionObject.h>
+#include <arm_navigation_msgs/CollisionObject.h>
+#include <arm_navigation_msgs/CollisionMap.h>
+
+#include <sensor_msgs/JointState.h>
 
 #include <planning_environment/models/collision_models.h>
 
@@ -83,10 +90,28 @@
 
 #include "object_manipulator/tools/exceptions.h"
 #include "object_manipulator/tools/service_action_wrappers.h"
+#include "object_manipulator/tools/message_hash.h"
 
 
 namespace object_manipulator {
 
+//! A planning scene fetch started by MechanismInterface::startPlanningSceneFetch()
+/*! Carries the call to the environment server, running in the background, and what is needed to 
+  install its answer; hand it back to MechanismInterface::finishPlanningSceneFetch(). */
+struct PlanningSceneFetch
+{
+  //! True if the installed planning scene could be reused, and no call was made
+  bool cached_;
+  //! The cache key the planning scene was requested with
+  boost::uint64_t key_;
+  //! The world revision the key was computed at
+  unsigned int world_revision_;
+  //! The call to the environment server
+  ServiceCallHandle<arm_navigation_msgs::SetPlanningSceneDiff> call_;
+
+  PlanningSceneFetch() : cached_(false), key_(0), world_revision_(0) {}
+};
+
 //! A collection of ROS service and action clients needed for grasp execution
 class MechanismInterface
 {
@@ -114,21 +139,75 @@ class MechanismInterface
   //! Values are taken from the params arm_name_joint_controller and arm_name_cartesian_controller (for each arm_name)
   std::map<std::string, std::string> cartesian_controller_names_; 
 
-  //! Caches the last requested collision operations
-  arm_navigation_msgs::OrderedCollisionOperations collision_operations_cache_;
-
-  //! Caches the last requested link padding
-  std::vector<arm_navigation_msgs::LinkPadding> link_padding_cache_;
-
   planning_environment::CollisionModels cm_;
   planning_models::KinematicState* planning_scene_state_;
 
-  //! Keeps track of whether planning scene caching has been called at all
-  bool planning_scene_cache_empty_;
+  //! The planning scene last installed in cm_, kept so that private copies of cm_ can be synced to it
+  arm_navigation_msgs::PlanningScene planning_scene_;
+
+  //! Incremented every time a new planning scene is installed in cm_
+  unsigned int planning_scene_revision_;
+
+  //! Hash of the static contents of planning_scene_; see getPlanningSceneHash()
+  boost::uint64_t planning_scene_hash_;
+
+  //! Hash of the sensed collision map in planning_scene_; see getCollisionMapHash()
+  boost::uint64_t collision_map_hash_;
 
   //! Used to disable planning scene caching altogether
   bool cache_planning_scene_;
 
+  //! Whether a new planning scene is applied to cm_ as a diff from the installed one when possible
+  bool incremental_planning_scene_;
+
+  //! Whether every incremental update is checked against a full rebuild (slow, for debugging only)
+  bool verify_planning_scene_diff_;
+
+  //! How many planning scenes were installed as a diff, and how many with a full rebuild
+  size_t incremental_planning_scene_installs_;
+  size_t full_planning_scene_installs_;
+
+  //! Whether state validity is checked against cm_ in-process instead of by the validity service
+  bool check_state_validity_locally_;
+
+  //! Joint names of each arm as reported by the IK info service, cached for local validity checks
+  std::map<std::string, std::vector<std::string> > arm_joint_names_;
+
+  //! Serializes all use of cm_ and the planning scene state, which may come from more than one thread
+  boost::recursive_mutex planning_scene_mutex_;
+
+  //! Guards the planning scene cache bookkeeping below, parts of which are updated from subscriber callbacks
+  mutable boost::mutex planning_scene_cache_mutex_;
+
+  //! Changes whenever the collision objects or attached objects known to the environment server may have changed
+  /*! Also bumped by invalidatePlanningSceneCache(), so that an invalidation during a call to the 
+    environment server is not undone when that call completes. */
+  unsigned int world_revision_;
+
+  //! Stamp of the last collision map sent to the environment server
+  ros::Time collision_map_stamp_;
+
+  //! The latest joint states of the robot
+  sensor_msgs::JointState::ConstPtr joint_state_;
+
+  //! The cache key the installed planning scene was requested with
+  boost::uint64_t planning_scene_key_;
+
+  //! False if the installed planning scene can not be reused, whatever the key
+  bool planning_scene_key_valid_;
+
+  //! How far (radians or meters) any joint may have moved for the installed planning scene to be reused
+  double planning_scene_cache_joint_tolerance_;
+
+  size_t planning_scene_cache_hits_;
+  size_t planning_scene_cache_misses_;
+
+  //! Subscribers keeping track of what the environment server builds the planning scene from
+  ros::Subscriber collision_map_sub_;
+  ros::Subscriber collision_object_sub_;
+  ros::Subscriber attached_object_sub_;
+  ros::Subscriber joint_state_sub_;
+
   //! Sets the parameters for the interpolated IK server
   void setInterpolatedIKParams(std::string arm_name, int num_steps, 
 			       int collision_check_resolution, bool start_from_end);
@@ -136,10 +215,48 @@ class MechanismInterface
   //! Calls the switch_controllers service
   bool callSwitchControllers(std::vector<std::string> start_controllers, std::vector<std::string> stop_controllers);
   
-  //! Checks if the planning scene is the same as the last one requested, to avoid unnecessary calls
-  /*! Returns true if the collision operations and link paddings are identical to the last ones requested. */
-  bool cachePlanningScene(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
-                          const std::vector<arm_navigation_msgs::LinkPadding> &link_padding);
+  //! Hash of everything the planning scene returned by the environment server depends on, except robot state
+  /*! That is the requested collision operations and link padding, the stamp of the last collision map 
+    and the revision of the collision objects and attached objects, which is returned in world_revision. */
+  boost::uint64_t planningSceneKey(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
+                                   const std::vector<arm_navigation_msgs::LinkPadding> &link_padding,
+                                   unsigned int &world_revision);
+
+  //! Checks if the installed planning scene was requested with the given key, and the robot has not moved since
+  /*! Counts the outcome as a cache hit or miss. */
+  bool cachePlanningScene(boost::uint64_t key);
+
+  //! Installs a planning scene returned by the environment server in cm_
+  /*! Applies it as a diff or rebuilds, as set by ~incremental_planning_scene, then records the key it 
+    was requested with. Must be called with planning_scene_mutex_ locked. */
+  void installPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene,
+                            boost::uint64_t key, unsigned int world_revision);
+
+  //! Like getJointNames(), but only asks the IK info service the first time for each arm
+  const std::vector<std::string>& getArmJointNames(const std::string &arm_name);
+
+  //! Checks arm states against the installed planning scene with cm_; see checkStateValidity()
+  /*! Returns false, without checking anything, if that is not possible. */
+  bool checkStateValidityLocally(const std::string &arm_name, 
+                                 const std::vector< std::vector<double> > &joint_values,
+                                 std::vector<bool> &valid);
+
+  //! Checks an arm state with the state validity service, against its own copy of the planning scene
+  bool checkStateValidityRemotely(const std::string &arm_name, const std::vector<double> &joint_values);
+
+  //! True if all the joints in the installed planning scene are within tolerance of the latest joint states
+  /*! Must be called with planning_scene_cache_mutex_ locked. */
+  bool robotStateUnchanged() const;
+
+  //! Makes sure the next call to getPlanningScene() goes to the environment server
+  /*! Needed whenever something other than us may have sent the environment server a different planning 
+    scene diff, as is the case for move_arm. */
+  void invalidatePlanningSceneCache();
+
+  void collisionMapCallback(const arm_navigation_msgs::CollisionMap::ConstPtr &collision_map);
+  void collisionObjectCallback(const arm_navigation_msgs::CollisionObject::ConstPtr &collision_object);
+  void attachedObjectCallback(const arm_navigation_msgs::AttachedCollisionObject::ConstPtr &attached_object);
+  void jointStateCallback(const sensor_msgs::JointState::ConstPtr &joint_state);
 
  public:
 
@@ -231,6 +348,32 @@ class MechanismInterface
     }
   }
 
+  //! Looks for all services and action servers at once, and creates their clients
+  /*! Otherwise, each client waits for its server on first use, one after the other, and the first 
+    pickup after startup pays for all of them. Here, all servers are looked for in parallel, so 
+    this takes as long as the slowest one. Returns true if everything needed for pickup and place 
+    with the given arms was found within the timeout (0 meaning no timeout); the names of the 
+    servers that were not are put in missing. Servers that are only needed by some executors 
+    (reactive grasping, controller switching, head pointing, etc.) are looked for in the 
+    background, but not waited for.
+
+    Meant to be called once, at startup, before any other use of the interface. */
+  bool warmUp(const std::vector<std::string> &arm_names, ros::Duration timeout, std::vector<std::string> &missing);
+
+  //! Whether the frequently called services (IK, FK, robot state, state validity, planning scene) 
+  //! keep their connections open between calls
+  /*! Set from ~persistent_service_connections (default true) on construction. Dropped connections 
+    are re-established automatically. */
+  void setPersistentServices(bool persistent);
+
+  //! Must be held while using the collision models or the planning scene state from more than one thread
+  /*! getPlanningScene() and checkStateValidity() lock it themselves, and can be called with it held. 
+    Anything else that uses getCollisionModels() or getPlanningSceneState() while other threads may 
+    be using the interface should lock it for the duration. */
+  boost::recursive_mutex& getPlanningSceneMutex() {
+    return planning_scene_mutex_;
+  }
+
   planning_environment::CollisionModels& getCollisionModels() {
     return cm_;
   }
@@ -239,6 +382,47 @@ class MechanismInterface
     return planning_scene_state_;
   }
 
+  //! The planning scene currently installed in the collision models
+  const arm_navigation_msgs::PlanningScene& getPlanningSceneMessage() const {
+    return planning_scene_;
+  }
+
+  //! Changes every time getPlanningScene() installs a new planning scene
+  unsigned int getPlanningSceneRevision() const {
+    return planning_scene_revision_;
+  }
+
+  //! Hash of the parts of the current planning scene that stay put from one request to the next
+  /*! Covers the collision objects, attached objects, fixed frame transforms, allowed collisions and 
+    link padding, ignoring time stamps; leaves out the robot state and the sensed collision map, 
+    which change every time. Unlike the revision, this is the same for two planning scenes that only 
+    differ in those, including across restarts. Meant for keying the IK cache, see IKCache. */
+  boost::uint64_t getPlanningSceneHash() const {
+    return planning_scene_hash_;
+  }
+
+  //! Computes the hash of a planning scene as returned by getPlanningSceneHash()
+  static boost::uint64_t hashPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene);
+
+  //! Hash of the contents of the sensed collision map in the current planning scene, ignoring its time stamp
+  /*! Whatever getPlanningSceneHash() leaves out of the world. Results that may depend on the sensed 
+    obstacles can only be reused while this stays the same. */
+  boost::uint64_t getCollisionMapHash() const {
+    return collision_map_hash_;
+  }
+
+  //! Computes the hash of a collision map as returned by getCollisionMapHash()
+  static boost::uint64_t hashCollisionMap(const arm_navigation_msgs::CollisionMap &collision_map);
+
+  //! The number of calls to getPlanningScene() answered from the cache, and the number that were not
+  /*! Both stay at 0 if planning scene caching is disabled. */
+  void getPlanningSceneCacheStats(size_t &hits, size_t &misses) const;
+
+  //! The number of planning scenes installed as a diff, and the number that needed a full rebuild
+  /*! A full rebuild is counted for the first planning scene, whenever ~incremental_planning_scene is 
+    off, and whenever applyPlanningSceneDiff() can not handle the change. */
+  void getPlanningSceneInstallCounts(size_t &incremental, size_t &full);
+
   //------------- IK -------------
 
   //! Gets the current robot state
@@ -246,14 +430,48 @@ class MechanismInterface
 
   //! Sends the requsted collision operations and link padding to the environment server as a diff
   //! from the current planning scene on the server
+  /*! If planning scene caching is enabled (~cache_planning_scene), the call to the environment server and 
+    the rebuild of the collision models are skipped when the installed planning scene was requested with 
+    the same collision operations and link padding, the environment server has not been sent any new 
+    collision map, collision object or attached object since, and no joint has moved by more than 
+    ~planning_scene_cache_joint_tolerance.
+
+    If ~incremental_planning_scene is set, the planning scene returned by the environment server is 
+    applied to the collision models as a diff from the installed one (see applyPlanningSceneDiff()), 
+    falling back on a full rebuild when that is not possible. Setting ~verify_planning_scene_diff 
+    additionally compares the result of every incremental update to that of a full rebuild. */
   void getPlanningScene(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
                         const std::vector<arm_navigation_msgs::LinkPadding> &link_padding);
 
+  //! Like getPlanningScene(), but sends the request to the environment server in the background
+  /*! Returns right away; the planning scene is installed by finishPlanningSceneFetch(), so that 
+    whatever the caller does in between (typically waiting for a grasp planner) overlaps with the 
+    call. Until then, the previously installed planning scene stays in use. */
+  PlanningSceneFetch startPlanningSceneFetch(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
+                                             const std::vector<arm_navigation_msgs::LinkPadding> &link_padding);
+
+  //! Waits for a fetch started by startPlanningSceneFetch() and installs the planning scene it returned
+  /*! The wait is done without holding the planning scene mutex. Throws a MechanismException if 
+    the call to the environment server failed. */
+  void finishPlanningSceneFetch(const PlanningSceneFetch &fetch);
+
   //! Checks if a given arm state is valid; joint_values must contain values for all joints of the arm
+  /*! An empty joint_values checks the current state of the robot. If ~check_state_validity_locally 
+    is set (the default), joint limits and collisions are checked in-process with the collision 
+    models holding the planning scene; otherwise, or if that is not possible, the state validity 
+    service is called. */
   bool checkStateValidity(std::string arm_name, const std::vector<double> &joint_values,
                           const arm_navigation_msgs::OrderedCollisionOperations &collision_operations,
                           const std::vector<arm_navigation_msgs::LinkPadding> &link_padding);
 
+  //! Checks a number of arm states under the same collision operations and link padding
+  /*! Sets the planning scene only once. valid gets one entry per joint vector; returns true if 
+    all states are valid. */
+  bool checkStateValidity(std::string arm_name, const std::vector< std::vector<double> > &joint_values,
+                          const arm_navigation_msgs::OrderedCollisionOperations &collision_operations,
+                          const std::vector<arm_navigation_msgs::LinkPadding> &link_padding,
+                          std::vector<bool> &valid);
+
   //! Checks if a given arm state is valid with no collision operations or link paddings
   bool checkStateValidity(std::string arm_name, const std::vector<double> &joint_values)
   {
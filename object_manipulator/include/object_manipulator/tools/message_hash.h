@@ -0,0 +1,102 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _MESSAGE_HASH_H_
+#define _MESSAGE_HASH_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_array.hpp>
+
+#include <ros/serialization.h>
+
+namespace object_manipulator {
+
+//! Accumulates a 64-bit FNV-1a hash of values and ROS messages
+/*! Meant for telling whether two inputs are identical, e.g. for cache keys. Messages are hashed 
+  through their serialized form, so header stamps count as content; clear them beforehand if they 
+  should not matter. */
+class MessageHasher
+{
+ private:
+  boost::uint64_t hash_;
+
+ public:
+  MessageHasher() : hash_(14695981039346656037ULL) {}
+
+  void addBytes(const void *data, size_t size)
+  {
+    const boost::uint8_t *bytes = static_cast<const boost::uint8_t*>(data);
+    for (size_t i=0; i<size; i++) {
+      hash_ ^= bytes[i];
+      hash_ *= 1099511628211ULL;
+    }
+  }
+
+  void add(double value) {addBytes(&value, sizeof(value));}
+
+  void add(boost::uint64_t value) {addBytes(&value, sizeof(value));}
+
+  void add(bool value) {add(static_cast<boost::uint64_t>(value));}
+
+  void add(const std::string &value) 
+  {
+    add(static_cast<boost::uint64_t>(value.size()));
+    addBytes(value.data(), value.size());
+  }
+
+  void add(const std::vector<double> &values)
+  {
+    add(static_cast<boost::uint64_t>(values.size()));
+    if (!values.empty()) addBytes(&values[0], values.size() * sizeof(double));
+  }
+
+  template <class M>
+  void addMessage(const M &msg)
+  {
+    uint32_t length = ros::serialization::serializationLength(msg);
+    boost::shared_array<uint8_t> buffer(new uint8_t[length]);
+    ros::serialization::OStream stream(buffer.get(), length);
+    ros::serialization::serialize(stream, msg);
+    add(static_cast<boost::uint64_t>(length));
+    addBytes(buffer.get(), length);
+  }
+
+  boost::uint64_t getHash() const {return hash_;}
+};
+
+} //namespace object_manipulator
+
+#endif
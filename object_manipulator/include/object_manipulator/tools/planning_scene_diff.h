@@ -0,0 +1,92 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _PLANNING_SCENE_DIFF_H_
+#define _PLANNING_SCENE_DIFF_H_
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include <arm_navigation_msgs/PlanningScene.h>
+#include <planning_environment/models/collision_models.h>
+
+namespace object_manipulator {
+
+//! Brings collision models holding one planning scene up to date with another, without a full rebuild
+/*! The collision models and state must hold the planning scene "from", as installed by 
+  setPlanningScene() or by a previous call to this function. The allowed collision matrix, the link 
+  padding and the robot state are always re-applied, so it does not matter if testers have changed 
+  them since. Collision objects in the world frame are added, replaced and removed one by one, and 
+  attached objects can be removed. A collision map in the world frame is replaced as a whole, which 
+  still skips rebuilding everything else; it is left alone, as the most expensive part to set, unless 
+  it has changed or has to be masked again because attached objects went away or moved with the robot.
+
+  Anything else (new or changed attached objects, fixed frame transforms, allowed contacts, objects 
+  outside of the world frame, or a changed collision map or robot state while the map is expressed 
+  in a frame other than the world frame) can not be applied incrementally. In that case false is 
+  returned without touching the models, and the caller should fall back on revertPlanningScene() and 
+  setPlanningScene(). Of these, a newly attached object is the only one expected in normal use, once 
+  per pickup; MechanismInterface counts how often the fallback is taken (see 
+  MechanismInterface::getPlanningSceneInstallCounts()).
+*/
+bool applyPlanningSceneDiff(planning_environment::CollisionModels &cm,
+                            planning_models::KinematicState &state,
+                            const arm_navigation_msgs::PlanningScene &from,
+                            const arm_navigation_msgs::PlanningScene &to);
+
+//! Hashes of everything in a set of collision models and a state that collision checks depend on
+/*! Used for checking that applyPlanningSceneDiff() ends up with the same contents as a full 
+  rebuild. */
+struct PlanningSceneSnapshot
+{
+  boost::uint64_t collision_objects_;
+  boost::uint64_t attached_objects_;
+  boost::uint64_t collision_map_;
+  boost::uint64_t allowed_collisions_;
+  boost::uint64_t link_padding_;
+  boost::uint64_t state_values_;
+};
+
+//! Records the current contents of the collision models and the state
+void takePlanningSceneSnapshot(planning_environment::CollisionModels &cm,
+                               const planning_models::KinematicState &state,
+                               PlanningSceneSnapshot &snapshot);
+
+//! Returns true if two snapshots are identical; otherwise, names the parts that differ
+bool comparePlanningSceneSnapshots(const PlanningSceneSnapshot &first, const PlanningSceneSnapshot &second,
+                                   std::string &differences);
+
+} //namespace object_manipulator
+
+#endif
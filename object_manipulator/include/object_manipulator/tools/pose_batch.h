@@ -0,0 +1,110 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _POSE_BATCH_H_
+#define _POSE_BATCH_H_
+
+#include <vector>
+
+#include <geometry_msgs/Pose.h>
+#include <tf/transform_datatypes.h>
+
+namespace object_manipulator {
+
+//! A batch of rigid transforms, stored as a structure of arrays of positions and unit quaternions
+/*! The fast testers apply the same few transforms (object pose, approach and lift offsets, grasp 
+  in gripper frame) to every candidate. With one tf::Transform per candidate, each product goes 
+  through a 3x3 matrix, and each conversion from and to a geometry_msgs::Pose through a 
+  quaternion-to-matrix or matrix-to-quaternion conversion. Here each component lives in its own 
+  contiguous array, and the batch operations work on quaternions directly, several poses at a time.
+
+  The batch operations use AVX if the package is compiled with it enabled (e.g. -mavx), SSE2 
+  otherwise on x86, and plain C++ everywhere else; all of them give the same results up to 
+  floating point rounding. The output of any batch operation may be one of its inputs.
+*/
+class PoseBatch
+{
+ public:
+  enum Component {X, Y, Z, QX, QY, QZ, QW, NUM_COMPONENTS};
+
+ private:
+  size_t size_;
+
+  std::vector<double> data_[NUM_COMPONENTS];
+
+ public:
+  //! Creates a batch of identity transforms
+  PoseBatch(size_t size = 0) : size_(0) {resize(size);}
+
+  size_t size() const {return size_;}
+
+  //! Resizes the batch; new entries are identity transforms
+  void resize(size_t size);
+
+  //! The array holding one component of all the poses
+  const double* component(Component c) const {return data_[c].empty() ? NULL : &data_[c][0];}
+  double* component(Component c) {return data_[c].empty() ? NULL : &data_[c][0];}
+
+  //! Sets entry i; the quaternion is normalized
+  void set(size_t i, const geometry_msgs::Pose &pose);
+  void set(size_t i, const tf::Transform &transform);
+
+  void get(size_t i, geometry_msgs::Pose &pose) const;
+  tf::Transform getTransform(size_t i) const;
+
+  //! out[i] = a[i] * b[i]; a and b must be the same size
+  static void compose(const PoseBatch &a, const PoseBatch &b, PoseBatch &out);
+
+  //! out[i] = a * b[i]
+  static void compose(const tf::Transform &a, const PoseBatch &b, PoseBatch &out);
+
+  //! out[i] = a[i] * b
+  static void compose(const PoseBatch &a, const tf::Transform &b, PoseBatch &out);
+
+  //! out[i] = a[i].inverse()
+  static void invert(const PoseBatch &a, PoseBatch &out);
+
+  //! Moves every pose by offset, expressed in the fixed frame or, if local, in the frame of the pose itself
+  /*! Same as premultiplying (or, if local, postmultiplying) by a pure translation. */
+  static void applyOffset(const PoseBatch &a, const tf::Vector3 &offset, bool local, PoseBatch &out);
+
+  //! The instruction set the batch operations were compiled for: "AVX", "SSE2" or "scalar"
+  static const char* instructionSet();
+};
+
+//! Returns a * b, computed on the quaternions directly
+geometry_msgs::Pose composePoses(const geometry_msgs::Pose &a, const geometry_msgs::Pose &b);
+
+} //namespace object_manipulator
+
+#endif
@@ -0,0 +1,128 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _POSTURE_PLAN_H_
+#define _POSTURE_PLAN_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/JointState.h>
+#include <planning_models/kinematic_state.h>
+
+namespace object_manipulator {
+
+//! Applies joint postures to a KinematicState by index instead of by name
+/*! Setting a state from a std::map<std::string, double> costs a map allocation and a name lookup 
+  for every joint, every time. A posture plan resolves joint names against the kinematic model once 
+  (typically once per goal), keeps all postures in flat arrays, and then works on the flat vector 
+  of state values returned by KinematicState::getKinematicStateValues().
+
+  Postures are added once and referred to by the index returned when adding them. Joint sets are 
+  like postures, except that the values are given when applying them (e.g. an IK solution).
+
+  Once all postures are added, the const member functions can be used concurrently from several 
+  threads, as long as each thread uses its own values vector and its own KinematicState. All 
+  states must come from the same kinematic model as the one the plan was initialized with.
+
+  Joint names that are not part of the model are ignored, same as for 
+  KinematicState::setKinematicState(std::map).
+*/
+class PosturePlan
+{
+ private:
+  //! Position of each joint in the flat vector of state values
+  std::map<std::string, unsigned int> joint_index_;
+
+  //! State values captured when initializing
+  std::vector<double> base_values_;
+
+  //! Flat storage for the postures: entries begin_[k] to begin_[k+1] belong to posture k
+  std::vector<size_t> begin_;
+  std::vector<unsigned int> indices_;
+  std::vector<double> values_;
+
+  //! Flat storage for the joint sets: entries set_begin_[k] to set_begin_[k+1] belong to set k
+  std::vector<size_t> set_begin_;
+  std::vector<unsigned int> set_indices_;
+
+  //! Returns the position of a joint in the flat vector of state values, or UNKNOWN_JOINT
+  unsigned int resolve(const std::string &name) const;
+
+ public:
+  //! Marks the entries of a joint set that are not part of the model
+  static const unsigned int UNKNOWN_JOINT = static_cast<unsigned int>(-1);
+
+  PosturePlan() : begin_(1, 0), set_begin_(1, 0) {}
+
+  //! Resolves all joint names of the state's model and captures its current values as the base state
+  /*! Also drops all previously added postures and joint sets. */
+  void init(const planning_models::KinematicState &state);
+
+  //! Adds a posture with the given joint names and values; returns its index
+  size_t addPosture(const sensor_msgs::JointState &posture);
+
+  //! Adds a posture that puts the given joints at their values in the base state; returns its index
+  size_t addBasePosture(const std::vector<std::string> &joint_names);
+
+  //! Adds a joint set whose values are only given when applying it; returns its index
+  size_t addJoints(const std::vector<std::string> &joint_names);
+
+  //! The state values captured by init()
+  const std::vector<double>& getBaseValues() const {return base_values_;}
+
+  //! Overwrites the entries of a posture in a vector of state values
+  void setPosture(size_t posture, std::vector<double> &values) const;
+
+  //! Overwrites the entries of a joint set in a vector of state values
+  /*! joint_values must be in the order of the joint names the set was created with. */
+  void setJoints(size_t joints, const std::vector<double> &joint_values, std::vector<double> &values) const;
+
+  //! Reads the entries of a joint set from a vector of state values
+  void getJoints(size_t joints, const std::vector<double> &values, std::vector<double> &joint_values) const;
+
+  //! Puts the state back to the base state
+  void applyBase(planning_models::KinematicState &state) const;
+
+  //! Applies a posture on top of the current state, using values as scratch space
+  void applyPosture(size_t posture, planning_models::KinematicState &state, std::vector<double> &values) const;
+
+  //! Applies a joint set on top of the current state, using values as scratch space
+  void applyJoints(size_t joints, const std::vector<double> &joint_values, 
+                   planning_models::KinematicState &state, std::vector<double> &values) const;
+};
+
+} //namespace object_manipulator
+
+#endif
@@ -0,0 +1,159 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _REACHABILITY_MAP_H_
+#define _REACHABILITY_MAP_H_
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <geometry_msgs/Pose.h>
+#include <tf/transform_datatypes.h>
+
+namespace object_manipulator {
+
+//! A voxel map of the gripper poses an arm can reach, used to reject hopeless IK queries early
+/*! The map covers an axis-aligned box in the base frame of the IK solver for one arm group. Each 
+  voxel stores a bit mask over NUM_ORIENTATION_BINS directions spread evenly over the sphere; bit 
+  b is set if IK was found with the approach axis of the gripper pointing (roughly) along direction 
+  b, with the gripper anywhere in the voxel. Rotation about the approach axis is not binned.
+
+  Since the testers reject poses outright when the map says they are unreachable, the map must 
+  err on the side of reachability. Maps are built offline (see build_reachability_map) by sampling 
+  IK at voxel centers with many rotations about the approach axis, a bin counting as reachable if 
+  any of them is. They are then dilated by one voxel and by the neighbouring orientation bins, so 
+  that a pose is only reported unreachable if no sample near it in position or direction reached 
+  it either. Everything outside the box is considered unreachable; the builder must therefore be 
+  given a box that encloses the whole workspace of the arm.
+
+  A map loaded from a file is memory-mapped read-only, so several testers and processes can share 
+  it cheaply. Queries are const and thread-safe. The file is in native byte order.
+*/
+class ReachabilityMap : boost::noncopyable
+{
+ public:
+  static const unsigned int NUM_ORIENTATION_BINS = 32;
+
+  //! How far apart (radians) the directions of two orientation bins may be for dilate() to merge them
+  /*! Two and a half times the angular radius of the area of the sphere covered by one bin, which 
+    takes in the bins bordering on it, whatever the direction within it. */
+  static double neighbourAngle() {return 2.5 * acos(1.0 - 2.0 / NUM_ORIENTATION_BINS);}
+
+ private:
+  std::string group_name_;
+  std::string base_frame_;
+  //! The approach axis of the gripper, in the frame of the IK tip link
+  tf::Vector3 approach_axis_;
+  tf::Vector3 origin_;
+  double resolution_;
+  unsigned int dims_[3];
+
+  //! The voxel masks; points either into owned_cells_ or into the memory-mapped file
+  const boost::uint32_t *cells_;
+  std::vector<boost::uint32_t> owned_cells_;
+  void *mapping_;
+  size_t mapping_size_;
+
+  //! Unit vectors for the orientation bins
+  static const std::vector<tf::Vector3>& binDirections();
+
+  //! For each orientation bin, the mask of the bins whose directions are within NEIGHBOUR_ANGLE of it
+  static const std::vector<boost::uint32_t>& binNeighbours();
+
+  void release();
+
+  //! Index of the voxel containing the given base frame position, or -1 if outside the map
+  long voxelIndex(const tf::Vector3 &position) const;
+
+ public:
+  ReachabilityMap();
+  ~ReachabilityMap();
+
+  //! Allocates an empty map covering [min, max] at the given resolution, discarding any previous contents
+  void create(const std::string &group_name, const std::string &base_frame, const tf::Vector3 &approach_axis,
+              const tf::Vector3 &min, const tf::Vector3 &max, double resolution);
+
+  //! Maps the file written by save() into memory; returns false on failure
+  bool load(const std::string &filename);
+
+  //! Writes the map to a file; returns false on failure
+  bool save(const std::string &filename) const;
+
+  bool empty() const {return cells_ == NULL;}
+
+  const std::string& getGroupName() const {return group_name_;}
+  const std::string& getBaseFrame() const {return base_frame_;}
+  const tf::Vector3& getApproachAxis() const {return approach_axis_;}
+  double getResolution() const {return resolution_;}
+  //! The corners of the box covered by the map, in the base frame
+  const tf::Vector3& getMin() const {return origin_;}
+  tf::Vector3 getMax() const {return origin_ + resolution_ * tf::Vector3(dims_[0], dims_[1], dims_[2]);}
+  size_t numVoxels() const {return (size_t)dims_[0] * dims_[1] * dims_[2];}
+
+  //! The orientation bin closest to the approach axis of a gripper with the given orientation
+  unsigned int orientationBin(const tf::Quaternion &orientation) const;
+
+  //! The direction at the center of an orientation bin
+  static const tf::Vector3& binDirection(unsigned int bin) {return binDirections()[bin];}
+
+  //! The center of voxel i
+  tf::Vector3 voxelCenter(size_t i) const;
+
+  //! The bit mask of reachable orientation bins for voxel i
+  boost::uint32_t voxelMask(size_t i) const {return cells_[i];}
+
+  //! Marks an orientation bin of voxel i as reachable; only for maps built with create()
+  void markReachable(size_t i, unsigned int bin);
+
+  //! Makes each voxel reachable in every orientation bin reachable from one of its 26 neighbours
+  /*! Then also makes every bin reachable that is within neighbourAngle() of a reachable one, as 
+    the samples only cover the direction at the center of each bin. Only for maps built with 
+    create(). */
+  void dilate();
+
+  //! Whether a gripper pose, in the base frame of the map, may be reachable
+  bool isReachable(const geometry_msgs::Pose &base_frame_pose) const;
+};
+
+//! Reachability maps, indexed by arm name
+typedef std::map<std::string, boost::shared_ptr<const ReachabilityMap> > ReachabilityMaps;
+
+} //namespace object_manipulator
+
+#endif
@@ -0,0 +1,87 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _REACHABILITY_MAP_BUILDER_H_
+#define _REACHABILITY_MAP_BUILDER_H_
+
+#include <string>
+#include <vector>
+
+#include <planning_environment/models/collision_models.h>
+#include <arm_kinematics_constraint_aware/arm_kinematics_solver_constraint_aware.h>
+
+#include "object_manipulator/tools/reachability_map.h"
+
+namespace object_manipulator {
+
+//! Fills in reachability maps by sampling IK, ignoring everything but the kinematics of the arm
+/*! Installs an empty planning scene with the robot in its default state, and allows all collisions 
+  involving the given links (normally the arm and gripper), so that a map is not specific to any 
+  environment or to where the rest of the robot happens to be. Also provides the same IK check for 
+  use as ground truth when evaluating a map.
+*/
+class ReachabilityMapBuilder
+{
+ private:
+  planning_environment::CollisionModels* cm_;
+  planning_models::KinematicState* state_;
+  arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver_;
+
+  //! The default state values, restored before every IK query
+  std::vector<double> default_values_;
+
+ public:
+  ReachabilityMapBuilder(planning_environment::CollisionModels* cm,
+                         arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver,
+                         const std::vector<std::string> &free_links);
+
+  ~ReachabilityMapBuilder();
+
+  //! The links of the arm and gripper for the given arm name, as listed in the hand description
+  static std::vector<std::string> armAndGripperLinks(planning_environment::CollisionModels* cm,
+                                                     const std::string &arm_name);
+
+  //! Whether IK can be solved for a gripper pose in the base frame of the solver
+  bool checkIK(const geometry_msgs::Pose &base_frame_pose);
+
+  //! Samples every orientation bin at the center of every voxel of a map created with create()
+  /*! Each bin is tried with num_rolls rotations about the approach axis; it is marked reachable 
+    as soon as one of them has an IK solution. As the map does not bin rotations about the approach 
+    axis, num_rolls should be large enough that no reachable roll falls between two samples; only 
+    unreachable bins pay for all of them. Returns the number of reachable (voxel, bin) pairs. */
+  size_t build(ReachabilityMap &map, unsigned int num_rolls);
+};
+
+} //namespace object_manipulator
+
+#endif
@@ -36,16 +36,345 @@
 #include <ros/ros.h>
 #include <actionlib/client/simple_action_client.h>
 
+#include <algorithm>
+#include <deque>
 #include <string>
 #include <map>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "object_manipulator/tools/exceptions.h"
 
 namespace object_manipulator {
 
+//! Paces the wait loops of the wrappers below
+/*! The waiting itself happens on a condition variable for services (see ServiceReadiness) and 
+  inside actionlib for actions. The loop only wakes up every short slice to check for interrupts, 
+  shutdown and the timeout, and logs at most once per log period. */
+class WaitLoop
+{
+ private:
+  ros::Time start_time_;
+  ros::Duration timeout_;
+  ros::Time last_log_time_;
+  ros::Duration log_period_;
+
+ public:
+  //! A timeout of 0 means waiting forever
+  WaitLoop(ros::Duration timeout, ros::Duration log_period = ros::Duration(1.0)) : 
+    start_time_(ros::Time::now()), timeout_(timeout), last_log_time_(start_time_), log_period_(log_period) {}
+
+  //! How long to block for before checking again; never 0, as that means forever to most wait functions
+  ros::Duration slice() const
+  {
+    ros::Duration slice(0.1);
+    if (timeout_ <= ros::Duration(0)) return slice;
+    ros::Duration remaining = timeout_ - (ros::Time::now() - start_time_);
+    if (remaining < slice) slice = remaining;
+    if (slice < ros::Duration(0.001)) slice = ros::Duration(0.001);
+    return slice;
+  }
+
+  bool expired() const
+  {
+    return timeout_ > ros::Duration(0) && ros::Time::now() - start_time_ >= timeout_;
+  }
+
+  //! True at most once per log period
+  bool shouldLog()
+  {
+    ros::Time current_time = ros::Time::now();
+    if (current_time - last_log_time_ < log_period_) return false;
+    last_log_time_ = current_time;
+    return true;
+  }
+};
+
+//! Keeps track of whether a service is available, looking for it in a background thread
+/*! The probe thread polls for the service, calling ros::service::waitForService() with a 0.1s 
+  timeout in a loop, so a service that shows up is noticed within about that long. However many 
+  threads wait for the same service, only this one thread polls; the others block on a condition 
+  variable until it reports the service found. Once found, a service is assumed to stay available, 
+  as is the case for the clients below. Must be held in a boost::shared_ptr.
+ */
+class ServiceReadiness : public boost::enable_shared_from_this<ServiceReadiness>
+{
+ private:
+  //! The resolved name of the service
+  std::string service_name_;
+  //! What to call the service in log messages
+  std::string description_;
+
+  boost::mutex mutex_;
+  boost::condition_variable ready_cond_;
+  bool ready_;
+  bool probing_;
+
+  //! Runs in the background until the service is found or ROS shuts down
+  void probe()
+  {
+    bool found = false;
+    while (!found && ros::ok()) found = ros::service::waitForService(service_name_, ros::Duration(0.1));
+    boost::mutex::scoped_lock lock(mutex_);
+    ready_ = found;
+    probing_ = false;
+    ready_cond_.notify_all();
+  }
+
+ public:
+  ServiceReadiness(const std::string &service_name, const std::string &description) : 
+    service_name_(service_name), description_(description), ready_(false), probing_(false) {}
+
+  const std::string& getServiceName() const {return service_name_;}
+
+  //! Starts looking for the service in the background, unless it is already found or being looked for
+  void start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (ready_ || probing_) return;
+    probing_ = true;
+    boost::thread probe_thread(boost::bind(&ServiceReadiness::probe, shared_from_this()));
+  }
+
+  bool isReady()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return ready_;
+  }
+
+  //! Waits until the service is available; returns false on timeout (0 means forever) or shutdown
+  /*! Throws InterruptRequestedException if the interrupt function, if any, asks for it. */
+  bool wait(ros::Duration timeout, const boost::function<bool()> &interrupt_function)
+  {
+    start();
+    WaitLoop loop(timeout);
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!ready_)
+    {
+      ready_cond_.timed_wait(lock, boost::posix_time::microseconds(loop.slice().toNSec() / 1000));
+      if (ready_) break;
+      if (interrupt_function && interrupt_function()) throw InterruptRequestedException();
+      if (!ros::ok() || loop.expired()) return false;
+      if (loop.shouldLog()) ROS_INFO_STREAM("Waiting for service " << description_);
+    }
+    return true;
+  }
+};
+
+//! The worker threads making the background calls to one service
+/*! Workers are started as calls come in, up to the maximum number of calls in flight, and then 
+  kept waiting for further calls; calls beyond that wait in a queue and are made in order. Workers 
+  hold on to the pool, so calls already queued are made even if the owner goes away. Must be held 
+  in a boost::shared_ptr.
+ */
+class ServiceCallPool : public boost::enable_shared_from_this<ServiceCallPool>
+{
+ private:
+  boost::mutex mutex_;
+  boost::condition_variable work_cond_;
+  std::deque< boost::function<void()> > queue_;
+  size_t num_workers_;
+  size_t idle_workers_;
+  size_t max_workers_;
+  bool shutting_down_;
+
+  //! Must be called with the mutex held
+  void startWorkersAsNeeded()
+  {
+    while (queue_.size() > idle_workers_ && num_workers_ < max_workers_)
+    {
+      num_workers_++;
+      boost::thread worker(boost::bind(&ServiceCallPool::work, shared_from_this()));
+    }
+  }
+
+  //! Runs in each worker until it is no longer needed
+  void work()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    //workers beyond a lowered maximum finish their call and go away
+    while (num_workers_ <= max_workers_)
+    {
+      if (!queue_.empty())
+      {
+        boost::function<void()> call = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+        call();
+        lock.lock();
+        continue;
+      }
+      if (shutting_down_) break;
+      idle_workers_++;
+      work_cond_.wait(lock);
+      idle_workers_--;
+    }
+    num_workers_--;
+  }
+
+ public:
+  ServiceCallPool(size_t max_in_flight) : num_workers_(0), idle_workers_(0), 
+    max_workers_(std::max<size_t>(max_in_flight, 1)), shutting_down_(false) {}
+
+  void setMaxInFlight(size_t max_in_flight)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_workers_ = std::max<size_t>(max_in_flight, 1);
+    work_cond_.notify_all();
+    startWorkersAsNeeded();
+  }
+
+  //! Queues a call, to be made by the next free worker
+  void submit(const boost::function<void()> &call)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.push_back(call);
+    startWorkersAsNeeded();
+    work_cond_.notify_one();
+  }
+
+  //! Lets the workers go away once there are no more calls queued, instead of waiting for more
+  void shutdown()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutting_down_ = true;
+    work_cond_.notify_all();
+  }
+};
+
+//! The default number of asynchronous calls to the same service that can be in flight at once
+static const size_t DEFAULT_MAX_IN_FLIGHT = 4;
+
+//! Handle to a service call running in the background; see ServiceWrapper::callAsync()
+/*! Copies of a handle all refer to the same call. The call goes ahead even if all handles to it 
+  are dropped. */
+template <class ServiceDataType>
+class ServiceCallHandle
+{
+ private:
+  //! Shared between the handles and the thread making the call
+  struct State
+  {
+    boost::mutex mutex_;
+    boost::condition_variable done_cond_;
+    bool done_;
+    bool success_;
+    std::string error_;
+    typename ServiceDataType::Request request_;
+    typename ServiceDataType::Response response_;
+  };
+
+  boost::shared_ptr<State> state_;
+
+  //! Makes the call; runs in a worker of the pool
+  static void execute(boost::shared_ptr<State> state, boost::shared_ptr<ServiceReadiness> readiness,
+                      ros::Duration timeout)
+  {
+    bool success = false;
+    std::string error;
+    typename ServiceDataType::Response response;
+    if (!readiness->wait(timeout, boost::function<bool()>()))
+    {
+      error = "service " + readiness->getServiceName() + " not available";
+    }
+    else
+    {
+      //the request is never touched by the handles once the call is started
+      ros::ServiceClient client = ros::NodeHandle().serviceClient<ServiceDataType>(readiness->getServiceName());
+      success = client.call(state->request_, response);
+      if (!success) error = "call to service " + readiness->getServiceName() + " failed";
+    }
+    boost::mutex::scoped_lock lock(state->mutex_);
+    state->response_ = response;
+    state->success_ = success;
+    state->error_ = error;
+    state->done_ = true;
+    state->done_cond_.notify_all();
+  }
+
+ public:
+  //! An invalid handle, not referring to any call
+  ServiceCallHandle() {}
+
+  //! Queues a call with the given request on the pool
+  /*! Once a worker of the pool is free, the call waits for the service to become available (for 
+    at most timeout, 0 meaning forever), then is made. */
+  ServiceCallHandle(const typename ServiceDataType::Request &request,
+                    boost::shared_ptr<ServiceReadiness> readiness,
+                    boost::shared_ptr<ServiceCallPool> pool,
+                    ros::Duration timeout) : state_(new State)
+  {
+    state_->done_ = false;
+    state_->success_ = false;
+    state_->request_ = request;
+    pool->submit(boost::bind(&ServiceCallHandle::execute, state_, readiness, timeout));
+  }
+
+  bool isValid() const {return state_.get() != NULL;}
+
+  //! True once the call has returned, successfully or not; never blocks
+  bool isDone() const
+  {
+    boost::mutex::scoped_lock lock(state_->mutex_);
+    return state_->done_;
+  }
+
+  //! Waits for the call to return, for at most timeout (0 meaning forever); returns isDone()
+  bool wait(ros::Duration timeout = ros::Duration(0)) const
+  {
+    boost::mutex::scoped_lock lock(state_->mutex_);
+    if (timeout <= ros::Duration(0))
+    {
+      while (!state_->done_) state_->done_cond_.wait(lock);
+      return true;
+    }
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds(timeout.toNSec() / 1000);
+    while (!state_->done_)
+    {
+      if (!state_->done_cond_.timed_wait(lock, deadline)) break;
+    }
+    return state_->done_;
+  }
+
+  //! Waits for the call to return, then tells whether it succeeded
+  bool succeeded() const
+  {
+    wait();
+    boost::mutex::scoped_lock lock(state_->mutex_);
+    return state_->success_;
+  }
+
+  //! Waits for the call to return, then gives its response; only meaningful if it succeeded
+  const typename ServiceDataType::Response& response() const
+  {
+    wait();
+    return state_->response_;
+  }
+
+  //! Waits for the call to return, then describes why it failed; empty if it succeeded
+  std::string error() const
+  {
+    wait();
+    boost::mutex::scoped_lock lock(state_->mutex_);
+    return state_->error_;
+  }
+};
+
 //! Wrapper class for service clients to perform initialization on first use
 /*! When the client is first used, it will check for the existence of the service
   and wait until the service becomes available.
+
+  Calls can also be made in the background with callAsync(), which returns right away with a 
+  handle to the call. The calls are made by a pool of at most max_in_flight worker threads, kept 
+  for the life of the wrapper; further calls wait in a queue for a free worker. The wrapper itself is meant to be used from a single thread, but the 
+  handles can be waited on from any thread.
  */
 template <class ServiceDataType>
 class ServiceWrapper
@@ -61,39 +390,82 @@ class ServiceWrapper
   ros::ServiceClient client_;
   //! Function used to check for interrupts
   boost::function<bool()> interrupt_function_;
+  //! Whether the service is available, shared with calls in flight
+  boost::shared_ptr<ServiceReadiness> readiness_;
+  //! Makes the background calls
+  boost::shared_ptr<ServiceCallPool> call_pool_;
+  //! Whether the client keeps its connection open between calls
+  bool persistent_;
  public:
  ServiceWrapper(std::string service_name) : initialized_(false), 
     service_name_(service_name),
-    nh_("")
+    nh_(""),
+    readiness_(new ServiceReadiness(service_name, service_name)),
+    call_pool_(new ServiceCallPool(DEFAULT_MAX_IN_FLIGHT)),
+    persistent_(false)
     {}
+
+  ~ServiceWrapper(){call_pool_->shutdown();}
   
   //! Sets the interrupt function
   void setInterruptFunction(boost::function<bool()> f){interrupt_function_ = f;}
 
+  //! Sets how many background calls can be in flight at the same time
+  void setMaxInFlight(size_t max_in_flight){call_pool_->setMaxInFlight(max_in_flight);}
+
+  //! Starts looking for the service in the background, without waiting for it
+  void startWaiting(){readiness_->start();}
+
+  //! True if the service has been found; never blocks
+  bool isReady() const {return readiness_->isReady();}
+
+  //! Makes the client keep its connection open between calls
+  /*! Saves setting up a connection on every call, which adds up for frequently called services. 
+    A persistent connection that has dropped (e.g. because the server was restarted) is noticed 
+    on the next use of the client and replaced by a new one. Persistent clients are only used 
+    for blocking calls; callAsync() always opens a new connection. */
+  void setPersistent(bool persistent)
+  {
+    if (persistent != persistent_) initialized_ = false;
+    persistent_ = persistent;
+  }
+
   //! Returns reference to client. On first use, initializes (and waits for) client. 
   ros::ServiceClient& client(ros::Duration timeout = ros::Duration(5.0)) 
   {
+    if (initialized_ && !client_.isValid())
+    {
+      ROS_WARN_STREAM("Persistent connection to service " << service_name_ << " dropped; reconnecting");
+      initialized_ = false;
+    }
     if (!initialized_)
     {
-      ros::Duration ping_time = ros::Duration(1.0);
-      if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-      ros::Time start_time = ros::Time::now();
-      while (1)
-      {
-	if (ros::service::waitForService(service_name_, ping_time)) break;
-	ROS_INFO_STREAM("Waiting for service " << service_name_);
-        if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
-	if (!ros::ok()) throw ServiceNotFoundException(service_name_);
-	ros::Time current_time = ros::Time::now();
-	if (timeout > ros::Duration(0) && current_time - start_time >= timeout) 
-	  throw ServiceNotFoundException(service_name_);
-      }
-      client_ = nh_.serviceClient<ServiceDataType>(service_name_);	
+      if (!readiness_->wait(timeout, interrupt_function_)) throw ServiceNotFoundException(service_name_);
+      client_ = nh_.serviceClient<ServiceDataType>(service_name_, persistent_);	
       initialized_ = true;
     }
     return client_;
   }
 
+  //! Calls the service; if a persistent connection turns out to have dropped, reconnects and tries once more
+  bool call(typename ServiceDataType::Request &request, typename ServiceDataType::Response &response,
+            ros::Duration timeout = ros::Duration(5.0))
+  {
+    if (client(timeout).call(request, response)) return true;
+    if (client_.isValid()) return false;
+    return client(timeout).call(request, response);
+  }
+
+  //! Calls the service in the background and returns a handle to the call right away
+  /*! The call waits for the service for at most timeout (0 meaning forever); if it does not show 
+    up, the call fails. Interrupts are not checked in the background; callers should check them 
+    while waiting on the handle. */
+  ServiceCallHandle<ServiceDataType> callAsync(const typename ServiceDataType::Request &request,
+                                               ros::Duration timeout = ros::Duration(5.0))
+  {
+    return ServiceCallHandle<ServiceDataType>(request, readiness_, call_pool_, timeout);
+  }
+
   bool isInitialized() const {return initialized_;}
 };
 
@@ -106,6 +478,9 @@ class ServiceWrapper
   name is first requested, it will wait for the service, then create the client and return it. 
   It will also remember the client, so that on subsequent calls the client is returned directly
   without additional waiting.
+
+  As for the ServiceWrapper, calls can also be made in the background with callAsync(); each arm's 
+  service has its own pool of workers.
  */
 template <class ServiceDataType>
 class MultiArmServiceWrapper
@@ -129,15 +504,78 @@ class MultiArmServiceWrapper
   //! Function used to check for interrupts
   boost::function<bool()> interrupt_function_;
 
+  //! Readiness and background call pool of the service for one arm
+  struct Channel
+  {
+    boost::shared_ptr<ServiceReadiness> readiness_;
+    boost::shared_ptr<ServiceCallPool> call_pool_;
+  };
+
+  typedef std::map<std::string, Channel> channel_map_type;
+
+  //! The channels created so far, mapped to service names
+  channel_map_type channels_;
+
+  //! Applied to the call pool of every channel
+  size_t max_in_flight_;
+
+  //! Whether clients keep their connections open between calls
+  bool persistent_;
+
+  //! Returns the channel for the requested arm, creating it on first use
+  Channel& channel(const std::string &client_name)
+  {
+    typename channel_map_type::iterator it = channels_.find(client_name);
+    if (it != channels_.end()) return it->second;
+    std::string service_name = client_name;
+    if (resolve_names_) service_name = nh_.resolveName(client_name);
+    Channel new_channel;
+    new_channel.readiness_.reset(new ServiceReadiness(service_name, client_name + " remapped to " + service_name));
+    new_channel.call_pool_.reset(new ServiceCallPool(max_in_flight_));
+    return channels_.insert(std::make_pair(client_name, new_channel)).first->second;
+  }
+
  public:
   //! Sets the node handle, prefix and suffix
  MultiArmServiceWrapper(std::string prefix, std::string suffix, bool resolve_names) : 
-  nh_(""), prefix_(prefix), suffix_(suffix), resolve_names_(resolve_names)
+  nh_(""), prefix_(prefix), suffix_(suffix), resolve_names_(resolve_names), max_in_flight_(DEFAULT_MAX_IN_FLIGHT),
+    persistent_(false)
   {}
 
+  ~MultiArmServiceWrapper()
+  {
+    for (typename channel_map_type::iterator it = channels_.begin(); it != channels_.end(); it++)
+    {
+      it->second.call_pool_->shutdown();
+    }
+  }
+
+  //! Makes the clients keep their connections open between calls; see ServiceWrapper::setPersistent()
+  void setPersistent(bool persistent)
+  {
+    if (persistent != persistent_) clients_.clear();
+    persistent_ = persistent;
+  }
+
   //! Sets the interrupt function
   void setInterruptFunction(boost::function<bool()> f){interrupt_function_ = f;}
 
+  //! Sets how many background calls can be in flight at the same time, for each arm
+  void setMaxInFlight(size_t max_in_flight)
+  {
+    max_in_flight_ = max_in_flight;
+    for (typename channel_map_type::iterator it = channels_.begin(); it != channels_.end(); it++)
+    {
+      it->second.call_pool_->setMaxInFlight(max_in_flight);
+    }
+  }
+
+  //! Starts looking for the service for the requested arm in the background, without waiting for it
+  void startWaiting(std::string arm_name){channel(prefix_ + arm_name + suffix_).readiness_->start();}
+
+  //! True if the service for the requested arm has been found; never blocks
+  bool isReady(std::string arm_name){return channel(prefix_ + arm_name + suffix_).readiness_->isReady();}
+
   //! Returns a service client for the requested arm
   /*! Service name is obtained as prefix + arm_name + suffix.
     On first request for a given arm, a service client will be initialized, and the service will
@@ -152,35 +590,48 @@ class MultiArmServiceWrapper
       map_type::iterator it = clients_.find(client_name);
       if ( it != clients_.end() ) 
       {
+	if (!it->second.isValid())
+	{
+	  ROS_WARN_STREAM("Persistent connection to service " << client_name << " dropped; reconnecting");
+	  it->second = nh_.serviceClient<ServiceDataType>(channel(client_name).readiness_->getServiceName(), true);
+	}
 	return it->second;
       }
 
-      std::string service_name = client_name;
-      if (resolve_names_) service_name = nh_.resolveName(client_name);
-
       //new service; wait for it
-      ros::Duration ping_time = ros::Duration(1.0);
-      if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-      ros::Time start_time = ros::Time::now();
-      while(1)
-      {
-	if (ros::service::waitForService(service_name, ping_time)) break;
-        if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
-	if (!ros::ok()) throw ServiceNotFoundException(client_name + " remapped to " + service_name);
-	ros::Time current_time = ros::Time::now();
-	if (timeout > ros::Duration(0) && current_time - start_time >= timeout) 
-	  throw ServiceNotFoundException(client_name + " remapped to " + service_name);
-	ROS_INFO_STREAM("Waiting for service " << client_name << " remapped to " << service_name);
-      }
+      Channel &new_channel = channel(client_name);
+      std::string service_name = new_channel.readiness_->getServiceName();
+      if (!new_channel.readiness_->wait(timeout, interrupt_function_))
+	throw ServiceNotFoundException(client_name + " remapped to " + service_name);
 
       //insert new service in list
       std::pair<map_type::iterator, bool> new_pair;
       new_pair = clients_.insert(std::pair<std::string, ros::ServiceClient>
-				 (client_name, nh_.serviceClient<ServiceDataType>(service_name) ) );
+				 (client_name, nh_.serviceClient<ServiceDataType>(service_name, persistent_) ) );
 
       //and return it
       return new_pair.first->second;
     }
+
+  //! Calls the service for the requested arm; see ServiceWrapper::call()
+  bool call(std::string arm_name, typename ServiceDataType::Request &request, 
+            typename ServiceDataType::Response &response, ros::Duration timeout = ros::Duration(5.0))
+  {
+    ros::ServiceClient &arm_client = client(arm_name, timeout);
+    if (arm_client.call(request, response)) return true;
+    if (arm_client.isValid()) return false;
+    return client(arm_name, timeout).call(request, response);
+  }
+
+  //! Calls the service for the requested arm in the background and returns a handle to the call right away
+  /*! See ServiceWrapper::callAsync(). */
+  ServiceCallHandle<ServiceDataType> callAsync(std::string arm_name, 
+                                               const typename ServiceDataType::Request &request,
+                                               ros::Duration timeout = ros::Duration(5.0))
+  {
+    Channel &arm_channel = channel(prefix_ + arm_name + suffix_);
+    return ServiceCallHandle<ServiceDataType>(request, arm_channel.readiness_, arm_channel.call_pool_, timeout);
+  }
 };
 
 //! Cancels all goals of the client when it goes out of scope
@@ -228,18 +679,15 @@ class ActionWrapper
     {
       // aleeper: Added this to aid with remapping debugging.
       remapped_name_ = nh_.resolveName(action_name_, true);
-      ros::Duration ping_time = ros::Duration(1.0);
-      if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-      ros::Time start_time = ros::Time::now();
+      WaitLoop loop(timeout);
       while (1)
       {
-	if (client_.waitForServer(ping_time)) break;
+	if (client_.waitForServer(loop.slice())) break;
         if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
 	if (!ros::ok()) throw ServiceNotFoundException(action_name_);
-	ros::Time current_time = ros::Time::now();
-	if (timeout > ros::Duration(0) && current_time - start_time >= timeout) 
-	  throw ServiceNotFoundException(action_name_);
-	ROS_INFO_STREAM("Waiting for action client: " << action_name_ << " remapped to " << remapped_name_);
+	if (loop.expired()) throw ServiceNotFoundException(action_name_);
+	if (loop.shouldLog()) 
+	  ROS_INFO_STREAM("Waiting for action client: " << action_name_ << " remapped to " << remapped_name_);
       }
       initialized_ = true;
     }
@@ -248,23 +696,25 @@ class ActionWrapper
 
   bool waitForResult(const ros::Duration &timeout=ros::Duration(0,0))
   {
-    ros::Duration ping_time = ros::Duration(5.0);
-    if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-    ros::Time start_time = ros::Time::now();
+    WaitLoop loop(timeout, ros::Duration(5.0));
     while (1)
     {
-      if (client().waitForResult(ping_time)) return true;
+      if (client().waitForResult(loop.slice())) return true;
       if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
       //we should probably throw something else here
       if (!ros::ok()) throw ServiceNotFoundException(action_name_);
-      ros::Time current_time = ros::Time::now();
-      if (timeout > ros::Duration(0) && current_time - start_time >= timeout) return false;
+      if (loop.expired()) return false;
       if (!client().isServerConnected()) return false;
-      ROS_INFO_STREAM("Waiting for result from action client: " << action_name_ << " remapped to " << remapped_name_);
+      if (loop.shouldLog())
+        ROS_INFO_STREAM("Waiting for result from action client: " << action_name_ << " remapped to " << remapped_name_);
     }
   }
 
   bool isInitialized() const {return initialized_;}
+
+  //! True if the action server has been found; never blocks
+  /*! The client starts connecting as soon as the wrapper is constructed. */
+  bool isReady() {return initialized_ || client_.isServerConnected();}
 };
 
 
@@ -368,6 +818,24 @@ class MultiArmActionWrapper
   //! Function used to check for interrupts
   boost::function<bool()> interrupt_function_;
 
+  //! The clients whose action servers have been waited for, by action name
+  std::set<std::string> ready_clients_;
+
+  //! Returns the action client with the given name, creating it (but not waiting for it) if needed
+  actionlib::SimpleActionClient<ActionDataType>* createClient(const std::string &client_name)
+  {
+    typename map_type::iterator it = clients_.find(client_name);
+    if ( it != clients_.end() ) return it->second;
+
+    std::string action_name = client_name;
+    if (resolve_names_) action_name = nh_.resolveName(client_name);
+    actionlib::SimpleActionClient<ActionDataType>* new_client = 
+      new actionlib::SimpleActionClient<ActionDataType>(nh_, action_name, spin_thread_ );
+    clients_.insert( std::pair<std::string,actionlib::SimpleActionClient<ActionDataType>* >
+                     (client_name, new_client ) );
+    return new_client;
+  }
+
  public:
   //! Sets the node handle, prefix and suffix
  MultiArmActionWrapper(std::string prefix, std::string suffix, bool spin_thread, bool resolve_names) : 
@@ -385,6 +853,20 @@ class MultiArmActionWrapper
     }
   }
 
+  //! Starts connecting to the action server for the requested arm, without waiting for it
+  /*! Action clients connect in the background, so starting them all first and then waiting for 
+    them takes as long as the slowest one rather than the sum of all. */
+  void startWaiting(std::string arm_name){createClient(prefix_ + arm_name + suffix_);}
+
+  //! True if the action server for the requested arm has been found; never blocks
+  bool isReady(std::string arm_name)
+  {
+    std::string client_name = prefix_ + arm_name + suffix_;
+    if (ready_clients_.count(client_name)) return true;
+    typename map_type::iterator it = clients_.find(client_name);
+    return it != clients_.end() && it->second->isServerConnected();
+  }
+
   //! Returns a action client for the requested arm
   /*! Action name is obtained as prefix + arm_name + suffix.
     On first request for a given arm, a action client will be initialized, and the action will
@@ -396,60 +878,43 @@ class MultiArmActionWrapper
       //compute the name of the action
       std::string client_name = prefix_ + arm_name + suffix_;
 
-      //check if the action client is already there      
-      typename map_type::iterator it = clients_.find(client_name);
-      if ( it != clients_.end() ) 
-      {
-	return *(it->second);
-      }
-      
+      //get the action client, creating it if needed
+      actionlib::SimpleActionClient<ActionDataType>* arm_client = createClient(client_name);
+      if (ready_clients_.count(client_name)) return *arm_client;
+
       std::string action_name = client_name;
       if (resolve_names_) action_name = nh_.resolveName(client_name);
 
-      //create new action client and insert in map
-      actionlib::SimpleActionClient<ActionDataType>* new_client = 
-	new actionlib::SimpleActionClient<ActionDataType>(nh_, action_name, spin_thread_ );
-
       //wait for the server
-      ros::Duration ping_time = ros::Duration(1.0);
-      if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-      ros::Time start_time = ros::Time::now();
+      WaitLoop loop(timeout);
       while (1)
       {
-	if (new_client->waitForServer(ping_time)) break;
+	if (arm_client->waitForServer(loop.slice())) break;
         if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
 	if (!ros::ok()) throw ServiceNotFoundException(client_name + " remapped to " + action_name);
-	ros::Time current_time = ros::Time::now();
-	if (timeout > ros::Duration(0) && current_time - start_time >= timeout) 
-	  throw ServiceNotFoundException(client_name + " remapped to " + action_name);
-	ROS_INFO_STREAM("Waiting for action client " << client_name << ", remapped to " << action_name);
+	if (loop.expired()) throw ServiceNotFoundException(client_name + " remapped to " + action_name);
+	if (loop.shouldLog()) 
+	  ROS_INFO_STREAM("Waiting for action client " << client_name << ", remapped to " << action_name);
       }
 
-      //insert new client in map
-      std::pair< typename map_type::iterator, bool> new_pair = 
-	clients_.insert( std::pair<std::string,actionlib::SimpleActionClient<ActionDataType>* >
-			 (client_name, new_client ) );
-
-      //and return it
-      return *(new_pair.first->second);      
+      //from now on, the client is returned directly
+      ready_clients_.insert(client_name);
+      return *arm_client;
     }
 
   //! The action client for the requested arm waits for result
   bool waitForResult(std::string arm_name, const ros::Duration &timeout=ros::Duration(0,0))
   {
-    ros::Duration ping_time = ros::Duration(1.0);
-    if (timeout > ros::Duration(0) && ping_time > timeout) ping_time = timeout;
-    ros::Time start_time = ros::Time::now();
+    WaitLoop loop(timeout);
     while (1)
     {
-      if (client(arm_name).waitForResult(ping_time)) return true;
+      if (client(arm_name).waitForResult(loop.slice())) return true;
       if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
       //we should probably throw something else here
       if (!ros::ok()) throw ServiceNotFoundException(arm_name);
-      ros::Time current_time = ros::Time::now();
-      if (timeout > ros::Duration(0) && current_time - start_time >= timeout) return false;
+      if (loop.expired()) return false;
       if (!client(arm_name).isServerConnected()) return false;
-      ROS_INFO_STREAM("Waiting for result from multi-arm action client on arm " << arm_name);
+      if (loop.shouldLog()) ROS_INFO_STREAM("Waiting for result from multi-arm action client on arm " << arm_name);
     }
   }
 
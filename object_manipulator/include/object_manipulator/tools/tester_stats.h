@@ -0,0 +1,159 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _TESTER_STATS_H_
+#define _TESTER_STATS_H_
+
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+namespace object_manipulator {
+
+//! Cumulative timing and outcome counts for one of the fast testers
+/*! The stages are named after the grasp tester; for placing, PREGRASP is the pre-place check and 
+  LIFT is the retreat check. Stage times are summed over all worker threads, so with several 
+  threads they can add up to more than the wall time of the calls. 
+
+  Latencies of individual stage runs and of whole calls are also kept as histograms with 
+  logarithmic buckets: bucket b counts latencies between 2^b and 2^(b+1) microseconds, with the 
+  last bucket also counting everything longer. */
+struct TesterStats
+{
+  enum Stage {COLLISION, LIFT, PREGRASP, IK, INTERPOLATED_IK, FINAL_CHECK, NUM_STAGES};
+
+  //! IK_CACHE_STALE counts cached IK results that no longer held; those are also counted as misses
+  enum Counter {IK_CACHE_HIT, IK_CACHE_MISS, IK_CACHE_STALE, REACHABILITY_REJECTION, 
+                COLLISION_MATRICES_CACHE_HIT, COLLISION_MATRICES_CACHE_MISS, IK_SEEDED, NUM_COUNTERS};
+
+  static const int NUM_BUCKETS = 24;
+
+  //! A short name for a stage, for printing and reporting
+  static const char* stageName(int stage);
+
+  //! A short name for a counter, for printing and reporting
+  static const char* counterName(int counter);
+
+  //! The histogram bucket for a latency in seconds
+  static int bucket(double seconds);
+
+  //! The upper bound, in seconds, of the latencies counted in a bucket
+  static double bucketLimit(int bucket);
+
+  //! An upper bound on the given fraction of the latencies counted in a histogram; 0 if it is empty
+  static double percentile(const size_t *histogram, double fraction);
+
+  //! Seconds spent in each stage
+  double stage_time_[NUM_STAGES];
+  //! Number of times each stage was run on a candidate
+  size_t stage_count_[NUM_STAGES];
+  //! Latency histogram for each stage
+  size_t stage_histogram_[NUM_STAGES][NUM_BUCKETS];
+
+  size_t counters_[NUM_COUNTERS];
+
+  //! Number of candidates with each result code
+  std::map<int, size_t> outcomes_;
+
+  //! Number of calls to the tester, and candidates tested in them
+  size_t calls_;
+  size_t candidates_;
+  //! Total wall time of the calls
+  double wall_time_;
+  //! Latency histogram for whole calls
+  size_t call_histogram_[NUM_BUCKETS];
+
+  TesterStats() {clear();}
+
+  void clear();
+
+  //! Explicit collision checks made by the tester per candidate, not counting those inside IK
+  double collisionChecksPerCandidate() const;
+
+  //! Fills in the values of a diagnostic status with a summary of these statistics
+  void toDiagnosticStatus(diagnostic_msgs::DiagnosticStatus &status) const;
+};
+
+//! Accumulates TesterStats; safe to use from several threads at once
+class TesterStatsRecorder
+{
+ private:
+  TesterStats stats_;
+  mutable boost::mutex mutex_;
+
+ public:
+  void addStageTime(TesterStats::Stage stage, double seconds);
+
+  void increment(TesterStats::Counter counter);
+
+  void addOutcome(int result_code, size_t count);
+
+  void addCall(size_t candidates, double seconds);
+
+  //! A copy of the statistics gathered so far
+  TesterStats getStats() const;
+
+  void reset();
+};
+
+//! Adds the time from its construction until stop() (or its destruction) to a stage of a recorder
+class StageTimer
+{
+ private:
+  TesterStatsRecorder &recorder_;
+  TesterStats::Stage stage_;
+  ros::WallTime start_;
+  bool running_;
+
+ public:
+  StageTimer(TesterStatsRecorder &recorder, TesterStats::Stage stage) : 
+    recorder_(recorder), stage_(stage), start_(ros::WallTime::now()), running_(true) {}
+
+  ~StageTimer() {stop();}
+
+  void stop()
+  {
+    if (!running_) return;
+    running_ = false;
+    recorder_.addStageTime(stage_, (ros::WallTime::now() - start_).toSec());
+  }
+};
+
+} //namespace object_manipulator
+
+#endif
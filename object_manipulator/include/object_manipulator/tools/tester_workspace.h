@@ -0,0 +1,165 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef _TESTER_WORKSPACE_H_
+#define _TESTER_WORKSPACE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <arm_navigation_msgs/PlanningScene.h>
+#include <planning_environment/models/collision_models.h>
+#include <arm_kinematics_constraint_aware/arm_kinematics_solver_constraint_aware.h>
+#include <pluginlib/class_loader.h>
+
+#include "object_manipulator/tools/reachability_map.h"
+
+namespace object_manipulator {
+
+typedef std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*> IKSolverMap;
+
+//! Creates a constraint-aware IK solver for every group in the collision models that has an IK chain
+/*! Returns false if the kinematics plugin could not be loaded; solvers created up to that point
+  are left in the map. */
+bool createIKSolvers(planning_environment::CollisionModels* cm,
+                     pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader,
+                     const std::string &plugin_name,
+                     IKSolverMap &ik_solver_map);
+
+//! Returns those of the given maps that were built in the base frame of the IK solver for their arm
+/*! Maps that do not match are reported and left out, as their answers would be meaningless. */
+ReachabilityMaps selectReachabilityMaps(const ReachabilityMaps &maps, const IKSolverMap &ik_solver_map);
+
+//! The collision environment, planning scene state and IK solvers used to test a batch of candidates
+/*! Neither CollisionModels nor the constraint-aware IK solvers may be used from more than one 
+  thread at a time. A fast tester running serially uses a single workspace that simply wraps its 
+  own models; when running in parallel, each worker thread gets a private workspace with its own 
+  copy of the collision models, kept in sync with the planning scene of the MechanismInterface.
+*/
+class TesterWorkspace
+{
+ private:
+  //! Whether the models and solvers were created by this workspace and must be deleted with it
+  bool owns_models_;
+
+  //! The revision of the planning scene currently installed in our collision models
+  unsigned int scene_revision_;
+
+  //! Whether a planning scene has been installed at all
+  bool scene_set_;
+
+  //! The planning scene currently installed in our collision models, kept for applying the next one as a diff
+  arm_navigation_msgs::PlanningScene scene_;
+
+ public:
+  //! The collision models used for all checks in this workspace
+  planning_environment::CollisionModels* cm_;
+
+  //! The planning scene state; gets modified freely during testing
+  planning_models::KinematicState* state_;
+
+  //! The IK solvers, one per group, all operating on cm_
+  IKSolverMap ik_solver_map_;
+
+  //! Tester-defined tag of the collision configuration currently applied to cm_; -1 if unknown
+  /*! Lets testers skip re-applying an allowed collision matrix and link padding that are 
+    already in place. */
+  int configuration_;
+
+  //! Scratch space for the flat state values used when applying a PosturePlan
+  std::vector<double> state_values_;
+
+  //! Wraps existing models and solvers without taking ownership
+  TesterWorkspace(planning_environment::CollisionModels* cm,
+                  planning_models::KinematicState* state,
+                  const IKSolverMap &ik_solver_map);
+
+  //! Loads a private copy of the collision models and creates IK solvers for it
+  TesterWorkspace(pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader,
+                  const std::string &plugin_name);
+
+  ~TesterWorkspace();
+
+  //! Installs the given planning scene, unless that revision is already installed
+  /*! Only meaningful for workspaces that own their models. The new planning scene is applied as a 
+    diff from the installed one where possible, see applyPlanningSceneDiff(). */
+  void syncPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene, unsigned int revision);
+};
+
+//! A set of private workspaces, one for each worker thread used by a fast tester
+class TesterWorkerPool
+{
+ private:
+  std::vector<TesterWorkspace*> workspaces_;
+
+  pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader_;
+
+  std::string plugin_name_;
+
+ public:
+  TesterWorkerPool(pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader,
+                   const std::string &plugin_name) : 
+    kinematics_loader_(kinematics_loader), plugin_name_(plugin_name) {}
+
+  ~TesterWorkerPool();
+
+  //! Deletes all workspaces, along with their IK solvers
+  /*! Owners must call this while the kinematics loader the pool was given is still alive, as 
+    unloading the plugin libraries first leaves the solvers without their code. */
+  void clear();
+
+  //! Returns num_workers workspaces, all holding the given revision of the planning scene
+  /*! Workspaces are created on first use and kept for subsequent calls, as loading the collision 
+    models is expensive. */
+  std::vector<TesterWorkspace*> getWorkspaces(size_t num_workers,
+                                              const arm_navigation_msgs::PlanningScene &planning_scene,
+                                              unsigned int revision);
+};
+
+//! Calls setup(w) once for every workspace, then job(w, i) for every i in [0, num_jobs)
+/*! With a single workspace everything runs in the calling thread. Otherwise one thread is started 
+  per workspace; jobs are handed out in increasing index order from a shared counter, so a worker 
+  that finishes early simply picks up the next pending job. A job must only write data belonging 
+  to its own index. Returns once all jobs are done. If any job throws, the remaining jobs are 
+  skipped and a MechanismException is thrown in the calling thread.
+*/
+void runInWorkspaces(const std::vector<TesterWorkspace*> &workspaces, size_t num_jobs,
+                     boost::function<void(TesterWorkspace&)> setup,
+                     boost::function<void(TesterWorkspace&, size_t)> job);
+
+} //namespace object_manipulator
+
+#endif
@@ -0,0 +1,187 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <algorithm>
+
+#include <ros/ros.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <actionlib/server/simple_action_server.h>
+
+#include <object_manipulation_msgs/BatchIKAction.h>
+
+#include "object_manipulator/tools/ik_tester_fast.h"
+#include "object_manipulator/tools/mechanism_interface.h"
+#include "object_manipulator/tools/exceptions.h"
+
+namespace object_manipulator {
+
+static const std::string BATCH_IK_ACTION_NAME = "batch_ik";
+
+//! Reads the name of the kinematics plugin from the private namespace
+static std::string getKinematicsPlugin(const ros::NodeHandle &priv_nh)
+{
+  std::string plugin_name;
+  priv_nh.param<std::string>("kinematics_plugin", plugin_name, "pr2_arm_kinematics/PR2ArmKinematicsPlugin");
+  return plugin_name;
+}
+
+//! Wraps IKTesterFast in a ROS API, so other nodes can get IK for many poses in a single round trip
+/*! Each goal is tested against the latest planning scene. Results are streamed as feedback as soon 
+  as they are known, at most once every ~feedback_period seconds. Private parameters: ik_test_threads, 
+  feedback_period, ik_seed_propagation, ik_seed_distance and kinematics_plugin.
+*/
+class BatchIKServer
+{
+private:
+  //! The private ROS node handle
+  ros::NodeHandle priv_nh_;  
+
+  //! Does the actual testing
+  IKTesterFast ik_tester_;
+
+  //! The action server for batch IK
+  actionlib::SimpleActionServer<object_manipulation_msgs::BatchIKAction> action_server_;
+
+  //! The minimum time between two feedback messages
+  ros::WallDuration feedback_period_;
+
+  //! Protects everything below, which is only valid during a goal
+  boost::mutex feedback_mutex_;
+
+  //! The results of the current goal, as filled in by the tester
+  const object_manipulation_msgs::BatchIKResult *result_;
+
+  //! The results not yet sent as feedback
+  object_manipulation_msgs::BatchIKFeedback feedback_;
+
+  ros::WallTime last_feedback_time_;
+
+  //! Publishes the pending feedback, if any; feedback_mutex_ must be held
+  void flushFeedback()
+  {
+    if(feedback_.indices.empty()) return;
+    action_server_.publishFeedback(feedback_);
+    feedback_.indices.clear();
+    feedback_.solutions.clear();
+    feedback_.error_codes.clear();
+    last_feedback_time_ = ros::WallTime::now();
+  }
+
+  //! Called by the tester, possibly from several threads, whenever the result for a pose is known
+  void resultCallback(size_t i)
+  {
+    boost::mutex::scoped_lock lock(feedback_mutex_);
+    feedback_.indices.push_back(i);
+    feedback_.solutions.push_back(result_->solutions[i]);
+    feedback_.error_codes.push_back(result_->error_codes[i]);
+    if(ros::WallTime::now() - last_feedback_time_ >= feedback_period_) flushFeedback();
+  }
+
+  //! Callback for the batch IK action
+  void batchIKCallback(const object_manipulation_msgs::BatchIKGoal::ConstPtr &goal)
+  {
+    object_manipulation_msgs::BatchIKResult result;
+    {
+      boost::mutex::scoped_lock lock(feedback_mutex_);
+      result_ = &result;
+      feedback_ = object_manipulation_msgs::BatchIKFeedback();
+      last_feedback_time_ = ros::WallTime::now();
+    }
+    try
+    {
+      //always test against the latest planning scene
+      arm_navigation_msgs::OrderedCollisionOperations collision_operations;
+      std::vector<arm_navigation_msgs::LinkPadding> link_padding;
+      mechInterface().getPlanningScene(collision_operations, link_padding);
+
+      ik_tester_.testIKSet(goal->arm_name, goal->poses, goal->return_on_first_hit, 
+                           result.solutions, result.error_codes);
+    }
+    catch (InterruptRequestedException &ex)
+    {
+      ROS_INFO("Batch IK preempted");
+      action_server_.setPreempted();
+      return;
+    }
+    catch (GraspException &ex)
+    {
+      ROS_ERROR("Batch IK error; exception: %s", ex.what());
+      action_server_.setAborted();
+      return;
+    }
+    {
+      boost::mutex::scoped_lock lock(feedback_mutex_);
+      flushFeedback();
+      result_ = NULL;
+    }
+    action_server_.setSucceeded(result);
+  }
+
+public:
+  BatchIKServer() : priv_nh_("~"),
+                    ik_tester_(NULL, getKinematicsPlugin(priv_nh_)),
+                    action_server_(priv_nh_, BATCH_IK_ACTION_NAME, 
+                                   boost::bind(&BatchIKServer::batchIKCallback, this, _1),
+                                   false),
+                    result_(NULL)
+  {
+    int ik_test_threads;
+    priv_nh_.param<int>("ik_test_threads", ik_test_threads, 1);
+    ik_tester_.setNumThreads(std::max(ik_test_threads, 1));
+    bool ik_seed_propagation;
+    double ik_seed_distance;
+    priv_nh_.param<bool>("ik_seed_propagation", ik_seed_propagation, false);
+    priv_nh_.param<double>("ik_seed_distance", ik_seed_distance, 0.05);
+    ik_tester_.setSeedPropagation(ik_seed_propagation, ik_seed_distance);
+    double feedback_period;
+    priv_nh_.param<double>("feedback_period", feedback_period, 0.1);
+    feedback_period_ = ros::WallDuration(feedback_period);
+
+    ik_tester_.setInterruptFunction(boost::bind(&actionlib::SimpleActionServer<object_manipulation_msgs::BatchIKAction>::
+                                                isPreemptRequested, &action_server_));
+    ik_tester_.setResultFunction(boost::bind(&BatchIKServer::resultCallback, this, _1));
+    action_server_.start();
+  }
+};
+
+} //namespace
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "batch_ik_server");
+  object_manipulator::BatchIKServer node;
+  ros::spin();
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <ros/ros.h>
+
+#include <pluginlib/class_loader.h>
+
+#include "object_manipulator/tools/hand_description.h"
+#include "object_manipulator/tools/reachability_map.h"
+#include "object_manipulator/tools/reachability_map_builder.h"
+#include "object_manipulator/tools/tester_workspace.h"
+
+using namespace object_manipulator;
+
+//! Builds the reachability map for one arm and saves it to a file
+/*! Needs the robot description and hand description on the parameter server. Private parameters:
+  arm_name, output_file, resolution (m), min_x/y/z and max_x/y/z (the box to cover, in the base 
+  frame of the IK solver, which must enclose the whole workspace of the arm), num_rolls, dilate 
+  and kinematics_plugin.
+*/
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "build_reachability_map");
+  ros::NodeHandle priv_nh("~");
+
+  std::string arm_name, output_file, plugin_name;
+  double resolution, min_x, min_y, min_z, max_x, max_y, max_z;
+  int num_rolls;
+  bool dilate;
+  priv_nh.param<std::string>("arm_name", arm_name, "right_arm");
+  priv_nh.param<std::string>("output_file", output_file, arm_name + ".reach");
+  priv_nh.param<std::string>("kinematics_plugin", plugin_name, "pr2_arm_kinematics/PR2ArmKinematicsPlugin");
+  priv_nh.param<double>("resolution", resolution, 0.05);
+  priv_nh.param<double>("min_x", min_x, -1.2);
+  priv_nh.param<double>("min_y", min_y, -1.2);
+  priv_nh.param<double>("min_z", min_z, -1.2);
+  priv_nh.param<double>("max_x", max_x, 1.2);
+  priv_nh.param<double>("max_y", max_y, 1.2);
+  priv_nh.param<double>("max_z", max_z, 1.2);
+  //rolls are not binned, so they are sampled densely to avoid missing a reachable one
+  priv_nh.param<int>("num_rolls", num_rolls, 16);
+  priv_nh.param<bool>("dilate", dilate, true);
+
+  planning_environment::CollisionModels cm("robot_description");
+  pluginlib::ClassLoader<kinematics::KinematicsBase> kinematics_loader("kinematics_base",
+                                                                       "kinematics::KinematicsBase");
+  IKSolverMap ik_solver_map;
+  createIKSolvers(&cm, kinematics_loader, plugin_name, ik_solver_map);
+  if (ik_solver_map.find(arm_name) == ik_solver_map.end()) {
+    ROS_ERROR("No IK solver for arm %s", arm_name.c_str());
+    return 1;
+  }
+  arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver = ik_solver_map[arm_name];
+
+  std::vector<std::string> free_links = ReachabilityMapBuilder::armAndGripperLinks(&cm, arm_name);
+
+  tf::Vector3 approach_axis;
+  tf::vector3MsgToTF(handDescription().approachDirection(arm_name), approach_axis);
+
+  ReachabilityMap map;
+  map.create(arm_name, solver->getBaseName(), approach_axis, tf::Vector3(min_x, min_y, min_z), 
+             tf::Vector3(max_x, max_y, max_z), resolution);
+  ROS_INFO("Building reachability map for %s in frame %s: %zu voxels, %d orientation bins, %d rolls", 
+           arm_name.c_str(), solver->getBaseName().c_str(), map.numVoxels(), 
+           ReachabilityMap::NUM_ORIENTATION_BINS, num_rolls);
+
+  ros::WallTime start = ros::WallTime::now();
+  size_t reachable;
+  {
+    ReachabilityMapBuilder builder(&cm, solver, free_links);
+    reachable = builder.build(map, num_rolls);
+  }
+  if (!ros::ok()) return 1;
+  ROS_INFO("Sampled in %.1f s; %zu of %zu voxel orientations reachable", (ros::WallTime::now() - start).toSec(),
+           reachable, map.numVoxels() * ReachabilityMap::NUM_ORIENTATION_BINS);
+  if (dilate) map.dilate();
+  else ROS_WARN("Reachability map not dilated; the testers may reject reachable poses with it");
+
+  for (IKSolverMap::iterator it = ik_solver_map.begin(); it != ik_solver_map.end(); it++) {
+    delete it->second;
+  }
+  if (!map.save(output_file)) return 1;
+  ROS_INFO("Saved reachability map to %s", output_file.c_str());
+  return 0;
+}
@@ -39,13 +39,17 @@
 
 #include <actionlib/server/simple_action_server.h>
 
+#include <std_msgs/Bool.h>
+
 #include <object_manipulation_msgs/PickupAction.h>
+#include <object_manipulation_msgs/PickupFeasibilityAction.h>
 #include <object_manipulation_msgs/PlaceAction.h>
 
 namespace object_manipulator {
 
 static const std::string PICKUP_ACTION_NAME = "object_manipulator_pickup";
 static const std::string PLACE_ACTION_NAME = "object_manipulator_place";
+static const std::string PICKUP_FEASIBILITY_ACTION_NAME = "object_manipulator_pickup_feasibility";
 
 //! Wraps the Object Manipulator in a ROS API
 class ObjectManipulatorNode
@@ -63,12 +67,78 @@ private:
   //! The action server for placing
   actionlib::SimpleActionServer<object_manipulation_msgs::PlaceAction> place_action_server_;
 
+  //! The action server for testing the grasps of several objects at once
+  actionlib::SimpleActionServer<object_manipulation_msgs::PickupFeasibilityAction> pickup_feasibility_action_server_;
+
+  //! Latched; tells whether all servers needed for pickup and place were found at startup
+  ros::Publisher ready_pub_;
+
+  //! The arms to look for servers for at startup: ~warm_up_arms, or else all arms in the hand description
+  std::vector<std::string> warmUpArms()
+  {
+    std::vector<std::string> arm_names;
+    XmlRpc::XmlRpcValue list;
+    if (priv_nh_.getParam("warm_up_arms", list) && list.getType() == XmlRpc::XmlRpcValue::TypeArray)
+    {
+      for (int32_t i=0; i<list.size(); i++)
+      {
+        if (list[i].getType() == XmlRpc::XmlRpcValue::TypeString) 
+          arm_names.push_back(static_cast<std::string>(list[i]));
+      }
+      return arm_names;
+    }
+    XmlRpc::XmlRpcValue hands;
+    if (ros::NodeHandle().getParam("/hand_description", hands) && hands.getType() == XmlRpc::XmlRpcValue::TypeStruct)
+    {
+      for (XmlRpc::XmlRpcValue::iterator it = hands.begin(); it != hands.end(); it++) 
+        arm_names.push_back(it->first);
+    }
+    return arm_names;
+  }
+
+  //! Looks for all needed services and action servers before taking any goals, then reports readiness
+  /*! Goals are accepted even if some servers are missing, in which case they are waited for on 
+    first use, as before. */
+  void warmUp()
+  {
+    ready_pub_ = priv_nh_.advertise<std_msgs::Bool>("ready", 1, true);
+    std_msgs::Bool ready;
+    ready.data = false;
+    ready_pub_.publish(ready);
+
+    bool warm_up;
+    priv_nh_.param<bool>("warm_up", warm_up, true);
+    if (!warm_up) return;
+    double warm_up_timeout;
+    priv_nh_.param<double>("warm_up_timeout", warm_up_timeout, 30.0);
+    ros::Time start_time = ros::Time::now();
+    std::vector<std::string> missing;
+    ready.data = mechInterface().warmUp(warmUpArms(), ros::Duration(warm_up_timeout), missing);
+    //the planners get whatever is left of the timeout, but never less than a second; 0 waits forever
+    ros::Duration remaining(0);
+    if (warm_up_timeout > 0)
+    {
+      remaining = ros::Duration(warm_up_timeout) - (ros::Time::now() - start_time);
+      if (remaining < ros::Duration(1.0)) remaining = ros::Duration(1.0);
+    }
+    if (!object_manipulator_.warmUpGraspPlanners(remaining, missing)) ready.data = false;
+    for (size_t i=0; i<missing.size(); i++) ROS_WARN("Object manipulator warm-up: %s", missing[i].c_str());
+    if (ready.data) ROS_INFO("Object manipulator ready");
+    ready_pub_.publish(ready);
+  }
+
   //! Callback for the pickup action
   void pickupCallback(const object_manipulation_msgs::PickupGoal::ConstPtr &goal)
   {
     object_manipulator_.pickup(goal, &pickup_action_server_);
   }
 
+  //! Callback for the pickup feasibility action
+  void pickupFeasibilityCallback(const object_manipulation_msgs::PickupFeasibilityGoal::ConstPtr &goal)
+  {
+    object_manipulator_.pickupFeasibility(goal, &pickup_feasibility_action_server_);
+  }
+
   //! Callback for the placing action
   void placeCallback(const object_manipulation_msgs::PlaceGoal::ConstPtr &goal)
   {
@@ -82,10 +152,15 @@ public:
                                                    false),
 			    place_action_server_( priv_nh_, PLACE_ACTION_NAME, 
 						  boost::bind(&ObjectManipulatorNode::placeCallback, this, _1),
-                                                  false)
+                                                  false),
+			    pickup_feasibility_action_server_( priv_nh_, PICKUP_FEASIBILITY_ACTION_NAME, 
+				       boost::bind(&ObjectManipulatorNode::pickupFeasibilityCallback, this, _1),
+                                                               false)
   {
+    warmUp();
     pickup_action_server_.start();
     place_action_server_.start();
+    pickup_feasibility_action_server_.start();
   }
 };
 
@@ -0,0 +1,166 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <ros/time.h>
+#include <tf/transform_datatypes.h>
+
+#include "object_manipulator/tools/pose_batch.h"
+
+using namespace object_manipulator;
+
+namespace {
+
+double randomUnit()
+{
+  return 2.0 * rand() / (double)RAND_MAX - 1.0;
+}
+
+geometry_msgs::Pose randomPose()
+{
+  geometry_msgs::Pose pose;
+  pose.position.x = randomUnit();
+  pose.position.y = randomUnit();
+  pose.position.z = randomUnit();
+  pose.orientation.x = randomUnit();
+  pose.orientation.y = randomUnit();
+  pose.orientation.z = randomUnit();
+  pose.orientation.w = randomUnit();
+  double norm = sqrt(pose.orientation.x*pose.orientation.x + pose.orientation.y*pose.orientation.y + 
+                     pose.orientation.z*pose.orientation.z + pose.orientation.w*pose.orientation.w);
+  pose.orientation.x /= norm;
+  pose.orientation.y /= norm;
+  pose.orientation.z /= norm;
+  pose.orientation.w /= norm;
+  return pose;
+}
+
+//! Largest difference between the positions and rotation matrices of two transforms
+double difference(const tf::Transform &a, const tf::Transform &b)
+{
+  double diff = 0;
+  for (int i=0; i<3; i++) {
+    diff = std::max(diff, fabs(a.getOrigin()[i] - b.getOrigin()[i]));
+    for (int j=0; j<3; j++) diff = std::max(diff, fabs(a.getBasis()[i][j] - b.getBasis()[i][j]));
+  }
+  return diff;
+}
+
+void report(const char *name, double tf_time, double batch_time, size_t poses, double error)
+{
+  printf("%-28s %10.1f %10.1f %8.2fx %10.1e\n", name, 1.0e9 * tf_time / poses, 1.0e9 * batch_time / poses,
+         tf_time / std::max(batch_time, 1.0e-12), error);
+}
+
+} //namespace
+
+//! Compares PoseBatch operations against the same operations done one tf::Transform at a time
+/*! Usage: pose_batch_benchmark [num_poses] [repetitions]. Reports the time per pose of each, the 
+  speedup, and the largest difference between the results. Does not need a ROS master. */
+int main(int argc, char **argv)
+{
+  size_t num_poses = argc > 1 ? atoi(argv[1]) : 1000;
+  int repetitions = argc > 2 ? atoi(argv[2]) : 1000;
+  if (num_poses == 0 || repetitions <= 0) {
+    fprintf(stderr, "Usage: %s [num_poses] [repetitions]\n", argv[0]);
+    return 1;
+  }
+  srand(0);
+
+  std::vector<geometry_msgs::Pose> msgs_a(num_poses), msgs_b(num_poses), msgs_out(num_poses);
+  std::vector<tf::Transform> tf_a(num_poses), tf_b(num_poses), tf_out(num_poses);
+  PoseBatch batch_a(num_poses), batch_b(num_poses), batch_out;
+  for (size_t i=0; i<num_poses; i++) {
+    msgs_a[i] = randomPose();
+    msgs_b[i] = randomPose();
+    tf::poseMsgToTF(msgs_a[i], tf_a[i]);
+    tf::poseMsgToTF(msgs_b[i], tf_b[i]);
+    batch_a.set(i, msgs_a[i]);
+    batch_b.set(i, msgs_b[i]);
+  }
+  tf::Transform fixed;
+  tf::poseMsgToTF(randomPose(), fixed);
+  tf::Vector3 offset(0.1, -0.05, 0.2);
+  tf::Transform offset_trans(tf::Quaternion(0, 0, 0, 1), offset);
+  size_t total = num_poses * repetitions;
+
+  printf("PoseBatch kernels compiled for %s, %zu poses x %d repetitions\n", PoseBatch::instructionSet(), 
+         num_poses, repetitions);
+  printf("%-28s %10s %10s %9s %10s\n", "operation", "tf ns", "batch ns", "speedup", "max diff");
+
+  ros::WallTime start;
+  double tf_time, batch_time, error;
+
+#define COMPARE(NAME, TF_LOOP, BATCH_OP, EXPECTED)                          \
+  start = ros::WallTime::now();                                             \
+  for (int r=0; r<repetitions; r++) {                                       \
+    for (size_t i=0; i<num_poses; i++) TF_LOOP;                             \
+  }                                                                         \
+  tf_time = (ros::WallTime::now() - start).toSec();                         \
+  start = ros::WallTime::now();                                             \
+  for (int r=0; r<repetitions; r++) BATCH_OP;                               \
+  batch_time = (ros::WallTime::now() - start).toSec();                      \
+  error = 0;                                                                \
+  for (size_t i=0; i<num_poses; i++) {                                      \
+    error = std::max(error, difference(batch_out.getTransform(i), EXPECTED)); \
+  }                                                                         \
+  report(NAME, tf_time, batch_time, total, error);
+
+  COMPARE("compose a[i] * b[i]", tf_out[i] = tf_a[i] * tf_b[i],
+          PoseBatch::compose(batch_a, batch_b, batch_out), tf_out[i]);
+  COMPARE("compose fixed * b[i]", tf_out[i] = fixed * tf_b[i],
+          PoseBatch::compose(fixed, batch_b, batch_out), tf_out[i]);
+  COMPARE("compose a[i] * fixed", tf_out[i] = tf_a[i] * fixed,
+          PoseBatch::compose(batch_a, fixed, batch_out), tf_out[i]);
+  COMPARE("invert", tf_out[i] = tf_a[i].inverse(),
+          PoseBatch::invert(batch_a, batch_out), tf_out[i]);
+  COMPARE("offset in fixed frame", tf_out[i] = offset_trans * tf_a[i],
+          PoseBatch::applyOffset(batch_a, offset, false, batch_out), tf_out[i]);
+  COMPARE("offset in local frame", tf_out[i] = tf_a[i] * offset_trans,
+          PoseBatch::applyOffset(batch_a, offset, true, batch_out), tf_out[i]);
+
+  //what the testers actually do: from messages, through a product, back to messages
+  COMPARE("msg -> fixed * b[i] -> msg",
+          {tf::Transform t; tf::poseMsgToTF(msgs_b[i], t); tf_out[i] = fixed * t; 
+            tf::poseTFToMsg(tf_out[i], msgs_out[i]);},
+          {for (size_t i=0; i<num_poses; i++) batch_b.set(i, msgs_b[i]);
+            PoseBatch::compose(fixed, batch_b, batch_out);
+            for (size_t i=0; i<num_poses; i++) batch_out.get(i, msgs_out[i]);},
+          tf_out[i]);
+
+#undef COMPARE
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <cstdlib>
+
+#include <ros/ros.h>
+
+#include <pluginlib/class_loader.h>
+
+#include "object_manipulator/tools/reachability_map.h"
+#include "object_manipulator/tools/reachability_map_builder.h"
+#include "object_manipulator/tools/tester_workspace.h"
+
+using namespace object_manipulator;
+
+//! Compares a reachability map against IK on random poses inside its box
+/*! Reports how many poses the map rejects, how many of those IK could actually have reached (false 
+  rejections), and how the cost of a map query compares to the cost of IK. Private parameters: 
+  map_file, num_samples, random_seed and kinematics_plugin.
+*/
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "reachability_map_benchmark");
+  ros::NodeHandle priv_nh("~");
+
+  std::string map_file, plugin_name;
+  int num_samples, random_seed;
+  priv_nh.param<std::string>("map_file", map_file, "right_arm.reach");
+  priv_nh.param<std::string>("kinematics_plugin", plugin_name, "pr2_arm_kinematics/PR2ArmKinematicsPlugin");
+  priv_nh.param<int>("num_samples", num_samples, 1000);
+  priv_nh.param<int>("random_seed", random_seed, 0);
+
+  ReachabilityMap map;
+  if (!map.load(map_file)) return 1;
+  std::string arm_name = map.getGroupName();
+
+  planning_environment::CollisionModels cm("robot_description");
+  pluginlib::ClassLoader<kinematics::KinematicsBase> kinematics_loader("kinematics_base",
+                                                                       "kinematics::KinematicsBase");
+  IKSolverMap ik_solver_map;
+  createIKSolvers(&cm, kinematics_loader, plugin_name, ik_solver_map);
+  if (ik_solver_map.find(arm_name) == ik_solver_map.end()) {
+    ROS_ERROR("No IK solver for arm %s", arm_name.c_str());
+    return 1;
+  }
+  if (ik_solver_map[arm_name]->getBaseName() != map.getBaseFrame()) {
+    ROS_ERROR("Map is in frame %s but the IK solver works in %s", map.getBaseFrame().c_str(),
+              ik_solver_map[arm_name]->getBaseName().c_str());
+    return 1;
+  }
+
+  std::vector<std::string> free_links = ReachabilityMapBuilder::armAndGripperLinks(&cm, arm_name);
+
+  srand(random_seed);
+  tf::Vector3 min = map.getMin(), max = map.getMax();
+  int reachable = 0, rejected = 0, false_rejections = 0;
+  double ik_time = 0, map_time = 0;
+  {
+    ReachabilityMapBuilder builder(&cm, ik_solver_map[arm_name], free_links);
+    for (int i=0; i<num_samples && ros::ok(); i++) {
+      geometry_msgs::Pose pose;
+      pose.position.x = min.x() + (max.x() - min.x()) * rand() / (double)RAND_MAX;
+      pose.position.y = min.y() + (max.y() - min.y()) * rand() / (double)RAND_MAX;
+      pose.position.z = min.z() + (max.z() - min.z()) * rand() / (double)RAND_MAX;
+      //uniformly distributed rotation
+      double u1 = rand() / (double)RAND_MAX, u2 = 2*M_PI*rand() / (double)RAND_MAX;
+      double u3 = 2*M_PI*rand() / (double)RAND_MAX;
+      pose.orientation.x = sqrt(1-u1) * sin(u2);
+      pose.orientation.y = sqrt(1-u1) * cos(u2);
+      pose.orientation.z = sqrt(u1) * sin(u3);
+      pose.orientation.w = sqrt(u1) * cos(u3);
+
+      ros::WallTime start = ros::WallTime::now();
+      bool map_says = map.isReachable(pose);
+      map_time += (ros::WallTime::now() - start).toSec();
+
+      start = ros::WallTime::now();
+      bool ik_says = builder.checkIK(pose);
+      ik_time += (ros::WallTime::now() - start).toSec();
+
+      if (ik_says) reachable++;
+      if (!map_says) {
+        rejected++;
+        if (ik_says) false_rejections++;
+      }
+    }
+  }
+
+  for (IKSolverMap::iterator it = ik_solver_map.begin(); it != ik_solver_map.end(); it++) {
+    delete it->second;
+  }
+
+  int unreachable = num_samples - reachable;
+  ROS_INFO("Samples: %d, reachable by IK: %d", num_samples, reachable);
+  ROS_INFO("Rejected by map: %d (%.1f%% of samples, %.1f%% of unreachable samples)", rejected,
+           100.0 * rejected / std::max(num_samples, 1), 100.0 * (rejected - false_rejections) / std::max(unreachable, 1));
+  ROS_INFO("False rejections: %d (%.1f%% of reachable samples)", false_rejections, 
+           100.0 * false_rejections / std::max(reachable, 1));
+  ROS_INFO("Mean map query %.2f us, mean IK query %.2f ms", 1.0e6 * map_time / std::max(num_samples, 1),
+           1.0e3 * ik_time / std::max(num_samples, 1));
+  return 0;
+}
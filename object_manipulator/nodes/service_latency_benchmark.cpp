@@ -0,0 +1,151 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include "object_manipulator/tools/mechanism_interface.h"
+#include "object_manipulator/tools/hand_description.h"
+
+using namespace object_manipulator;
+
+namespace {
+
+//! Collects the durations of a series of calls
+class LatencySamples
+{
+ private:
+  std::vector<double> samples_;
+  ros::WallTime start_;
+
+ public:
+  void start() {start_ = ros::WallTime::now();}
+
+  void stop() {samples_.push_back((ros::WallTime::now() - start_).toSec());}
+
+  void report(const std::string &name, bool persistent)
+  {
+    if (samples_.empty()) return;
+    std::vector<double> sorted = samples_;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (size_t i=0; i<sorted.size(); i++) total += sorted[i];
+    ROS_INFO("%-14s %-10s mean %7.2f ms, median %7.2f ms, max %7.2f ms (%zu calls)", name.c_str(), 
+             persistent ? "persistent" : "transient", 1.0e3 * total / sorted.size(), 
+             1.0e3 * sorted[sorted.size() / 2], 1.0e3 * sorted.back(), sorted.size());
+  }
+};
+
+//! Times getRobotState, getFK and getIKForPose on the current arm configuration
+void runCalls(const std::string &arm_name, int num_calls, bool persistent)
+{
+  mechInterface().setPersistentServices(persistent);
+  LatencySamples robot_state_samples, fk_samples, ik_samples;
+
+  arm_navigation_msgs::RobotState robot_state;
+  mechInterface().getRobotState(robot_state);
+  std::vector<std::string> joint_names = mechInterface().getJointNames(arm_name);
+  std::vector<double> positions(joint_names.size(), 0.0);
+  for (size_t i=0; i<joint_names.size(); i++) {
+    for (size_t j=0; j<robot_state.joint_state.name.size(); j++) {
+      if (robot_state.joint_state.name[j] == joint_names[i]) positions[i] = robot_state.joint_state.position[j];
+    }
+  }
+  geometry_msgs::PoseStamped pose;
+  pose.header.frame_id = handDescription().robotFrame(arm_name);
+  pose.header.stamp = ros::Time(0);
+  if (!mechInterface().getFK(arm_name, positions, pose)) {
+    ROS_ERROR("FK failed for the current configuration of %s", arm_name.c_str());
+    return;
+  }
+  arm_navigation_msgs::OrderedCollisionOperations collision_operations;
+  std::vector<arm_navigation_msgs::LinkPadding> link_padding;
+
+  for (int i=0; i<num_calls && ros::ok(); i++) {
+    robot_state_samples.start();
+    mechInterface().getRobotState(robot_state);
+    robot_state_samples.stop();
+
+    geometry_msgs::PoseStamped fk_pose;
+    fk_pose.header = pose.header;
+    fk_samples.start();
+    mechInterface().getFK(arm_name, positions, fk_pose);
+    fk_samples.stop();
+
+    kinematics_msgs::GetConstraintAwarePositionIK::Response ik_response;
+    ik_samples.start();
+    mechInterface().getIKForPose(arm_name, pose, ik_response, collision_operations, link_padding);
+    ik_samples.stop();
+  }
+
+  robot_state_samples.report("getRobotState", persistent);
+  fk_samples.report("getFK", persistent);
+  ik_samples.report("getIKForPose", persistent);
+}
+
+} //namespace
+
+//! Compares the per-call latency of frequently called services over persistent and transient connections
+/*! Calls getRobotState, getFK and getIKForPose (for the current arm configuration) num_calls times 
+  each, first with transient, then with persistent service connections. Note that getFK and 
+  getIKForPose also ask for the arm's joint names each time, and getIKForPose sets the planning 
+  scene, all of which go over the same kind of connection. Private parameters: arm_name and 
+  num_calls.
+*/
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "service_latency_benchmark");
+  ros::NodeHandle priv_nh("~");
+
+  std::string arm_name;
+  int num_calls;
+  priv_nh.param<std::string>("arm_name", arm_name, "right_arm");
+  priv_nh.param<int>("num_calls", num_calls, 100);
+
+  try {
+    //make sure all servers are up, so that waiting for them is not counted
+    std::vector<std::string> missing;
+    if (!mechInterface().warmUp(std::vector<std::string>(1, arm_name), ros::Duration(30.0), missing)) {
+      for (size_t i=0; i<missing.size(); i++) ROS_ERROR("Missing: %s", missing[i].c_str());
+      return 1;
+    }
+    runCalls(arm_name, num_calls, false);
+    runCalls(arm_name, num_calls, true);
+  } catch (GraspException &ex) {
+    ROS_ERROR("Benchmark failed: %s", ex.what());
+    return 1;
+  }
+  return 0;
+}
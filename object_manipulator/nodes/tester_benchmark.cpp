@@ -0,0 +1,330 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include <arm_navigation_msgs/PlanningScene.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <object_manipulation_msgs/PickupActionGoal.h>
+#include <object_manipulation_msgs/PlaceActionGoal.h>
+#include <object_manipulation_msgs/GraspPlanningActionResult.h>
+
+#include "object_manipulator/grasp_execution/grasp_tester_fast.h"
+#include "object_manipulator/place_execution/place_tester_fast.h"
+#include "object_manipulator/tools/ik_tester_fast.h"
+#include "object_manipulator/tools/tester_stats.h"
+
+using namespace object_manipulator;
+
+static void usage()
+{
+  printf("Usage: tester_benchmark [options] bag_file...\n"
+         "Replays recorded planning scenes and pickup / place goals through the fast testers and\n"
+         "reports where the time goes. Messages are used in the order they were recorded: each goal\n"
+         "is tested against the last planning scene before it. Pickup goals without desired grasps\n"
+         "use the grasps from the last grasp planning result before them. Goals may be recorded\n"
+         "either as plain goals or as action goals.\n"
+         "Options:\n"
+         "  --repeat N        test every goal N times (default 1)\n"
+         "  --first-hit       stop at the first feasible grasp or place location, as when executing\n"
+         "  --plugin NAME     kinematics plugin (default pr2_arm_kinematics/PR2ArmKinematicsPlugin)\n"
+         "  --ik-topic NAME   topic with PoseStamped messages to test IK on (default ik_poses)\n"
+         "  --ik-arm NAME     arm to test IK poses with (default right_arm)\n"
+         "  --compare-seeding also test every goal with IK seeded from neighbouring candidates, and\n"
+         "                    report the IK time saved\n");
+}
+
+static void printReport(const std::string &name, const TesterStats &stats)
+{
+  printf("\n%s: %zu calls, %zu candidates in %.3f s", name.c_str(), stats.calls_, stats.candidates_, 
+         stats.wall_time_);
+  if (stats.wall_time_ > 0) printf(", %.1f candidates/s", stats.candidates_ / stats.wall_time_);
+  printf("\n");
+  if (stats.calls_ == 0) return;
+  printf("  per call: p50 < %.3f ms, p90 < %.3f ms, p99 < %.3f ms; %.2f collision checks per candidate\n",
+         1.0e3 * TesterStats::percentile(stats.call_histogram_, 0.5),
+         1.0e3 * TesterStats::percentile(stats.call_histogram_, 0.9),
+         1.0e3 * TesterStats::percentile(stats.call_histogram_, 0.99), stats.collisionChecksPerCandidate());
+
+  printf("  %-16s %10s %12s %12s %12s %12s\n", "stage", "runs", "total (s)", "mean (ms)", "p50 (ms)", "p99 (ms)");
+  for (int s=0; s<TesterStats::NUM_STAGES; s++) {
+    if (stats.stage_count_[s] == 0) continue;
+    printf("  %-16s %10zu %12.3f %12.3f %12.3f %12.3f\n", TesterStats::stageName(s), stats.stage_count_[s], 
+           stats.stage_time_[s], 1.0e3 * stats.stage_time_[s] / stats.stage_count_[s],
+           1.0e3 * TesterStats::percentile(stats.stage_histogram_[s], 0.5),
+           1.0e3 * TesterStats::percentile(stats.stage_histogram_[s], 0.99));
+  }
+  for (int c=0; c<TesterStats::NUM_COUNTERS; c++) {
+    if (stats.counters_[c] != 0) printf("  %s: %zu\n", TesterStats::counterName(c), stats.counters_[c]);
+  }
+
+  size_t max_count = 0;
+  for (std::map<int, size_t>::const_iterator it = stats.outcomes_.begin(); it != stats.outcomes_.end(); it++) {
+    max_count = std::max(max_count, it->second);
+  }
+  printf("  %-8s %10s\n", "outcome", "count");
+  for (std::map<int, size_t>::const_iterator it = stats.outcomes_.begin(); it != stats.outcomes_.end(); it++) {
+    printf("  %-8d %10zu ", it->first, it->second);
+    size_t bar = (50 * it->second + max_count - 1) / max_count;
+    for (size_t b=0; b<bar; b++) printf("#");
+    printf("\n");
+  }
+}
+
+//! Prints how IK fared with seeds from neighbouring candidates, compared to planning scene seeds
+/*! The kinematics plugins do not report their iteration counts, but their search time is 
+  proportional to them, so IK time is what gets compared. */
+static void printSeedingReport(const std::string &name, const TesterStats &plain, const TesterStats &seeded)
+{
+  printf("\n%s IK seeding: %zu of %zu IK runs seeded from neighbours\n", name.c_str(),
+         seeded.counters_[TesterStats::IK_SEEDED], seeded.stage_count_[TesterStats::IK]);
+  if (plain.stage_count_[TesterStats::IK] == 0 || seeded.stage_count_[TesterStats::IK] == 0) return;
+  double plain_mean = plain.stage_time_[TesterStats::IK] / plain.stage_count_[TesterStats::IK];
+  double seeded_mean = seeded.stage_time_[TesterStats::IK] / seeded.stage_count_[TesterStats::IK];
+  printf("  mean IK time %.3f ms -> %.3f ms (%.1f%% saved); total %.3f s -> %.3f s\n", 
+         1.0e3 * plain_mean, 1.0e3 * seeded_mean, 100.0 * (1.0 - seeded_mean / plain_mean),
+         plain.stage_time_[TesterStats::IK], seeded.stage_time_[TesterStats::IK]);
+  //SUCCESS is 1 for grasp results, place location results and arm navigation error codes alike
+  size_t plain_success = 0, seeded_success = 0;
+  std::map<int, size_t>::const_iterator it = plain.outcomes_.find(1);
+  if (it != plain.outcomes_.end()) plain_success = it->second;
+  it = seeded.outcomes_.find(1);
+  if (it != seeded.outcomes_.end()) seeded_success = it->second;
+  printf("  successful candidates: %zu -> %zu\n", plain_success, seeded_success);
+}
+
+//! Collision models for a single tester, holding the planning scene being replayed
+/*! Every tester gets its own, so that none of them benefits from state left behind in the collision 
+  models by the testers that ran before it. */
+class TesterModels
+{
+ public:
+  planning_environment::CollisionModels cm_;
+  planning_models::KinematicState *state_;
+
+  TesterModels() : cm_("robot_description"), state_(NULL) {}
+
+  ~TesterModels()
+  {
+    if (state_) cm_.revertPlanningScene(state_);
+  }
+
+  //! Installs a new planning scene in place of the previous one; returns false on failure
+  bool setPlanningScene(const arm_navigation_msgs::PlanningScene &scene)
+  {
+    if (state_) cm_.revertPlanningScene(state_);
+    state_ = cm_.setPlanningScene(scene);
+    return state_ != NULL;
+  }
+};
+
+//! Replays recorded goals through GraspTesterFast, PlaceTesterFast and IKTesterFast
+/*! Works entirely off line: each tester uses collision models of its own, with the planning scenes 
+  from the bags, and no services or other nodes are contacted. The robot and hand descriptions and 
+  the kinematics parameters are still read from the parameter server, as the kinematics plugins 
+  load them from there; a roscore with the robot's parameters loaded is all that is needed.
+*/
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "tester_benchmark", ros::init_options::AnonymousName);
+
+  int repeat = 1;
+  bool first_hit = false;
+  bool compare_seeding = false;
+  std::string plugin_name = "pr2_arm_kinematics/PR2ArmKinematicsPlugin";
+  std::string ik_topic = "ik_poses", ik_arm = "right_arm";
+  std::vector<std::string> bag_files;
+  for (int i=1; i<argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--repeat" && i+1 < argc) repeat = std::max(1, atoi(argv[++i]));
+    else if (arg == "--first-hit") first_hit = true;
+    else if (arg == "--plugin" && i+1 < argc) plugin_name = argv[++i];
+    else if (arg == "--ik-topic" && i+1 < argc) ik_topic = argv[++i];
+    else if (arg == "--ik-arm" && i+1 < argc) ik_arm = argv[++i];
+    else if (arg == "--compare-seeding") compare_seeding = true;
+    else if (arg.size() > 1 && arg[0] == '-') {
+      usage();
+      return 1;
+    }
+    else bag_files.push_back(arg);
+  }
+  if (bag_files.empty()) {
+    usage();
+    return 1;
+  }
+
+  //the models outlive the testers using them
+  TesterModels grasp_models, place_models, ik_models;
+  GraspTesterFast grasp_tester(&grasp_models.cm_, plugin_name);
+  PlaceTesterFast place_tester(&place_models.cm_, plugin_name);
+  IKTesterFast ik_tester(&ik_models.cm_, plugin_name);
+
+  //the same testers again, with IK seeded from neighbouring candidates
+  boost::scoped_ptr<TesterModels> seeded_grasp_models, seeded_place_models, seeded_ik_models;
+  boost::scoped_ptr<GraspTesterFast> seeded_grasp_tester;
+  boost::scoped_ptr<PlaceTesterFast> seeded_place_tester;
+  boost::scoped_ptr<IKTesterFast> seeded_ik_tester;
+  if (compare_seeding) {
+    seeded_grasp_models.reset(new TesterModels);
+    seeded_place_models.reset(new TesterModels);
+    seeded_ik_models.reset(new TesterModels);
+    seeded_grasp_tester.reset(new GraspTesterFast(&seeded_grasp_models->cm_, plugin_name));
+    seeded_place_tester.reset(new PlaceTesterFast(&seeded_place_models->cm_, plugin_name));
+    seeded_ik_tester.reset(new IKTesterFast(&seeded_ik_models->cm_, plugin_name));
+    seeded_grasp_tester->setSeedPropagation(true);
+    seeded_place_tester->setSeedPropagation(true);
+    seeded_ik_tester->setSeedPropagation(true);
+  }
+
+  bool have_scene = false;
+  std::vector<object_manipulation_msgs::Grasp> planned_grasps;
+  size_t num_scenes = 0;
+
+  for (size_t b=0; b<bag_files.size(); b++) {
+    rosbag::Bag bag;
+    try {
+      bag.open(bag_files[b], rosbag::bagmode::Read);
+    } catch (rosbag::BagException &ex) {
+      fprintf(stderr, "Could not open %s: %s\n", bag_files[b].c_str(), ex.what());
+      return 1;
+    }
+    rosbag::View view(bag);
+    BOOST_FOREACH(const rosbag::MessageInstance &m, view)
+    {
+      arm_navigation_msgs::PlanningScene::ConstPtr scene = m.instantiate<arm_navigation_msgs::PlanningScene>();
+      if (scene) {
+        bool ok = grasp_models.setPlanningScene(*scene) && place_models.setPlanningScene(*scene) &&
+          ik_models.setPlanningScene(*scene);
+        if (ok && compare_seeding) {
+          ok = seeded_grasp_models->setPlanningScene(*scene) && seeded_place_models->setPlanningScene(*scene) &&
+            seeded_ik_models->setPlanningScene(*scene);
+        }
+        if (!ok) {
+          fprintf(stderr, "Could not set planning scene %zu\n", num_scenes);
+          return 1;
+        }
+        grasp_tester.setPlanningSceneState(grasp_models.state_);
+        place_tester.setPlanningSceneState(place_models.state_);
+        ik_tester.setPlanningSceneState(ik_models.state_);
+        if (compare_seeding) {
+          seeded_grasp_tester->setPlanningSceneState(seeded_grasp_models->state_);
+          seeded_place_tester->setPlanningSceneState(seeded_place_models->state_);
+          seeded_ik_tester->setPlanningSceneState(seeded_ik_models->state_);
+        }
+        have_scene = true;
+        num_scenes++;
+        continue;
+      }
+
+      object_manipulation_msgs::GraspPlanningResult::ConstPtr planning_result = 
+        m.instantiate<object_manipulation_msgs::GraspPlanningResult>();
+      object_manipulation_msgs::GraspPlanningActionResult::ConstPtr planning_action_result = 
+        m.instantiate<object_manipulation_msgs::GraspPlanningActionResult>();
+      if (planning_action_result) planning_result.reset(new object_manipulation_msgs::GraspPlanningResult(planning_action_result->result));
+      if (planning_result) {
+        planned_grasps = planning_result->grasps;
+        continue;
+      }
+
+      object_manipulation_msgs::PickupGoal::ConstPtr pickup_goal = m.instantiate<object_manipulation_msgs::PickupGoal>();
+      object_manipulation_msgs::PickupActionGoal::ConstPtr pickup_action_goal = 
+        m.instantiate<object_manipulation_msgs::PickupActionGoal>();
+      if (pickup_action_goal) pickup_goal.reset(new object_manipulation_msgs::PickupGoal(pickup_action_goal->goal));
+
+      object_manipulation_msgs::PlaceGoal::ConstPtr place_goal = m.instantiate<object_manipulation_msgs::PlaceGoal>();
+      object_manipulation_msgs::PlaceActionGoal::ConstPtr place_action_goal = 
+        m.instantiate<object_manipulation_msgs::PlaceActionGoal>();
+      if (place_action_goal) place_goal.reset(new object_manipulation_msgs::PlaceGoal(place_action_goal->goal));
+
+      geometry_msgs::PoseStamped::ConstPtr ik_pose;
+      if (m.getTopic() == ik_topic || m.getTopic() == "/" + ik_topic) {
+        ik_pose = m.instantiate<geometry_msgs::PoseStamped>();
+      }
+
+      if (!pickup_goal && !place_goal && !ik_pose) continue;
+      if (!have_scene) {
+        fprintf(stderr, "Skipping a goal recorded before any planning scene\n");
+        continue;
+      }
+
+      for (int r=0; r<repeat; r++) {
+        try {
+          if (pickup_goal) {
+            std::vector<GraspExecutionInfo> execution_info;
+            const std::vector<object_manipulation_msgs::Grasp> &grasps = 
+              pickup_goal->desired_grasps.empty() ? planned_grasps : pickup_goal->desired_grasps;
+            grasp_tester.testGrasps(*pickup_goal, grasps, execution_info, first_hit);
+            if (compare_seeding) seeded_grasp_tester->testGrasps(*pickup_goal, grasps, execution_info, first_hit);
+          }
+          if (place_goal) {
+            std::vector<PlaceExecutionInfo> execution_info;
+            place_tester.testPlaces(*place_goal, place_goal->place_locations, execution_info, first_hit);
+            if (compare_seeding) {
+              seeded_place_tester->testPlaces(*place_goal, place_goal->place_locations, execution_info, first_hit);
+            }
+          }
+          if (ik_pose) {
+            std::vector<geometry_msgs::PoseStamped> poses(1, *ik_pose);
+            std::vector<sensor_msgs::JointState> solutions;
+            std::vector<arm_navigation_msgs::ArmNavigationErrorCodes> error_codes;
+            ik_tester.testIKSet(ik_arm, poses, first_hit, solutions, error_codes);
+            if (compare_seeding) seeded_ik_tester->testIKSet(ik_arm, poses, first_hit, solutions, error_codes);
+          }
+        } catch (GraspException &ex) {
+          fprintf(stderr, "Test failed: %s\n", ex.what());
+        }
+      }
+    }
+  }
+
+  printf("Replayed %zu planning scenes from %zu bags\n", num_scenes, bag_files.size());
+  printReport("GraspTesterFast", grasp_tester.getStats());
+  printReport("PlaceTesterFast", place_tester.getStats());
+  printReport("IKTesterFast", ik_tester.getStats());
+  if (compare_seeding) {
+    printSeedingReport("GraspTesterFast", grasp_tester.getStats(), seeded_grasp_tester->getStats());
+    printSeedingReport("PlaceTesterFast", place_tester.getStats(), seeded_place_tester->getStats());
+    printSeedingReport("IKTesterFast", ik_tester.getStats(), seeded_ik_tester->getStats());
+  }
+  return 0;
+}
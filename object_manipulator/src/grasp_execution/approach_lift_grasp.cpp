@@ -78,19 +78,49 @@ void GraspPerformer::performGrasps(const object_manipulation_msgs::PickupGoal &g
                                    const std::vector<object_manipulation_msgs::Grasp> &grasps,
                                    std::vector<GraspExecutionInfo> &execution_info)
 {
+  bool attempted = false;
   for (size_t i=0; i<grasps.size(); i++)
   {
     if (feedback_function_) feedback_function_(i);
     if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
     if (i>= execution_info.size()) throw GraspException("Grasp Performer: not enough execution info provided");
     if (execution_info[i].result_.result_code != GraspResult::SUCCESS) continue;
+    //the trajectories were computed before the last attempt, which may have moved things around
+    if (attempted && !revalidateGrasp(goal, grasps[i], execution_info[i]))
+    {
+      ROS_DEBUG_NAMED("manipulation","Grasp performer: grasp %zd no longer valid after previous attempt", i);
+      if (marker_publisher_) marker_publisher_->colorGraspMarker(execution_info[i].marker_id_, 1.0, 0.0, 0.0); //red
+      execution_info[i].result_ = Result(GraspResult::PREGRASP_IN_COLLISION, true);
+      continue;
+    }
     ROS_DEBUG_NAMED("manipulation","Grasp performer: trying grasp %zd out of batch of %zd", i, grasps.size());
+    retry_possible_ = false;
     performGrasp(goal, grasps[i], execution_info[i]);
+    attempted = true;
     if (execution_info[i].result_.result_code == execution_info[i].result_.SUCCESS || 
-        !execution_info[i].result_.continuation_possible) return;
+        (!execution_info[i].result_.continuation_possible && !retry_possible_)) 
+    {
+      execution_info.resize(i+1);
+      return;
+    }
+    if (!execution_info[i].result_.continuation_possible)
+    {
+      ROS_DEBUG_NAMED("manipulation","Grasp performer: grasp %zd failed, retrying with the next one", i);
+    }
   }
 }
 
+bool GraspPerformer::revalidateGrasp(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                                     const object_manipulation_msgs::Grasp &grasp,
+                                     const GraspExecutionInfo &execution_info)
+{
+  if (execution_info.approach_trajectory_.points.empty()) return true;
+  return mechInterface().checkStateValidity(pickup_goal.arm_name, 
+                                            execution_info.approach_trajectory_.points.front().positions,
+                                            pickup_goal.additional_collision_operations,
+                                            pickup_goal.additional_link_padding);
+}
+
 // ------------------------------ Grasp Testers ----------------------------------
 
 /*! Disables collision between gripper and target
@@ -405,8 +435,10 @@ void StandardGraspPerformer::performGrasp(const object_manipulation_msgs::Pickup
                     "releasing object and retreating");
     mechInterface().handPostureGraspAction(pickup_goal.arm_name, grasp,
                                 object_manipulation_msgs::GraspHandPostureExecutionGoal::RELEASE, -1);    
-    retreat(pickup_goal, grasp, execution_info);
+    GraspResult retreat_result = retreat(pickup_goal, grasp, execution_info);
     execution_info.result_ = Result(GraspResult::GRASP_FAILED, false);
+    //the object may have been pushed, but another grasp can be tried from where the arm is
+    retry_possible_ = (retreat_result.result_code == GraspResult::SUCCESS);
     return;
   }
   
@@ -33,13 +33,19 @@
 
 // Author(s): E. Gil Jones
 
+#include <set>
 #include <sstream>
 
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "object_manipulator/grasp_execution/grasp_tester_fast.h"
 
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/vector_tools.h"
 #include "object_manipulator/tools/mechanism_interface.h"
+#include "object_manipulator/tools/exceptions.h"
+#include "object_manipulator/tools/message_hash.h"
 
 //#include <demo_synchronizer/synchronizer_client.h>
 
@@ -48,27 +54,32 @@ using arm_navigation_msgs::ArmNavigationErrorCodes;
 
 namespace object_manipulator {
 
-    void  print_contacts(planning_environment::CollisionModels* cm, planning_models::KinematicState* state) {
-        std::vector<arm_navigation_msgs::ContactInformation> contacts;
-        cm->getAllCollisionsForState(*state, contacts,1);
+    //! Counts each contact under its pair of bodies, in alphabetical order
+    void add_contacts(const std::vector<arm_navigation_msgs::ContactInformation> &contacts,
+                      GraspTesterFast::ContactSummary &summary) {
         if(contacts.size() == 0) {
             ROS_WARN_STREAM("Collision reported but no contacts");
         }
-        std::vector<std::string> names;
         for(unsigned int j = 0; j < contacts.size(); j++) {
-            names.push_back(contacts[j].contact_body_1);
-
-            ROS_DEBUG_STREAM_NAMED("manipulation", "Collision between " << contacts[j].contact_body_1
-                             << " and " << contacts[j].contact_body_2);
+            const std::string &body_1 = contacts[j].contact_body_1;
+            const std::string &body_2 = contacts[j].contact_body_2;
+            if(body_1 < body_2) summary[std::make_pair(body_1, body_2)]++;
+            else summary[std::make_pair(body_2, body_1)]++;
         }
     }
 
+    //! Appends an arrow for each grasp, colored by its result, followed by the robot markers of the grasps
+    /*! Robot markers of later grasps replace those of earlier ones with the same namespace and id, 
+      so only the last of each is kept. */
     void visualize_grasps(const object_manipulation_msgs::PickupGoal &pickup_goal,
                           const std::vector<object_manipulation_msgs::Grasp> &grasps,
                           const std::vector<GraspExecutionInfo> &execution_info,
-                          ros::Publisher &vis_marker_publisher) {
+                          const std::vector<visualization_msgs::MarkerArray> &robot_markers,
+                          const std::string &ns_prefix,
+                          visualization_msgs::MarkerArray &markers) {
+        ros::Time now = ros::Time::now();
         /* display markers for all of the grasps */
-        for(unsigned int i = 0; i < grasps.size(); i++)
+        for(unsigned int i = 0; i < grasps.size() && i < execution_info.size(); i++)
         {
             float r, g, b;
             switch(execution_info[i].result_.result_code)
@@ -111,9 +122,9 @@ namespace object_manipulator {
 
             marker.pose = grasps[i].grasp_pose;
             marker.header.frame_id = pickup_goal.target.reference_frame_id;
-            marker.header.stamp = ros::Time::now();
+            marker.header.stamp = now;
             std::ostringstream marker_ns;
-            marker_ns << "grasp " << i << " (" << execution_info[i].result_.result_code << ")";
+            marker_ns << ns_prefix << "grasp " << i << " (" << execution_info[i].result_.result_code << ")";
             marker.ns = marker_ns.str();
 
             marker.action = visualization_msgs::Marker::ADD;
@@ -130,8 +141,18 @@ namespace object_manipulator {
 
             marker.id = 0;
 
-            ROS_DEBUG("Displaying marker %d with ns %s", i, marker.ns.c_str());
-            vis_marker_publisher.publish(marker);
+            markers.markers.push_back(marker);
+        }
+
+        std::set<std::pair<std::string, int> > shown;
+        for(size_t i = robot_markers.size(); i > 0; i--) {
+            const std::vector<visualization_msgs::Marker> &arr = robot_markers[i-1].markers;
+            for(size_t j = 0; j < arr.size(); j++) {
+                if(shown.insert(std::make_pair(arr[j].ns, arr[j].id)).second) {
+                    markers.markers.push_back(arr[j]);
+                    markers.markers.back().ns = ns_prefix + arr[j].ns;
+                }
+            }
         }
     }
 
@@ -141,43 +162,26 @@ namespace object_manipulator {
                                          consistent_angle_(M_PI/12.0),
                                          num_points_(10),
                                          redundancy_(2),
+                                         num_threads_(1),
+                                         first_hit_window_(1),
+                                         seed_propagation_(false),
+                                         seed_distance_(0.05),
+                                         diagnose_(false),
+                                         worker_pool_(kinematics_loader_, plugin_name),
+                                         collision_matrices_revision_(0),
+                                         marker_publisher_("grasp_executor_fast_array"),
                                          cm_(cm),
                                          state_(NULL),
                                          kinematics_loader_("kinematics_base","kinematics::KinematicsBase")
     {
-        ros::NodeHandle nh;
-
-        vis_marker_publisher_ = nh.advertise<visualization_msgs::Marker> ("grasp_executor_fast", 128);
-        vis_marker_array_publisher_ = nh.advertise<visualization_msgs::MarkerArray> ("grasp_executor_fast_array", 128);
-
-        const std::map<std::string, planning_models::KinematicModel::GroupConfig>& group_config_map =
-                getCollisionModels()->getKinematicModel()->getJointModelGroupConfigMap();
-
-        for(std::map<std::string, planning_models::KinematicModel::GroupConfig>::const_iterator it = group_config_map.begin();
-        it != group_config_map.end();
-        it++) {
-            kinematics::KinematicsBase* kinematics_solver = NULL;
-            try
-            {
-                kinematics_solver = kinematics_loader_.createClassInstance(plugin_name);
-            }
-            catch(pluginlib::PluginlibException& ex)
-            {
-                ROS_ERROR("The plugin failed to load. Error1: %s", ex.what());    //handle the class failing to load
-                return;
-            }
-            if(!it->second.base_link_.empty() && !it->second.tip_link_.empty()) {
-                ik_solver_map_[it->first] = new arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware(kinematics_solver,
-                                                                                                                    getCollisionModels(),
-                                                                                                                    it->first);
-                ik_solver_map_[it->first]->setSearchDiscretization(.025);
-            }
-        }
+        createIKSolvers(getCollisionModels(), kinematics_loader_, plugin_name, ik_solver_map_);
     }
 
     GraspTesterFast::~GraspTesterFast()
     {
-        for(std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*>::iterator it = ik_solver_map_.begin();
+        //the kinematics loader is destroyed before the pool, and takes the plugin libraries with it
+        worker_pool_.clear();
+        for(IKSolverMap::iterator it = ik_solver_map_.begin();
         it != ik_solver_map_.end();
         it++) {
             delete it->second;
@@ -238,41 +242,38 @@ namespace object_manipulator {
         group_joints = ik_solver_map_[group_name]->getJointNames();
     }
 
-    bool GraspTesterFast::getInterpolatedIK(const std::string& arm_name,
+    bool GraspTesterFast::getInterpolatedIK(const GraspTestBatch &batch,
+                                            TesterWorkspace &workspace,
+                                            const std::string& arm_name,
                                             const tf::Transform& first_pose,
                                             const tf::Vector3& direction,
                                             const double& distance,
                                             const std::vector<double>& ik_solution,
                                             const bool& reverse,
                                             const bool& premultiply,
-                                            trajectory_msgs::JointTrajectory& traj) {
+                                            trajectory_msgs::JointTrajectory& traj,
+                                            arm_navigation_msgs::ArmNavigationErrorCodes& error_code) {
 
-        std::map<std::string, double> ik_solution_map;
-        for(unsigned int i = 0; i < traj.joint_names.size(); i++) {
-            ik_solution_map[traj.joint_names[i]] = ik_solution[i];
-        }
-
-        getPlanningSceneState()->setKinematicState(ik_solution_map);
+        batch.posture_plan_.applyJoints(batch.arm_joints_, ik_solution, *workspace.state_, workspace.state_values_);
 
         geometry_msgs::Pose start_pose;
         tf::poseTFToMsg(first_pose, start_pose);
 
         arm_navigation_msgs::Constraints emp;
-        arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-        return ik_solver_map_[arm_name]->interpolateIKDirectional(start_pose,
-                                                                  direction,
-                                                                  distance,
-                                                                  emp,
-                                                                  getPlanningSceneState(),
-                                                                  error_code,
-                                                                  traj,
-                                                                  redundancy_,
-                                                                  consistent_angle_,
-                                                                  reverse,
-                                                                  premultiply,
-                                                                  num_points_,
-                                                                  ros::Duration(2.5),
-                                                                  false);
+        return workspace.ik_solver_map_[arm_name]->interpolateIKDirectional(start_pose,
+                                                                            direction,
+                                                                            distance,
+                                                                            emp,
+                                                                            workspace.state_,
+                                                                            error_code,
+                                                                            traj,
+                                                                            redundancy_,
+                                                                            consistent_angle_,
+                                                                            reverse,
+                                                                            premultiply,
+                                                                            num_points_,
+                                                                            ros::Duration(2.5),
+                                                                            false);
     }
 
     /* this doesn't get called since testGrasps() does everything, but we still need to have
@@ -281,615 +282,987 @@ namespace object_manipulator {
                                     const object_manipulation_msgs::Grasp &grasp,
                                     GraspExecutionInfo &execution_info)  {}
 
-    void GraspTesterFast::testGrasps(const object_manipulation_msgs::PickupGoal &pickup_goal,
-                                     const std::vector<object_manipulation_msgs::Grasp> &grasps,
-                                     std::vector<GraspExecutionInfo> &execution_info,
-                                     bool return_on_first_hit)
+    bool GraspTesterFast::CollisionMatricesKey::operator<(const CollisionMatricesKey &other) const
+    {
+        if(arm_name_ != other.arm_name_) return arm_name_ < other.arm_name_;
+        if(collision_object_name_ != other.collision_object_name_) return collision_object_name_ < other.collision_object_name_;
+        if(collision_support_surface_name_ != other.collision_support_surface_name_) {
+            return collision_support_surface_name_ < other.collision_support_surface_name_;
+        }
+        return allow_gripper_support_collision_ < other.allow_gripper_support_collision_;
+    }
 
+    boost::shared_ptr<const GraspTesterFast::CollisionMatrices>
+    GraspTesterFast::computeCollisionMatrices(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                                              planning_environment::CollisionModels* cm,
+                                              const std::vector<std::string> &end_effector_links)
     {
-        ros::WallTime start = ros::WallTime::now();
-        std::map<unsigned int, unsigned int> outcome_count;
-        planning_environment::CollisionModels* cm = getCollisionModels();
-        planning_models::KinematicState* state = getPlanningSceneState();
-        std::map<std::string, double> planning_scene_state_values;
-        state->getKinematicStateValues(planning_scene_state_values);
+        boost::shared_ptr<CollisionMatrices> acms(new CollisionMatrices);
 
-        std::vector<std::string> end_effector_links, arm_links;
-        end_effector_links = handDescription().gripperTouchLinkNames(pickup_goal.arm_name);
-        //getGroupLinks(handDescription().gripperCollisionName(pickup_goal.arm_name), end_effector_links);
+        std::vector<std::string> arm_links;
         getGroupLinks(handDescription().armGroup(pickup_goal.arm_name), arm_links);
 
-        collision_space::EnvironmentModel::AllowedCollisionMatrix original_acm = cm->getCurrentAllowedCollisionMatrix();
         cm->disableCollisionsForNonUpdatedLinks(pickup_goal.arm_name); /* disable collisions for all links not in the arm we are using */
-        collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm = cm->getCurrentAllowedCollisionMatrix();
-        collision_space::EnvironmentModel::AllowedCollisionMatrix object_disable_acm = group_disable_acm;
-        object_disable_acm.changeEntry(pickup_goal.collision_object_name, end_effector_links, true);
-        collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_disable_acm = object_disable_acm;
+        acms->group_disable_acm_ = cm->getCurrentAllowedCollisionMatrix();
+        acms->object_support_disable_acm_ = acms->group_disable_acm_;
+        acms->object_support_disable_acm_.changeEntry(pickup_goal.collision_object_name, end_effector_links, true);
         if(pickup_goal.allow_gripper_support_collision)
         {
             ROS_DEBUG("Disabling collisions between gripper and support surface");
             if(pickup_goal.collision_support_surface_name == "\"all\"")
             {
                 for(unsigned int i = 0; i < end_effector_links.size(); i++){
-                    object_support_disable_acm.changeEntry(end_effector_links[i], true);
+                    acms->object_support_disable_acm_.changeEntry(end_effector_links[i], true);
                 }
             }
             else{
                 ROS_DEBUG("not all");
-                object_support_disable_acm.changeEntry(pickup_goal.collision_support_surface_name, end_effector_links, true);
+                acms->object_support_disable_acm_.changeEntry(pickup_goal.collision_support_surface_name, end_effector_links, true);
             }
         }
 
-        /* allows collisions between the object and the and effector */
-        collision_space::EnvironmentModel::AllowedCollisionMatrix object_all_arm_disable_acm = object_disable_acm;
-
         /* allows collisions between the end effector and the object, as well as between the end effector and the support surface */
-        collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_all_arm_disable_acm = object_support_disable_acm;
+        acms->object_support_all_arm_disable_acm_ = acms->object_support_disable_acm_;
 
         /* allows collisions between the arm and anything else */
-        collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm = group_disable_acm;
+        acms->group_all_arm_disable_acm_ = acms->group_disable_acm_;
 
         //turning off collisions for the arm associated with this end effector
         for(unsigned int i = 0; i < arm_links.size(); i++) {
-            object_all_arm_disable_acm.changeEntry(arm_links[i], true);
-            object_support_all_arm_disable_acm.changeEntry(arm_links[i], true);
-            group_all_arm_disable_acm.changeEntry(arm_links[i], true);
+            acms->object_support_all_arm_disable_acm_.changeEntry(arm_links[i], true);
+            acms->group_all_arm_disable_acm_.changeEntry(arm_links[i], true);
         }
-        cm->setAlteredAllowedCollisionMatrix(object_support_all_arm_disable_acm);
-
-        //first we apply link padding for grasp check
-        cm->applyLinkPaddingToCollisionSpace(linkPaddingForGrasp(pickup_goal));
-
-        //setup that's not grasp specific
-        std_msgs::Header target_header;
-        target_header.frame_id = pickup_goal.target.reference_frame_id;
+        return acms;
+    }
 
-        bool in_object_frame = false;
-        tf::Transform obj_pose(tf::Quaternion(0,0,0,1.0), tf::Vector3(0.0,0.0,0.0));
-        if(pickup_goal.target.reference_frame_id == pickup_goal.collision_object_name) {
-            in_object_frame = true;
-            geometry_msgs::PoseStamped obj_world_pose_stamped;
-            cm->convertPoseGivenWorldTransform(*state,
-                                               cm->getWorldFrameId(),
-                                               pickup_goal.target.potential_models[0].pose.header,
-                                               pickup_goal.target.potential_models[0].pose.pose,
-                                               obj_world_pose_stamped);
-            tf::poseMsgToTF(obj_world_pose_stamped.pose, obj_pose);
+    boost::shared_ptr<const GraspTesterFast::CollisionMatrices>
+    GraspTesterFast::getCollisionMatrices(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                                          planning_environment::CollisionModels* cm,
+                                          const std::vector<std::string> &end_effector_links)
+    {
+        //we can only tell when the planning scene changes if it's the one from the mechanism interface
+        if(cm_ != NULL || state_ != NULL) {
+            return computeCollisionMatrices(pickup_goal, cm, end_effector_links);
         }
 
-        execution_info.clear();
-        execution_info.resize(grasps.size());
-
-        tf::Vector3 pregrasp_dir;
-        tf::vector3MsgToTF(doNegate(handDescription().approachDirection(pickup_goal.arm_name)), pregrasp_dir);
-        pregrasp_dir.normalize();
-
-        tf::Vector3 lift_dir;
-        tf::vector3MsgToTF(pickup_goal.lift.direction.vector, lift_dir);
-        lift_dir.normalize();
-        tf::Vector3 distance_lift_dir = lift_dir*fabs(pickup_goal.lift.desired_distance);
-        tf::Transform lift_trans(tf::Quaternion(0,0,0,1.0), distance_lift_dir);
-
-        std::vector<tf::Transform> grasp_poses(grasps.size());
-
-        ros::Rate debug_rate(0.2);
+        CollisionMatricesKey key;
+        key.arm_name_ = pickup_goal.arm_name;
+        key.collision_object_name_ = pickup_goal.collision_object_name;
+        key.collision_support_surface_name_ = pickup_goal.collision_support_surface_name;
+        key.allow_gripper_support_collision_ = pickup_goal.allow_gripper_support_collision;
+
+        boost::mutex::scoped_lock lock(collision_matrices_mutex_);
+        unsigned int revision = mechInterface().getPlanningSceneRevision();
+        if(revision != collision_matrices_revision_) {
+            collision_matrices_cache_.clear();
+            collision_matrices_revision_ = revision;
+        }
+        std::map<CollisionMatricesKey, boost::shared_ptr<const CollisionMatrices> >::iterator it = 
+            collision_matrices_cache_.find(key);
+        if(it != collision_matrices_cache_.end()) {
+            ROS_DEBUG_NAMED("manipulation", "Using cached collision matrices");
+            stats_.increment(TesterStats::COLLISION_MATRICES_CACHE_HIT);
+            return it->second;
+        }
+        stats_.increment(TesterStats::COLLISION_MATRICES_CACHE_MISS);
+        boost::shared_ptr<const CollisionMatrices> acms = computeCollisionMatrices(pickup_goal, cm, end_effector_links);
+        collision_matrices_cache_[key] = acms;
+        return acms;
+    }
 
-        //now this is grasp specific
-        for(unsigned int i = 0; i < grasps.size(); i++) {
+    void GraspTesterFast::configureStage(const GraspTestBatch &batch, TesterWorkspace &workspace, int stage)
+    {
+        if(workspace.configuration_ == stage) return;
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        switch(stage)
+        {
+        case GRASP_COLLISION_STAGE:
+            //only checking the hand, with the object and support surface allowed and reduced padding
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->object_support_all_arm_disable_acm_);
+            cm->applyLinkPaddingToCollisionSpace(batch.grasp_link_padding_);
+            break;
+        case LIFT_COLLISION_STAGE:
+            //hand only with default padding, collisions allowed between gripper and object
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->object_support_all_arm_disable_acm_);
+            break;
+        case PREGRASP_COLLISION_STAGE:
+            //hand only, not allowing object touch
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->group_all_arm_disable_acm_);
+            break;
+        case IK_STAGE:
+            //re-enabling collisions for the arms, and also reducing link paddings
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->object_support_disable_acm_);
+            cm->applyLinkPaddingToCollisionSpace(batch.grasp_link_padding_);
+            break;
+        case FINAL_PREGRASP_STAGE:
+            //the start of the approach needs to be collision-free according to the default collision matrix
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->group_disable_acm_);
+            break;
+        case FINAL_LIFT_STAGE:
+            //the object will be attached to the gripper for the lift, so we don't care if the object collides with the hand
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(batch.collision_matrices_->object_support_disable_acm_);
+            break;
+        }
+        workspace.configuration_ = stage;
+    }
 
-            //check whether the grasp pose is ok (only checking hand, not arms)
-            //using pre-grasp posture, cause grasp_posture only matters for closing the gripper
-            std::map<std::string, double> pre_grasp_joint_vals;
-            for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                pre_grasp_joint_vals[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-            }
-            state->setKinematicState(pre_grasp_joint_vals);
-
-            //always true
-            execution_info[i].result_.continuation_possible = true;
-
-            if(!in_object_frame) {
-                geometry_msgs::PoseStamped grasp_world_pose_stamped;
-                if(!cm->convertPoseGivenWorldTransform(*state,
-                                                       cm->getWorldFrameId(),
-                                                       target_header,
-                                                       grasps[i].grasp_pose,
-                                                       grasp_world_pose_stamped)) {
-                    ROS_WARN_STREAM("Can't convert into non-object frame " << target_header.frame_id);
-                    continue;
-                }
-                tf::poseMsgToTF(grasp_world_pose_stamped.pose, grasp_poses[i]);
-            } else {
-                tf::Transform gp;
-                tf::poseMsgToTF(grasps[i].grasp_pose, gp);
-                grasp_poses[i] = obj_pose*gp;
-            }
-            state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(pickup_goal.arm_name),grasp_poses[i]);
+    void GraspTesterFast::testGraspCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
+
+        //check whether the grasp pose is ok (only checking hand, not arms)
+        //using pre-grasp posture, cause grasp_posture only matters for closing the gripper
+        batch.posture_plan_.applyPosture(batch.pre_grasp_postures_[i], *state, workspace.state_values_);
+
+        //always true
+        info.result_.continuation_possible = true;
+
+        //the conversion failure has already been reported
+        if(!batch.grasp_poses_valid_) return;
+        state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.grasp_poses_.getTransform(i));
+
+        if(cm->isKinematicStateInCollision(*state)) {
+            ROS_DEBUG_STREAM("Grasp in collision");
+            recordContacts(batch, workspace, i);
+            addRobotMarkers(batch, workspace, i, 0.0, 1.0, 1.0, "grasp_in_collision");
+            info.result_.result_code = GraspResult::GRASP_IN_COLLISION;
+        } else {
+            info.result_.result_code = 0;
+        }
+    }
 
-            if(cm->isKinematicStateInCollision(*state)) {
-                ROS_DEBUG_STREAM("Grasp in collision");
-                print_contacts(cm, state);
+    void GraspTesterFast::recordContacts(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        if(!batch.collect_contacts_) return;
+        std::vector<arm_navigation_msgs::ContactInformation> contacts;
+        workspace.cm_->getAllCollisionsForState(*workspace.state_, contacts, 1);
+        add_contacts(contacts, batch.contacts_[i]);
+    }
 
-                std_msgs::ColorRGBA col_pregrasp;
-                col_pregrasp.r = 0.0;
-                col_pregrasp.g = 1.0;
-                col_pregrasp.b = 1.0;
-                col_pregrasp.a = 1.0;
-                visualization_msgs::MarkerArray arr;
-                cm->getRobotMarkersGivenState(*state, arr, col_pregrasp,
-                                              "grasp_in_collision",
-                                              ros::Duration(0.0),
-                                              &end_effector_links);
-                vis_marker_array_publisher_.publish(arr);
-                execution_info[i].result_.result_code = GraspResult::GRASP_IN_COLLISION;
-                outcome_count[GraspResult::GRASP_IN_COLLISION]++;
-            } else {
-                execution_info[i].result_.result_code = 0;
+    void GraspTesterFast::summarizeContacts(GraspTestBatch &batch)
+    {
+        if(!batch.collect_contacts_) return;
+        for(size_t i = 0; i < batch.contacts_.size(); i++) {
+            for(ContactSummary::const_iterator it = batch.contacts_[i].begin(); it != batch.contacts_[i].end(); it++) {
+                contact_summary_[it->first] += it->second;
             }
         }
+        for(ContactSummary::const_iterator it = contact_summary_.begin(); it != contact_summary_.end(); it++) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Contacts between " << it->first.first << " and " 
+                                   << it->first.second << ": " << it->second);
+        }
+    }
 
-        //now we revert link paddings for pre-grasp and lift checks
-        cm->revertCollisionSpacePaddingToDefault();
+    void GraspTesterFast::addRobotMarkers(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                                          float r, float g, float b, const std::string &ns)
+    {
+        if(!batch.visualize_) return;
+        std_msgs::ColorRGBA col;
+        col.r = r;
+        col.g = g;
+        col.b = b;
+        col.a = 1.0;
+        workspace.cm_->getRobotMarkersGivenState(*workspace.state_, batch.robot_markers_[i], col, ns,
+                                                 ros::Duration(0.0), &batch.end_effector_links_);
+    }
 
-        //first we do lift, with the hand in the grasp posture (collisions allowed between gripper and object)
-        cm->setAlteredAllowedCollisionMatrix(object_support_all_arm_disable_acm);
-        for(unsigned int i = 0; i < grasps.size(); i++) {
+    void GraspTesterFast::addMarkers(GraspTestBatch &batch, const std::string &ns_prefix,
+                                     visualization_msgs::MarkerArray &markers)
+    {
+        if(!batch.visualize_) return;
+        visualize_grasps(*batch.pickup_goal_, *batch.grasps_, *batch.execution_info_, batch.robot_markers_, 
+                         ns_prefix, markers);
+    }
 
-            if(execution_info[i].result_.result_code != 0) continue;
+    void GraspTesterFast::testLiftCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_models::KinematicState* state = workspace.state_;
 
-            std::map<std::string, double> grasp_joint_vals;
-            for(unsigned int j = 0; j < grasps[i].grasp_posture.name.size(); j++) {
-                grasp_joint_vals[grasps[i].grasp_posture.name[j]] = grasps[i].grasp_posture.position[j];
-            }
-            state->setKinematicState(grasp_joint_vals);
+        batch.posture_plan_.applyPosture(batch.grasp_postures_[i], *state, workspace.state_values_);
 
-            tf::Transform lift_pose = lift_trans*grasp_poses[i];
-            state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(pickup_goal.arm_name),lift_pose);
+        state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.lift_poses_.getTransform(i));
 
-            if(cm->isKinematicStateInCollision(*state)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation", "Lift in collision");
-                print_contacts(cm, state);
-                execution_info[i].result_.result_code = GraspResult::LIFT_IN_COLLISION;
-                outcome_count[GraspResult::LIFT_IN_COLLISION]++;
-            }
+        if(workspace.cm_->isKinematicStateInCollision(*state)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Lift in collision");
+            recordContacts(batch, workspace, i);
+            info.result_.result_code = GraspResult::LIFT_IN_COLLISION;
         }
+    }
 
-        //now we do pre-grasp not allowing object touch, but with arms disabled
-        cm->setAlteredAllowedCollisionMatrix(group_all_arm_disable_acm);
+    void GraspTesterFast::testPregraspCollision(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
 
-        for(unsigned int i = 0; i < grasps.size(); i++) {
+        //opening the gripper back to pre_grasp
+        batch.posture_plan_.applyPosture(batch.pre_grasp_postures_[i], *state, workspace.state_values_);
 
-            if(execution_info[i].result_.result_code != 0) continue;
+        state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.pre_grasp_poses_.getTransform(i));
 
-            //opening the gripper back to pre_grasp
-            std::map<std::string, double> pre_grasp_joint_vals;
-            for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                pre_grasp_joint_vals[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-            }
-            state->setKinematicState(pre_grasp_joint_vals);
+        if(cm->isKinematicStateInCollision(*state)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Pre-grasp in collision");
+            recordContacts(batch, workspace, i);
+            addRobotMarkers(batch, workspace, i, 1.0, 0.0, 1.0, "pre_grasp_in_collision");
 
-            tf::Vector3 distance_pregrasp_dir = pregrasp_dir * fabs(grasps[0].desired_approach_distance);
-            tf::Transform pre_grasp_trans(tf::Quaternion(0,0,0,1.0), distance_pregrasp_dir);
-            tf::Transform pre_grasp_pose = grasp_poses[i]*pre_grasp_trans;
-            state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(pickup_goal.arm_name),pre_grasp_pose);
+            info.result_.result_code = GraspResult::PREGRASP_IN_COLLISION;
+        }
+    }
 
-            if(cm->isKinematicStateInCollision(*state)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation", "Pre-grasp in collision");
-                print_contacts(cm, state);
+    void GraspTesterFast::testGraspIK(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        const object_manipulation_msgs::PickupGoal &pickup_goal = *batch.pickup_goal_;
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
+        arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver = 
+          workspace.ik_solver_map_[pickup_goal.arm_name];
+
+        //getting back to original state for seed, adjusted for pre-grasp
+        const PosturePlan &plan = batch.posture_plan_;
+        std::vector<double> &values = workspace.state_values_;
+        values = plan.getBaseValues();
+        plan.setPosture(batch.pre_grasp_postures_[i], values);
+        if(!batch.ik_seeds_.empty() && !batch.ik_seeds_[i].empty()) {
+            //or starting from the solution for a neighbouring grasp
+            plan.setJoints(batch.arm_joints_, batch.ik_seeds_[i], values);
+            stats_.increment(TesterStats::IK_SEEDED);
+        }
+        state->setKinematicState(values);
+
+        //now call ik for grasp
+        geometry_msgs::Pose grasp_geom_pose;
+        batch.grasp_poses_.get(i, grasp_geom_pose);
+        geometry_msgs::PoseStamped base_link_grasp_pose;
+        cm->convertPoseGivenWorldTransform(*state,
+                                           solver->getBaseName(),
+                                           batch.world_header_,
+                                           grasp_geom_pose,
+                                           base_link_grasp_pose);
+
+        ReachabilityMaps::const_iterator map_it = reachability_maps_.find(pickup_goal.arm_name);
+        if(map_it != reachability_maps_.end() && !map_it->second->isReachable(base_link_grasp_pose.pose)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Grasp " << i << " rejected by reachability map");
+            stats_.increment(TesterStats::REACHABILITY_REJECTION);
+            info.result_.result_code = GraspResult::GRASP_OUT_OF_REACH;
+            return;
+        }
 
-                std_msgs::ColorRGBA col_pregrasp;
-                col_pregrasp.r = 1.0;
-                col_pregrasp.g = 0.0;
-                col_pregrasp.b = 1.0;
-                col_pregrasp.a = 1.0;
-                visualization_msgs::MarkerArray arr;
-                cm->getRobotMarkersGivenState(*state, arr, col_pregrasp,
-                                              "pre_grasp_in_collision",
-                                              ros::Duration(0.0),
-                                              &end_effector_links);
-                vis_marker_array_publisher_.publish(arr);
-
-                execution_info[i].result_.result_code = GraspResult::PREGRASP_IN_COLLISION;
-                outcome_count[GraspResult::PREGRASP_IN_COLLISION]++;
-                continue;
+        IKCache::Key key;
+        if(batch.ik_cache_ != NULL) {
+            key = batch.ik_cache_->makeKey(pickup_goal.arm_name, base_link_grasp_pose.pose,
+                                           batch.scene_hash_, batch.ik_context_hashes_[i]);
+            IKCache::Entry entry;
+            if(batch.ik_cache_->lookup(key, entry)) {
+                if(cachedIKHolds(batch, workspace, i, entry)) {
+                    ROS_DEBUG_STREAM_NAMED("manipulation", "Using cached IK for grasp " << i);
+                    stats_.increment(TesterStats::IK_CACHE_HIT);
+                    info.approach_trajectory_ = entry.first_trajectory_;
+                    info.lift_trajectory_ = entry.second_trajectory_;
+                    if(entry.result_code_ != 0) info.result_.result_code = entry.result_code_;
+                    if(!batch.ik_solutions_.empty()) batch.ik_solutions_[i] = entry.solution_;
+                    return;
+                }
+                ROS_DEBUG_STREAM_NAMED("manipulation", "Cached IK for grasp " << i << " does not hold any more");
+                stats_.increment(TesterStats::IK_CACHE_STALE);
+                //back to the seed
+                state->setKinematicState(values);
             }
         }
 
-        visualize_grasps(pickup_goal, grasps, execution_info, vis_marker_publisher_);
+        IKCache::Entry entry;
+        if(batch.ik_cache_ != NULL) {
+            stats_.increment(TesterStats::IK_CACHE_MISS);
+            plan.getJoints(batch.arm_joints_, values, entry.seed_);
+        }
 
-        std_msgs::Header world_header;
-        world_header.frame_id = cm->getWorldFrameId();
-        const std::vector<std::string>& joint_names = ik_solver_map_[pickup_goal.arm_name]->getJointNames();
+        arm_navigation_msgs::ArmNavigationErrorCodes error_code;
+        error_code.val = error_code.SUCCESS;
+        solveGraspIK(batch, workspace, i, base_link_grasp_pose, entry.solution_, error_code);
+        if(!batch.ik_solutions_.empty()) batch.ik_solutions_[i] = entry.solution_;
+
+        //a failure that ran into an obstacle says nothing about the next planning scene
+        if(batch.ik_cache_ != NULL && 
+           (info.result_.result_code == 0 || error_code.val == error_code.NO_IK_SOLUTION)) {
+            entry.result_code_ = info.result_.result_code;
+            entry.collision_map_hash_ = batch.collision_map_hash_;
+            entry.first_trajectory_ = info.approach_trajectory_;
+            entry.second_trajectory_ = info.lift_trajectory_;
+            batch.ik_cache_pending_.set(i, key, entry);
+        }
+    }
 
-        if(return_on_first_hit) {
+    bool GraspTesterFast::cachedIKHolds(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                                        const IKCache::Entry &entry)
+    {
+        if(entry.result_code_ != 0) return entry.collision_map_hash_ == batch.collision_map_hash_;
+
+        //the solver only checked these against the obstacles sensed back then
+        StageTimer timer(stats_, TesterStats::IK);
+        std::vector<double> values;
+        size_t pre_grasp_posture = batch.pre_grasp_postures_[i];
+        if(armInCollision(batch, workspace, entry.solution_, pre_grasp_posture, values)) return false;
+        const std::vector<trajectory_msgs::JointTrajectoryPoint> &approach = entry.first_trajectory_.points;
+        for(size_t p = 0; p < approach.size(); p++) {
+            if(armInCollision(batch, workspace, approach[p].positions, pre_grasp_posture, values)) return false;
+        }
+        const std::vector<trajectory_msgs::JointTrajectoryPoint> &lift = entry.second_trajectory_.points;
+        for(size_t p = 0; p < lift.size(); p++) {
+            if(armInCollision(batch, workspace, lift[p].positions, batch.grasp_postures_[i], values)) return false;
+        }
+        return true;
+    }
 
-            bool last_ik_failed = false;
-            for(unsigned int i = 0; i < grasps.size(); i++) {
+    bool GraspTesterFast::armInCollision(const GraspTestBatch &batch, TesterWorkspace &workspace,
+                                         const std::vector<double> &arm_values, size_t hand_posture,
+                                         std::vector<double> &values)
+    {
+        values = batch.posture_plan_.getBaseValues();
+        batch.posture_plan_.setPosture(hand_posture, values);
+        batch.posture_plan_.setJoints(batch.arm_joints_, arm_values, values);
+        workspace.state_->setKinematicState(values);
+        return workspace.cm_->isKinematicStateInCollision(*workspace.state_);
+    }
 
-                if(execution_info[i].result_.result_code != 0) continue;
+    void GraspTesterFast::testGraspIKChain(GraspTestBatch &batch, TesterWorkspace &workspace, size_t c)
+    {
+        batch.seed_chains_.solveChain(c, batch.ik_seeds_, batch.ik_solutions_,
+                                      boost::bind(&GraspTesterFast::testGraspIK, this, boost::ref(batch),
+                                                  boost::ref(workspace), _1));
+    }
 
-                if(!last_ik_failed) {
-                    //now we move to the ik portion, which requires re-enabling collisions for the arms
-                    cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
+    void GraspTesterFast::solveGraspIK(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                                       const geometry_msgs::PoseStamped &base_link_grasp_pose,
+                                       std::vector<double> &ik_solution,
+                                       arm_navigation_msgs::ArmNavigationErrorCodes &error_code)
+    {
+        const object_manipulation_msgs::PickupGoal &pickup_goal = *batch.pickup_goal_;
+        const object_manipulation_msgs::Grasp &grasp = (*batch.grasps_)[i];
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
+        arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver = 
+          workspace.ik_solver_map_[pickup_goal.arm_name];
+        const std::vector<std::string>& joint_names = solver->getJointNames();
+        const PosturePlan &plan = batch.posture_plan_;
+        std::vector<double> &values = workspace.state_values_;
 
-                    //and also reducing link paddings
-                    cm->applyLinkPaddingToCollisionSpace(linkPaddingForGrasp(pickup_goal));
-                }
-                //getting back to original state for seed
-                state->setKinematicState(planning_scene_state_values);
+        arm_navigation_msgs::Constraints emp;
+        sensor_msgs::JointState solution;
+        ROS_DEBUG_STREAM("X y z " << base_link_grasp_pose.pose.position.x << " "
+                        << base_link_grasp_pose.pose.position.y << " "
+                        << base_link_grasp_pose.pose.position.z);
+        StageTimer ik_timer(stats_, TesterStats::IK);
+        bool ik_found = solver->findConstraintAwareSolution(base_link_grasp_pose.pose,
+                                                            emp,
+                                                            state,
+                                                            solution,
+                                                            error_code,
+                                                            false);
+        ik_timer.stop();
+        if(!ik_found) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Grasp out of reach");
+            addRobotMarkers(batch, workspace, i, 0.0, 1.0, 1.0, "out_of_reach");
+
+            info.result_.result_code = GraspResult::GRASP_OUT_OF_REACH;
+            return;
+        }
+        ik_solution = solution.position;
+
+        StageTimer interpolation_timer(stats_, TesterStats::INTERPOLATED_IK);
+
+        state->getKinematicStateValues(values);
+        plan.setJoints(batch.arm_joints_, solution.position, values);
+        plan.setPosture(batch.pre_grasp_postures_[i], values);
+        state->setKinematicState(values);
+
+        //now we solve interpolated ik
+        tf::Transform base_link_bullet_grasp_pose;
+        tf::poseMsgToTF(base_link_grasp_pose.pose, base_link_bullet_grasp_pose);
+
+        /* try to do interpolated IK from grasp back to pregrasp */
+        info.approach_trajectory_.joint_names = joint_names;
+        if(!getInterpolatedIK(batch,
+                              workspace,
+                              pickup_goal.arm_name,
+                              base_link_bullet_grasp_pose,
+                              batch.pregrasp_dir_,
+                              grasp.desired_approach_distance,
+                              solution.position,
+                              true,
+                              false,
+                              info.approach_trajectory_,
+                              error_code)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "No interpolated IK for pre-grasp to grasp");
+            info.result_.result_code = GraspResult::PREGRASP_UNFEASIBLE;
+            return;
+        }
 
-                //adjusting planning scene state for pre-grasp
-                std::map<std::string, double> pre_grasp_values;
-                for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                    pre_grasp_values[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-                }
-                state->setKinematicState(pre_grasp_values);
-
-                //now call ik for grasp
-                geometry_msgs::Pose grasp_geom_pose;
-                tf::poseTFToMsg(grasp_poses[i], grasp_geom_pose);
-                geometry_msgs::PoseStamped base_link_grasp_pose;
-                cm->convertPoseGivenWorldTransform(*state,
-                                                   ik_solver_map_[pickup_goal.arm_name]->getBaseName(),
-                                                   world_header,
-                                                   grasp_geom_pose,
-                                                   base_link_grasp_pose);
-
-                arm_navigation_msgs::Constraints emp;
-                sensor_msgs::JointState solution;
-                arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-                ROS_DEBUG_STREAM("X y z " << base_link_grasp_pose.pose.position.x << " "
-                                << base_link_grasp_pose.pose.position.y << " "
-                                << base_link_grasp_pose.pose.position.z);
-                if(!ik_solver_map_[pickup_goal.arm_name]->findConstraintAwareSolution(base_link_grasp_pose.pose,
-                                                                                      emp,
-                                                                                      state,
-                                                                                      solution,
-                                                                                      error_code,
-                                                                                      false)) {
-                    ROS_DEBUG_STREAM_NAMED("manipulation", "Grasp out of reach");
-                    std_msgs::ColorRGBA col_pregrasp;
-                    col_pregrasp.r = 0.0;
-                    col_pregrasp.g = 1.0;
-                    col_pregrasp.b = 1.0;
-                    col_pregrasp.a = 1.0;
-                    visualization_msgs::MarkerArray arr;
-                    cm->getRobotMarkersGivenState(*state, arr, col_pregrasp,
-                                                  "out_of_reach",
-                                                  ros::Duration(0.0),
-                                                  &end_effector_links);
-                    vis_marker_array_publisher_.publish(arr);
-
-                    execution_info[i].result_.result_code = GraspResult::GRASP_OUT_OF_REACH;
-                    outcome_count[GraspResult::GRASP_OUT_OF_REACH]++;
-                    last_ik_failed = true;
-                    continue;
-                } else {
-                    last_ik_failed = false;
-                }
+        /* try to do interpolated IK for the lift */
+        state->getKinematicStateValues(values);
+        plan.setJoints(batch.arm_joints_, solution.position, values);
+        plan.setPosture(batch.grasp_postures_[i], values);
+        state->setKinematicState(values);
+        info.lift_trajectory_.joint_names = joint_names;
+        if(!getInterpolatedIK(batch,
+                              workspace,
+                              pickup_goal.arm_name,
+                              base_link_bullet_grasp_pose,
+                              batch.lift_dir_,
+                              pickup_goal.lift.desired_distance,
+                              solution.position,
+                              false,
+                              true,
+                              info.lift_trajectory_,
+                              error_code)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation","No interpolated IK for grasp to lift");
+            info.result_.result_code = GraspResult::LIFT_UNFEASIBLE;
+            return;
+        }
+    }
 
-                std::map<std::string, double> ik_map_pre_grasp;
-                std::map<std::string, double> ik_map_grasp;
-                for(unsigned int j = 0; j < joint_names.size(); j++) {
-                    ik_map_pre_grasp[joint_names[j]] = solution.position[j];
-                }
-                ik_map_grasp = ik_map_pre_grasp;
+    void GraspTesterFast::testFinalPregrasp(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i)
+    {
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
 
-                for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                    ik_map_pre_grasp[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-                }
-                for(unsigned int j = 0; j < grasps[i].grasp_posture.name.size(); j++) {
-                    ik_map_grasp[grasps[i].grasp_posture.name[j]] = grasps[i].grasp_posture.position[j];
-                }
+        if(info.approach_trajectory_.points.empty()) {
+            ROS_WARN_STREAM("No result code and no points in approach trajectory");
+            return;
+        }
 
-                state->setKinematicState(ik_map_pre_grasp);
-
-                //now we solve interpolated ik
-                tf::Transform base_link_bullet_grasp_pose;
-                tf::poseMsgToTF(base_link_grasp_pose.pose, base_link_bullet_grasp_pose);
-                execution_info[i].approach_trajectory_.joint_names = joint_names;
-                //now we need to do interpolated ik
-                if(!getInterpolatedIK(pickup_goal.arm_name,
-                                      base_link_bullet_grasp_pose,
-                                      pregrasp_dir,
-                                      grasps[i].desired_approach_distance,
-                                      solution.position,
-                                      true,
-                                      false,
-                                      execution_info[i].approach_trajectory_)) {
-                    ROS_DEBUG_STREAM_NAMED("manipulation", "No interpolated IK for pre-grasp to grasp");
-                    execution_info[i].result_.result_code = GraspResult::PREGRASP_UNFEASIBLE;
-                    outcome_count[GraspResult::PREGRASP_UNFEASIBLE]++;
-                    continue;
-                }
+        std::vector<double> &values = workspace.state_values_;
+        state->getKinematicStateValues(values);
+        batch.posture_plan_.setJoints(batch.arm_joints_, info.approach_trajectory_.points[0].positions, values);
+        batch.posture_plan_.setPosture(batch.pre_grasp_postures_[i], values);
+        state->setKinematicState(values);
+        if(cm->isKinematicStateInCollision(*state)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation","Final pre-grasp check failed");
+            std::vector<arm_navigation_msgs::ContactInformation> contacts;
+            if(batch.visualize_ || batch.collect_contacts_) {
+                cm->getAllCollisionsForState(*state, contacts,1);
+            }
+            if(batch.collect_contacts_) add_contacts(contacts, batch.contacts_[i]);
 
-                ROS_DEBUG_STREAM_NAMED("manipulation", "Last approach point is " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[0] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[1] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[2] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[3] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[4] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[5] << " " <<
-                                 execution_info[i].approach_trajectory_.points.back().positions[6]);
-
-                state->setKinematicState(ik_map_grasp);
-                execution_info[i].lift_trajectory_.joint_names = joint_names;
-                if(!getInterpolatedIK(pickup_goal.arm_name,
-                                      base_link_bullet_grasp_pose,
-                                      lift_dir,
-                                      pickup_goal.lift.desired_distance,
-                                      solution.position,
-                                      false,
-                                      true,
-                                      execution_info[i].lift_trajectory_)) {
-                    ROS_DEBUG_STREAM_NAMED("manipulation", "No interpolated IK for grasp to lift");
-                    execution_info[i].result_.result_code = GraspResult::LIFT_UNFEASIBLE;
-                    outcome_count[GraspResult::LIFT_UNFEASIBLE]++;
-                    continue;
+            if(batch.visualize_) {
+                std::vector<std::string> names;
+                for(unsigned int j = 0; j < contacts.size(); j++) {
+                    names.push_back(contacts[j].contact_body_1);
                 }
 
-                ROS_DEBUG_STREAM_NAMED("manipulation", "First lift point is " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[0] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[1] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[2] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[3] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[4] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[5] << " " <<
-                                 execution_info[i].lift_trajectory_.points.front().positions[6]);
-
-                //now we revert link paddings and object collisions and do a final check for the initial ik points
-                cm->revertCollisionSpacePaddingToDefault();
+                std_msgs::ColorRGBA col_pregrasp;
+                col_pregrasp.r = 0.0;
+                col_pregrasp.g = 0.0;
+                col_pregrasp.b = 1.0;
+                col_pregrasp.a = 1.0;
+                cm->getRobotPaddedMarkersGivenState(*state, batch.robot_markers_[i], col_pregrasp,
+                                                    "padded",
+                                                    ros::Duration(0.0),
+                                                    &names);
+            }
+            info.result_.result_code = GraspResult::PREGRASP_OUT_OF_REACH;
+        }
+    }
 
-                //the start of the approach needs to be collision-free according to the default collision matrix
-                cm->setAlteredAllowedCollisionMatrix(group_disable_acm);
+    void GraspTesterFast::testFinalLift(GraspTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                                        size_t hand_posture)
+    {
+        GraspExecutionInfo &info = (*batch.execution_info_)[i];
+        planning_environment::CollisionModels* cm = workspace.cm_;
+        planning_models::KinematicState* state = workspace.state_;
 
-                if(execution_info[i].approach_trajectory_.points.empty()) {
-                    ROS_WARN_STREAM("No result code and no points in approach trajectory");
-                    continue;
-                }
+        if(info.lift_trajectory_.points.empty()) {
+            ROS_WARN_STREAM("No result code and no points in lift trajectory");
+            return;
+        }
+        std::vector<double> &values = workspace.state_values_;
+        state->getKinematicStateValues(values);
+        batch.posture_plan_.setJoints(batch.arm_joints_, info.lift_trajectory_.points.back().positions, values);
+        batch.posture_plan_.setPosture(hand_posture, values);
+        state->setKinematicState(values);
+        if(cm->isKinematicStateInCollision(*state)) {
+            ROS_DEBUG_STREAM_NAMED("manipulation","Final lift check failed");
+            recordContacts(batch, workspace, i);
+            info.result_.result_code = GraspResult::LIFT_OUT_OF_REACH;
+        } else {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Everything successful");
+            info.result_.result_code = GraspResult::SUCCESS;
+        }
+    }
 
-                std::map<std::string, double> pre_grasp_ik = ik_map_pre_grasp;
-                for(unsigned int j = 0; j < joint_names.size(); j++) {
-                    pre_grasp_ik[joint_names[j]] = execution_info[i].approach_trajectory_.points[0].positions[j];
-                }
-                state->setKinematicState(pre_grasp_ik);
-                if(cm->isKinematicStateInCollision(*state)) {
-                    ROS_DEBUG_STREAM_NAMED("manipulation", "Final pre-grasp check failed");
-                    std::vector<arm_navigation_msgs::ContactInformation> contacts;
-                    execution_info[i].result_.result_code = GraspResult::PREGRASP_OUT_OF_REACH;
-                    outcome_count[GraspResult::PREGRASP_OUT_OF_REACH]++;
-                    continue;
-                }
+    void GraspTesterFast::testGraspInStage(GraspTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                                           TesterWorkspace &workspace, size_t job)
+    {
+        size_t i = indices[job];
+        if(stage == IK_STAGE) {
+            //IK and interpolated IK are timed separately as they go
+            testGraspIK(batch, workspace, i);
+            return;
+        }
+        //indexed by TestStage
+        static const TesterStats::Stage stats_stages[] = {TesterStats::COLLISION, TesterStats::LIFT,
+                                                          TesterStats::PREGRASP, TesterStats::IK,
+                                                          TesterStats::FINAL_CHECK, TesterStats::FINAL_CHECK};
+        StageTimer timer(stats_, stats_stages[stage]);
+        switch(stage)
+        {
+        case GRASP_COLLISION_STAGE: testGraspCollision(batch, workspace, i); break;
+        case LIFT_COLLISION_STAGE: testLiftCollision(batch, workspace, i); break;
+        case PREGRASP_COLLISION_STAGE: testPregraspCollision(batch, workspace, i); break;
+        case IK_STAGE: testGraspIK(batch, workspace, i); break;
+        case FINAL_PREGRASP_STAGE: testFinalPregrasp(batch, workspace, i); break;
+        case FINAL_LIFT_STAGE:
+            //this check has always been done with the hand open when returning on the first hit
+            if(batch.return_on_first_hit_) testFinalLift(batch, workspace, i, batch.pre_grasp_postures_[i]);
+            else testFinalLift(batch, workspace, i, batch.grasp_postures_[i]);
+            break;
+        }
+    }
 
-                //the object will be attached to the gripper for the lift, so we don't care if the object collides with the hand
-                cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
+    void GraspTesterFast::runStage(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                                   size_t begin, size_t end)
+    {
+        if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
 
-                if(execution_info[i].lift_trajectory_.points.empty()) {
-                    ROS_WARN_STREAM("No result code and no points in lift trajectory");
-                    continue;
-                }
-                std::map<std::string, double> lift_ik = ik_map_pre_grasp;
-                for(unsigned int j = 0; j < joint_names.size(); j++) {
-                    lift_ik[joint_names[j]] = execution_info[i].lift_trajectory_.points.back().positions[j];
-                }
-                state->setKinematicState(lift_ik);
-                if(cm->isKinematicStateInCollision(*state)) {
-                    ROS_DEBUG_STREAM_NAMED("manipulation", "Final lift check failed");
-                    execution_info[i].result_.result_code = GraspResult::LIFT_OUT_OF_REACH;
-                    outcome_count[GraspResult::LIFT_OUT_OF_REACH]++;
-                    continue;
-                } else {
-                    ROS_DEBUG_STREAM("Everything successful");
-                    execution_info[i].result_.result_code = GraspResult::SUCCESS;
-                    execution_info.resize(i+1);
-                    outcome_count[GraspResult::SUCCESS]++;
-                    break;
-                }
-            }
-            for(std::map<unsigned int, unsigned int>::iterator it = outcome_count.begin();
-            it != outcome_count.end();
-            it++) {
-                ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
+        //the grasp collision stage is the one that sets the result codes in the first place
+        std::vector<size_t> pending;
+        for(size_t i = begin; i < end; i++) {
+            if(stage == GRASP_COLLISION_STAGE || (*batch.execution_info_)[i].result_.result_code == 0) {
+                pending.push_back(i);
             }
-            cm->setAlteredAllowedCollisionMatrix(original_acm);
-            ROS_INFO_STREAM("Took " << (ros::WallTime::now()-start).toSec());
+        }
+        if(stage == IK_STAGE && seed_propagation_) {
+            //each chain is solved in order by a single worker, so seeds never depend on scheduling
+            batch.seed_chains_.build(batch.grasp_poses_, pending);
+            runInWorkspaces(workspaces, batch.seed_chains_.size(),
+                            boost::bind(&GraspTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                            boost::bind(&GraspTesterFast::testGraspIKChain, this, boost::ref(batch), _1, _2));
             return;
         }
+        runInWorkspaces(workspaces, pending.size(),
+                        boost::bind(&GraspTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                        boost::bind(&GraspTesterFast::testGraspInStage, this, boost::ref(batch),
+                                    boost::cref(pending), stage, _1, _2));
+    }
 
+    std::vector<TesterWorkspace*> GraspTesterFast::getWorkspaces(TesterWorkspace *serial_workspace)
+    {
+        std::vector<TesterWorkspace*> workspaces;
+        //workers mirror the planning scene of the mechanism interface, so we can only use them if that's what we test against
+        if(num_threads_ <= 1 || cm_ != NULL || state_ != NULL) {
+            workspaces.push_back(serial_workspace);
+            return workspaces;
+        }
+        return worker_pool_.getWorkspaces(num_threads_,
+                                          mechInterface().getPlanningSceneMessage(),
+                                          mechInterface().getPlanningSceneRevision());
+    }
 
-        //now we move to the ik portion, which requires re-enabling collisions for the arms
-        cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
-
-        //and also reducing link paddings
-        cm->applyLinkPaddingToCollisionSpace(linkPaddingForGrasp(pickup_goal));
-
+    void GraspTesterFast::prepareBatch(GraspTestBatch &batch,
+                                       const object_manipulation_msgs::PickupGoal &pickup_goal,
+                                       const std::vector<object_manipulation_msgs::Grasp> &grasps,
+                                       std::vector<GraspExecutionInfo> &execution_info,
+                                       bool return_on_first_hit,
+                                       planning_environment::CollisionModels* cm,
+                                       planning_models::KinematicState* state)
+    {
+        batch.pickup_goal_ = &pickup_goal;
+        batch.grasps_ = &grasps;
+        batch.execution_info_ = &execution_info;
+        batch.return_on_first_hit_ = return_on_first_hit;
+        //nothing gets drawn unless someone is looking
+        batch.visualize_ = marker_publisher_.active();
+        //neither is contact enumeration, unless asked for
+        batch.collect_contacts_ = diagnose_ || 
+          log4cxx::Logger::getLogger(ROSCONSOLE_DEFAULT_NAME ".manipulation")->isDebugEnabled();
+
+        //resolving all the joints we'll need once, so the stages can set them by index
+        batch.posture_plan_.init(*state);
+        batch.pre_grasp_postures_.resize(grasps.size());
+        batch.grasp_postures_.resize(grasps.size());
         for(unsigned int i = 0; i < grasps.size(); i++) {
+            batch.pre_grasp_postures_[i] = batch.posture_plan_.addPosture(grasps[i].pre_grasp_posture);
+            batch.grasp_postures_[i] = batch.posture_plan_.addPosture(grasps[i].grasp_posture);
+        }
+        if(ik_solver_map_.find(pickup_goal.arm_name) == ik_solver_map_.end()) {
+            ROS_ERROR_STREAM("No IK solver for arm " << pickup_goal.arm_name);
+            throw GraspException("no IK solver for requested arm");
+        }
+        batch.arm_joints_ = batch.posture_plan_.addJoints(ik_solver_map_[pickup_goal.arm_name]->getJointNames());
 
-            if(execution_info[i].result_.result_code != 0) continue;
+        batch.end_effector_links_ = handDescription().gripperTouchLinkNames(pickup_goal.arm_name);
+        //getGroupLinks(handDescription().gripperCollisionName(pickup_goal.arm_name), end_effector_links);
+        batch.gripper_frame_ = handDescription().gripperFrame(pickup_goal.arm_name);
 
-            //getting back to original state for seed
-            state->setKinematicState(planning_scene_state_values);
+        batch.collision_matrices_ = getCollisionMatrices(pickup_goal, cm, batch.end_effector_links_);
+        batch.grasp_link_padding_ = linkPaddingForGrasp(pickup_goal);
 
-            //adjusting planning scene state for pre-grasp
-            std::map<std::string, double> pre_grasp_values;
-            for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                pre_grasp_values[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-            }
-            state->setKinematicState(pre_grasp_values);
+        //setup that's not grasp specific
+        batch.target_header_.frame_id = pickup_goal.target.reference_frame_id;
+        batch.world_header_.frame_id = cm->getWorldFrameId();
 
-            //now call ik for grasp
-            geometry_msgs::Pose grasp_geom_pose;
-            tf::poseTFToMsg(grasp_poses[i], grasp_geom_pose);
-            geometry_msgs::PoseStamped base_link_grasp_pose;
+        batch.in_object_frame_ = false;
+        batch.obj_pose_ = tf::Transform(tf::Quaternion(0,0,0,1.0), tf::Vector3(0.0,0.0,0.0));
+        if(pickup_goal.target.reference_frame_id == pickup_goal.collision_object_name) {
+            batch.in_object_frame_ = true;
+            geometry_msgs::PoseStamped obj_world_pose_stamped;
             cm->convertPoseGivenWorldTransform(*state,
-                                               ik_solver_map_[pickup_goal.arm_name]->getBaseName(),
-                                               world_header,
-                                               grasp_geom_pose,
-                                               base_link_grasp_pose);
-
-            arm_navigation_msgs::Constraints emp;
-            sensor_msgs::JointState solution;
-            arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-            if(!ik_solver_map_[pickup_goal.arm_name]->findConstraintAwareSolution(base_link_grasp_pose.pose,
-                                                                                  emp,
-                                                                                  state,
-                                                                                  solution,
-                                                                                  error_code,
-                                                                                  false)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation", "Grasp out of reach");
-                print_contacts(cm, state);
-                execution_info[i].result_.result_code = GraspResult::GRASP_OUT_OF_REACH;
-                outcome_count[GraspResult::GRASP_OUT_OF_REACH]++;
-                continue;
-            }
+                                               cm->getWorldFrameId(),
+                                               pickup_goal.target.potential_models[0].pose.header,
+                                               pickup_goal.target.potential_models[0].pose.pose,
+                                               obj_world_pose_stamped);
+            tf::poseMsgToTF(obj_world_pose_stamped.pose, batch.obj_pose_);
+        }
 
-            std::map<std::string, double> ik_map_pre_grasp;
-            std::map<std::string, double> ik_map_grasp;
-            for(unsigned int j = 0; j < joint_names.size(); j++) {
-                ik_map_pre_grasp[joint_names[j]] = solution.position[j];
-            }
-            ik_map_grasp = ik_map_pre_grasp;
+        execution_info.clear();
+        execution_info.resize(grasps.size());
+
+        tf::vector3MsgToTF(doNegate(handDescription().approachDirection(pickup_goal.arm_name)), batch.pregrasp_dir_);
+        batch.pregrasp_dir_.normalize();
 
-            for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                ik_map_pre_grasp[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
+        tf::vector3MsgToTF(pickup_goal.lift.direction.vector, batch.lift_dir_);
+        batch.lift_dir_.normalize();
+
+        //the gripper poses the collision stages need are computed for all grasps at once
+        PoseBatch grasp_poses(grasps.size());
+        for(unsigned int i = 0; i < grasps.size(); i++) {
+            grasp_poses.set(i, grasps[i].grasp_pose);
+        }
+        tf::Transform target_pose = batch.obj_pose_;
+        batch.grasp_poses_valid_ = true;
+        if(!batch.in_object_frame_) {
+            geometry_msgs::Pose identity;
+            identity.orientation.w = 1.0;
+            geometry_msgs::PoseStamped target_world_pose_stamped;
+            if(cm->convertPoseGivenWorldTransform(*state,
+                                                  cm->getWorldFrameId(),
+                                                  batch.target_header_,
+                                                  identity,
+                                                  target_world_pose_stamped)) {
+                tf::poseMsgToTF(target_world_pose_stamped.pose, target_pose);
+            } else {
+                ROS_WARN_STREAM("Can't convert into non-object frame " << batch.target_header_.frame_id);
+                batch.grasp_poses_valid_ = false;
             }
-            for(unsigned int j = 0; j < grasps[i].grasp_posture.name.size(); j++) {
-                ik_map_grasp[grasps[i].grasp_posture.name[j]] = grasps[i].grasp_posture.position[j];
+        }
+        PoseBatch::compose(target_pose, grasp_poses, batch.grasp_poses_);
+        PoseBatch::applyOffset(batch.grasp_poses_, batch.lift_dir_*fabs(pickup_goal.lift.desired_distance), 
+                               false, batch.lift_poses_);
+        //the pre-grasp collision check has always used the approach distance of the first grasp
+        if(!grasps.empty()) {
+            PoseBatch::applyOffset(batch.grasp_poses_, batch.pregrasp_dir_ * fabs(grasps[0].desired_approach_distance),
+                                   true, batch.pre_grasp_poses_);
+        }
+        if(batch.visualize_) batch.robot_markers_.resize(grasps.size());
+        if(seed_propagation_) {
+            batch.seed_chains_ = IKSeedChains(seed_distance_);
+            batch.ik_seeds_.resize(grasps.size());
+            batch.ik_solutions_.resize(grasps.size());
+        }
+        if(batch.collect_contacts_) batch.contacts_.resize(grasps.size());
+
+        //IK results can only be reused if we know which planning scene they were computed in
+        batch.ik_cache_ = NULL;
+        if(ik_cache_ && cm_ == NULL && state_ == NULL) {
+            batch.ik_cache_ = ik_cache_.get();
+            std::vector<double> arm_start;
+            batch.posture_plan_.getJoints(batch.arm_joints_, batch.posture_plan_.getBaseValues(), arm_start);
+            batch.scene_hash_ = ik_cache_->sceneHash(mechInterface().getPlanningSceneHash(), arm_start);
+            batch.collision_map_hash_ = mechInterface().getCollisionMapHash();
+            batch.ik_cache_pending_.reset(grasps.size());
+
+            //everything else the IK stage depends on
+            MessageHasher goal_hasher;
+            goal_hasher.add(std::string("grasp"));
+            goal_hasher.add(pickup_goal.collision_object_name);
+            goal_hasher.add(pickup_goal.collision_support_surface_name);
+            goal_hasher.add((bool)pickup_goal.allow_gripper_support_collision);
+            for(unsigned int j = 0; j < batch.grasp_link_padding_.size(); j++) {
+                goal_hasher.addMessage(batch.grasp_link_padding_[j]);
             }
+            goal_hasher.add((double)batch.pregrasp_dir_.x());
+            goal_hasher.add((double)batch.pregrasp_dir_.y());
+            goal_hasher.add((double)batch.pregrasp_dir_.z());
+            goal_hasher.add((double)batch.lift_dir_.x());
+            goal_hasher.add((double)batch.lift_dir_.y());
+            goal_hasher.add((double)batch.lift_dir_.z());
+            goal_hasher.add((double)pickup_goal.lift.desired_distance);
+            //seeded IK may find solutions where the planning scene seed did not
+            if(seed_propagation_) goal_hasher.add(std::string("seeded"));
+            batch.ik_context_hashes_.resize(grasps.size());
+            for(unsigned int i = 0; i < grasps.size(); i++) {
+                MessageHasher hasher = goal_hasher;
+                hasher.addMessage(grasps[i].pre_grasp_posture.name);
+                hasher.add(grasps[i].pre_grasp_posture.position);
+                hasher.addMessage(grasps[i].grasp_posture.name);
+                hasher.add(grasps[i].grasp_posture.position);
+                hasher.add((double)grasps[i].desired_approach_distance);
+                batch.ik_context_hashes_[i] = hasher.getHash();
+            }
+        }
+    }
 
-            state->setKinematicState(ik_map_pre_grasp);
-
-            //now we solve interpolated ik
-            tf::Transform base_link_bullet_grasp_pose;
-            tf::poseMsgToTF(base_link_grasp_pose.pose, base_link_bullet_grasp_pose);
-
-            /* try to do interpolated IK from grasp back to pregrasp */
-            execution_info[i].approach_trajectory_.joint_names = joint_names;
-            if(!getInterpolatedIK(pickup_goal.arm_name,
-                                  base_link_bullet_grasp_pose,
-                                  pregrasp_dir,
-                                  grasps[i].desired_approach_distance,
-                                  solution.position,
-                                  true,
-                                  false,
-                                  execution_info[i].approach_trajectory_)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation", "No interpolated IK for pre-grasp to grasp");
-                execution_info[i].result_.result_code = GraspResult::PREGRASP_UNFEASIBLE;
-                outcome_count[GraspResult::PREGRASP_UNFEASIBLE]++;
-                continue;
+    void GraspTesterFast::resetWorkspaces(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces,
+                                          TesterWorkspace *serial_workspace)
+    {
+        for(size_t w = 0; w < workspaces.size(); w++) {
+            workspaces[w]->configuration_ = -1;
+            if(workspaces[w] != serial_workspace) {
+                batch.posture_plan_.applyBase(*workspaces[w]->state_);
             }
+        }
+        if(workspaces.size() > 1) {
+            ROS_DEBUG_STREAM_NAMED("manipulation", "Testing " << batch.grasps_->size() << " grasps for " 
+                                   << batch.pickup_goal_->arm_name << " on " << workspaces.size() << " threads");
+        }
+    }
 
-            /* try to do interpolated IK for the lift */
-            state->setKinematicState(ik_map_grasp);
-            execution_info[i].lift_trajectory_.joint_names = joint_names;
-            if(!getInterpolatedIK(pickup_goal.arm_name,
-                                  base_link_bullet_grasp_pose,
-                                  lift_dir,
-                                  pickup_goal.lift.desired_distance,
-                                  solution.position,
-                                  false,
-                                  true,
-                                  execution_info[i].lift_trajectory_)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation","No interpolated IK for grasp to lift");
-                execution_info[i].result_.result_code = GraspResult::LIFT_UNFEASIBLE;
-                outcome_count[GraspResult::LIFT_UNFEASIBLE]++;
-                continue;
+    void GraspTesterFast::runBatch(GraspTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces)
+    {
+        size_t num_grasps = batch.grasps_->size();
+        if(batch.return_on_first_hit_) {
+            //the grasps are pulled in order, a window at a time, and taken through all the stages;
+            //the first success in the original order wins, so the result does not depend on the
+            //window size or the number of workers
+            size_t window = std::max<size_t>(first_hit_window_, workspaces.size());
+            size_t success = num_grasps;
+            for(size_t begin = 0; begin < num_grasps && success == num_grasps; begin += window) {
+                size_t end = std::min(begin + window, num_grasps);
+                runStage(batch, workspaces, GRASP_COLLISION_STAGE, begin, end);
+                runStage(batch, workspaces, LIFT_COLLISION_STAGE, begin, end);
+                runStage(batch, workspaces, PREGRASP_COLLISION_STAGE, begin, end);
+                runStage(batch, workspaces, IK_STAGE, begin, end);
+                runStage(batch, workspaces, FINAL_PREGRASP_STAGE, begin, end);
+                runStage(batch, workspaces, FINAL_LIFT_STAGE, begin, end);
+                for(size_t i = begin; i < end; i++) {
+                    if((*batch.execution_info_)[i].result_.result_code == GraspResult::SUCCESS) {
+                        ROS_DEBUG_STREAM("Everything successful");
+                        success = i;
+                        break;
+                    }
+                }
             }
+            if(success < num_grasps) batch.execution_info_->resize(success+1);
+            return;
         }
 
+        runStage(batch, workspaces, GRASP_COLLISION_STAGE, 0, num_grasps);
+        //first we do lift, with the hand in the grasp posture (collisions allowed between gripper and object)
+        runStage(batch, workspaces, LIFT_COLLISION_STAGE, 0, num_grasps);
+        //now we do pre-grasp not allowing object touch, but with arms disabled
+        runStage(batch, workspaces, PREGRASP_COLLISION_STAGE, 0, num_grasps);
+
+        //now we move to the ik portion, which requires re-enabling collisions for the arms
+        runStage(batch, workspaces, IK_STAGE, 0, num_grasps);
         //now we revert link paddings and object collisions and do a final check for the initial ik points
-        cm->revertCollisionSpacePaddingToDefault();
+        runStage(batch, workspaces, FINAL_PREGRASP_STAGE, 0, num_grasps);
+        //now we need to disable collisions with the object for lift
+        runStage(batch, workspaces, FINAL_LIFT_STAGE, 0, num_grasps);
+    }
 
-        cm->setAlteredAllowedCollisionMatrix(group_disable_acm);
+    void GraspTesterFast::runBatchInThread(GraspTestBatch *batch, const std::vector<TesterWorkspace*> *workspaces,
+                                           BatchOutcome *outcome)
+    {
+        ros::WallTime start = ros::WallTime::now();
+        try
+        {
+            runBatch(*batch, *workspaces);
+        }
+        catch(InterruptRequestedException &ex)
+        {
+            outcome->interrupted_ = true;
+        }
+        catch(std::exception &ex)
+        {
+            outcome->error_ = ex.what();
+        }
+        catch(...)
+        {
+            outcome->error_ = "unknown exception";
+        }
+        outcome->seconds_ = (ros::WallTime::now()-start).toSec();
+    }
 
-        for(unsigned int i = 0; i < grasps.size(); i++) {
+    void GraspTesterFast::finishBatch(GraspTestBatch &batch, double seconds)
+    {
+        if(batch.ik_cache_ != NULL) batch.ik_cache_->insert(batch.ik_cache_pending_);
+        summarizeContacts(batch);
 
-            if(execution_info[i].result_.result_code != 0) continue;
+        ROS_DEBUG_STREAM("Took " << seconds);
 
-            if(execution_info[i].approach_trajectory_.points.empty()) {
-                ROS_WARN_STREAM("No result code and no points in approach trajectory");
-                continue;
-            }
+        std::map<unsigned int, unsigned int> outcome_count;
+        const std::vector<GraspExecutionInfo> &execution_info = *batch.execution_info_;
+        for(unsigned int i = 0; i < execution_info.size(); i++) {
+            if(execution_info[i].result_.result_code != 0) outcome_count[execution_info[i].result_.result_code]++;
+        }
+        for(std::map<unsigned int, unsigned int>::iterator it = outcome_count.begin();
+        it != outcome_count.end();
+        it++) {
+            ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
+            stats_.addOutcome(it->first, it->second);
+        }
+        stats_.addCall(execution_info.size(), seconds);
+    }
 
-            std::map<std::string, double> ik_map_pre_grasp;
-            for(unsigned int j = 0; j < joint_names.size(); j++) {
-                ik_map_pre_grasp[joint_names[j]] = execution_info[i].approach_trajectory_.points[0].positions[j];
-            }
-            for(unsigned int j = 0; j < grasps[i].pre_grasp_posture.name.size(); j++) {
-                ik_map_pre_grasp[grasps[i].pre_grasp_posture.name[j]] = grasps[i].pre_grasp_posture.position[j];
-            }
-            state->setKinematicState(ik_map_pre_grasp);
-            if(cm->isKinematicStateInCollision(*state)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation","Final pre-grasp check failed");
-                print_contacts(cm, state);
+    void GraspTesterFast::testGrasps(const object_manipulation_msgs::PickupGoal &pickup_goal,
+                                     const std::vector<object_manipulation_msgs::Grasp> &grasps,
+                                     std::vector<GraspExecutionInfo> &execution_info,
+                                     bool return_on_first_hit)
 
-                std::vector<arm_navigation_msgs::ContactInformation> contacts;
-                cm->getAllCollisionsForState(*state, contacts,1);
-                std::vector<std::string> names;
-                for(unsigned int j = 0; j < contacts.size(); j++) {
-                    names.push_back(contacts[j].contact_body_1);
-                }
+    {
+        ros::WallTime start = ros::WallTime::now();
+        boost::recursive_mutex::scoped_lock scene_lock(mechInterface().getPlanningSceneMutex());
+        planning_environment::CollisionModels* cm = getCollisionModels();
+        planning_models::KinematicState* state = getPlanningSceneState();
 
-                std_msgs::ColorRGBA col_pregrasp;
-                col_pregrasp.r = 0.0;
-                col_pregrasp.g = 0.0;
-                col_pregrasp.b = 1.0;
-                col_pregrasp.a = 1.0;
-                visualization_msgs::MarkerArray arr;
-                cm->getRobotPaddedMarkersGivenState(*state, arr, col_pregrasp,
-                                                    "padded",
-                                                    ros::Duration(0.0),
-                                                    &names);
-                vis_marker_array_publisher_.publish(arr);
-                execution_info[i].result_.result_code = GraspResult::PREGRASP_OUT_OF_REACH;
-                outcome_count[GraspResult::PREGRASP_OUT_OF_REACH]++;
-                continue;
+        collision_space::EnvironmentModel::AllowedCollisionMatrix original_acm = cm->getCurrentAllowedCollisionMatrix();
+        GraspTestBatch batch;
+        //the workers get the same planning scene, so the allowed collision matrices computed here apply to them too
+        TesterWorkspace serial_workspace(cm, state, ik_solver_map_);
+        try
+        {
+            prepareBatch(batch, pickup_goal, grasps, execution_info, return_on_first_hit, cm, state);
+            std::vector<TesterWorkspace*> workspaces = getWorkspaces(&serial_workspace);
+            resetWorkspaces(batch, workspaces, &serial_workspace);
+            if(workspaces[0] != &serial_workspace) {
+                //the workers are synced to the planning scene by now and never touch cm, so everyone 
+                //else can have it back while they run
+                cm->revertCollisionSpacePaddingToDefault();
+                cm->setAlteredAllowedCollisionMatrix(original_acm);
+                scene_lock.unlock();
+            }
+            runBatch(batch, workspaces);
+        }
+        catch(...)
+        {
+            if(scene_lock.owns_lock()) {
+                cm->revertCollisionSpacePaddingToDefault();
+                cm->setAlteredAllowedCollisionMatrix(original_acm);
             }
+            throw;
+        }
+        if(scene_lock.owns_lock()) {
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(original_acm);
+            scene_lock.unlock();
+        }
 
+        if(batch.visualize_) {
+            visualization_msgs::MarkerArray markers;
+            addMarkers(batch, "", markers);
+            marker_publisher_.publish(markers);
         }
+        contact_summary_.clear();
+        finishBatch(batch, (ros::WallTime::now()-start).toSec());
+    }
 
-        //now we need to disable collisions with the object for lift
-        cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
+    void GraspTesterFast::testGraspsForArms(const std::vector<object_manipulation_msgs::PickupGoal> &pickup_goals,
+                                            const std::vector< std::vector<object_manipulation_msgs::Grasp> > &grasps,
+                                            std::vector< std::vector<GraspExecutionInfo> > &execution_info,
+                                            bool return_on_first_hit)
+    {
+        size_t num_arms = pickup_goals.size();
+        if(grasps.size() != num_arms) {
+            throw GraspException("testGraspsForArms needs one list of grasps per pickup goal");
+        }
+        execution_info.resize(num_arms);
+        //workers mirror the planning scene of the mechanism interface, so we can only use them if that's what we test against
+        if(num_arms < 2 || cm_ != NULL || state_ != NULL) {
+            ContactSummary summary;
+            for(size_t a = 0; a < num_arms; a++) {
+                testGrasps(pickup_goals[a], grasps[a], execution_info[a], return_on_first_hit);
+                for(ContactSummary::const_iterator it = contact_summary_.begin(); it != contact_summary_.end(); it++) {
+                    summary[it->first] += it->second;
+                }
+            }
+            contact_summary_ = summary;
+            return;
+        }
 
-        for(unsigned int i = 0; i < grasps.size(); i++) {
+        boost::recursive_mutex::scoped_lock scene_lock(mechInterface().getPlanningSceneMutex());
+        planning_environment::CollisionModels* cm = getCollisionModels();
+        planning_models::KinematicState* state = getPlanningSceneState();
 
-            if(execution_info[i].result_.result_code != 0) continue;
+        collision_space::EnvironmentModel::AllowedCollisionMatrix original_acm = cm->getCurrentAllowedCollisionMatrix();
+        std::vector< boost::shared_ptr<GraspTestBatch> > batches(num_arms);
+        std::vector<BatchOutcome> outcomes(num_arms);
+        //each arm is timed for its own setup and run, plus the setup shared by all of them
+        std::vector<double> seconds(num_arms, 0.0);
+        try
+        {
+            //the batches are prepared one after the other on the shared collision models; each arm's 
+            //collision matrices must start from the original matrix, not from the previous arm's
+            for(size_t a = 0; a < num_arms; a++) {
+                ros::WallTime prepare_start = ros::WallTime::now();
+                cm->setAlteredAllowedCollisionMatrix(original_acm);
+                batches[a].reset(new GraspTestBatch);
+                prepareBatch(*batches[a], pickup_goals[a], grasps[a], execution_info[a], return_on_first_hit, cm, state);
+                seconds[a] += (ros::WallTime::now()-prepare_start).toSec();
+            }
+            ros::WallTime workspaces_start = ros::WallTime::now();
+
+            //every arm gets its own share of the workers, so no state is shared between the arms
+            size_t per_arm = std::max<size_t>(num_threads_ / num_arms, 1);
+            std::vector<TesterWorkspace*> all_workspaces = 
+              worker_pool_.getWorkspaces(per_arm * num_arms,
+                                         mechInterface().getPlanningSceneMessage(),
+                                         mechInterface().getPlanningSceneRevision());
+            std::vector< std::vector<TesterWorkspace*> > workspaces(num_arms);
+            for(size_t a = 0; a < num_arms; a++) {
+                workspaces[a].assign(all_workspaces.begin() + a*per_arm, all_workspaces.begin() + (a+1)*per_arm);
+                resetWorkspaces(*batches[a], workspaces[a], NULL);
+            }
+            double workspaces_seconds = (ros::WallTime::now()-workspaces_start).toSec();
+            for(size_t a = 0; a < num_arms; a++) seconds[a] += workspaces_seconds;
+            //only the workers are used from here on
+            cm->revertCollisionSpacePaddingToDefault();
+            cm->setAlteredAllowedCollisionMatrix(original_acm);
+            scene_lock.unlock();
 
-            if(execution_info[i].lift_trajectory_.points.empty()) {
-                ROS_WARN_STREAM("No result code and no points in lift trajectory");
-                continue;
+            boost::thread_group threads;
+            for(size_t a = 0; a < num_arms; a++) {
+                threads.create_thread(boost::bind(&GraspTesterFast::runBatchInThread, this,
+                                                  batches[a].get(), &workspaces[a], &outcomes[a]));
             }
-            std::map<std::string, double> ik_map_grasp;
-            for(unsigned int j = 0; j < joint_names.size(); j++) {
-                ik_map_grasp[joint_names[j]] = execution_info[i].lift_trajectory_.points.back().positions[j];
+            threads.join_all();
+            for(size_t a = 0; a < num_arms; a++) {
+                if(outcomes[a].interrupted_) throw InterruptRequestedException();
             }
-            for(unsigned int j = 0; j < grasps[i].grasp_posture.name.size(); j++) {
-                ik_map_grasp[grasps[i].grasp_posture.name[j]] = grasps[i].grasp_posture.position[j];
+            for(size_t a = 0; a < num_arms; a++) {
+                if(!outcomes[a].error_.empty()) {
+                    ROS_ERROR_STREAM("Testing grasps for " << pickup_goals[a].arm_name << " failed: " << outcomes[a].error_);
+                    throw MechanismException("grasp testing failed for " + pickup_goals[a].arm_name + ": " + outcomes[a].error_);
+                }
             }
-            state->setKinematicState(ik_map_grasp);
-            if(cm->isKinematicStateInCollision(*state)) {
-                ROS_DEBUG_STREAM_NAMED("manipulation","Final lift check failed");
-                print_contacts(cm, state);
-                execution_info[i].result_.result_code = GraspResult::LIFT_OUT_OF_REACH;
-                outcome_count[GraspResult::LIFT_OUT_OF_REACH]++;
-                continue;
-            } else {
-                ROS_DEBUG_STREAM_NAMED("manipulation", "Everything successful");
-                execution_info[i].result_.result_code = GraspResult::SUCCESS;
-                outcome_count[GraspResult::SUCCESS]++;
+        }
+        catch(...)
+        {
+            if(scene_lock.owns_lock()) {
+                cm->revertCollisionSpacePaddingToDefault();
+                cm->setAlteredAllowedCollisionMatrix(original_acm);
             }
+            throw;
         }
-        cm->setAlteredAllowedCollisionMatrix(original_acm);
-
-        visualize_grasps(pickup_goal, grasps, execution_info, vis_marker_publisher_);
-
-        ROS_DEBUG_STREAM("Took " << (ros::WallTime::now()-start).toSec());
 
-        for(std::map<unsigned int, unsigned int>::iterator it = outcome_count.begin();
-        it != outcome_count.end();
-        it++) {
-            ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
+        //the arms' markers go out together, so that one does not replace the other
+        visualization_msgs::MarkerArray markers;
+        bool visualize = false;
+        contact_summary_.clear();
+        for(size_t a = 0; a < num_arms; a++) {
+            visualize = visualize || batches[a]->visualize_;
+            addMarkers(*batches[a], pickup_goals[a].arm_name + " ", markers);
+            ROS_INFO_STREAM("Outcomes for " << pickup_goals[a].arm_name << ":");
+            finishBatch(*batches[a], seconds[a] + outcomes[a].seconds_);
         }
+        if(visualize) marker_publisher_.publish(markers);
     }
 
 
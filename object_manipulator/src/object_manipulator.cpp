@@ -60,6 +60,9 @@
 #include "object_manipulator/tools/grasp_marker_publisher.h"
 #include "object_manipulator/tools/exceptions.h"
 
+#include <boost/lexical_cast.hpp>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
 using object_manipulation_msgs::GraspableObject;
 using object_manipulation_msgs::PickupGoal;
 using object_manipulation_msgs::PickupResult;
@@ -77,11 +80,189 @@ using object_manipulation_msgs::GraspPlanningAction;
 
 namespace object_manipulator {
 
+const std::vector<Grasp>& GraspBatch::grasps() const
+{
+  static const std::vector<Grasp> empty;
+  if (!grasps_) return empty;
+  return *grasps_;
+}
+
+GraspBatch GraspContainer::collect(size_t start, boost::mutex::scoped_lock &lock)
+{
+  if (start >= size_) return GraspBatch();
+  size_t first = std::upper_bound(segment_starts_.begin(), segment_starts_.end(), start) - 
+    segment_starts_.begin() - 1;
+  //the common case: everything left is a single segment, which can be handed out as is
+  if (segment_starts_[first] == start && first + 1 == segments_.size()) return GraspBatch(segments_[first], start);
+
+  //otherwise, merge the segments; they are immutable, so this can be done without the lock
+  std::vector<Segment> segments(segments_.begin() + first, segments_.end());
+  size_t offset = start - segment_starts_[first];
+  size_t total = size_ - start;
+  lock.unlock();
+  boost::shared_ptr<std::vector<Grasp> > merged(new std::vector<Grasp>);
+  merged->reserve(total);
+  merged->insert(merged->end(), segments[0]->begin() + offset, segments[0]->end());
+  for (size_t i=1; i<segments.size(); i++) merged->insert(merged->end(), segments[i]->begin(), segments[i]->end());
+  return GraspBatch(merged, start);
+}
+
+void GraspContainer::append(const Segment &segment, size_t start, unsigned int generation)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (generation != generation_)
+  {
+    ROS_DEBUG_NAMED("manipulation", "Dropping %zu grasps meant for an earlier pickup", segment->size());
+    return;
+  }
+  if (start != size_)
+  {
+    ROS_WARN("Grasp container changed while adding grasps; dropping %zu grasps", segment->size());
+    return;
+  }
+  segments_.push_back(segment);
+  segment_starts_.push_back(size_);
+  size_ += segment->size();
+  grasps_cond_.notify_all();
+}
+
+GraspBatch GraspContainer::getGrasps(size_t start)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return collect(start, lock);
+}
+
+GraspBatch GraspContainer::waitForGrasps(size_t start, ros::Duration timeout)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  boost::system_time deadline = boost::get_system_time() + 
+    boost::posix_time::microseconds(timeout.toNSec() / 1000);
+  while (size_ <= start && !closed_)
+  {
+    if (!grasps_cond_.timed_wait(lock, deadline)) break;
+  }
+  return collect(start, lock);
+}
+
+void GraspContainer::addGrasps(const boost::shared_ptr<const std::vector<Grasp> > &new_grasps, 
+                               unsigned int generation)
+{
+  //only the producer adds grasps, so the size can not grow between here and append()
+  size_t start = size();
+  if (!new_grasps || new_grasps->size() <= start)
+  {
+    ROS_WARN("No new grasps to add to container");
+    return;
+  }
+  if (start == 0) append(new_grasps, start, generation);
+  else append(Segment(new std::vector<Grasp>(new_grasps->begin() + start, new_grasps->end())), start, generation);
+}
+
+void GraspContainer::addGrasps(const std::vector<Grasp> &new_grasps, unsigned int generation)
+{
+  size_t start = size();
+  if (new_grasps.size() <= start)
+  {
+    ROS_WARN("No new grasps to add to container");
+    return;
+  }
+  append(Segment(new std::vector<Grasp>(new_grasps.begin() + start, new_grasps.end())), start, generation);
+}
+
+void GraspContainer::close(unsigned int generation)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (generation != generation_) return;
+  closed_ = true;
+  grasps_cond_.notify_all();
+}
+
+unsigned int GraspContainer::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  segments_.clear();
+  segment_starts_.clear();
+  size_ = 0;
+  closed_ = false;
+  return ++generation_;
+}
+
+TestedGraspQueue::~TestedGraspQueue()
+{
+  stop();
+  if (testing_thread_)
+  {
+    testing_thread_->join();
+    delete testing_thread_;
+  }
+}
+
+void TestedGraspQueue::start(boost::function<void()> testing_function)
+{
+  testing_thread_ = new boost::thread(testing_function);
+}
+
+void TestedGraspQueue::push(const GraspBatch &batch, size_t index, const GraspExecutionInfo &execution_info)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  grasps_.push_back(TestedGrasp());
+  grasps_.back().batch_ = batch;
+  grasps_.back().index_ = index;
+  grasps_.back().execution_info_ = execution_info;
+  grasps_cond_.notify_all();
+}
+
+void TestedGraspQueue::finish(Outcome outcome, const std::string &error)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  outcome_ = outcome;
+  error_ = error;
+  grasps_cond_.notify_all();
+}
+
+bool TestedGraspQueue::popAll(std::deque<TestedGrasp> &tested, ros::Duration timeout)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  boost::system_time deadline = boost::get_system_time() + 
+    boost::posix_time::microseconds(timeout.toNSec() / 1000);
+  while (grasps_.empty() && outcome_ == TESTING)
+  {
+    if (!grasps_cond_.timed_wait(lock, deadline)) break;
+  }
+  if (grasps_.empty()) return false;
+  tested.insert(tested.end(), grasps_.begin(), grasps_.end());
+  grasps_.clear();
+  return true;
+}
+
+TestedGraspQueue::Outcome TestedGraspQueue::getOutcome(std::string &error)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  error = error_;
+  return outcome_;
+}
+
+void TestedGraspQueue::stop()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stop_requested_ = true;
+}
+
+bool TestedGraspQueue::interrupted()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (stop_requested_) return true;
+  }
+  return interrupt_function_ && interrupt_function_();
+}
+
 ObjectManipulator::ObjectManipulator() :
   priv_nh_("~"),
   root_nh_(""),
   grasp_planning_actions_("", "", false, false),
-  marker_pub_(NULL)
+  marker_pub_(NULL),
+  ik_cache_saved_revision_(0)
 {
   bool publish_markers = true;
   if (publish_markers)
@@ -125,6 +306,111 @@ ObjectManipulator::ObjectManipulator() :
   priv_nh_.param<bool>("use_probabilistic_grasp_planner", use_probabilistic_planner_, false);
   priv_nh_.param<bool>("randomize_grasps", randomize_grasps_, false);
 
+  int grasp_test_threads;
+  priv_nh_.param<int>("grasp_test_threads", grasp_test_threads, 1);
+  grasp_tester_fast_->setNumThreads(std::max(grasp_test_threads, 1));
+  int grasp_test_window;
+  priv_nh_.param<int>("grasp_test_window", grasp_test_window, 1);
+  grasp_tester_fast_->setFirstHitWindow(std::max(grasp_test_window, 1));
+  bool grasp_test_diagnose;
+  priv_nh_.param<bool>("grasp_test_diagnose", grasp_test_diagnose, false);
+  grasp_tester_fast_->setDiagnose(grasp_test_diagnose);
+  //feasible grasps kept ready, with their trajectories, to go on to right away when an attempt fails
+  int grasp_retry_candidates;
+  priv_nh_.param<int>("grasp_retry_candidates", grasp_retry_candidates, 3);
+  standard_grasp_performer_->setRetryCandidates(std::max(grasp_retry_candidates, 1));
+  reactive_grasp_performer_->setRetryCandidates(std::max(grasp_retry_candidates, 1));
+  unsafe_grasp_performer_->setRetryCandidates(std::max(grasp_retry_candidates, 1));
+  int place_test_threads;
+  priv_nh_.param<int>("place_test_threads", place_test_threads, 1);
+  standard_place_tester_->setNumThreads(std::max(place_test_threads, 1));
+  //seeding IK for each candidate with the solution found for a nearby one
+  bool ik_seed_propagation;
+  double ik_seed_distance;
+  priv_nh_.param<bool>("ik_seed_propagation", ik_seed_propagation, false);
+  priv_nh_.param<double>("ik_seed_distance", ik_seed_distance, 0.05);
+  grasp_tester_fast_->setSeedPropagation(ik_seed_propagation, ik_seed_distance);
+  standard_place_tester_->setSeedPropagation(ik_seed_propagation, ik_seed_distance);
+
+  //IK results are only cached if asked for, and only persist across runs if a file is given
+  int ik_cache_size;
+  priv_nh_.param<int>("ik_cache_size", ik_cache_size, 0);
+  priv_nh_.param<std::string>("ik_cache_file", ik_cache_file_, "");
+  if(ik_cache_size > 0)
+  {
+    ik_cache_.reset(new IKCache(ik_cache_size));
+    if(!ik_cache_file_.empty())
+    {
+      if(ik_cache_->load(ik_cache_file_)) 
+        ROS_INFO("Loaded %zu cached IK results from %s", ik_cache_->size(), ik_cache_file_.c_str());
+      else ROS_INFO("Could not load cached IK results from %s; starting empty", ik_cache_file_.c_str());
+      ik_cache_saved_revision_ = ik_cache_->getRevision();
+      //saving on shutdown alone would lose everything if the node is killed
+      double ik_cache_save_period;
+      priv_nh_.param<double>("ik_cache_save_period", ik_cache_save_period, 60.0);
+      if(ik_cache_save_period > 0)
+        ik_cache_save_timer_ = root_nh_.createTimer(ros::Duration(ik_cache_save_period), 
+                                                    &ObjectManipulator::saveIKCacheCallback, this);
+    }
+    grasp_tester_fast_->setIKCache(ik_cache_);
+    standard_place_tester_->setIKCache(ik_cache_);
+  }
+
+  //reachability maps are given as a dictionary from arm name to map file
+  XmlRpc::XmlRpcValue map_files;
+  if(priv_nh_.getParam("reachability_maps", map_files))
+  {
+    ReachabilityMaps reachability_maps;
+    if(map_files.getType() != XmlRpc::XmlRpcValue::TypeStruct)
+    {
+      ROS_ERROR("Parameter reachability_maps must be a dictionary from arm name to file name");
+    }
+    else
+    {
+      for(XmlRpc::XmlRpcValue::iterator it = map_files.begin(); it != map_files.end(); it++)
+      {
+        if(it->second.getType() != XmlRpc::XmlRpcValue::TypeString) continue;
+        boost::shared_ptr<ReachabilityMap> map(new ReachabilityMap);
+        if(!map->load(static_cast<std::string>(it->second))) continue;
+        ROS_INFO("Using reachability map %s for arm %s", static_cast<std::string>(it->second).c_str(), 
+                 it->first.c_str());
+        reachability_maps[it->first] = map;
+      }
+    }
+    grasp_tester_fast_->setReachabilityMaps(reachability_maps);
+    standard_place_tester_->setReachabilityMaps(reachability_maps);
+  }
+
+  //pickup goals without an arm name are tried with each of these arms, if we have an IK solver for it
+  XmlRpc::XmlRpcValue any_arm_names;
+  if(priv_nh_.getParam("any_arm_names", any_arm_names) && any_arm_names.getType() == XmlRpc::XmlRpcValue::TypeArray)
+  {
+    for(int i = 0; i < any_arm_names.size(); i++)
+    {
+      if(any_arm_names[i].getType() != XmlRpc::XmlRpcValue::TypeString) continue;
+      any_arm_names_.push_back(static_cast<std::string>(any_arm_names[i]));
+    }
+  }
+  else
+  {
+    any_arm_names_.push_back("right_arm");
+    any_arm_names_.push_back("left_arm");
+  }
+  for(std::vector<std::string>::iterator it = any_arm_names_.begin(); it != any_arm_names_.end(); )
+  {
+    if(grasp_tester_fast_->canTestArm(*it)) it++;
+    else it = any_arm_names_.erase(it);
+  }
+
+  double tester_stats_period;
+  priv_nh_.param<double>("tester_stats_period", tester_stats_period, 1.0);
+  if(tester_stats_period > 0)
+  {
+    diagnostics_pub_ = root_nh_.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 10);
+    diagnostics_timer_ = root_nh_.createTimer(ros::Duration(tester_stats_period), 
+                                              &ObjectManipulator::publishTesterStats, this);
+  }
+
   ROS_INFO("Object manipulator ready. Default cluster planner: %s. Default database planner: %s.", 
 	   default_cluster_planner_.c_str(), default_database_planner_.c_str());
   if(use_probabilistic_planner_)
@@ -136,6 +422,9 @@ ObjectManipulator::ObjectManipulator() :
 
 ObjectManipulator::~ObjectManipulator()
 {
+  ik_cache_save_timer_.stop();
+  saveIKCache();
+
   delete marker_pub_;
 
   //old style executors
@@ -158,6 +447,76 @@ ObjectManipulator::~ObjectManipulator()
   delete reactive_place_performer_;
 }
 
+TesterStats ObjectManipulator::getGraspTesterStats() const
+{
+  return grasp_tester_fast_->getStats();
+}
+
+TesterStats ObjectManipulator::getPlaceTesterStats() const
+{
+  return standard_place_tester_->getStats();
+}
+
+void ObjectManipulator::saveIKCache()
+{
+  if(!ik_cache_ || ik_cache_file_.empty()) return;
+  size_t revision = ik_cache_->getRevision();
+  if(revision == ik_cache_saved_revision_) return;
+  if(!ik_cache_->save(ik_cache_file_)) 
+  {
+    ROS_WARN("Failed to save cached IK results to %s", ik_cache_file_.c_str());
+    return;
+  }
+  ik_cache_saved_revision_ = revision;
+}
+
+void ObjectManipulator::publishTesterStats(const ros::TimerEvent &event)
+{
+  if(diagnostics_pub_.getNumSubscribers() == 0) return;
+  diagnostic_msgs::DiagnosticArray array;
+  array.header.stamp = ros::Time::now();
+  array.status.resize(2);
+  getGraspTesterStats().toDiagnosticStatus(array.status[0]);
+  array.status[0].name = "object_manipulator: grasp tester";
+  getPlaceTesterStats().toDiagnosticStatus(array.status[1]);
+  array.status[1].name = "object_manipulator: place tester";
+  for(size_t i=0; i<array.status.size(); i++)
+  {
+    array.status[i].level = diagnostic_msgs::DiagnosticStatus::OK;
+    array.status[i].message = "Feasibility testing statistics";
+  }
+
+  size_t hits, misses;
+  mechInterface().getPlanningSceneCacheStats(hits, misses);
+  diagnostic_msgs::DiagnosticStatus cache_status;
+  cache_status.name = "object_manipulator: planning scene cache";
+  cache_status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  cache_status.message = "Planning scene cache statistics";
+  diagnostic_msgs::KeyValue kv;
+  kv.key = "hits";
+  kv.value = boost::lexical_cast<std::string>(hits);
+  cache_status.values.push_back(kv);
+  kv.key = "misses";
+  kv.value = boost::lexical_cast<std::string>(misses);
+  cache_status.values.push_back(kv);
+  if(hits + misses > 0)
+  {
+    kv.key = "hit_rate";
+    kv.value = boost::lexical_cast<std::string>((double)hits / (hits + misses));
+    cache_status.values.push_back(kv);
+  }
+  size_t incremental, full;
+  mechInterface().getPlanningSceneInstallCounts(incremental, full);
+  kv.key = "incremental_installs";
+  kv.value = boost::lexical_cast<std::string>(incremental);
+  cache_status.values.push_back(kv);
+  kv.key = "full_rebuilds";
+  kv.value = boost::lexical_cast<std::string>(full);
+  cache_status.values.push_back(kv);
+  array.status.push_back(cache_status);
+  diagnostics_pub_.publish(array);
+}
+
 void ObjectManipulator::graspFeedback(
                                  actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
                                  size_t tested_grasps, size_t current_grasp)
@@ -168,32 +527,329 @@ void ObjectManipulator::graspFeedback(
   action_server->publishFeedback(feedback);
 }
 
-void ObjectManipulator::graspPlanningFeedbackCallback(
+void ObjectManipulator::graspPlanningFeedbackCallback(unsigned int generation,
                                              const object_manipulation_msgs::GraspPlanningFeedbackConstPtr &feedback)
 {
   ROS_DEBUG_STREAM_NAMED("manipulation", "Feedback from planning action, total grasps: " << feedback->grasps.size());
-  grasp_container_.addGrasps(feedback->grasps);
+  grasp_container_.addGrasps(boost::shared_ptr<const std::vector<Grasp> >(feedback, &feedback->grasps), 
+                             generation);
 }
 
-void ObjectManipulator::graspPlanningDoneCallback(const actionlib::SimpleClientGoalState& state,
+void ObjectManipulator::graspPlanningDoneCallback(unsigned int generation,
+                                                  const actionlib::SimpleClientGoalState& state,
                                              const object_manipulation_msgs::GraspPlanningResultConstPtr &result)
 {
   if (state == actionlib::SimpleClientGoalState::SUCCEEDED)
   {
     ROS_DEBUG_STREAM_NAMED("manipulation", "Final result from planning action, total grasps: " << result->grasps.size());
-    grasp_container_.addGrasps(result->grasps);
+    grasp_container_.addGrasps(boost::shared_ptr<const std::vector<Grasp> >(result, &result->grasps),
+                               generation);
   }
   else
   {
     ROS_ERROR("Grasp planning action did not succeed");
   }
+  grasp_container_.close(generation);
+}
+
+bool ObjectManipulator::warmUpGraspPlanners(ros::Duration timeout, std::vector<std::string> &missing)
+{
+  boost::mutex::scoped_lock pickup_lock(pickup_mutex_);
+  ros::Time start_time = ros::Time::now();
+  //the planners selectGraspPlanner() can choose from
+  std::vector<std::string> planners;
+  if (use_probabilistic_planner_) 
+  {
+    planners.push_back(default_probabilistic_planner_);
+  }
+  else
+  {
+    planners.push_back(default_cluster_planner_);
+    planners.push_back(default_database_planner_);
+  }
+  //start connecting to all of them at once, then wait for each in turn
+  for (size_t i=0; i<planners.size(); i++) grasp_planning_actions_.startWaiting(planners[i]);
+  bool found_all = true;
+  for (size_t i=0; i<planners.size(); i++)
+  {
+    ros::Duration remaining(0);
+    if (timeout > ros::Duration(0))
+    {
+      remaining = timeout - (ros::Time::now() - start_time);
+      if (remaining < ros::Duration(0.001)) remaining = ros::Duration(0.001);
+    }
+    try
+    {
+      grasp_planning_actions_.client(planners[i], remaining);
+    }
+    catch (ServiceNotFoundException &ex)
+    {
+      missing.push_back(ex.what());
+      found_all = false;
+    }
+  }
+  ROS_INFO("Object manipulator: grasp planner warm-up took %.2f s", (ros::Time::now() - start_time).toSec());
+  return found_all;
+}
+
+std::string ObjectManipulator::selectGraspPlanner(const GraspableObject &target)
+{
+  if (use_probabilistic_planner_)
+  {
+    ROS_INFO("Using probabilistic planner");
+    // use the default probabilistic planner
+    return default_probabilistic_planner_;
+  }
+  // decide which grasp planner to call depending on the type of object
+  if (!target.potential_models.empty()) return default_database_planner_;
+  return default_cluster_planner_;
+}
+
+void ObjectManipulator::sendGraspPlanningGoal(const PickupGoal &pickup_goal, const std::string &planner_action)
+{
+  object_manipulation_msgs::GraspPlanningGoal goal;
+  goal.arm_name = pickup_goal.arm_name;
+  goal.target = pickup_goal.target;
+  goal.collision_object_name = pickup_goal.collision_object_name;
+  goal.collision_support_surface_name = pickup_goal.collision_support_surface_name;
+  goal.movable_obstacles = pickup_goal.movable_obstacles;
+  grasp_planning_actions_.client(planner_action).sendGoal(goal);
+}
+
+bool ObjectManipulator::waitForGraspPlanning(const std::string &planner_action, 
+                                             boost::function<bool()> interrupt_function,
+                                             std::vector<Grasp> &grasps)
+{
+  actionlib::SimpleActionClient<GraspPlanningAction> &client = grasp_planning_actions_.client(planner_action);
+  while (!client.waitForResult(ros::Duration(0.25)))
+  {
+    if (interrupt_function && interrupt_function()) throw InterruptRequestedException();
+    if (client.getState() == actionlib::SimpleClientGoalState::LOST) 
+    {
+      ROS_ERROR("Lost the goal of grasp planning action %s", planner_action.c_str());
+      return false;
+    }
+  }
+  if (client.getState() != actionlib::SimpleClientGoalState::SUCCEEDED || !client.getResult()) 
+  {
+    ROS_ERROR("Grasp planning action %s did not succeed", planner_action.c_str());
+    return false;
+  }
+  grasps = client.getResult()->grasps;
+  return true;
+}
+
+void ObjectManipulator::pickupFeasibility(const object_manipulation_msgs::PickupFeasibilityGoal::ConstPtr &goal,
+                   actionlib::SimpleActionServer<object_manipulation_msgs::PickupFeasibilityAction> *action_server)
+{
+  boost::mutex::scoped_lock pickup_lock(pickup_mutex_);
+
+  object_manipulation_msgs::PickupFeasibilityResult result;
+  result.manipulation_result.value = ManipulationResult::UNFEASIBLE;
+  size_t num_objects = goal->targets.size();
+  if (!goal->collision_object_names.empty() && goal->collision_object_names.size() != num_objects)
+  {
+    ROS_ERROR("Pickup feasibility: %zd collision object names given for %zd targets", 
+              goal->collision_object_names.size(), num_objects);
+    result.manipulation_result.value = ManipulationResult::ERROR;
+    action_server->setAborted(result);
+    return;
+  }
+  result.objects.resize(num_objects);
+
+  //the pickup goals that are being tested; only the target is different for each one
+  std::vector<PickupGoal> pickup_goals(num_objects);
+  std::vector<std::string> planner_actions(num_objects);
+  for (size_t i=0; i<num_objects; i++)
+  {
+    pickup_goals[i].arm_name = goal->arm_name;
+    pickup_goals[i].target = goal->targets[i];
+    if (!goal->collision_object_names.empty()) pickup_goals[i].collision_object_name = goal->collision_object_names[i];
+    pickup_goals[i].collision_support_surface_name = goal->collision_support_surface_name;
+    pickup_goals[i].allow_gripper_support_collision = goal->allow_gripper_support_collision;
+    pickup_goals[i].lift = goal->lift;
+    pickup_goals[i].only_perform_feasibility_test = true;
+    pickup_goals[i].additional_collision_operations = goal->additional_collision_operations;
+    pickup_goals[i].additional_link_padding = goal->additional_link_padding;
+    planner_actions[i] = selectGraspPlanner(goal->targets[i]);
+  }
+
+  boost::function<bool()> interrupt_function = 
+    boost::bind(&actionlib::SimpleActionServer<object_manipulation_msgs::PickupFeasibilityAction>::isPreemptRequested,
+                action_server);
+  grasp_tester_fast_->setInterruptFunction(interrupt_function);
+  grasp_tester_fast_->setFeedbackFunction(boost::function<void(size_t)>());
+
+  ScopedGoalCancel<GraspPlanningAction> goal_cancel(NULL);
+  try
+  {
+    //the planner starts on the first object while we get the planning scene, which is used for all objects
+    arm_navigation_msgs::OrderedCollisionOperations emp_coll;
+    std::vector<arm_navigation_msgs::LinkPadding> link_padding;
+    PlanningSceneFetch planning_scene_fetch = mechInterface().startPlanningSceneFetch(emp_coll, link_padding);
+    if (num_objects > 0)
+    {
+      sendGraspPlanningGoal(pickup_goals[0], planner_actions[0]);
+      goal_cancel.setClient(&grasp_planning_actions_.client(planner_actions[0]));
+    }
+    mechInterface().finishPlanningSceneFetch(planning_scene_fetch);
+
+    std::vector< std::pair<int, size_t> > feasible_objects;
+    for (size_t i=0; i<num_objects; i++)
+    {
+      object_manipulation_msgs::PickupFeasibilityFeedback feedback;
+      feedback.tested_objects = i;
+      feedback.total_objects = num_objects;
+      action_server->publishFeedback(feedback);
+
+      std::vector<Grasp> grasps;
+      bool planned = waitForGraspPlanning(planner_actions[i], interrupt_function, grasps);
+      //the planner works on the next object while this one is tested
+      if (i+1 < num_objects)
+      {
+        sendGraspPlanningGoal(pickup_goals[i+1], planner_actions[i+1]);
+        goal_cancel.setClient(&grasp_planning_actions_.client(planner_actions[i+1]));
+      }
+      else
+      {
+        goal_cancel.setClient(NULL);
+      }
+
+      object_manipulation_msgs::ObjectFeasibility &object = result.objects[i];
+      object.feasible_grasps = 0;
+      object.manipulation_result.value = ManipulationResult::UNFEASIBLE;
+      if (!planned)
+      {
+        object.manipulation_result.value = ManipulationResult::ERROR;
+        continue;
+      }
+      if (grasps.empty()) continue;
+
+      std::vector<GraspExecutionInfo> execution_info;
+      grasp_tester_fast_->testGrasps(pickup_goals[i], grasps, execution_info, false);
+      object.grasps.swap(grasps);
+      for (size_t j=0; j<execution_info.size(); j++)
+      {
+        object.grasp_results.push_back(execution_info[j].result_);
+        if (execution_info[j].result_.result_code == GraspResult::SUCCESS) object.feasible_grasps++;
+      }
+      //in case the tester stopped early, keep the grasps and their results matched
+      object.grasps.resize(object.grasp_results.size());
+      if (object.feasible_grasps > 0)
+      {
+        object.manipulation_result.value = ManipulationResult::SUCCESS;
+        feasible_objects.push_back(std::make_pair(-object.feasible_grasps, i));
+      }
+      ROS_DEBUG_NAMED("manipulation", "Pickup feasibility: object %zd has %d feasible grasps out of %zd", 
+                      i, object.feasible_grasps, object.grasps.size());
+    }
+
+    //most feasible grasps first, otherwise in the order of the request
+    std::sort(feasible_objects.begin(), feasible_objects.end());
+    for (size_t i=0; i<feasible_objects.size(); i++) result.pick_order.push_back(feasible_objects[i].second);
+    if (!feasible_objects.empty())
+    {
+      result.manipulation_result.value = ManipulationResult::SUCCESS;
+      action_server->setSucceeded(result);
+    }
+    else
+    {
+      action_server->setAborted(result);
+    }
+  }
+  catch (InterruptRequestedException &ex)
+  {
+    ROS_DEBUG_NAMED("manipulation","Pickup feasibility goal preempted");
+    action_server->setPreempted();
+  }
+  catch (ServiceNotFoundException &ex)
+  {
+    ROS_ERROR("Pickup feasibility: grasp planning action not found");
+    result.manipulation_result.value = ManipulationResult::ERROR;
+    action_server->setAborted(result);
+  }
+  catch (GraspException &ex)
+  {
+    ROS_ERROR("Pickup feasibility error; exception: %s", ex.what());
+    result.manipulation_result.value = ManipulationResult::ERROR;
+    action_server->setAborted(result);
+  }
+}
+
+void ObjectManipulator::testGraspsInBackground(PickupGoal::ConstPtr pickup_goal, GraspTester *grasp_tester,
+                       actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+                       TestedGraspQueue *tested_grasps, PlanningSceneFetch planning_scene_fetch,
+                       std::vector<GraspExecutionInfo> pretested)
+{
+  bool return_on_first_hit = !pickup_goal->only_perform_feasibility_test;
+  try
+  {
+    mechInterface().finishPlanningSceneFetch(planning_scene_fetch);
+
+    size_t next_grasp = 0;
+    while (1)
+    {
+      if (tested_grasps->interrupted()) throw InterruptRequestedException();
+      GraspBatch batch = grasp_container_.waitForGrasps(next_grasp, ros::Duration(0.25));
+      if (batch.empty())
+      {
+        //nothing can be added once the container is closed, so anything added before is seen here
+        if (grasp_container_.isClosed() && grasp_container_.size() <= next_grasp) break;
+        continue;
+      }
+      const std::vector<object_manipulation_msgs::Grasp> &grasps = batch.grasps();
+      size_t done = 0;
+      for (; next_grasp + done < pretested.size() && done < grasps.size(); done++)
+      {
+        tested_grasps->push(batch, done, pretested[next_grasp + done]);
+      }
+      while (done < grasps.size())
+      {
+        //only when resuming after a hit do the remaining grasps need to be copied
+        std::vector<object_manipulation_msgs::Grasp> remaining;
+        if (done > 0) remaining.assign(grasps.begin() + done, grasps.end());
+        grasp_tester->setFeedbackFunction(boost::bind(&ObjectManipulator::graspFeedback, 
+                                                      this, action_server, next_grasp + done, _1));
+        //the performer also uses the collision models, for checking state validity; the fast tester 
+        //only locks them while setting up, not while its workers run
+        std::vector<GraspExecutionInfo> execution_info;
+        grasp_tester->testGrasps(*pickup_goal, done > 0 ? remaining : grasps, execution_info, 
+                                 return_on_first_hit);
+        if (execution_info.empty()) throw GraspException("grasp tester provided empty ExecutionInfo");
+        for (size_t i=0; i<execution_info.size(); i++)
+        {
+          tested_grasps->push(batch, done + i, execution_info[i]);
+        }
+        done += execution_info.size();
+        const GraspResult &last_result = execution_info.back().result_;
+        if (last_result.result_code != GraspResult::SUCCESS && !last_result.continuation_possible)
+        {
+          tested_grasps->finish(TestedGraspQueue::DONE);
+          return;
+        }
+      }
+      next_grasp += grasps.size();
+    }
+    tested_grasps->finish(TestedGraspQueue::DONE);
+  }
+  catch (InterruptRequestedException &ex)
+  {
+    tested_grasps->finish(TestedGraspQueue::INTERRUPTED);
+  }
+  catch (MoveArmStuckException &ex)
+  {
+    tested_grasps->finish(TestedGraspQueue::MOVE_ARM_STUCK);
+  }
+  catch (GraspException &ex)
+  {
+    tested_grasps->finish(TestedGraspQueue::ERROR, ex.what());
+  }
 }
 
 void ObjectManipulator::pickup(const PickupGoal::ConstPtr &pickup_goal,
 			       actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server)
 {
-  //the result that will be returned
-  PickupResult result;
+  boost::mutex::scoped_lock pickup_lock(pickup_mutex_);
 
   //we are making some assumptions here. We are assuming that the frame of the cluster is the
   //cannonical frame of the system, so here we check that the frames of all recognitions
@@ -206,68 +862,196 @@ void ObjectManipulator::pickup(const PickupGoal::ConstPtr &pickup_goal,
       if ( pickup_goal->target.potential_models[i].pose.header.frame_id != pickup_goal->target.cluster.header.frame_id)
       {
         ROS_ERROR("Target object recognition result(s) not in the same frame as the cluster");
+        PickupResult result;
         result.manipulation_result.value = ManipulationResult::ERROR;
         action_server->setAborted(result);
         return;
       }
     }
   }
-  
-  //populate the grasp container
-  grasp_container_.clear();
-  bool using_planner_action;
-  std::string planner_action;
-  if (!pickup_goal->desired_grasps.empty())
+
+  if (!pickup_goal->arm_name.empty())
   {
-    //use the requested grasps, if any
-    grasp_container_.addGrasps(pickup_goal->desired_grasps);
-    using_planner_action = false;
+    pickupWithArm(pickup_goal, action_server, PriorGraspTests());
+    return;
   }
-  else
+  PriorGraspTests prior;
+  PickupGoal::ConstPtr arm_goal = chooseArm(pickup_goal, action_server, prior);
+  if (arm_goal) pickupWithArm(arm_goal, action_server, prior);
+}
+
+PickupGoal::ConstPtr ObjectManipulator::chooseArm(const PickupGoal::ConstPtr &pickup_goal,
+                           actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+                           PriorGraspTests &prior)
+{
+  PickupResult result;
+  result.manipulation_result.value = ManipulationResult::ERROR;
+  if (pickup_goal->ignore_collisions)
   {
-    if (use_probabilistic_planner_)
+    ROS_ERROR("Object manipulator: can not choose an arm when ignoring collisions; the goal must name one");
+    action_server->setAborted(result);
+    return PickupGoal::ConstPtr();
+  }
+  if (any_arm_names_.empty())
+  {
+    ROS_ERROR("Object manipulator: no arm named in the pickup goal, and no arms to choose from");
+    action_server->setAborted(result);
+    return PickupGoal::ConstPtr();
+  }
+
+  size_t num_arms = any_arm_names_.size();
+  std::vector<PickupGoal> arm_goals(num_arms, *pickup_goal);
+  for (size_t a=0; a<num_arms; a++) arm_goals[a].arm_name = any_arm_names_[a];
+  std::vector< std::vector<Grasp> > arm_grasps(num_arms);
+
+  boost::function<bool()> interrupt_function = 
+    boost::bind(&actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction>::isPreemptRequested,
+                action_server);
+  grasp_tester_fast_->setInterruptFunction(interrupt_function);
+  grasp_tester_fast_->setFeedbackFunction(boost::function<void(size_t)>());
+
+  ScopedGoalCancel<GraspPlanningAction> goal_cancel(NULL);
+  try
+  {
+    //the planner starts on the first arm while we get the planning scene, which is used for all arms
+    arm_navigation_msgs::OrderedCollisionOperations emp_coll;
+    std::vector<arm_navigation_msgs::LinkPadding> link_padding;
+    PlanningSceneFetch planning_scene_fetch = mechInterface().startPlanningSceneFetch(emp_coll, link_padding);
+    std::string planner_action;
+    if (pickup_goal->desired_grasps.empty())
     {
-        ROS_INFO("Using probabilistic planner");
-        // use the default probabilistic planner
-        planner_action = default_probabilistic_planner_;
+      planner_action = selectGraspPlanner(pickup_goal->target);
+      sendGraspPlanningGoal(arm_goals[0], planner_action);
+      goal_cancel.setClient(&grasp_planning_actions_.client(planner_action));
     }
     else
     {
-        // decide which grasp planner to call depending on the type of object
-        if (!pickup_goal->target.potential_models.empty())
-            planner_action = default_database_planner_;
-        else
-            planner_action = default_cluster_planner_;        
+      for (size_t a=0; a<num_arms; a++) arm_grasps[a] = pickup_goal->desired_grasps;
     }
+    mechInterface().finishPlanningSceneFetch(planning_scene_fetch);
 
-    //call the planner action, which will populate the grasp container as feedback arrives
-    object_manipulation_msgs::GraspPlanningGoal goal;
-    goal.arm_name = pickup_goal->arm_name;
-    goal.target = pickup_goal->target;
-    goal.collision_object_name = pickup_goal->collision_object_name;
-    goal.collision_support_surface_name = pickup_goal->collision_support_surface_name;
-    goal.movable_obstacles = pickup_goal->movable_obstacles;
-    try
+    //a planner client handles one goal at a time, so the arms are planned for one after the other
+    if (!planner_action.empty())
     {
-      grasp_planning_actions_.client(planner_action).sendGoal(goal, 
-                                          boost::bind(&ObjectManipulator::graspPlanningDoneCallback, this, _1, _2),
-                                          actionlib::SimpleActionClient<GraspPlanningAction>::SimpleActiveCallback(), 
-                                          boost::bind(&ObjectManipulator::graspPlanningFeedbackCallback, this, _1));
+      for (size_t a=0; a<num_arms; a++)
+      {
+        if (a > 0) sendGraspPlanningGoal(arm_goals[a], planner_action);
+        if (!waitForGraspPlanning(planner_action, interrupt_function, arm_grasps[a]))
+        {
+          ROS_WARN("Object manipulator: no grasps planned for %s", arm_goals[a].arm_name.c_str());
+          arm_grasps[a].clear();
+        }
+      }
+      goal_cancel.setClient(NULL);
     }
-    catch (ServiceNotFoundException &ex)
+
+    //each arm gets its own share of the tester's workers, so the arms are tested side by side
+    std::vector< std::vector<GraspExecutionInfo> > execution_info;
+    grasp_tester_fast_->testGraspsForArms(arm_goals, arm_grasps, execution_info, true);
+
+    //the winner is the arm whose first feasible grasp is the most promising one; earlier arms win ties
+    int best_arm = -1;
+    double best_probability = 0.0;
+    for (size_t a=0; a<num_arms; a++)
     {
-      ROS_ERROR("Planning action %s not found", planner_action.c_str());
-      result.manipulation_result.value = ManipulationResult::ERROR;
+      for (size_t i=0; i<execution_info[a].size(); i++)
+      {
+        result.attempted_grasps.push_back(arm_grasps[a][i]);
+        result.attempted_grasp_results.push_back(execution_info[a][i].result_);
+      }
+      if (execution_info[a].empty() || execution_info[a].back().result_.result_code != GraspResult::SUCCESS) 
+      {
+        ROS_DEBUG_NAMED("manipulation", "Object manipulator: no feasible grasp for %s", 
+                        arm_goals[a].arm_name.c_str());
+        continue;
+      }
+      double probability = arm_grasps[a][execution_info[a].size()-1].success_probability;
+      ROS_DEBUG_NAMED("manipulation", "Object manipulator: first feasible grasp for %s has probability %f", 
+                      arm_goals[a].arm_name.c_str(), probability);
+      if (best_arm < 0 || probability > best_probability)
+      {
+        best_arm = a;
+        best_probability = probability;
+      }
+    }
+    if (best_arm < 0)
+    {
+      ROS_INFO("Object manipulator: no feasible grasps for any arm");
+      result.manipulation_result.value = ManipulationResult::UNFEASIBLE;
       action_server->setAborted(result);
-      return;
+      return PickupGoal::ConstPtr();
+    }
+    ROS_INFO("Object manipulator: picking up with %s", arm_goals[best_arm].arm_name.c_str());
+
+    //the feasible grasp goes first, and is not tested again; the untested ones after it are still 
+    //there to fall back on
+    PickupGoal::Ptr arm_goal(new PickupGoal(arm_goals[best_arm]));
+    size_t first_feasible = execution_info[best_arm].size() - 1;
+    arm_goal->desired_grasps.assign(arm_grasps[best_arm].begin() + first_feasible, arm_grasps[best_arm].end());
+    prior.attempted_grasps_.clear();
+    prior.attempted_grasp_results_.clear();
+    for (size_t a=0; a<num_arms; a++)
+    {
+      for (size_t i=0; i<execution_info[a].size(); i++)
+      {
+        if ((int)a == best_arm && i == first_feasible) continue;
+        prior.attempted_grasps_.push_back(arm_grasps[a][i]);
+        prior.attempted_grasp_results_.push_back(execution_info[a][i].result_);
+      }
     }
-    using_planner_action = true;
+    prior.tested_.assign(1, execution_info[best_arm][first_feasible]);
+    return arm_goal;
   }
-  ScopedGoalCancel<GraspPlanningAction> goal_cancel(NULL);
-  if (using_planner_action)
+  catch (InterruptRequestedException &ex)
   {
-    goal_cancel.setClient(&grasp_planning_actions_.client(planner_action));
+    ROS_DEBUG_NAMED("manipulation","Pickup goal preempted");
+    action_server->setPreempted();
+  }
+  catch (ServiceNotFoundException &ex)
+  {
+    ROS_ERROR("Object manipulator: grasp planning action not found");
+    action_server->setAborted(result);
+  }
+  catch (MoveArmStuckException &ex)
+  {
+    ROS_ERROR("Choosing an arm failed because move_arm is stuck");
+    result.manipulation_result.value = ManipulationResult::ARM_MOVEMENT_PREVENTED;
+    action_server->setAborted(result);
+  }
+  catch (GraspException &ex)
+  {
+    ROS_ERROR("Error choosing an arm; exception: %s", ex.what());
+    result.manipulation_result.value = ManipulationResult::ERROR;
+    action_server->setAborted(result);
   }
+  return PickupGoal::ConstPtr();
+}
+
+namespace {
+
+//! Clears the interrupt function of a grasp tester when going out of scope
+/*! For interrupt functions bound to something that lives no longer than the caller. */
+class ScopedTesterInterrupt
+{
+private:
+  GraspTester *tester_;
+public:
+  ScopedTesterInterrupt(GraspTester *tester) : tester_(tester) {}
+  ~ScopedTesterInterrupt(){tester_->setInterruptFunction(boost::function<bool()>());}
+};
+
+} //namespace
+
+void ObjectManipulator::pickupWithArm(const PickupGoal::ConstPtr &pickup_goal,
+			       actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction> *action_server,
+                               const PriorGraspTests &prior)
+{
+  //the result that will be returned
+  PickupResult result;
+  result.arm_name = pickup_goal->arm_name;
+  result.attempted_grasps = prior.attempted_grasps_;
+  result.attempted_grasp_results = prior.attempted_grasp_results_;
+
   //decide which grasp tester and performer will be used
   GraspTester *grasp_tester;
   GraspPerformer *grasp_performer;
@@ -289,86 +1073,163 @@ void ObjectManipulator::pickup(const PickupGoal::ConstPtr &pickup_goal,
     }
   }
 
-  grasp_tester->setInterruptFunction(
+  //populate the grasp container
+  unsigned int generation = grasp_container_.clear();
+  bool using_planner_action = pickup_goal->desired_grasps.empty();
+  std::string planner_action;
+  if (!using_planner_action)
+  {
+    //use the requested grasps, if any
+    grasp_container_.addGrasps(boost::shared_ptr<const std::vector<Grasp> >(pickup_goal, 
+                                                                            &pickup_goal->desired_grasps),
+                               generation);
+    grasp_container_.close(generation);
+  }
+  else
+  {
+    planner_action = selectGraspPlanner(pickup_goal->target);
+  }
+
+  //start testing in the background; this first installs the planning scene, fetched while the planner 
+  //is working, then tests grasps as soon as they are in the container
+  //grasps tested before were tested against the installed planning scene, which is kept for the rest
+  PlanningSceneFetch planning_scene_fetch;
+  if (prior.tested_.empty())
+  {
+    arm_navigation_msgs::OrderedCollisionOperations emp_coll;
+    std::vector<arm_navigation_msgs::LinkPadding> link_padding;
+    planning_scene_fetch = mechInterface().startPlanningSceneFetch(emp_coll, link_padding);
+  }
+  else
+  {
+    planning_scene_fetch.cached_ = true;
+  }
+  //goes out of scope after the queue, whose destructor stops the testing thread, so the tester is not 
+  //left with an interrupt function bound to a queue that is gone
+  ScopedTesterInterrupt tester_interrupt(grasp_tester);
+  TestedGraspQueue tested_grasps(
                boost::bind(&actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction>::isPreemptRequested,
                            action_server));
+  grasp_tester->setInterruptFunction(boost::bind(&TestedGraspQueue::interrupted, &tested_grasps));
   grasp_performer->setInterruptFunction(
                boost::bind(&actionlib::SimpleActionServer<object_manipulation_msgs::PickupAction>::isPreemptRequested,
                            action_server));
+  tested_grasps.start(boost::bind(&ObjectManipulator::testGraspsInBackground, this, 
+                                  pickup_goal, grasp_tester, action_server, &tested_grasps, 
+                                  planning_scene_fetch, prior.tested_));
+
+  ScopedGoalCancel<GraspPlanningAction> goal_cancel(NULL);
+  if (using_planner_action)
+  {
+    //call the planner action, which will populate the grasp container as feedback arrives
+    object_manipulation_msgs::GraspPlanningGoal goal;
+    goal.arm_name = pickup_goal->arm_name;
+    goal.target = pickup_goal->target;
+    goal.collision_object_name = pickup_goal->collision_object_name;
+    goal.collision_support_surface_name = pickup_goal->collision_support_surface_name;
+    goal.movable_obstacles = pickup_goal->movable_obstacles;
+    try
+    {
+      grasp_planning_actions_.client(planner_action).sendGoal(goal, 
+                                          boost::bind(&ObjectManipulator::graspPlanningDoneCallback, this, generation, _1, _2),
+                                          actionlib::SimpleActionClient<GraspPlanningAction>::SimpleActiveCallback(), 
+                                          boost::bind(&ObjectManipulator::graspPlanningFeedbackCallback, this, generation, _1));
+    }
+    catch (ServiceNotFoundException &ex)
+    {
+      ROS_ERROR("Planning action %s not found", planner_action.c_str());
+      result.manipulation_result.value = ManipulationResult::ERROR;
+      action_server->setAborted(result);
+      return;
+    }
+    goal_cancel.setClient(&grasp_planning_actions_.client(planner_action));
+  }
 
   //PROF_RESET_ALL;
   //PROF_START_TIMER(TOTAL_PICKUP_TIMER);
 
-  ros::WallDuration dur(1.0);
-  dur.sleep();
-
-  arm_navigation_msgs::OrderedCollisionOperations emp_coll;
-  std::vector<arm_navigation_msgs::LinkPadding> link_padding;
-  mechInterface().getPlanningScene(emp_coll, link_padding);
-
-  std::map<unsigned int, unsigned int> results;
-
-  ros::WallTime start = ros::WallTime::now();
-
-  //try the grasps in the list until one succeeds
+  //perform the grasps in the order they pass testing, until one succeeds
   result.manipulation_result.value = ManipulationResult::UNFEASIBLE;
   try
   {
-    size_t tested_grasps = 0;
+    //grasps taken from the queue, in the order they were tested, but not dealt with yet
+    std::deque<TestedGrasp> ready;
     while (1)
     {
       if (action_server->isPreemptRequested()) throw InterruptRequestedException();
 
-      ROS_DEBUG_STREAM_NAMED("manipulation", "Object manipulator: getting grasps beyond " << tested_grasps);
-      std::vector<object_manipulation_msgs::Grasp> new_grasps = grasp_container_.getGrasps(tested_grasps);
-      if ( new_grasps.empty() )
-      { 
-        if ( using_planner_action && (grasp_planning_actions_.client(planner_action).getState() == 
-                                      actionlib::SimpleClientGoalState::ACTIVE || 
-                                      grasp_planning_actions_.client(planner_action).getState() == 
-                                      actionlib::SimpleClientGoalState::PENDING) )
+      //the container is closed by the planner's done callback, which does not come if the planner is lost
+      if ( using_planner_action && !grasp_container_.isClosed() && 
+           grasp_planning_actions_.client(planner_action).getState() == actionlib::SimpleClientGoalState::LOST )
+      {
+        ROS_WARN("Object manipulator: lost the goal of the grasp planning action");
+        grasp_container_.close(generation);
+      }
+
+      //wakes up as soon as a grasp has been tested; the timeout is only for checking for preemption
+      if (ready.empty() && !tested_grasps.popAll(ready, ros::Duration(0.25)))
+      {
+        std::string error;
+        TestedGraspQueue::Outcome outcome = tested_grasps.getOutcome(error);
+        if (outcome == TestedGraspQueue::TESTING)
         {
-          ROS_DEBUG_NAMED("manipulation", "Object manipulator: waiting for planner action to provide grasps");
-          ros::Duration(0.25).sleep();
+          ROS_DEBUG_NAMED("manipulation", "Object manipulator: waiting for grasps to be planned and tested");
           continue;
         }
+        if (outcome == TestedGraspQueue::INTERRUPTED) throw InterruptRequestedException();
+        if (outcome == TestedGraspQueue::MOVE_ARM_STUCK) throw MoveArmStuckException();
+        if (outcome == TestedGraspQueue::ERROR) throw GraspException("grasp tester: " + error);
+        ROS_INFO("Object manipulator: all grasps have been tested");
+        break;
+      }
+      std::vector<object_manipulation_msgs::Grasp> grasps(1, ready.front().grasp());
+      std::vector<GraspExecutionInfo> execution_info(1, ready.front().execution_info_);
+      ready.pop_front();
+      //try to perform it; later grasps keep being tested in the meantime
+      if (execution_info[0].result_.result_code == GraspResult::SUCCESS)
+      {
+        if (pickup_goal->only_perform_feasibility_test)
+        {
+          result.manipulation_result.value = ManipulationResult::SUCCESS;
+        }
         else
         {
-          ROS_INFO("Object manipulator: all grasps have been tested");
-          break;
+          //hand over the next feasible grasps that have already been tested too, so that the 
+          //performer can go on to them right away if this one fails
+          tested_grasps.popAll(ready, ros::Duration(0));
+          std::deque<TestedGrasp>::iterator it = ready.begin();
+          while (it != ready.end() && grasps.size() < grasp_performer->getRetryCandidates())
+          {
+            if (it->execution_info_.result_.result_code != GraspResult::SUCCESS) 
+            {
+              it++;
+              continue;
+            }
+            grasps.push_back(it->grasp());
+            execution_info.push_back(it->execution_info_);
+            it = ready.erase(it);
+          }
+          ROS_DEBUG_NAMED("manipulation", "Attempting to perform grasps (%zd ready)", grasps.size());
+          grasp_performer->performGrasps(*pickup_goal, grasps, execution_info);
+          if (execution_info.empty()) throw GraspException("grasp performer provided empty ExecutionInfo");
         }
       }
-      grasp_tester->setFeedbackFunction(boost::bind(&ObjectManipulator::graspFeedback, 
-                                                    this, action_server, tested_grasps,  _1));
-      //test a batch of grasps
-      std::vector<GraspExecutionInfo> execution_info;
-      grasp_tester->testGrasps(*pickup_goal, new_grasps, execution_info, !pickup_goal->only_perform_feasibility_test);
-      if (execution_info.empty()) throw GraspException("grasp tester provided empty ExecutionInfo");
-      if (execution_info.empty()) throw GraspException("grasp tester provided empty ExecutionInfo");
-      //try to perform them
-      if (!pickup_goal->only_perform_feasibility_test)
-      {
-        ROS_DEBUG_NAMED("manipulation", "Attempting to perform grasps");
-        grasp_performer->performGrasps(*pickup_goal, new_grasps, execution_info);
-      }
-      if (execution_info.empty()) throw GraspException("grasp performer provided empty ExecutionInfo");
-      //copy information about tested grasps over in result
+      //copy information about the grasps the performer got to over in result
       for (size_t i=0; i<execution_info.size(); i++)
       {
-        result.attempted_grasps.push_back(new_grasps[i]);
+        result.attempted_grasps.push_back(grasps[i]);
         result.attempted_grasp_results.push_back(execution_info[i].result_);
       }
+      const object_manipulation_msgs::Grasp &grasp = grasps.at( execution_info.size() -1 );
       //see if we're done
-      if (execution_info.back().result_.result_code == GraspResult::SUCCESS)
+      if (execution_info.back().result_.result_code == GraspResult::SUCCESS && 
+          !pickup_goal->only_perform_feasibility_test)
       {
+        ROS_DEBUG_NAMED("manipulation", "Grasp reports success");
         result.manipulation_result.value = ManipulationResult::SUCCESS;
-        if (!pickup_goal->only_perform_feasibility_test)
-        {
-          ROS_DEBUG_NAMED("manipulation", "Grasp reports success");
-          result.grasp = new_grasps.at( execution_info.size() -1 );
-          action_server->setSucceeded(result);
-          return;
-        }
+        result.grasp = grasp;
+        action_server->setSucceeded(result);
+        return;
       }
       //see if continuation is possible
       if (!execution_info.back().result_.continuation_possible)
@@ -377,7 +1238,7 @@ void ObjectManipulator::pickup(const PickupGoal::ConstPtr &pickup_goal,
         {
           ROS_ERROR("Continuation impossible when performing feasibility test");
         }
-        result.grasp = new_grasps.at( execution_info.size() -1 );
+        result.grasp = grasp;
         if (execution_info.back().result_.result_code == GraspResult::LIFT_FAILED)
           result.manipulation_result.value = ManipulationResult::LIFT_FAILED;
         else
@@ -385,8 +1246,6 @@ void ObjectManipulator::pickup(const PickupGoal::ConstPtr &pickup_goal,
         action_server->setAborted(result);
         return;
       }
-      //remember how many grasps we've tried
-      tested_grasps += execution_info.size();
     }
     //all the grasps have been tested
     if (pickup_goal->only_perform_feasibility_test && result.manipulation_result.value == ManipulationResult::SUCCESS)
@@ -458,8 +1317,11 @@ void ObjectManipulator::place(const object_manipulation_msgs::PlaceGoal::ConstPt
       place_tester->setFeedbackFunction(boost::bind(&ObjectManipulator::placeFeedback, 
                                                     this, action_server, tested_places, place_locations.size(), _1));
       //test a batch of locations
-      place_tester->testPlaces(*place_goal, place_locations, execution_info, 
-                               !place_goal->only_perform_feasibility_test);
+      {
+        boost::recursive_mutex::scoped_lock lock(mechInterface().getPlanningSceneMutex());
+        place_tester->testPlaces(*place_goal, place_locations, execution_info, 
+                                 !place_goal->only_perform_feasibility_test);
+      }
       if (execution_info.empty()) throw GraspException("place tester provided empty ExecutionInfo");
       //try to perform them
       if (!place_goal->only_perform_feasibility_test)
@@ -37,6 +37,7 @@
 #include "object_manipulator/tools/exceptions.h"
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/vector_tools.h"
+#include "object_manipulator/tools/pose_batch.h"
 
 using arm_navigation_msgs::ArmNavigationErrorCodes;
 using object_manipulation_msgs::PlaceLocationResult;
@@ -81,11 +82,8 @@ PlaceTester::computeGripperPose(geometry_msgs::PoseStamped place_location,
                                         std::string frame_id)
 {
   //get the gripper pose relative to place location
-  tf::Transform place_trans;
-  tf::poseMsgToTF(place_location.pose, place_trans);
   tf::Transform grasp_trans;
-  tf::poseMsgToTF(grasp_pose, grasp_trans);
-  grasp_trans = place_trans * grasp_trans;
+  tf::poseMsgToTF(composePoses(place_location.pose, grasp_pose), grasp_trans);
 
   //get it in the requested frame
   tf::Stamped<tf::Pose> grasp_trans_stamped;
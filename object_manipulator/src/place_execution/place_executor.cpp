@@ -36,6 +36,7 @@
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/exceptions.h"
 #include "object_manipulator/tools/vector_tools.h"
+#include "object_manipulator/tools/pose_batch.h"
 
 //#include <demo_synchronizer/synchronizer_client.h>
 
@@ -49,11 +50,8 @@ geometry_msgs::PoseStamped PlaceExecutor::computeGripperPose(geometry_msgs::Pose
                                                              std::string frame_id)
 {
   //get the gripper pose relative to place location
-  tf::Transform place_trans;
-  tf::poseMsgToTF(place_location.pose, place_trans);
   tf::Transform grasp_trans;
-  tf::poseMsgToTF(grasp_pose, grasp_trans);
-  grasp_trans = place_trans * grasp_trans;
+  tf::poseMsgToTF(composePoses(place_location.pose, grasp_pose), grasp_trans);
 
   //get it in the requested frame
   tf::Stamped<tf::Pose> grasp_trans_stamped;
@@ -33,11 +33,17 @@
 
 // Author(s): E. Gil JOnes
 
+#include <set>
+
+#include <boost/bind.hpp>
+
 #include "object_manipulator/place_execution/place_tester_fast.h"
 
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/vector_tools.h"
 #include "object_manipulator/tools/mechanism_interface.h"
+#include "object_manipulator/tools/exceptions.h"
+#include "object_manipulator/tools/message_hash.h"
 
 using object_manipulation_msgs::PlaceLocationResult;
 using arm_navigation_msgs::ArmNavigationErrorCodes;
@@ -50,6 +56,10 @@ namespace object_manipulator {
     consistent_angle_(M_PI/12.0), 
     num_points_(10), 
     redundancy_(2),
+    num_threads_(1),
+    seed_propagation_(false),
+    seed_distance_(0.05),
+    worker_pool_(kinematics_loader_, plugin_name),
     cm_(cm),
     state_(NULL),
     kinematics_loader_("kinematics_base","kinematics::KinematicsBase")
@@ -59,36 +69,14 @@ namespace object_manipulator {
   vis_marker_publisher_ = nh.advertise<visualization_msgs::Marker> ("grasp_executor_fast", 128);
   vis_marker_array_publisher_ = nh.advertise<visualization_msgs::MarkerArray> ("grasp_executor_fast_array", 128);
 
-  const std::map<std::string, planning_models::KinematicModel::GroupConfig>& group_config_map = 
-    getCollisionModels()->getKinematicModel()->getJointModelGroupConfigMap();
-
-
-  for(std::map<std::string, planning_models::KinematicModel::GroupConfig>::const_iterator it = group_config_map.begin();
-      it != group_config_map.end();
-      it++) {
-    if(!it->second.base_link_.empty() && !it->second.tip_link_.empty()) {
-      kinematics::KinematicsBase* kinematics_solver = NULL;
-      try
-      {
-        kinematics_solver = kinematics_loader_.createClassInstance(plugin_name);
-      }
-      catch(pluginlib::PluginlibException& ex)
-      {
-        ROS_ERROR("The plugin failed to load. Error1: %s", ex.what());    //handle the class failing to load
-        return;
-      }
-
-      ik_solver_map_[it->first] = new arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware(kinematics_solver,
-                                                                                                          getCollisionModels(),
-                                                                                                          it->first);
-      ik_solver_map_[it->first]->setSearchDiscretization(.025);
-    }
-  }
+  createIKSolvers(getCollisionModels(), kinematics_loader_, plugin_name, ik_solver_map_);
 }
 
 PlaceTesterFast::~PlaceTesterFast()
 {
-  for(std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*>::iterator it = ik_solver_map_.begin();
+  //the kinematics loader is destroyed before the pool, and takes the plugin libraries with it
+  worker_pool_.clear();
+  for(IKSolverMap::iterator it = ik_solver_map_.begin();
       it != ik_solver_map_.end();
       it++) {
     delete it->second;
@@ -142,41 +130,434 @@ void PlaceTesterFast::getGroupLinks(const std::string& group_name,
   group_links = jmg->getGroupLinkNames();
 }
 
-bool PlaceTesterFast::getInterpolatedIK(const std::string& arm_name,
+
+bool PlaceTesterFast::getInterpolatedIK(const PlaceTestBatch &batch,
+                                        TesterWorkspace &workspace,
                                         const tf::Transform& first_pose,
                                         const tf::Vector3& direction,
                                         const double& distance,
                                         const std::vector<double>& ik_solution,
                                         const bool& reverse, 
                                         const bool& premultiply,
-                                        trajectory_msgs::JointTrajectory& traj) {
-
-  std::map<std::string, double> ik_solution_map;
-  for(unsigned int i = 0; i < traj.joint_names.size(); i++) {
-    ik_solution_map[traj.joint_names[i]] = ik_solution[i];
-  }
+                                        trajectory_msgs::JointTrajectory& traj,
+                                        arm_navigation_msgs::ArmNavigationErrorCodes& error_code) {
 
-  getPlanningSceneState()->setKinematicState(ik_solution_map);
+  batch.posture_plan_.applyJoints(batch.arm_joints_, ik_solution, *workspace.state_, workspace.state_values_);
 
   geometry_msgs::Pose start_pose;
   tf::poseTFToMsg(first_pose, start_pose);
 
   arm_navigation_msgs::Constraints emp;
+  return workspace.ik_solver_map_[batch.place_goal_->arm_name]->interpolateIKDirectional(start_pose,
+                                                                                         direction,
+                                                                                         distance,
+                                                                                         emp,
+                                                                                         workspace.state_,
+                                                                                         error_code,
+                                                                                         traj,
+                                                                                         redundancy_, 
+                                                                                         consistent_angle_,
+                                                                                         reverse,
+                                                                                         premultiply,
+                                                                                         num_points_,
+                                                                                         ros::Duration(2.5),
+                                                                                         false);
+}
+
+void PlaceTesterFast::resetState(const PlaceTestBatch &batch, TesterWorkspace &workspace, size_t posture)
+{
+  //starting from the planning scene state every time, so results do not depend on the order of testing
+  std::vector<double> &values = workspace.state_values_;
+  values = batch.posture_plan_.getBaseValues();
+  batch.posture_plan_.setPosture(posture, values);
+  workspace.state_->setKinematicState(values);
+}
+
+void PlaceTesterFast::configureStage(const PlaceTestBatch &batch, TesterWorkspace &workspace, int stage)
+{
+  if(workspace.configuration_ == stage) return;
+  planning_environment::CollisionModels* cm = workspace.cm_;
+  switch(stage)
+  {
+  case PLACE_COLLISION_STAGE:
+    //only checking the gripper, with the object and support surface allowed and reduced padding
+    cm->setAlteredAllowedCollisionMatrix(batch.object_support_all_arm_disable_acm_);
+    cm->applyLinkPaddingToCollisionSpace(batch.place_link_padding_);
+    break;
+  case PREPLACE_COLLISION_STAGE:
+    //gripper only with default padding, not allowing anything different 
+    cm->revertCollisionSpacePaddingToDefault();
+    cm->setAlteredAllowedCollisionMatrix(batch.group_all_arm_disable_acm_);
+    break;
+  case RETREAT_COLLISION_STAGE:
+    //TODO - for now, just have to hope that we're not in contact with the object
+    //after we release, but there's not a good way to check this for now
+    //so we just leave the object all arm disable on for the retreat position check
+    cm->revertCollisionSpacePaddingToDefault();
+    cm->setAlteredAllowedCollisionMatrix(batch.object_all_arm_disable_acm_);
+    break;
+  case IK_STAGE:
+    //re-enabling collisions for the arms, and also reducing link paddings
+    cm->setAlteredAllowedCollisionMatrix(batch.object_support_disable_acm_);
+    cm->applyLinkPaddingToCollisionSpace(batch.place_link_padding_);
+    break;
+  case FINAL_PREPLACE_STAGE:
+    //the start of the place approach needs to be collision-free according to the default collision matrix
+    cm->revertCollisionSpacePaddingToDefault();
+    cm->setAlteredAllowedCollisionMatrix(batch.group_disable_acm_);
+    break;
+  case FINAL_RETREAT_STAGE:
+    //this check has always been done with the default collision matrix when returning on the first hit
+    cm->revertCollisionSpacePaddingToDefault();
+    if(batch.return_on_first_hit_) cm->setAlteredAllowedCollisionMatrix(batch.group_disable_acm_);
+    else cm->setAlteredAllowedCollisionMatrix(batch.object_support_disable_acm_);
+    break;
+  }
+  workspace.configuration_ = stage;
+}
+
+void PlaceTesterFast::testPlaceCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  PlaceExecutionInfo &info = (*batch.execution_info_)[i];
+  planning_environment::CollisionModels* cm = workspace.cm_;
+  planning_models::KinematicState* state = workspace.state_;
+
+  //using the grasp posture
+  resetState(batch, workspace, batch.post_grasp_posture_);
+    
+  //always true
+  info.result_.continuation_possible = true;
+    
+  if(!batch.place_pose_valid_[i]) {
+    ROS_INFO_STREAM("Something wrong with pose conversion");
+    return;
+  }
+  info.gripper_place_pose_.header = batch.world_header_;
+  info.gripper_place_pose_.header.stamp = (*batch.place_locations_)[i].header.stamp;
+  batch.place_poses_.get(i, info.gripper_place_pose_.pose);
+  state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.place_poses_.getTransform(i));
+    
+  if(cm->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG_STREAM("Place in collision");
+    info.result_.result_code = PlaceLocationResult::PLACE_IN_COLLISION;
+  } else {
+    info.result_.result_code = 0;
+  }
+}
+
+void PlaceTesterFast::testPreplaceCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  planning_models::KinematicState* state = workspace.state_;
+
+  batch.posture_plan_.applyBase(*state);
+    
+  state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.approach_poses_.getTransform(i));
+    
+  if(workspace.cm_->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG_STREAM("Preplace in collision");
+    (*batch.execution_info_)[i].result_.result_code = PlaceLocationResult::PREPLACE_IN_COLLISION;
+  }
+}
+
+void PlaceTesterFast::testRetreatCollision(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  planning_models::KinematicState* state = workspace.state_;
+
+  //with the gripper at post grasp position
+  resetState(batch, workspace, batch.post_grasp_posture_);
+
+  state->updateKinematicStateWithLinkAt(batch.gripper_frame_, batch.retreat_poses_.getTransform(i));
+    
+  if(workspace.cm_->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG_STREAM("Retreat in collision");
+    (*batch.execution_info_)[i].result_.result_code = PlaceLocationResult::RETREAT_IN_COLLISION;
+  }
+}
+
+void PlaceTesterFast::testPlaceIK(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  const object_manipulation_msgs::PlaceGoal &place_goal = *batch.place_goal_;
+  PlaceExecutionInfo &info = (*batch.execution_info_)[i];
+  planning_models::KinematicState* state = workspace.state_;
+
+  //getting back to original state for seed
+  resetState(batch, workspace, batch.post_grasp_posture_);
+  if(!batch.ik_seeds_.empty() && !batch.ik_seeds_[i].empty()) {
+    //or starting from the solution for a neighbouring location
+    batch.posture_plan_.setJoints(batch.arm_joints_, batch.ik_seeds_[i], workspace.state_values_);
+    state->setKinematicState(workspace.state_values_);
+    stats_.increment(TesterStats::IK_SEEDED);
+  }
+
+  //now call ik for grasp
+  geometry_msgs::Pose place_geom_pose;
+  batch.place_poses_.get(i, place_geom_pose);
+  geometry_msgs::PoseStamped base_link_place_pose;
+  workspace.cm_->convertPoseGivenWorldTransform(*state,
+                                                workspace.ik_solver_map_[place_goal.arm_name]->getBaseName(),
+                                                batch.world_header_,
+                                                place_geom_pose,
+                                                base_link_place_pose);
+
+  ReachabilityMaps::const_iterator map_it = reachability_maps_.find(place_goal.arm_name);
+  if(map_it != reachability_maps_.end() && !map_it->second->isReachable(base_link_place_pose.pose)) {
+    ROS_DEBUG_STREAM("Place rejected by reachability map");
+    stats_.increment(TesterStats::REACHABILITY_REJECTION);
+    info.result_.result_code = PlaceLocationResult::PLACE_OUT_OF_REACH;
+    return;
+  }
+
+  IKCache::Key key;
+  IKCache::Entry entry;
+  if(batch.ik_cache_ != NULL) {
+    key = batch.ik_cache_->makeKey(place_goal.arm_name, base_link_place_pose.pose, batch.scene_hash_, batch.context_hash_);
+    if(batch.ik_cache_->lookup(key, entry)) {
+      if(cachedIKHolds(batch, workspace, entry)) {
+        ROS_DEBUG_STREAM("Using cached IK for place");
+        stats_.increment(TesterStats::IK_CACHE_HIT);
+        info.descend_trajectory_ = entry.first_trajectory_;
+        info.retreat_trajectory_ = entry.second_trajectory_;
+        info.result_.result_code = entry.result_code_;
+        if(!batch.ik_solutions_.empty()) batch.ik_solutions_[i] = entry.solution_;
+        return;
+      }
+      ROS_DEBUG_STREAM("Cached IK for place does not hold any more");
+      stats_.increment(TesterStats::IK_CACHE_STALE);
+      //back to the seed
+      state->setKinematicState(workspace.state_values_);
+      entry = IKCache::Entry();
+    }
+    stats_.increment(TesterStats::IK_CACHE_MISS);
+    batch.posture_plan_.getJoints(batch.arm_joints_, workspace.state_values_, entry.seed_);
+  }
+
   arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-  return ik_solver_map_[arm_name]->interpolateIKDirectional(start_pose,
-                                                            direction,
-                                                            distance,
-                                                            emp,
-                                                            getPlanningSceneState(),
-                                                            error_code,
-                                                            traj,
-                                                            redundancy_, 
-                                                            consistent_angle_,
-                                                            reverse,
-                                                            premultiply,
-                                                            num_points_,
-                                                            ros::Duration(2.5),
-                                                            false);
+  error_code.val = error_code.SUCCESS;
+  entry.result_code_ = solvePlaceIK(batch, workspace, i, base_link_place_pose, entry.solution_, error_code);
+  info.result_.result_code = entry.result_code_;
+  if(!batch.ik_solutions_.empty()) batch.ik_solutions_[i] = entry.solution_;
+
+  //a failure that ran into an obstacle says nothing about the next planning scene
+  if(batch.ik_cache_ != NULL && (entry.result_code_ == 0 || error_code.val == error_code.NO_IK_SOLUTION)) {
+    entry.collision_map_hash_ = batch.collision_map_hash_;
+    entry.first_trajectory_ = info.descend_trajectory_;
+    entry.second_trajectory_ = info.retreat_trajectory_;
+    batch.ik_cache_pending_.set(i, key, entry);
+  }
+}
+
+bool PlaceTesterFast::cachedIKHolds(PlaceTestBatch &batch, TesterWorkspace &workspace, const IKCache::Entry &entry)
+{
+  if(entry.result_code_ != 0) return entry.collision_map_hash_ == batch.collision_map_hash_;
+
+  //the solver only checked these against the obstacles sensed back then
+  StageTimer timer(stats_, TesterStats::IK);
+  std::vector<double> values;
+  if(armInCollision(batch, workspace, entry.solution_, batch.post_grasp_posture_, values)) return false;
+  const std::vector<trajectory_msgs::JointTrajectoryPoint> &descend = entry.first_trajectory_.points;
+  for(size_t p = 0; p < descend.size(); p++) {
+    if(armInCollision(batch, workspace, descend[p].positions, batch.grasp_posture_, values)) return false;
+  }
+  const std::vector<trajectory_msgs::JointTrajectoryPoint> &retreat = entry.second_trajectory_.points;
+  for(size_t p = 0; p < retreat.size(); p++) {
+    if(armInCollision(batch, workspace, retreat[p].positions, batch.post_grasp_posture_, values)) return false;
+  }
+  return true;
+}
+
+bool PlaceTesterFast::armInCollision(const PlaceTestBatch &batch, TesterWorkspace &workspace, 
+                                     const std::vector<double> &arm_values, size_t posture, 
+                                     std::vector<double> &values)
+{
+  values = batch.posture_plan_.getBaseValues();
+  batch.posture_plan_.setPosture(posture, values);
+  batch.posture_plan_.setJoints(batch.arm_joints_, arm_values, values);
+  workspace.state_->setKinematicState(values);
+  return workspace.cm_->isKinematicStateInCollision(*workspace.state_);
+}
+
+void PlaceTesterFast::testPlaceIKChain(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t c)
+{
+  batch.seed_chains_.solveChain(c, batch.ik_seeds_, batch.ik_solutions_,
+                                boost::bind(&PlaceTesterFast::testPlaceIK, this, boost::ref(batch),
+                                            boost::ref(workspace), _1));
+}
+
+int PlaceTesterFast::solvePlaceIK(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i,
+                                  const geometry_msgs::PoseStamped& base_link_place_pose,
+                                  std::vector<double>& ik_solution,
+                                  arm_navigation_msgs::ArmNavigationErrorCodes& error_code)
+{
+  const object_manipulation_msgs::PlaceGoal &place_goal = *batch.place_goal_;
+  PlaceExecutionInfo &execution_info = (*batch.execution_info_)[i];
+  planning_models::KinematicState* state = workspace.state_;
+  arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver = 
+    workspace.ik_solver_map_[place_goal.arm_name];
+  const std::vector<std::string>& joint_names = solver->getJointNames();
+
+  arm_navigation_msgs::Constraints emp;
+  sensor_msgs::JointState solution;
+  StageTimer ik_timer(stats_, TesterStats::IK);
+  bool ik_found = solver->findConstraintAwareSolution(base_link_place_pose.pose,
+                                                      emp,
+                                                      state,
+                                                      solution,
+                                                      error_code,
+                                                      false);
+  ik_timer.stop();
+  if(!ik_found) {
+    ROS_DEBUG_STREAM("Place out of reach");
+    return PlaceLocationResult::PLACE_OUT_OF_REACH;
+  } 
+  ik_solution = solution.position;
+
+  StageTimer interpolation_timer(stats_, TesterStats::INTERPOLATED_IK);
+
+  batch.posture_plan_.applyPosture(batch.grasp_posture_, *state, workspace.state_values_);
+
+  //now we solve interpolated ik
+  tf::Transform base_link_bullet_place_pose;
+  tf::poseMsgToTF(base_link_place_pose.pose, base_link_bullet_place_pose);
+  //now we need to do interpolated ik
+  execution_info.descend_trajectory_.joint_names = joint_names;
+  if(!getInterpolatedIK(batch, workspace,
+                        base_link_bullet_place_pose,
+                        batch.approach_dir_,
+                        place_goal.approach.desired_distance,
+                        solution.position,
+                        true,
+                        true,
+                        execution_info.descend_trajectory_,
+                        error_code)) {
+    ROS_DEBUG_STREAM("No interpolated IK for approach to place");
+    return PlaceLocationResult::PLACE_UNFEASIBLE;
+  }
+
+  batch.posture_plan_.applyPosture(batch.post_grasp_posture_, *state, workspace.state_values_);
+  execution_info.retreat_trajectory_.joint_names = joint_names;
+  if(!getInterpolatedIK(batch, workspace,
+                        base_link_bullet_place_pose,
+                        batch.retreat_dir_,
+                        place_goal.desired_retreat_distance,
+                        solution.position,
+                        false,
+                        false,
+                        execution_info.retreat_trajectory_,
+                        error_code)) {
+    ROS_DEBUG_STREAM("No interpolated IK for place to retreat");
+    return PlaceLocationResult::RETREAT_UNFEASIBLE;
+  }
+  return 0;
+}
+
+void PlaceTesterFast::testFinalPreplace(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  PlaceExecutionInfo &info = (*batch.execution_info_)[i];
+  planning_models::KinematicState* state = workspace.state_;
+
+  if(info.descend_trajectory_.points.empty()) {
+    ROS_WARN_STREAM("No result code and no points in approach trajectory");
+    return;
+  }
+
+  std::vector<double> &values = workspace.state_values_;
+  values = batch.posture_plan_.getBaseValues();
+  batch.posture_plan_.setJoints(batch.arm_joints_, info.descend_trajectory_.points[0].positions, values);
+  batch.posture_plan_.setPosture(batch.grasp_posture_, values);
+  state->setKinematicState(values);
+  if(workspace.cm_->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG_STREAM("Final pre-place check failed");
+    info.result_.result_code = PlaceLocationResult::PREPLACE_OUT_OF_REACH;
+  }
+}
+
+void PlaceTesterFast::testFinalRetreat(PlaceTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  PlaceExecutionInfo &info = (*batch.execution_info_)[i];
+  planning_models::KinematicState* state = workspace.state_;
+
+  //when returning on the first hit, a location without an approach trajectory has always stopped here
+  if(batch.return_on_first_hit_ && info.descend_trajectory_.points.empty()) return;
+
+  if(info.retreat_trajectory_.points.empty()) {
+    ROS_WARN_STREAM("No result code and no points in retreat trajectory");
+    return;
+  }    
+  std::vector<double> &values = workspace.state_values_;
+  values = batch.posture_plan_.getBaseValues();
+  batch.posture_plan_.setJoints(batch.arm_joints_, info.retreat_trajectory_.points.back().positions, values);
+  batch.posture_plan_.setPosture(batch.post_grasp_posture_, values);
+  state->setKinematicState(values);
+  if(workspace.cm_->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG_STREAM("Final retreat check failed");
+    info.result_.result_code = PlaceLocationResult::RETREAT_OUT_OF_REACH;
+  } else {
+    ROS_DEBUG_STREAM("Everything successful");
+    info.result_.result_code = PlaceLocationResult::SUCCESS;
+  }
+}
+
+void PlaceTesterFast::testPlaceInStage(PlaceTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                                       TesterWorkspace &workspace, size_t job)
+{
+  size_t i = indices[job];
+  if(stage == IK_STAGE) {
+    //IK and interpolated IK are timed separately as they go
+    testPlaceIK(batch, workspace, i);
+    return;
+  }
+  //indexed by TestStage
+  static const TesterStats::Stage stats_stages[] = {TesterStats::COLLISION, TesterStats::PREGRASP,
+                                                    TesterStats::LIFT, TesterStats::IK,
+                                                    TesterStats::FINAL_CHECK, TesterStats::FINAL_CHECK};
+  StageTimer timer(stats_, stats_stages[stage]);
+  switch(stage)
+  {
+  case PLACE_COLLISION_STAGE: testPlaceCollision(batch, workspace, i); break;
+  case PREPLACE_COLLISION_STAGE: testPreplaceCollision(batch, workspace, i); break;
+  case RETREAT_COLLISION_STAGE: testRetreatCollision(batch, workspace, i); break;
+  case FINAL_PREPLACE_STAGE: testFinalPreplace(batch, workspace, i); break;
+  case FINAL_RETREAT_STAGE: testFinalRetreat(batch, workspace, i); break;
+  }
+}
+
+void PlaceTesterFast::runStage(PlaceTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                               size_t begin, size_t end)
+{
+  if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
+
+  //the place collision stage is the one that sets the result codes in the first place
+  std::vector<size_t> pending;
+  for(size_t i = begin; i < end; i++) {
+    if(stage == PLACE_COLLISION_STAGE || (*batch.execution_info_)[i].result_.result_code == 0) {
+      pending.push_back(i);
+    }
+  }
+  if(stage == IK_STAGE && seed_propagation_) {
+    //each chain is solved in order by a single worker, so seeds never depend on scheduling
+    batch.seed_chains_.build(batch.place_poses_, pending);
+    runInWorkspaces(workspaces, batch.seed_chains_.size(),
+                    boost::bind(&PlaceTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                    boost::bind(&PlaceTesterFast::testPlaceIKChain, this, boost::ref(batch), _1, _2));
+    return;
+  }
+  runInWorkspaces(workspaces, pending.size(),
+                  boost::bind(&PlaceTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                  boost::bind(&PlaceTesterFast::testPlaceInStage, this, boost::ref(batch),
+                              boost::cref(pending), stage, _1, _2));
+}
+
+std::vector<TesterWorkspace*> PlaceTesterFast::getWorkspaces(TesterWorkspace *serial_workspace)
+{
+  std::vector<TesterWorkspace*> workspaces;
+  //workers mirror the planning scene of the mechanism interface, so we can only use them if that's what we test against
+  if(num_threads_ <= 1 || cm_ != NULL || state_ != NULL) {
+    workspaces.push_back(serial_workspace);
+    return workspaces;
+  }
+  return worker_pool_.getWorkspaces(num_threads_,
+                                    mechInterface().getPlanningSceneMessage(),
+                                    mechInterface().getPlanningSceneRevision());
 }
 
 void PlaceTesterFast::testPlace(const object_manipulation_msgs::PlaceGoal &placre_goal,
@@ -198,8 +579,24 @@ void PlaceTesterFast::testPlaces(const object_manipulation_msgs::PlaceGoal &plac
   planning_environment::CollisionModels* cm = getCollisionModels();
   planning_models::KinematicState* state = getPlanningSceneState();
 
-  std::map<std::string, double> planning_scene_state_values;
-  state->getKinematicStateValues(planning_scene_state_values);
+  if(ik_solver_map_.find(place_goal.arm_name) == ik_solver_map_.end()) {
+    ROS_ERROR_STREAM("No IK solver for arm " << place_goal.arm_name);
+    throw GraspException("no IK solver for requested arm");
+  }
+  const std::vector<std::string>& joint_names = ik_solver_map_[place_goal.arm_name]->getJointNames();
+
+  PlaceTestBatch batch;
+  batch.place_goal_ = &place_goal;
+  batch.place_locations_ = &place_locations;
+  batch.execution_info_ = &execution_info;
+  batch.return_on_first_hit_ = return_on_first_hit;
+
+  //resolving the joints we'll need once, so we can set them by index for each place location
+  batch.posture_plan_.init(*state);
+  batch.arm_joints_ = batch.posture_plan_.addJoints(joint_names);
+  batch.post_grasp_posture_ = batch.posture_plan_.addPosture(place_goal.grasp.pre_grasp_posture);
+  batch.grasp_posture_ = batch.posture_plan_.addBasePosture(place_goal.grasp.pre_grasp_posture.name);
+  batch.gripper_frame_ = handDescription().gripperFrame(place_goal.arm_name);
   
   std::vector<std::string> end_effector_links, arm_links; 
   getGroupLinks(handDescription().gripperCollisionName(place_goal.arm_name), end_effector_links);
@@ -207,8 +604,8 @@ void PlaceTesterFast::testPlaces(const object_manipulation_msgs::PlaceGoal &plac
   
   collision_space::EnvironmentModel::AllowedCollisionMatrix original_acm = cm->getCurrentAllowedCollisionMatrix();
   cm->disableCollisionsForNonUpdatedLinks(place_goal.arm_name);
-  collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm = cm->getCurrentAllowedCollisionMatrix();
-  collision_space::EnvironmentModel::AllowedCollisionMatrix object_disable_acm = group_disable_acm;
+  batch.group_disable_acm_ = cm->getCurrentAllowedCollisionMatrix();
+  collision_space::EnvironmentModel::AllowedCollisionMatrix object_disable_acm = batch.group_disable_acm_;
   if(!place_goal.collision_support_surface_name.empty()) {
     if(place_goal.collision_support_surface_name == "\"all\"")
     {
@@ -219,433 +616,184 @@ void PlaceTesterFast::testPlaces(const object_manipulation_msgs::PlaceGoal &plac
       object_disable_acm.changeEntry(place_goal.collision_object_name, place_goal.collision_support_surface_name, true);
     }
   }
-  collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_disable_acm = object_disable_acm;
+  batch.object_support_disable_acm_ = object_disable_acm;
   if(place_goal.allow_gripper_support_collision) {
     if(place_goal.collision_support_surface_name == "\"all\"")
     {
       for(unsigned int i = 0; i < end_effector_links.size(); i++){
-	object_support_disable_acm.changeEntry(end_effector_links[i], true);
+	batch.object_support_disable_acm_.changeEntry(end_effector_links[i], true);
       }
     }
     else
     {
-      object_support_disable_acm.changeEntry(place_goal.collision_support_surface_name, end_effector_links, true); 
+      batch.object_support_disable_acm_.changeEntry(place_goal.collision_support_surface_name, end_effector_links, true); 
     }
   }
-  collision_space::EnvironmentModel::AllowedCollisionMatrix object_all_arm_disable_acm = object_disable_acm;
-  collision_space::EnvironmentModel::AllowedCollisionMatrix object_support_all_arm_disable_acm = object_support_disable_acm;
-  collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm = group_disable_acm;
+  batch.object_all_arm_disable_acm_ = object_disable_acm;
+  batch.object_support_all_arm_disable_acm_ = batch.object_support_disable_acm_;
+  batch.group_all_arm_disable_acm_ = batch.group_disable_acm_;
 
   //turning off collisions for the arm associated with this end effector
   for(unsigned int i = 0; i < arm_links.size(); i++) {
-    object_all_arm_disable_acm.changeEntry(arm_links[i], true);
-    object_support_all_arm_disable_acm.changeEntry(arm_links[i], true);
-    group_all_arm_disable_acm.changeEntry(arm_links[i], true);
+    batch.object_all_arm_disable_acm_.changeEntry(arm_links[i], true);
+    batch.object_support_all_arm_disable_acm_.changeEntry(arm_links[i], true);
+    batch.group_all_arm_disable_acm_.changeEntry(arm_links[i], true);
+  }
+  batch.place_link_padding_ = linkPaddingForPlace(place_goal);
+  if(seed_propagation_) {
+    batch.seed_chains_ = IKSeedChains(seed_distance_);
+    batch.ik_seeds_.resize(place_locations.size());
+    batch.ik_solutions_.resize(place_locations.size());
   }
-  cm->setAlteredAllowedCollisionMatrix(object_support_all_arm_disable_acm);
-  
-  //first we apply link padding for place check
-  cm->applyLinkPaddingToCollisionSpace(linkPaddingForPlace(place_goal));
     
   execution_info.clear();
   execution_info.resize(place_locations.size());
 
-  tf::Vector3 approach_dir;
-  tf::vector3MsgToTF(doNegate(place_goal.approach.direction.vector), approach_dir);
-  approach_dir.normalize();
-  tf::Vector3 distance_approach_dir = approach_dir*fabs(place_goal.approach.desired_distance);
-  tf::Transform approach_trans(tf::Quaternion(0,0,0,1.0), distance_approach_dir);
-
-  tf::Vector3 retreat_dir;
-  tf::vector3MsgToTF(doNegate(handDescription().approachDirection(place_goal.arm_name)), retreat_dir);
-  retreat_dir.normalize();
-  tf::Vector3 distance_retreat_dir = retreat_dir*fabs(place_goal.desired_retreat_distance);    
-  tf::Transform retreat_trans(tf::Quaternion(0,0,0,1.0), distance_retreat_dir);
-
-  std::map<std::string, double> planning_scene_state_values_post_grasp = planning_scene_state_values_post_grasp;
-  std::map<std::string, double> post_grasp_joint_vals;    
-  std::map<std::string, double> grasp_joint_vals;
-  for(unsigned int j = 0; j < place_goal.grasp.pre_grasp_posture.name.size(); j++) {
-    planning_scene_state_values_post_grasp[place_goal.grasp.pre_grasp_posture.name[j]] = place_goal.grasp.pre_grasp_posture.position[j];
-    post_grasp_joint_vals[place_goal.grasp.pre_grasp_posture.name[j]] = place_goal.grasp.pre_grasp_posture.position[j];
-    grasp_joint_vals[place_goal.grasp.pre_grasp_posture.name[j]] = planning_scene_state_values[place_goal.grasp.pre_grasp_posture.name[j]];
-  }
-
-  std::vector<tf::Transform> place_poses(place_locations.size());
-
-  //now this is place specific
+  tf::vector3MsgToTF(doNegate(place_goal.approach.direction.vector), batch.approach_dir_);
+  batch.approach_dir_.normalize();
+
+  tf::vector3MsgToTF(doNegate(handDescription().approachDirection(place_goal.arm_name)), batch.retreat_dir_);
+  batch.retreat_dir_.normalize();
+  batch.world_header_.frame_id = cm->getWorldFrameId();
+
+  //the gripper poses the collision stages need are computed for all locations at once, looking up 
+  //the world pose of each frame the locations are given in only once
+  PoseBatch frame_poses(place_locations.size()), location_poses(place_locations.size());
+  batch.place_pose_valid_.assign(place_locations.size(), true);
+  std::map<std::string, tf::Transform> frame_transforms;
+  std::set<std::string> bad_frames;
+  geometry_msgs::Pose identity;
+  identity.orientation.w = 1.0;
   for(unsigned int i = 0; i < place_locations.size(); i++) {
-    //using the grasp posture
-    state->setKinematicState(post_grasp_joint_vals);
-    
-    //always true
-    execution_info[i].result_.continuation_possible = true;
-    
-    if(!cm->convertPoseGivenWorldTransform(*state,
-                                           cm->getWorldFrameId(),
-                                           place_locations[i].header,
-                                           place_locations[i].pose,
-                                           execution_info[i].gripper_place_pose_)) {
-      ROS_INFO_STREAM("Something wrong with pose conversion");
+    const std_msgs::Header &header = place_locations[i].header;
+    location_poses.set(i, place_locations[i].pose);
+    if(bad_frames.count(header.frame_id)) {
+      batch.place_pose_valid_[i] = false;
       continue;
     }
-    tf::poseMsgToTF(execution_info[i].gripper_place_pose_.pose, place_poses[i]);
-    tf::Transform grasp_trans;
-    tf::poseMsgToTF(place_goal.grasp.grasp_pose, grasp_trans);
-    //post multiply for object frame
-    place_poses[i] = place_poses[i]*grasp_trans;
-    tf::poseTFToMsg(place_poses[i], execution_info[i].gripper_place_pose_.pose);
-    state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(place_goal.arm_name),place_poses[i]);
-    
-    if(cm->isKinematicStateInCollision(*state)) {
-      ROS_DEBUG_STREAM("Place in collision");
-      execution_info[i].result_.result_code = PlaceLocationResult::PLACE_IN_COLLISION;
-      outcome_count[PlaceLocationResult::PLACE_IN_COLLISION]++;
-    } else {
-      execution_info[i].result_.result_code = 0;
+    std::map<std::string, tf::Transform>::iterator it = frame_transforms.find(header.frame_id);
+    if(it == frame_transforms.end()) {
+      geometry_msgs::PoseStamped frame_world_pose;
+      if(!cm->convertPoseGivenWorldTransform(*state, cm->getWorldFrameId(), header, identity, frame_world_pose)) {
+        bad_frames.insert(header.frame_id);
+        batch.place_pose_valid_[i] = false;
+        continue;
+      }
+      it = frame_transforms.insert(std::make_pair(header.frame_id, tf::Transform())).first;
+      tf::poseMsgToTF(frame_world_pose.pose, it->second);
     }
+    frame_poses.set(i, it->second);
   }
-
-  //now we revert link paddings for approach and retreat checks
-  cm->revertCollisionSpacePaddingToDefault();
-
-  //now we do the place approach pose, not allowing anything different 
-  cm->setAlteredAllowedCollisionMatrix(group_all_arm_disable_acm);
-
-  for(unsigned int i = 0; i < place_locations.size(); i++) {
-  
-    if(execution_info[i].result_.result_code != 0) continue;
-
-    state->setKinematicState(planning_scene_state_values);
-    
-    tf::Transform approach_pose = approach_trans*place_poses[i];
-    state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(place_goal.arm_name),approach_pose);
-    
-    if(cm->isKinematicStateInCollision(*state)) {
-      ROS_DEBUG_STREAM("Preplace in collision");
-      // std::vector<arm_navigation_msgs::ContactInformation> contacts;
-      // cm->getAllCollisionsForState(*state, contacts,1);
-      // if(contacts.size() == 0) {
-      //   ROS_WARN_STREAM("Collision reported but no contacts");
-      // }
-      // for(unsigned int j = 0; j < contacts.size(); j++) {
-      //   ROS_INFO_STREAM("Collision between " << contacts[j].contact_body_1 
-      //                   << " and " << contacts[j].contact_body_2);
-      // }
-      execution_info[i].result_.result_code = PlaceLocationResult::PREPLACE_IN_COLLISION;
-      outcome_count[PlaceLocationResult::PREPLACE_IN_COLLISION]++;
-      continue;
+  PoseBatch::compose(frame_poses, location_poses, batch.place_poses_);
+  //post multiply for object frame
+  tf::Transform grasp_trans;
+  tf::poseMsgToTF(place_goal.grasp.grasp_pose, grasp_trans);
+  PoseBatch::compose(batch.place_poses_, grasp_trans, batch.place_poses_);
+  PoseBatch::applyOffset(batch.place_poses_, batch.approach_dir_*fabs(place_goal.approach.desired_distance),
+                         false, batch.approach_poses_);
+  PoseBatch::applyOffset(batch.place_poses_, batch.retreat_dir_*fabs(place_goal.desired_retreat_distance),
+                         true, batch.retreat_poses_);
+
+  //IK results can only be reused if we know which planning scene they were computed in
+  batch.ik_cache_ = NULL;
+  batch.scene_hash_ = 0;
+  batch.collision_map_hash_ = 0;
+  batch.context_hash_ = 0;
+  if(ik_cache_ && cm_ == NULL && state_ == NULL) {
+    batch.ik_cache_ = ik_cache_.get();
+    std::vector<double> arm_start;
+    batch.posture_plan_.getJoints(batch.arm_joints_, batch.posture_plan_.getBaseValues(), arm_start);
+    batch.scene_hash_ = ik_cache_->sceneHash(mechInterface().getPlanningSceneHash(), arm_start);
+    batch.collision_map_hash_ = mechInterface().getCollisionMapHash();
+    batch.ik_cache_pending_.reset(place_locations.size());
+
+    //everything else the IK stage depends on
+    MessageHasher hasher;
+    hasher.add(std::string("place"));
+    hasher.addMessage(place_goal.grasp.pre_grasp_posture.name);
+    hasher.add(place_goal.grasp.pre_grasp_posture.position);
+    hasher.add((double)place_goal.approach.desired_distance);
+    hasher.add((double)place_goal.desired_retreat_distance);
+    hasher.add((double)batch.approach_dir_.x());
+    hasher.add((double)batch.approach_dir_.y());
+    hasher.add((double)batch.approach_dir_.z());
+    hasher.add((double)batch.retreat_dir_.x());
+    hasher.add((double)batch.retreat_dir_.y());
+    hasher.add((double)batch.retreat_dir_.z());
+    hasher.add(place_goal.collision_object_name);
+    hasher.add(place_goal.collision_support_surface_name);
+    hasher.add((bool)place_goal.allow_gripper_support_collision);
+    for(unsigned int i = 0; i < batch.place_link_padding_.size(); i++) {
+      hasher.addMessage(batch.place_link_padding_[i]);
     }
+    //seeded IK may find solutions where the planning scene seed did not
+    if(seed_propagation_) hasher.add(std::string("seeded"));
+    batch.context_hash_ = hasher.getHash();
   }
 
-  //TODO - for now, just have to hope that we're not in contact with the object
-  //after we release, but there's not a good way to check this for now
-  //so we just leave the object all arm disable on for the retreat position check
-  cm->setAlteredAllowedCollisionMatrix(object_all_arm_disable_acm);
-
-  //first we do retreat, with the gripper at post grasp position
-  for(unsigned int i = 0; i < place_locations.size(); i++) {
-  
-    if(execution_info[i].result_.result_code != 0) continue;
-
-    state->setKinematicState(post_grasp_joint_vals);
-
-    tf::Transform retreat_pose = place_poses[i]*retreat_trans;
-    state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(place_goal.arm_name),retreat_pose);
-    
-    if(cm->isKinematicStateInCollision(*state)) {
-      /*
-	std_msgs::ColorRGBA col_pregrasp;
-	col_pregrasp.r = 0.0;
-	col_pregrasp.g = 1.0;
-	col_pregrasp.b = 1.0;
-	col_pregrasp.a = 1.0;
-	visualization_msgs::MarkerArray arr;
-	cm_->getRobotMarkersGivenState(*state, arr, col_pregrasp,
-				       "retreat",
-				       ros::Duration(0.0), 
-				       &end_effector_links);
-	vis_marker_array_publisher_.publish(arr);
-      */
-      ROS_DEBUG_STREAM("Retreat in collision");
-      execution_info[i].result_.result_code = PlaceLocationResult::RETREAT_IN_COLLISION;
-      outcome_count[PlaceLocationResult::RETREAT_IN_COLLISION]++;
-    }
+  //the workers get the same planning scene, so the allowed collision matrices computed here apply to them too
+  TesterWorkspace serial_workspace(cm, state, ik_solver_map_);
+  std::vector<TesterWorkspace*> workspaces = getWorkspaces(&serial_workspace);
+  for(size_t w = 0; w < workspaces.size(); w++) {
+    workspaces[w]->configuration_ = -1;
   }
-
-  std_msgs::Header world_header;
-  world_header.frame_id = cm->getWorldFrameId();
-  const std::vector<std::string>& joint_names = ik_solver_map_[place_goal.arm_name]->getJointNames();
-
-  if(return_on_first_hit) {
-    
-    bool last_ik_failed = false;
-    for(unsigned int i = 0; i < place_locations.size(); i++) {
-
-      if(execution_info[i].result_.result_code != 0) continue;
-
-      if(!last_ik_failed) {
-        //now we move to the ik portion, which requires re-enabling collisions for the arms
-        cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
-        
-        //and also reducing link paddings
-        cm->applyLinkPaddingToCollisionSpace(linkPaddingForPlace(place_goal));
-      }
-      //getting back to original state for seed
-      state->setKinematicState(planning_scene_state_values_post_grasp);
-
-      //now call ik for grasp
-      geometry_msgs::Pose place_geom_pose;
-      tf::poseTFToMsg(place_poses[i], place_geom_pose);
-      geometry_msgs::PoseStamped base_link_place_pose;
-      cm->convertPoseGivenWorldTransform(*state,
-					 ik_solver_map_[place_goal.arm_name]->getBaseName(),
-                                         world_header,
-                                         place_geom_pose,
-                                         base_link_place_pose);
-      
-      arm_navigation_msgs::Constraints emp;
-      sensor_msgs::JointState solution;
-      arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-      if(!ik_solver_map_[place_goal.arm_name]->findConstraintAwareSolution(base_link_place_pose.pose,
-                                                                           emp,
-                                                                           state,
-                                                                           solution,
-                                                                           error_code,
-                                                                           false)) {
-        ROS_DEBUG_STREAM("Place out of reach");
-        execution_info[i].result_.result_code = PlaceLocationResult::PLACE_OUT_OF_REACH;
-        outcome_count[PlaceLocationResult::PLACE_OUT_OF_REACH]++;
-        last_ik_failed = true;
-        continue;
-      } else {
-        last_ik_failed = false;
-      }
-
-      state->setKinematicState(grasp_joint_vals);
-      
-      //now we solve interpolated ik
-      tf::Transform base_link_bullet_place_pose;
-      tf::poseMsgToTF(base_link_place_pose.pose, base_link_bullet_place_pose);
-      //now we need to do interpolated ik
-      execution_info[i].descend_trajectory_.joint_names = joint_names;
-      if(!getInterpolatedIK(place_goal.arm_name,
-                            base_link_bullet_place_pose,
-                            approach_dir,
-                            place_goal.approach.desired_distance,
-                            solution.position,
-                            true,
-                            true,
-                            execution_info[i].descend_trajectory_)) {
-        ROS_DEBUG_STREAM("No interpolated IK for approach to place");
-        execution_info[i].result_.result_code = PlaceLocationResult::PLACE_UNFEASIBLE;
-        outcome_count[PlaceLocationResult::PLACE_UNFEASIBLE]++;
-        continue;
-      }
-      
-      state->setKinematicState(planning_scene_state_values_post_grasp);
-      execution_info[i].retreat_trajectory_.joint_names = joint_names;
-      if(!getInterpolatedIK(place_goal.arm_name,
-                            base_link_bullet_place_pose,
-                            retreat_dir,
-                            place_goal.desired_retreat_distance,
-                            solution.position,
-                            false,
-                            false,
-                            execution_info[i].retreat_trajectory_)) {
-        ROS_DEBUG_STREAM("No interpolated IK for place to retreat");
-        execution_info[i].result_.result_code = PlaceLocationResult::RETREAT_UNFEASIBLE;
-        outcome_count[PlaceLocationResult::RETREAT_UNFEASIBLE]++;
-        continue;
-      }
-
-      //now we revert link paddings and object collisions and do a final check for the initial ik points
-      cm->revertCollisionSpacePaddingToDefault();
-
-      //the start of the place approach needs to be collision-free according to the default collision matrix
-      cm->setAlteredAllowedCollisionMatrix(group_disable_acm);
-
-      if(execution_info[i].descend_trajectory_.points.empty()) {
-        ROS_WARN_STREAM("No result code and no points in approach trajectory");
-        continue;
-      }
-
-      std::map<std::string, double> pre_place_ik = grasp_joint_vals;
-      for(unsigned int j = 0; j < joint_names.size(); j++) {
-        pre_place_ik[joint_names[j]] = execution_info[i].descend_trajectory_.points[0].positions[j];
-      } 
-      state->setKinematicState(pre_place_ik);
-      if(cm->isKinematicStateInCollision(*state)) {
-        ROS_DEBUG_STREAM("Final pre-place check failed");
-        execution_info[i].result_.result_code = PlaceLocationResult::PREPLACE_OUT_OF_REACH;
-        outcome_count[PlaceLocationResult::PREPLACE_OUT_OF_REACH]++;
-        continue;
-      }
-
-      //the end of the place retreat also needs to be collision-free according to the default collision matrix
-      if(execution_info[i].retreat_trajectory_.points.empty()) {
-        ROS_WARN_STREAM("No result code and no points in retreat trajectory");
-        continue;
-      }    
-      std::map<std::string, double> retreat_ik = post_grasp_joint_vals;
-      for(unsigned int j = 0; j < joint_names.size(); j++) {
-       retreat_ik[joint_names[j]] = execution_info[i].retreat_trajectory_.points.back().positions[j];
-      } 
-      state->setKinematicState(retreat_ik);
-      if(cm->isKinematicStateInCollision(*state)) {
-        ROS_DEBUG_STREAM("Final retreat check failed");
-        execution_info[i].result_.result_code = PlaceLocationResult::RETREAT_OUT_OF_REACH;
-        outcome_count[PlaceLocationResult::RETREAT_OUT_OF_REACH]++;
-        continue;
-      } else {
-        ROS_INFO_STREAM("Everything successful");
-        execution_info[i].result_.result_code = PlaceLocationResult::SUCCESS;
-	execution_info.resize(i+1);
-        outcome_count[PlaceLocationResult::SUCCESS]++;
-        break;
-      }
-    }
-    for(std::map<unsigned int, unsigned int>::iterator it = outcome_count.begin();
-        it != outcome_count.end();
-        it++) {
-      ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
-    }
-    cm->setAlteredAllowedCollisionMatrix(original_acm);
-    return;
+  if(workspaces.size() > 1) {
+    ROS_DEBUG_STREAM("Testing " << place_locations.size() << " place locations on " 
+                     << workspaces.size() << " threads");
   }
-    
-  //now we move to the ik portion, which requires re-enabling collisions for the arms
-  cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
-  
-  //and also reducing link paddings
-  cm->applyLinkPaddingToCollisionSpace(linkPaddingForPlace(place_goal));
-  
-  for(unsigned int i = 0; i < place_locations.size(); i++) {
-
-    if(execution_info[i].result_.result_code != 0) continue;
 
-    //getting back to original state for seed
-    state->setKinematicState(planning_scene_state_values_post_grasp);
-
-    //now call ik for grasp
-    geometry_msgs::Pose place_geom_pose;
-    tf::poseTFToMsg(place_poses[i], place_geom_pose);
-    geometry_msgs::PoseStamped base_link_place_pose;
-    cm->convertPoseGivenWorldTransform(*state,
-				       ik_solver_map_[place_goal.arm_name]->getBaseName(),
-                                       world_header,
-                                       place_geom_pose,
-                                       base_link_place_pose);
-    
-    arm_navigation_msgs::Constraints emp;
-    sensor_msgs::JointState solution;
-    arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-    if(!ik_solver_map_[place_goal.arm_name]->findConstraintAwareSolution(base_link_place_pose.pose,
-                                                                         emp,
-                                                                         state,
-                                                                         solution,
-                                                                         error_code,
-                                                                         false)) {
-      ROS_DEBUG_STREAM("Place out of reach");
-      execution_info[i].result_.result_code = PlaceLocationResult::PLACE_OUT_OF_REACH;
-      outcome_count[PlaceLocationResult::PLACE_OUT_OF_REACH]++;
-      continue;
-    } 
-
-    state->setKinematicState(grasp_joint_vals);
-
-    //now we solve interpolated ik
-    tf::Transform base_link_bullet_place_pose;
-    tf::poseMsgToTF(base_link_place_pose.pose, base_link_bullet_place_pose);
-    //now we need to do interpolated ik
-    execution_info[i].descend_trajectory_.joint_names = joint_names;
-    if(!getInterpolatedIK(place_goal.arm_name,
-                          base_link_bullet_place_pose,
-                          approach_dir,
-                          place_goal.approach.desired_distance,
-                          solution.position,
-                          true,
-                          true,
-                          execution_info[i].descend_trajectory_)) {
-      ROS_DEBUG_STREAM("No interpolated IK for approach to place");
-      execution_info[i].result_.result_code = PlaceLocationResult::PLACE_UNFEASIBLE;
-      outcome_count[PlaceLocationResult::PLACE_UNFEASIBLE]++;
-      continue;
+  //the locations that make it through the collision stages, to be counted once their final outcome is known
+  std::vector<size_t> collision_free;
+  size_t end = place_locations.size();
+  try
+  {
+    //these are cheap, and always done for all locations
+    runStage(batch, workspaces, PLACE_COLLISION_STAGE, 0, place_locations.size());
+    runStage(batch, workspaces, PREPLACE_COLLISION_STAGE, 0, place_locations.size());
+    runStage(batch, workspaces, RETREAT_COLLISION_STAGE, 0, place_locations.size());
+    for(size_t i = 0; i < place_locations.size(); i++) {
+      if(execution_info[i].result_.result_code != 0) outcome_count[execution_info[i].result_.result_code]++;
+      else collision_free.push_back(i);
     }
 
-    state->setKinematicState(planning_scene_state_values_post_grasp);
-    execution_info[i].retreat_trajectory_.joint_names = joint_names;
-    if(!getInterpolatedIK(place_goal.arm_name,
-                          base_link_bullet_place_pose,
-                          retreat_dir,
-                          place_goal.desired_retreat_distance,
-                          solution.position,
-                          false,
-                          false,
-                          execution_info[i].retreat_trajectory_)) {
-      ROS_DEBUG_STREAM("No interpolated IK for place to retreat");
-      execution_info[i].result_.result_code = PlaceLocationResult::RETREAT_UNFEASIBLE;
-      outcome_count[PlaceLocationResult::RETREAT_UNFEASIBLE]++;
-      continue;
+    if(return_on_first_hit) {
+      //locations are taken through IK and the final checks a window at a time; the first success 
+      //in the original order wins, so the result does not depend on the number of workers
+      size_t window = workspaces.size();
+      for(size_t begin = 0; begin < end; begin += window) {
+        size_t window_end = std::min(begin + window, place_locations.size());
+        runStage(batch, workspaces, IK_STAGE, begin, window_end);
+        runStage(batch, workspaces, FINAL_PREPLACE_STAGE, begin, window_end);
+        runStage(batch, workspaces, FINAL_RETREAT_STAGE, begin, window_end);
+        for(size_t i = begin; i < window_end; i++) {
+          if(execution_info[i].result_.result_code == PlaceLocationResult::SUCCESS) {
+            ROS_INFO_STREAM("Everything successful");
+            end = i+1;
+            break;
+          }
+        }
+      }
+    } else {
+      runStage(batch, workspaces, IK_STAGE, 0, place_locations.size());
+      runStage(batch, workspaces, FINAL_PREPLACE_STAGE, 0, place_locations.size());
+      runStage(batch, workspaces, FINAL_RETREAT_STAGE, 0, place_locations.size());
     }
   }
-
-  //now we revert link paddings and object collisions and do a final check for the initial ik points
-  cm->revertCollisionSpacePaddingToDefault();
-
-  cm->setAlteredAllowedCollisionMatrix(group_disable_acm);
-  
-  for(unsigned int i = 0; i < place_locations.size(); i++) {
-    
-    if(execution_info[i].result_.result_code != 0) continue;
-    
-    if(execution_info[i].descend_trajectory_.points.empty()) {
-      ROS_WARN_STREAM("No result code and no points in approach trajectory");
-      continue;
-    }
-
-    std::map<std::string, double> pre_place_ik = grasp_joint_vals;
-    for(unsigned int j = 0; j < joint_names.size(); j++) {
-      pre_place_ik[joint_names[j]] = execution_info[i].descend_trajectory_.points[0].positions[j];
-    } 
-    state->setKinematicState(pre_place_ik);
-    if(cm->isKinematicStateInCollision(*state)) {
-      ROS_DEBUG_STREAM("Final pre-place check failed");
-      execution_info[i].result_.result_code = PlaceLocationResult::PREPLACE_OUT_OF_REACH;
-      outcome_count[PlaceLocationResult::PREPLACE_OUT_OF_REACH]++;
-      continue;
-    }
-    
+  catch(...)
+  {
+    cm->revertCollisionSpacePaddingToDefault();
+    cm->setAlteredAllowedCollisionMatrix(original_acm);
+    throw;
   }
+  cm->revertCollisionSpacePaddingToDefault();
+  cm->setAlteredAllowedCollisionMatrix(original_acm);
+  if(batch.ik_cache_ != NULL) batch.ik_cache_->insert(batch.ik_cache_pending_);
 
-  //now we need to disable collisions with the object for lift
-  cm->setAlteredAllowedCollisionMatrix(object_support_disable_acm);
-
-  for(unsigned int i = 0; i < place_locations.size(); i++) {
-    
-    if(execution_info[i].result_.result_code != 0) continue;
-    
-    if(execution_info[i].retreat_trajectory_.points.empty()) {
-      ROS_WARN_STREAM("No result code and no points in retreat trajectory");
-      continue;
-    }    
-    std::map<std::string, double> retreat_ik = post_grasp_joint_vals;
-    for(unsigned int j = 0; j < joint_names.size(); j++) {
-      retreat_ik[joint_names[j]] = execution_info[i].retreat_trajectory_.points.back().positions[j];
-    } 
-    state->setKinematicState(retreat_ik);
-    if(cm->isKinematicStateInCollision(*state)) {
-      ROS_DEBUG_STREAM("Final lift check failed");
-      execution_info[i].result_.result_code = PlaceLocationResult::RETREAT_OUT_OF_REACH;
-      outcome_count[PlaceLocationResult::RETREAT_OUT_OF_REACH]++;
-      continue;
-    } else {
-      ROS_DEBUG_STREAM("Everything successful");
-      execution_info[i].result_.result_code = PlaceLocationResult::SUCCESS;
-      outcome_count[PlaceLocationResult::SUCCESS]++;
-    }
+  for(size_t j = 0; j < collision_free.size() && collision_free[j] < end; j++) {
+    unsigned int code = execution_info[collision_free[j]].result_.result_code;
+    if(code != 0) outcome_count[code]++;
   }
-  cm->setAlteredAllowedCollisionMatrix(original_acm);
+  execution_info.resize(end);
 
   ROS_INFO_STREAM("Took " << (ros::WallTime::now()-start).toSec());
 
@@ -653,7 +801,9 @@ void PlaceTesterFast::testPlaces(const object_manipulation_msgs::PlaceGoal &plac
       it != outcome_count.end();
       it++) {
     ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
+    stats_.addOutcome(it->first, it->second);
   }
+  stats_.addCall(execution_info.size(), (ros::WallTime::now()-start).toSec());
 }
 
 
@@ -0,0 +1,106 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/batch_marker_publisher.h"
+
+namespace object_manipulator {
+
+BatchMarkerPublisher::BatchMarkerPublisher(const std::string &topic) :
+  has_pending_(false),
+  shutdown_(false)
+{
+  ros::NodeHandle nh;
+  publisher_ = nh.advertise<visualization_msgs::MarkerArray>(topic, 8);
+  double max_rate;
+  ros::param::param<double>("~tester_visualization_rate", max_rate, 2.0);
+  min_period_ = (max_rate > 0) ? 1.0 / max_rate : 0.0;
+  publishing_thread_ = new boost::thread(boost::bind(&BatchMarkerPublisher::publishingThread, this));
+}
+
+BatchMarkerPublisher::~BatchMarkerPublisher()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  condition_.notify_all();
+  publishing_thread_->join();
+  delete publishing_thread_;
+}
+
+bool BatchMarkerPublisher::active() const
+{
+  bool enabled = true;
+  ros::param::getCached("~tester_visualization", enabled);
+  return enabled && publisher_.getNumSubscribers() > 0;
+}
+
+void BatchMarkerPublisher::publish(visualization_msgs::MarkerArray &markers)
+{
+  if (markers.markers.empty()) return;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    pending_.markers.swap(markers.markers);
+    has_pending_ = true;
+  }
+  markers.markers.clear();
+  condition_.notify_all();
+}
+
+void BatchMarkerPublisher::publishingThread()
+{
+  ros::WallTime last_publish(0);
+  visualization_msgs::MarkerArray batch;
+  while (true)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!has_pending_ && !shutdown_) condition_.wait(lock);
+      if (shutdown_) return;
+    }
+    //wait out the rest of the period; batches arriving meanwhile replace the pending one
+    ros::WallDuration wait = ros::WallDuration(min_period_) - (ros::WallTime::now() - last_publish);
+    if (wait > ros::WallDuration(0)) wait.sleep();
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (shutdown_) return;
+      batch.markers.swap(pending_.markers);
+      pending_.markers.clear();
+      has_pending_ = false;
+    }
+    publisher_.publish(batch);
+    last_publish = ros::WallTime::now();
+  }
+}
+
+} //namespace object_manipulator
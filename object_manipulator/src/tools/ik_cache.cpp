@@ -0,0 +1,368 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/ik_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#include <boost/shared_array.hpp>
+
+#include <ros/ros.h>
+#include <ros/serialization.h>
+
+#include "object_manipulator/tools/message_hash.h"
+
+namespace object_manipulator {
+
+static const char IK_CACHE_FILE_MAGIC[] = "OMIKCACHE";
+static const boost::uint32_t IK_CACHE_FILE_VERSION = 3;
+
+bool IKCache::Key::operator<(const Key &other) const
+{
+  if (scene_hash_ != other.scene_hash_) return scene_hash_ < other.scene_hash_;
+  if (context_hash_ != other.context_hash_) return context_hash_ < other.context_hash_;
+  for (int i=0; i<7; i++) {
+    if (cell_[i] != other.cell_[i]) return cell_[i] < other.cell_[i];
+  }
+  return group_ < other.group_;
+}
+
+IKCache::IKCache(size_t capacity, double position_resolution, double orientation_resolution,
+                 double joint_resolution) :
+  capacity_(std::max<size_t>(capacity, 1)),
+  position_resolution_(position_resolution),
+  orientation_resolution_(orientation_resolution),
+  joint_resolution_(joint_resolution),
+  hits_(0),
+  misses_(0),
+  revision_(0)
+{
+}
+
+boost::uint64_t IKCache::sceneHash(boost::uint64_t static_scene_hash, 
+                                   const std::vector<double> &arm_joint_values) const
+{
+  MessageHasher hasher;
+  hasher.add(static_scene_hash);
+  for (size_t i=0; i<arm_joint_values.size(); i++) {
+    hasher.add((boost::uint64_t)(boost::int64_t) floor(arm_joint_values[i] / joint_resolution_ + 0.5));
+  }
+  return hasher.getHash();
+}
+
+IKCache::Key IKCache::makeKey(const std::string &group, const geometry_msgs::Pose &base_frame_pose,
+                              boost::uint64_t scene_hash, boost::uint64_t context_hash) const
+{
+  Key key;
+  key.group_ = group;
+  key.scene_hash_ = scene_hash;
+  key.context_hash_ = context_hash;
+  key.cell_[0] = (boost::int32_t) floor(base_frame_pose.position.x / position_resolution_ + 0.5);
+  key.cell_[1] = (boost::int32_t) floor(base_frame_pose.position.y / position_resolution_ + 0.5);
+  key.cell_[2] = (boost::int32_t) floor(base_frame_pose.position.z / position_resolution_ + 0.5);
+
+  //q and -q are the same rotation; a quaternion component changes by about half the rotation angle
+  double q[4] = {base_frame_pose.orientation.x, base_frame_pose.orientation.y, 
+                 base_frame_pose.orientation.z, base_frame_pose.orientation.w};
+  double norm = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  if (norm == 0) norm = 1;
+  double sign = (q[3] < 0) ? -1.0 : 1.0;
+  for (int i=0; i<4; i++) {
+    key.cell_[3+i] = (boost::int32_t) floor(sign * q[i] / norm / (0.5 * orientation_resolution_) + 0.5);
+  }
+  return key;
+}
+
+bool IKCache::lookup(const Key &key, Entry &entry)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<Key, EntryList::iterator>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  entry = it->second->second;
+  return true;
+}
+
+void IKCache::insertLocked(const Key &key, const Entry &entry)
+{
+  revision_++;
+  std::map<Key, EntryList::iterator>::iterator it = index_.find(key);
+  if (it != index_.end()) {
+    it->second->second = entry;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  entries_.push_front(std::make_pair(key, entry));
+  index_[key] = entries_.begin();
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void IKCache::insert(const Key &key, const Entry &entry)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  insertLocked(key, entry);
+}
+
+void IKCache::insert(Pending &pending)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  for (size_t i=0; i<pending.entries_.size(); i++) {
+    if (pending.filled_[i]) insertLocked(pending.entries_[i].first, pending.entries_[i].second);
+  }
+  pending.reset(pending.entries_.size());
+}
+
+void IKCache::Pending::reset(size_t size)
+{
+  entries_.clear();
+  entries_.resize(size);
+  filled_.assign(size, 0);
+}
+
+void IKCache::Pending::set(size_t i, const Key &key, const Entry &entry)
+{
+  entries_[i].first = key;
+  entries_[i].second = entry;
+  filled_[i] = 1;
+}
+
+void IKCache::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  revision_++;
+}
+
+size_t IKCache::size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return entries_.size();
+}
+
+void IKCache::getStats(size_t &hits, size_t &misses) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  hits = hits_;
+  misses = misses_;
+}
+
+size_t IKCache::getRevision() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return revision_;
+}
+
+namespace {
+
+template <class T>
+void writeValue(std::ostream &out, const T &value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+bool readValue(std::istream &in, T &value)
+{
+  in.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return in.good();
+}
+
+//! Whether there are at least size bytes left before end, the size of the file being read
+bool bytesLeft(std::istream &in, std::streamoff end, boost::uint64_t size)
+{
+  std::streamoff pos = in.tellg();
+  if (pos < 0 || pos > end) return false;
+  return size <= (boost::uint64_t)(end - pos);
+}
+
+void writeString(std::ostream &out, const std::string &str)
+{
+  writeValue(out, (boost::uint32_t) str.size());
+  out.write(str.data(), str.size());
+}
+
+bool readString(std::istream &in, std::streamoff end, std::string &str)
+{
+  boost::uint32_t size;
+  if (!readValue(in, size) || !bytesLeft(in, end, size)) return false;
+  str.resize(size);
+  if (size > 0) in.read(&str[0], size);
+  return in.good();
+}
+
+void writeVector(std::ostream &out, const std::vector<double> &values)
+{
+  writeValue(out, (boost::uint32_t) values.size());
+  if (!values.empty()) out.write(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(double));
+}
+
+bool readVector(std::istream &in, std::streamoff end, std::vector<double> &values)
+{
+  boost::uint32_t size;
+  if (!readValue(in, size) || !bytesLeft(in, end, (boost::uint64_t) size * sizeof(double))) return false;
+  values.resize(size);
+  if (size > 0) in.read(reinterpret_cast<char*>(&values[0]), size * sizeof(double));
+  return in.good();
+}
+
+template <class M>
+void writeMessage(std::ostream &out, const M &msg)
+{
+  boost::uint32_t length = ros::serialization::serializationLength(msg);
+  boost::shared_array<uint8_t> buffer(new uint8_t[length]);
+  ros::serialization::OStream stream(buffer.get(), length);
+  ros::serialization::serialize(stream, msg);
+  writeValue(out, length);
+  out.write(reinterpret_cast<const char*>(buffer.get()), length);
+}
+
+template <class M>
+bool readMessage(std::istream &in, std::streamoff end, M &msg)
+{
+  boost::uint32_t length;
+  if (!readValue(in, length) || !bytesLeft(in, end, length)) return false;
+  boost::shared_array<uint8_t> buffer(new uint8_t[length]);
+  in.read(reinterpret_cast<char*>(buffer.get()), length);
+  if (!in.good()) return false;
+  //the lengths inside the message are checked against the buffer by the deserializer
+  try
+  {
+    ros::serialization::IStream stream(buffer.get(), length);
+    ros::serialization::deserialize(stream, msg);
+  }
+  catch (ros::Exception &ex)
+  {
+    return false;
+  }
+  return true;
+}
+
+} //namespace
+
+bool IKCache::save(const std::string &filename) const
+{
+  std::string temp_filename = filename + ".tmp";
+  std::ofstream out(temp_filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out.good()) {
+    ROS_ERROR("IK cache: could not open %s for writing", temp_filename.c_str());
+    return false;
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  out.write(IK_CACHE_FILE_MAGIC, sizeof(IK_CACHE_FILE_MAGIC));
+  writeValue(out, IK_CACHE_FILE_VERSION);
+  writeValue(out, (boost::uint64_t) entries_.size());
+  //least recently used first, so that loading restores the order
+  for (EntryList::const_reverse_iterator it = entries_.rbegin(); it != entries_.rend(); it++) {
+    const Key &key = it->first;
+    const Entry &entry = it->second;
+    writeString(out, key.group_);
+    for (int i=0; i<7; i++) writeValue(out, key.cell_[i]);
+    writeValue(out, key.scene_hash_);
+    writeValue(out, key.context_hash_);
+    writeValue(out, (boost::int32_t) entry.result_code_);
+    writeValue(out, entry.collision_map_hash_);
+    writeVector(out, entry.seed_);
+    writeVector(out, entry.solution_);
+    writeMessage(out, entry.first_trajectory_);
+    writeMessage(out, entry.second_trajectory_);
+  }
+  out.close();
+  if (out.fail()) {
+    ROS_ERROR("IK cache: failed writing to %s", temp_filename.c_str());
+    remove(temp_filename.c_str());
+    return false;
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    ROS_ERROR("IK cache: could not replace %s with %s", filename.c_str(), temp_filename.c_str());
+    remove(temp_filename.c_str());
+    return false;
+  }
+  ROS_DEBUG("IK cache: saved %zd entries to %s", entries_.size(), filename.c_str());
+  return true;
+}
+
+bool IKCache::load(const std::string &filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in.good()) {
+    ROS_WARN("IK cache: could not open %s for reading", filename.c_str());
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  std::streamoff end = in.tellg();
+  in.seekg(0, std::ios::beg);
+  char magic[sizeof(IK_CACHE_FILE_MAGIC)];
+  boost::uint32_t version;
+  boost::uint64_t num_entries;
+  in.read(magic, sizeof(magic));
+  if (!in.good() || memcmp(magic, IK_CACHE_FILE_MAGIC, sizeof(magic)) != 0 ||
+      !readValue(in, version) || version != IK_CACHE_FILE_VERSION || !readValue(in, num_entries)) {
+    ROS_ERROR("IK cache: %s is not an IK cache file of a known version", filename.c_str());
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  for (boost::uint64_t n=0; n<num_entries; n++) {
+    Key key;
+    Entry entry;
+    boost::int32_t result_code;
+    bool ok = readString(in, end, key.group_);
+    for (int i=0; ok && i<7; i++) ok = readValue(in, key.cell_[i]);
+    ok = ok && readValue(in, key.scene_hash_) && readValue(in, key.context_hash_) && 
+      readValue(in, result_code) && readValue(in, entry.collision_map_hash_) && readVector(in, end, entry.seed_) && readVector(in, end, entry.solution_) &&
+      readMessage(in, end, entry.first_trajectory_) && readMessage(in, end, entry.second_trajectory_);
+    if (!ok) {
+      ROS_ERROR("IK cache: %s is truncated or damaged; loaded %llu of %llu entries", filename.c_str(), 
+                (unsigned long long) n, (unsigned long long) num_entries);
+      return false;
+    }
+    entry.result_code_ = result_code;
+    insertLocked(key, entry);
+  }
+  ROS_INFO("IK cache: loaded %llu entries from %s", (unsigned long long) num_entries, filename.c_str());
+  return true;
+}
+
+} //namespace object_manipulator
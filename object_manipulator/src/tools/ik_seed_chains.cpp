@@ -0,0 +1,109 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/ik_seed_chains.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace object_manipulator {
+
+double IKSeedChains::distance(size_t i, size_t j) const
+{
+  const PoseBatch &p = *poses_;
+  double dx = p.component(PoseBatch::X)[i] - p.component(PoseBatch::X)[j];
+  double dy = p.component(PoseBatch::Y)[i] - p.component(PoseBatch::Y)[j];
+  double dz = p.component(PoseBatch::Z)[i] - p.component(PoseBatch::Z)[j];
+  //quaternions are normalized by the batch; q and -q are the same rotation
+  double dot = fabs(p.component(PoseBatch::QX)[i] * p.component(PoseBatch::QX)[j] + 
+                    p.component(PoseBatch::QY)[i] * p.component(PoseBatch::QY)[j] + 
+                    p.component(PoseBatch::QZ)[i] * p.component(PoseBatch::QZ)[j] + 
+                    p.component(PoseBatch::QW)[i] * p.component(PoseBatch::QW)[j]);
+  double angle = 2.0 * acos(std::min(dot, 1.0));
+  return sqrt(dx*dx + dy*dy + dz*dz) + rotation_weight_ * angle;
+}
+
+void IKSeedChains::build(const PoseBatch &poses, const std::vector<size_t> &candidates)
+{
+  poses_ = &poses;
+  chains_.clear();
+  std::vector<bool> used(candidates.size(), false);
+  size_t first_unused = 0;
+  while (true) {
+    while (first_unused < candidates.size() && used[first_unused]) first_unused++;
+    if (first_unused == candidates.size()) break;
+
+    chains_.push_back(std::vector<size_t>());
+    std::vector<size_t> &chain = chains_.back();
+    size_t current = first_unused;
+    while (true) {
+      used[current] = true;
+      chain.push_back(candidates[current]);
+
+      //the nearest remaining candidate; ties go to the earlier one, keeping the chains deterministic
+      size_t nearest = candidates.size();
+      double nearest_distance = std::numeric_limits<double>::max();
+      for (size_t k=first_unused; k<candidates.size(); k++) {
+        if (used[k]) continue;
+        double d = distance(candidates[current], candidates[k]);
+        if (d < nearest_distance) {
+          nearest = k;
+          nearest_distance = d;
+        }
+      }
+      if (nearest == candidates.size() || nearest_distance > max_distance_) break;
+      current = nearest;
+    }
+  }
+}
+
+void IKSeedChains::solveChain(size_t c, std::vector< std::vector<double> > &seeds,
+                              const std::vector< std::vector<double> > &solutions,
+                              boost::function<void(size_t)> solve) const
+{
+  const std::vector<size_t> &chain = chains_[c];
+  //the last candidate along the chain that IK was found for
+  size_t last_solved = chain.size();
+  for (size_t k=0; k<chain.size(); k++) {
+    size_t i = chain[k];
+    seeds[i].clear();
+    if (last_solved < chain.size() && distance(chain[last_solved], i) <= max_distance_) {
+      seeds[i] = solutions[chain[last_solved]];
+    }
+    solve(i);
+    if (!solutions[i].empty()) last_solved = k;
+  }
+}
+
+} //namespace object_manipulator
@@ -33,10 +33,13 @@
 
 // Author(s): Kaijen Hsiao (code adapted from Gil's fast grasp tester)
 
+#include <boost/bind.hpp>
+
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/vector_tools.h"
 #include "object_manipulator/tools/mechanism_interface.h"
 #include "object_manipulator/tools/ik_tester_fast.h"
+#include "object_manipulator/tools/exceptions.h"
 
 using arm_navigation_msgs::ArmNavigationErrorCodes;
 
@@ -45,6 +48,10 @@ namespace object_manipulator {
   IKTesterFast::IKTesterFast(planning_environment::CollisionModels* cm,
 				   const std::string& plugin_name) 
   : redundancy_(2),
+    num_threads_(1),
+    seed_propagation_(false),
+    seed_distance_(0.05),
+    worker_pool_(kinematics_loader_, plugin_name),
     cm_(cm),
     state_(NULL),
     kinematics_loader_("kinematics_base","kinematics::KinematicsBase")
@@ -54,34 +61,14 @@ namespace object_manipulator {
   vis_marker_publisher_ = nh.advertise<visualization_msgs::Marker> ("ik_tester_fast", 128);
   vis_marker_array_publisher_ = nh.advertise<visualization_msgs::MarkerArray> ("ik_tester_fast_array", 128);
 
-  const std::map<std::string, planning_models::KinematicModel::GroupConfig>& group_config_map = 
-    getCollisionModels()->getKinematicModel()->getJointModelGroupConfigMap();
-
-  for(std::map<std::string, planning_models::KinematicModel::GroupConfig>::const_iterator it = group_config_map.begin();
-      it != group_config_map.end();
-      it++) {
-    kinematics::KinematicsBase* kinematics_solver = NULL;
-    try
-    {
-      kinematics_solver = kinematics_loader_.createClassInstance(plugin_name);
-    }
-    catch(pluginlib::PluginlibException& ex)
-    {
-      ROS_ERROR("The plugin failed to load. Error1: %s", ex.what());    //handle the class failing to load
-      return;
-    }
-    if(!it->second.base_link_.empty() && !it->second.tip_link_.empty()) {
-      ik_solver_map_[it->first] = new arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware(kinematics_solver,
-                                                                                                          getCollisionModels(),
-                                                                                                          it->first);
-      ik_solver_map_[it->first]->setSearchDiscretization(.025);
-    }
-  }
+  createIKSolvers(getCollisionModels(), kinematics_loader_, plugin_name, ik_solver_map_);
 }
 
 IKTesterFast::~IKTesterFast()
 {
-  for(std::map<std::string, arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware*>::iterator it = ik_solver_map_.begin();
+  //the kinematics loader is destroyed before the pool, and takes the plugin libraries with it
+  worker_pool_.clear();
+  for(IKSolverMap::iterator it = ik_solver_map_.begin();
       it != ik_solver_map_.end();
       it++) {
     delete it->second;
@@ -134,22 +121,226 @@ void IKTesterFast::getGroupJoints(const std::string& group_name,
 }
 
 
+void IKTesterFast::configureStage(const IKTestBatch &batch, TesterWorkspace &workspace, int stage)
+{
+  if(workspace.configuration_ == stage) return;
+  switch(stage)
+  {
+  case COLLISION_STAGE:
+    //only check the gripper for collisions, not the arm
+    workspace.cm_->setAlteredAllowedCollisionMatrix(batch.group_all_arm_disable_acm_);
+    break;
+  case IK_STAGE:
+    //go back to checking the entire arm
+    workspace.cm_->setAlteredAllowedCollisionMatrix(batch.group_disable_acm_);
+    break;
+  }
+  workspace.configuration_ = stage;
+}
+
+void IKTesterFast::testIKCollision(IKTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  planning_environment::CollisionModels* cm = workspace.cm_;
+  planning_models::KinematicState* state = workspace.state_;
+  const geometry_msgs::PoseStamped &test_pose = (*batch.test_poses_)[i];
+
+  //set kinematic state back to original
+  batch.posture_plan_.applyBase(*state);
+
+  //first check to see if the gripper itself is in collision
+  geometry_msgs::PoseStamped world_pose_stamped;
+  if(!cm->convertPoseGivenWorldTransform(*state,
+                                         batch.world_header_.frame_id,
+                                         test_pose.header,
+                                         test_pose.pose,
+                                         world_pose_stamped)) {
+    ROS_WARN_STREAM("Can't convert into frame " << batch.world_header_.frame_id);
+    return;
+  }
+  batch.converted_[i] = true;
+  batch.world_poses_.set(i, world_pose_stamped.pose);
+    
+  tf::Transform tf_pose;
+  tf::poseMsgToTF(world_pose_stamped.pose, tf_pose);
+
+  if(!state->updateKinematicStateWithLinkAt(batch.gripper_frame_, tf_pose))
+  {
+    ROS_ERROR("ik_tester_fast: updateKinematicStateWithLinkAt failed!");
+  }
+
+  if(cm->isKinematicStateInCollision(*state)) {
+    ROS_DEBUG("Kinematic state in collision!");
+    (*batch.error_codes_)[i].val = ArmNavigationErrorCodes::KINEMATICS_STATE_IN_COLLISION;
+  } 
+}
+
+void IKTesterFast::testIK(IKTestBatch &batch, TesterWorkspace &workspace, size_t i)
+{
+  planning_environment::CollisionModels* cm = workspace.cm_;
+  planning_models::KinematicState* state = workspace.state_;
+  arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* ik_solver = 
+    workspace.ik_solver_map_[batch.arm_name_];
+
+  //now check collision-aware ik for pose, seeded from the planning scene state
+  std::vector<double> &values = workspace.state_values_;
+  values = batch.posture_plan_.getBaseValues();
+  if(!batch.ik_seeds_.empty() && !batch.ik_seeds_[i].empty()) {
+    //or from the solution for a neighbouring pose
+    batch.posture_plan_.setJoints(batch.arm_joints_, batch.ik_seeds_[i], values);
+    stats_.increment(TesterStats::IK_SEEDED);
+  }
+  state->setKinematicState(values);
+
+  geometry_msgs::Pose world_pose;
+  batch.world_poses_.get(i, world_pose);
+  geometry_msgs::PoseStamped base_link_gripper_pose;
+  cm->convertPoseGivenWorldTransform(*state,
+                                     ik_solver->getBaseName(),
+                                     batch.world_header_,
+                                     world_pose,
+                                     base_link_gripper_pose);
+
+  ReachabilityMaps::const_iterator map_it = reachability_maps_.find(batch.arm_name_);
+  if(map_it != reachability_maps_.end() && !map_it->second->isReachable(base_link_gripper_pose.pose)) {
+    ROS_DEBUG("Pose rejected by reachability map");
+    stats_.increment(TesterStats::REACHABILITY_REJECTION);
+    (*batch.error_codes_)[i].val = ArmNavigationErrorCodes::NO_IK_SOLUTION;
+    return;
+  }
+
+  arm_navigation_msgs::Constraints emp;
+  sensor_msgs::JointState solution;
+  ArmNavigationErrorCodes error_code;
+  ROS_DEBUG_STREAM("x y z " << base_link_gripper_pose.pose.position.x << " " 
+                   << base_link_gripper_pose.pose.position.y << " " 
+                   << base_link_gripper_pose.pose.position.z);
+  StageTimer ik_timer(stats_, TesterStats::IK);
+  bool ik_found = ik_solver->findConstraintAwareSolution(base_link_gripper_pose.pose,
+                                                         emp,
+                                                         state,
+                                                         solution,
+                                                         error_code,
+                                                         false);
+  ik_timer.stop();
+  if(ik_found) {
+    (*batch.solutions_)[i] = solution;
+    if(!batch.ik_solutions_.empty()) batch.ik_solutions_[i] = solution.position;
+  }
+  //didn't find a solution 
+  else 
+  {
+    ROS_DEBUG("Pose out of reach or in collision");
+  }
+  (*batch.error_codes_)[i].val = error_code.val;
+}
+
+void IKTesterFast::testIKChain(IKTestBatch &batch, TesterWorkspace &workspace, size_t c)
+{
+  batch.seed_chains_.solveChain(c, batch.ik_seeds_, batch.ik_solutions_,
+                                boost::bind(&IKTesterFast::testPoseInStage, this, boost::ref(batch),
+                                            (int)IK_STAGE, boost::ref(workspace), _1));
+}
+
+void IKTesterFast::testPoseInStage(IKTestBatch &batch, int stage, TesterWorkspace &workspace, size_t i)
+{
+  if(stage == COLLISION_STAGE) {
+    StageTimer timer(stats_, TesterStats::COLLISION);
+    testIKCollision(batch, workspace, i);
+  } else {
+    //IK is timed on its own, without the reachability check
+    testIK(batch, workspace, i);
+  }
+  //a pose is done once it fails the collision check, or could not be converted, or went through IK
+  bool done = stage == IK_STAGE || !batch.converted_[i] || (*batch.error_codes_)[i].val != 0;
+  if(done && batch.report_) result_function_(i);
+}
+
+void IKTesterFast::testIKInStage(IKTestBatch &batch, const std::vector<size_t> &indices, int stage,
+                                 TesterWorkspace &workspace, size_t job)
+{
+  testPoseInStage(batch, stage, workspace, indices[job]);
+}
+
+void IKTesterFast::runStage(IKTestBatch &batch, const std::vector<TesterWorkspace*> &workspaces, int stage,
+                            size_t begin, size_t end)
+{
+  if (interrupt_function_ && interrupt_function_()) throw InterruptRequestedException();
+
+  //the collision stage is the one that sets the error codes in the first place
+  std::vector<size_t> pending;
+  for(size_t i = begin; i < end; i++) {
+    if(stage == COLLISION_STAGE || (batch.converted_[i] && (*batch.error_codes_)[i].val == 0)) {
+      pending.push_back(i);
+    }
+  }
+  if(stage == IK_STAGE && seed_propagation_) {
+    //each chain is solved in order by a single worker, so seeds never depend on scheduling
+    batch.seed_chains_.build(batch.world_poses_, pending);
+    runInWorkspaces(workspaces, batch.seed_chains_.size(),
+                    boost::bind(&IKTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                    boost::bind(&IKTesterFast::testIKChain, this, boost::ref(batch), _1, _2));
+    return;
+  }
+  runInWorkspaces(workspaces, pending.size(),
+                  boost::bind(&IKTesterFast::configureStage, this, boost::cref(batch), _1, stage),
+                  boost::bind(&IKTesterFast::testIKInStage, this, boost::ref(batch),
+                              boost::cref(pending), stage, _1, _2));
+}
+
+std::vector<TesterWorkspace*> IKTesterFast::getWorkspaces(TesterWorkspace *serial_workspace)
+{
+  std::vector<TesterWorkspace*> workspaces;
+  //workers mirror the planning scene of the mechanism interface, so we can only use them if that's what we test against
+  if(num_threads_ <= 1 || cm_ != NULL || state_ != NULL) {
+    workspaces.push_back(serial_workspace);
+    return workspaces;
+  }
+  return worker_pool_.getWorkspaces(num_threads_,
+                                    mechInterface().getPlanningSceneMessage(),
+                                    mechInterface().getPlanningSceneRevision());
+}
+
 void IKTesterFast::testIKSet(std::string arm_name, const std::vector<geometry_msgs::PoseStamped> &test_poses,
                              bool return_on_first_hit, std::vector<sensor_msgs::JointState> &solutions_arr,
                              std::vector<arm_navigation_msgs::ArmNavigationErrorCodes> &error_codes)
 {
   ros::WallTime start = ros::WallTime::now();
 
+  error_codes.clear();
   error_codes.resize(test_poses.size());
+  solutions_arr.clear();
   solutions_arr.resize(test_poses.size());
   std::map<int, int> outcome_count;
 
-  state_ = NULL;
+  if(ik_solver_map_.find(arm_name) == ik_solver_map_.end()) {
+    ROS_ERROR_STREAM("No IK solver for arm " << arm_name);
+    throw GraspException("no IK solver for requested arm");
+  }
+
+  //unless testing against our own models, always use the latest planning scene
+  if(cm_ == NULL) state_ = NULL;
   planning_environment::CollisionModels* cm = getCollisionModels();
   planning_models::KinematicState* state = getPlanningSceneState();
 
-  std::map<std::string, double> planning_scene_state_values;
-  state->getKinematicStateValues(planning_scene_state_values);
+  IKTestBatch batch;
+  batch.arm_name_ = arm_name;
+  batch.test_poses_ = &test_poses;
+  batch.solutions_ = &solutions_arr;
+  batch.error_codes_ = &error_codes;
+  //when returning on the first hit, results are only final once we know where the first hit is
+  batch.report_ = result_function_ && !return_on_first_hit;
+  batch.gripper_frame_ = handDescription().gripperFrame(arm_name);
+  batch.world_poses_.resize(test_poses.size());
+  batch.converted_.assign(test_poses.size(), false);
+  if(seed_propagation_) {
+    batch.seed_chains_ = IKSeedChains(seed_distance_);
+    batch.ik_seeds_.resize(test_poses.size());
+    batch.ik_solutions_.resize(test_poses.size());
+  }
+
+  //restoring the original state by index is much cheaper than by joint name
+  batch.posture_plan_.init(*state);
+  batch.arm_joints_ = batch.posture_plan_.addJoints(ik_solver_map_[arm_name]->getJointNames());
 
   std::vector<std::string> end_effector_links, arm_links; 
   getGroupLinks(handDescription().gripperCollisionName(arm_name), end_effector_links);
@@ -157,91 +348,63 @@ void IKTesterFast::testIKSet(std::string arm_name, const std::vector<geometry_ms
 
   collision_space::EnvironmentModel::AllowedCollisionMatrix original_acm = cm->getCurrentAllowedCollisionMatrix();
   cm->disableCollisionsForNonUpdatedLinks(arm_name);
-  collision_space::EnvironmentModel::AllowedCollisionMatrix group_disable_acm = cm->getCurrentAllowedCollisionMatrix();
-  collision_space::EnvironmentModel::AllowedCollisionMatrix group_all_arm_disable_acm = group_disable_acm;
+  batch.group_disable_acm_ = cm->getCurrentAllowedCollisionMatrix();
+  batch.group_all_arm_disable_acm_ = batch.group_disable_acm_;
 
   //turning off collisions for the arm associated with this end effector for group_all_arm_disable_acm
   for(unsigned int i = 0; i < arm_links.size(); i++) {
-    group_all_arm_disable_acm.changeEntry(arm_links[i], true);
+    batch.group_all_arm_disable_acm_.changeEntry(arm_links[i], true);
   }
 
-  std_msgs::Header world_header;
-  world_header.frame_id = cm->getWorldFrameId();
-
-  //Check IK for each pose in turn
-  for(unsigned int i = 0; i < test_poses.size(); i++) {
-
-    //set kinematic state back to original
-    state->setKinematicState(planning_scene_state_values);
-
-    //first check to see if the gripper itself is in collision
-    geometry_msgs::PoseStamped world_pose_stamped;
-    if(!cm->convertPoseGivenWorldTransform(*state,
-                                           world_header.frame_id,
-                                           test_poses[i].header,
-                                           test_poses[i].pose,
-                                           world_pose_stamped)) {
-      ROS_WARN_STREAM("Can't convert into frame " << world_header.frame_id);
-      continue;
-    }
-    
-    tf::Transform tf_pose;
-    tf::poseMsgToTF(world_pose_stamped.pose, tf_pose);
-
-    //only check the gripper for collisions, not the arm
-    cm->setAlteredAllowedCollisionMatrix(group_all_arm_disable_acm);
+  batch.world_header_.frame_id = cm->getWorldFrameId();
 
-    if(!state->updateKinematicStateWithLinkAt(handDescription().gripperFrame(arm_name), tf_pose))
-    {
-      ROS_ERROR("ik_tester_fast: updateKinematicStateWithLinkAt failed!");
-    }
+  //the workers get the same planning scene, so the allowed collision matrices computed here apply to them too
+  TesterWorkspace serial_workspace(cm, state, ik_solver_map_);
+  std::vector<TesterWorkspace*> workspaces = getWorkspaces(&serial_workspace);
+  for(size_t w = 0; w < workspaces.size(); w++) {
+    workspaces[w]->configuration_ = -1;
+  }
+  if(workspaces.size() > 1) {
+    ROS_DEBUG_STREAM("Testing " << test_poses.size() << " poses on " << workspaces.size() << " threads");
+  }
 
-    if(cm->isKinematicStateInCollision(*state)) {
-      ROS_DEBUG("Kinematic state in collision!");
-      outcome_count[arm_navigation_msgs::ArmNavigationErrorCodes::KINEMATICS_STATE_IN_COLLISION]++;
-      error_codes[i].val = arm_navigation_msgs::ArmNavigationErrorCodes::KINEMATICS_STATE_IN_COLLISION;
-      continue;
-    } 
-    
-    //now check collision-aware ik for pose
-    //go back to checking the entire arm
-    cm->setAlteredAllowedCollisionMatrix(group_disable_acm);
-    //cm->setAlteredAllowedCollisionMatrix(original_acm);
-    state->setKinematicState(planning_scene_state_values);
-
-    geometry_msgs::PoseStamped base_link_gripper_pose;
-    cm->convertPoseGivenWorldTransform(*state,
-                                       ik_solver_map_[arm_name]->getBaseName(),
-                                       world_header,
-                                       world_pose_stamped.pose,
-                                       base_link_gripper_pose);
-
-    arm_navigation_msgs::Constraints emp;
-    sensor_msgs::JointState solution;
-    arm_navigation_msgs::ArmNavigationErrorCodes error_code;
-    ROS_DEBUG_STREAM("x y z " << base_link_gripper_pose.pose.position.x << " " 
-                     << base_link_gripper_pose.pose.position.y << " " 
-                     << base_link_gripper_pose.pose.position.z);
-    if(ik_solver_map_[arm_name]->findConstraintAwareSolution(base_link_gripper_pose.pose,
-                                                              emp,
-                                                              state,
-                                                              solution,
-                                                              error_code,
-                                                              false)) {
-      solutions_arr[i] = solution;
+  size_t end = test_poses.size();
+  try
+  {
+    if(return_on_first_hit) {
+      //poses are tested a window at a time; the first success in the original order wins, so the 
+      //result does not depend on the number of workers
+      size_t window = workspaces.size();
+      for(size_t begin = 0; begin < end; begin += window) {
+        size_t window_end = std::min(begin + window, test_poses.size());
+        runStage(batch, workspaces, COLLISION_STAGE, begin, window_end);
+        runStage(batch, workspaces, IK_STAGE, begin, window_end);
+        for(size_t i = begin; i < window_end; i++) {
+          if(error_codes[i].val == ArmNavigationErrorCodes::SUCCESS) end = i+1;
+          if(result_function_) result_function_(i);
+          if(end == i+1) break;
+        }
+      }
+      //the poses after the first hit are reported as not tested at all
+      for(size_t i = end; i < test_poses.size(); i++) {
+        error_codes[i] = ArmNavigationErrorCodes();
+        solutions_arr[i] = sensor_msgs::JointState();
+      }
+    } else {
+      runStage(batch, workspaces, COLLISION_STAGE, 0, test_poses.size());
+      runStage(batch, workspaces, IK_STAGE, 0, test_poses.size());
     }
-    //didn't find a solution 
-    else 
-    {
-      ROS_DEBUG("Pose out of reach or in collision");
-    }
-
-    //put the collision matrix back
+  }
+  catch(...)
+  {
     cm->setAlteredAllowedCollisionMatrix(original_acm);
+    throw;
+  }
+  //put the collision matrix back
+  cm->setAlteredAllowedCollisionMatrix(original_acm);
 
-    outcome_count[error_code.val]++;
-    error_codes[i].val = error_code.val;
-    if(return_on_first_hit && error_code.val == arm_navigation_msgs::ArmNavigationErrorCodes::SUCCESS) break;
+  for(size_t i = 0; i < end; i++) {
+    if(batch.converted_[i]) outcome_count[error_codes[i].val]++;
   }
 
   ROS_INFO_STREAM("Took " << (ros::WallTime::now()-start).toSec());
@@ -251,7 +414,9 @@ void IKTesterFast::testIKSet(std::string arm_name, const std::vector<geometry_ms
       it != outcome_count.end();
       it++) {
     ROS_INFO_STREAM("Outcome " << it->first << " count " << it->second);
+    stats_.addOutcome(it->first, it->second);
   }
+  stats_.addCall(test_poses.size(), (ros::WallTime::now()-start).toSec());
 }
 
 
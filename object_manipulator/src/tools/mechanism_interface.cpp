@@ -34,6 +34,12 @@
 #include "object_manipulator/tools/mechanism_interface.h"
 #include "object_manipulator/tools/hand_description.h"
 #include "object_manipulator/tools/exceptions.h"
+#include "object_manipulator/tools/planning_scene_diff.h"
+#include "object_manipulator/tools/posture_plan.h"
+
+#include <algorithm>
+
+#include <planning_environment/models/model_utils.h>
 
 //#define PROF_ENABLED
 //#include <profiling/profiling.h>
@@ -73,6 +79,8 @@ static const std::string MOVE_ARM_PLANNER_SERVICE_NAME = "ompl_planning/plan_kin
 static const std::string MOVE_ARM_CONSTRAINED_PLANNER_SERVICE_NAME = "ompl_planning/plan_kinematic_path";
 
 static const std::string ATTACHED_COLLISION_TOPIC="attached_collision_object";
+static const std::string COLLISION_OBJECT_TOPIC="collision_object";
+static const std::string COLLISION_MAP_TOPIC="collision_map_occ";
 
 static const std::string POINT_HEAD_ACTION_TOPIC = "/head_traj_controller/point_head_action";
 
@@ -84,8 +92,21 @@ MechanismInterface::MechanismInterface() :
   root_nh_(""),priv_nh_("~"),
   cm_("robot_description"),
   planning_scene_state_(NULL),
-  planning_scene_cache_empty_(true),
+  planning_scene_revision_(0),
+  planning_scene_hash_(0),
+  collision_map_hash_(0),
   cache_planning_scene_(false),
+  incremental_planning_scene_(true),
+  verify_planning_scene_diff_(false),
+  incremental_planning_scene_installs_(0),
+  full_planning_scene_installs_(0),
+  check_state_validity_locally_(true),
+  world_revision_(0),
+  planning_scene_key_(0),
+  planning_scene_key_valid_(false),
+  planning_scene_cache_joint_tolerance_(0.001),
+  planning_scene_cache_hits_(0),
+  planning_scene_cache_misses_(0),
   //------------------- multi arm service clients -----------------------
   ik_query_client_("", IK_QUERY_SERVICE_SUFFIX, true),
   ik_service_client_("", IK_SERVICE_SUFFIX, true),
@@ -121,6 +142,132 @@ MechanismInterface::MechanismInterface() :
   //JointStates topic for current arm angles
   priv_nh_.param<std::string>("joint_states_topic", joint_states_topic_, "joint_states");
 
+  priv_nh_.param<bool>("incremental_planning_scene", incremental_planning_scene_, true);
+  priv_nh_.param<bool>("verify_planning_scene_diff", verify_planning_scene_diff_, false);
+  priv_nh_.param<bool>("check_state_validity_locally", check_state_validity_locally_, true);
+  bool persistent_services;
+  priv_nh_.param<bool>("persistent_service_connections", persistent_services, true);
+  setPersistentServices(persistent_services);
+
+  //the planning scene cache needs to know whenever the environment server's inputs change
+  priv_nh_.param<bool>("cache_planning_scene", cache_planning_scene_, false);
+  if (cache_planning_scene_)
+  {
+    std::string collision_map_topic;
+    priv_nh_.param<std::string>("collision_map_topic", collision_map_topic, COLLISION_MAP_TOPIC);
+    priv_nh_.param<double>("planning_scene_cache_joint_tolerance", planning_scene_cache_joint_tolerance_, 0.001);
+    collision_map_sub_ = root_nh_.subscribe(collision_map_topic, 1, 
+                                            &MechanismInterface::collisionMapCallback, this);
+    collision_object_sub_ = root_nh_.subscribe(COLLISION_OBJECT_TOPIC, 100, 
+                                               &MechanismInterface::collisionObjectCallback, this);
+    attached_object_sub_ = root_nh_.subscribe(ATTACHED_COLLISION_TOPIC, 100, 
+                                              &MechanismInterface::attachedObjectCallback, this);
+    joint_state_sub_ = root_nh_.subscribe(joint_states_topic_, 1, &MechanismInterface::jointStateCallback, this);
+  }
+}
+
+void MechanismInterface::setPersistentServices(bool persistent)
+{
+  ik_query_client_.setPersistent(persistent);
+  ik_service_client_.setPersistent(persistent);
+  fk_service_client_.setPersistent(persistent);
+  get_robot_state_client_.setPersistent(persistent);
+  check_state_validity_client_.setPersistent(persistent);
+  set_planning_scene_diff_service_.setPersistent(persistent);
+}
+
+namespace {
+
+//! The part of a warm-up timeout that is left; never 0, which would mean waiting forever
+ros::Duration remainingTime(const ros::Time &start_time, const ros::Duration &timeout)
+{
+  if (timeout <= ros::Duration(0)) return ros::Duration(0);
+  ros::Duration remaining = timeout - (ros::Time::now() - start_time);
+  if (remaining < ros::Duration(0.001)) remaining = ros::Duration(0.001);
+  return remaining;
+}
+
+//! Waits for the server of a client wrapper, recording its name if it is not found
+template <class Wrapper>
+void warmUpClient(Wrapper &wrapper, const ros::Time &start_time, const ros::Duration &timeout, 
+                  std::vector<std::string> &missing)
+{
+  try
+  {
+    wrapper.client(remainingTime(start_time, timeout));
+  }
+  catch (ServiceNotFoundException &ex)
+  {
+    missing.push_back(ex.what());
+  }
+}
+
+//! Waits for the server of a multi-arm client wrapper for one arm, recording its name if it is not found
+template <class Wrapper>
+void warmUpClient(Wrapper &wrapper, const std::string &arm_name, const ros::Time &start_time, 
+                  const ros::Duration &timeout, std::vector<std::string> &missing)
+{
+  try
+  {
+    wrapper.client(arm_name, remainingTime(start_time, timeout));
+  }
+  catch (ServiceNotFoundException &ex)
+  {
+    missing.push_back(ex.what());
+  }
+}
+
+} //namespace
+
+bool MechanismInterface::warmUp(const std::vector<std::string> &arm_names, ros::Duration timeout,
+                                std::vector<std::string> &missing)
+{
+  ros::Time start_time = ros::Time::now();
+  missing.clear();
+
+  //start looking for everything at once
+  check_state_validity_client_.startWaiting();
+  joint_trajectory_normalizer_service_.startWaiting();
+  switch_controller_service_.startWaiting();
+  list_controllers_service_.startWaiting();
+  get_robot_state_client_.startWaiting();
+  set_planning_scene_diff_service_.startWaiting();
+  reset_collision_map_service_.startWaiting();
+  for (size_t i=0; i<arm_names.size(); i++)
+  {
+    ik_query_client_.startWaiting(arm_names[i]);
+    ik_service_client_.startWaiting(arm_names[i]);
+    fk_service_client_.startWaiting(arm_names[i]);
+    interpolated_ik_service_client_.startWaiting(arm_names[i]);
+    interpolated_ik_set_params_client_.startWaiting(arm_names[i]);
+    grasp_status_client_.startWaiting(arm_names[i]);
+    reactive_grasp_action_client_.startWaiting(arm_names[i]);
+    reactive_lift_action_client_.startWaiting(arm_names[i]);
+    reactive_place_action_client_.startWaiting(arm_names[i]);
+    move_arm_action_client_.startWaiting(arm_names[i]);
+    traj_action_client_.startWaiting(arm_names[i]);
+    hand_posture_client_.startWaiting(arm_names[i]);
+  }
+
+  //then wait for the ones pickup and place can not do without
+  warmUpClient(get_robot_state_client_, start_time, timeout, missing);
+  warmUpClient(set_planning_scene_diff_service_, start_time, timeout, missing);
+  warmUpClient(joint_trajectory_normalizer_service_, start_time, timeout, missing);
+  if (!check_state_validity_locally_) warmUpClient(check_state_validity_client_, start_time, timeout, missing);
+  for (size_t i=0; i<arm_names.size(); i++)
+  {
+    warmUpClient(ik_query_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(ik_service_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(fk_service_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(interpolated_ik_service_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(interpolated_ik_set_params_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(move_arm_action_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(traj_action_client_, arm_names[i], start_time, timeout, missing);
+    warmUpClient(hand_posture_client_, arm_names[i], start_time, timeout, missing);
+  }
+  ROS_INFO("Mechanism interface: warm-up took %.2f s, %zu servers missing", 
+           (ros::Time::now() - start_time).toSec(), missing.size());
+  return missing.empty();
 }
 
 /*! For now, just calls the IK Info service each time. In the future, we might do some
@@ -130,7 +277,7 @@ std::vector<std::string> MechanismInterface::getJointNames(std::string arm_name)
 {
   kinematics_msgs::GetKinematicSolverInfo::Request query_request;
   kinematics_msgs::GetKinematicSolverInfo::Response query_response;  
-  if ( !ik_query_client_.client(arm_name).call(query_request, query_response) ) 
+  if ( !ik_query_client_.call(arm_name, query_request, query_response) ) 
   {
     ROS_ERROR("Failed to call ik information query");
     throw MechanismException("Failed to call ik information query");
@@ -142,7 +289,7 @@ void MechanismInterface::getRobotState(arm_navigation_msgs::RobotState& robot_st
 {
   arm_navigation_msgs::GetRobotState::Request req;
   arm_navigation_msgs::GetRobotState::Response res;  
-  if(!get_robot_state_client_.client().call(req,res)) 
+  if(!get_robot_state_client_.call(req,res)) 
   {
     ROS_ERROR("Mechanism interface: can't get current robot state");
     throw MechanismException("Mechanism interface: can't get current robot state");
@@ -150,77 +297,116 @@ void MechanismInterface::getRobotState(arm_navigation_msgs::RobotState& robot_st
   robot_state = res.robot_state;
 }
 
-bool compareOrderedCollisionOperations(const arm_navigation_msgs::OrderedCollisionOperations& c1,
-                                       const arm_navigation_msgs::OrderedCollisionOperations& c2)
+boost::uint64_t 
+MechanismInterface::planningSceneKey(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
+                                     const std::vector<arm_navigation_msgs::LinkPadding> &link_padding,
+                                     unsigned int &world_revision)
 {
-  if (c1.collision_operations.size() != c2.collision_operations.size()) return false;
-  for (size_t i=0; i<c1.collision_operations.size(); i++)
-  {
-    if (c1.collision_operations[i].object1 != c2.collision_operations[i].object1 ) return false;
-    if (c1.collision_operations[i].object2 != c2.collision_operations[i].object2 ) return false;
-    if (c1.collision_operations[i].penetration_distance != 
-        c2.collision_operations[i].penetration_distance ) return false;
-    if (c1.collision_operations[i].operation != c2.collision_operations[i].operation ) return false;
-  }
-  return true;
+  MessageHasher hasher;
+  hasher.addMessage(collision_operations);
+  for (size_t i=0; i<link_padding.size(); i++) hasher.addMessage(link_padding[i]);
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  world_revision = world_revision_;
+  hasher.add((boost::uint64_t)world_revision_);
+  hasher.add((boost::uint64_t)collision_map_stamp_.toNSec());
+  return hasher.getHash();
 }
 
-bool compareLinkPadding(const std::vector<arm_navigation_msgs::LinkPadding> &l1,
-                        const std::vector<arm_navigation_msgs::LinkPadding> &l2)
+bool MechanismInterface::robotStateUnchanged() const
 {
-  if (l1.size() != l2.size()) return false;
-  for (size_t i=0; i<l1.size(); i++)
-  {
-    if (l1[i].link_name != l2[i].link_name) return false;
-    if (l1[i].padding != l2[i].padding) return false;
+  if (!joint_state_) return false;
+  std::map<std::string, double> current;
+  for (size_t i=0; i<joint_state_->name.size() && i<joint_state_->position.size(); i++) {
+    current[joint_state_->name[i]] = joint_state_->position[i];
+  }
+  const sensor_msgs::JointState &scene_joints = planning_scene_.robot_state.joint_state;
+  for (size_t i=0; i<scene_joints.name.size() && i<scene_joints.position.size(); i++) {
+    std::map<std::string, double>::const_iterator it = current.find(scene_joints.name[i]);
+    if (it == current.end()) continue;
+    if (fabs(it->second - scene_joints.position[i]) > planning_scene_cache_joint_tolerance_) return false;
   }
   return true;
 }
 
-bool MechanismInterface::cachePlanningScene(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
-                                            const std::vector<arm_navigation_msgs::LinkPadding> &link_padding)
+bool MechanismInterface::cachePlanningScene(boost::uint64_t key)
 {
-  static int cache_hits = 0;
-  static int total_hits = 0;
-  total_hits++;
-  if (!cache_planning_scene_) 
-  {
-    ROS_DEBUG_NAMED("manipulation","Planning scene caching disabled");
-    collision_operations_cache_ = collision_operations;
-    link_padding_cache_ = link_padding;
-    return false;
-  }
-  if (planning_scene_cache_empty_)
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  if (planning_scene_state_ == NULL || !planning_scene_key_valid_ || key != planning_scene_key_)
   {
-    ROS_DEBUG_NAMED("manipulation","Planning scene cache empty.");
-    collision_operations_cache_ = collision_operations;
-    link_padding_cache_ = link_padding;
-    planning_scene_cache_empty_ = false;
+    planning_scene_cache_misses_++;
+    ROS_DEBUG_NAMED("manipulation","Planning scene cache miss (hits: %zu/%zu).", planning_scene_cache_hits_, 
+                    planning_scene_cache_hits_ + planning_scene_cache_misses_);
     return false;
   }
-  if (!compareOrderedCollisionOperations(collision_operations, collision_operations_cache_))
+  if (!robotStateUnchanged())
   {
-    ROS_DEBUG_NAMED("manipulation","Planning scene cache miss - collisions (hits: %d/%d).", cache_hits, total_hits);
-    collision_operations_cache_ = collision_operations;
-    link_padding_cache_ = link_padding;
+    planning_scene_cache_misses_++;
+    ROS_DEBUG_NAMED("manipulation","Planning scene cache miss - robot moved (hits: %zu/%zu).", 
+                    planning_scene_cache_hits_, planning_scene_cache_hits_ + planning_scene_cache_misses_);
     return false;
   }
-  if (!compareLinkPadding(link_padding, link_padding_cache_))
-  {
-    ROS_DEBUG_NAMED("manipulation","Planning scene cache miss - padding (hits: %d/%d).", cache_hits, total_hits);
-    collision_operations_cache_ = collision_operations;
-    link_padding_cache_ = link_padding;
-    return false;
-  }
-  cache_hits++;
-  ROS_DEBUG_NAMED("manipulation", "Planning scene cache hit (hits: %d/%d).", cache_hits, total_hits);
+  planning_scene_cache_hits_++;
+  ROS_DEBUG_NAMED("manipulation", "Planning scene cache hit (hits: %zu/%zu).", planning_scene_cache_hits_, 
+                  planning_scene_cache_hits_ + planning_scene_cache_misses_);
   return true;
 }
+
+void MechanismInterface::invalidatePlanningSceneCache()
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  planning_scene_key_valid_ = false;
+  world_revision_++;
+}
+
+void MechanismInterface::getPlanningSceneCacheStats(size_t &hits, size_t &misses) const
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  hits = planning_scene_cache_hits_;
+  misses = planning_scene_cache_misses_;
+}
+
+void MechanismInterface::getPlanningSceneInstallCounts(size_t &incremental, size_t &full)
+{
+  boost::recursive_mutex::scoped_lock lock(planning_scene_mutex_);
+  incremental = incremental_planning_scene_installs_;
+  full = full_planning_scene_installs_;
+}
+
+void MechanismInterface::collisionMapCallback(const arm_navigation_msgs::CollisionMap::ConstPtr &collision_map)
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  collision_map_stamp_ = collision_map->header.stamp;
+}
+
+void MechanismInterface::collisionObjectCallback(const arm_navigation_msgs::CollisionObject::ConstPtr &)
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  world_revision_++;
+}
+
+void MechanismInterface::attachedObjectCallback(const arm_navigation_msgs::AttachedCollisionObject::ConstPtr &)
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  world_revision_++;
+}
+
+void MechanismInterface::jointStateCallback(const sensor_msgs::JointState::ConstPtr &joint_state)
+{
+  boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+  joint_state_ = joint_state;
+}
   
 void MechanismInterface::getPlanningScene(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
                                           const std::vector<arm_navigation_msgs::LinkPadding> &link_padding)
 {
-  //if (cachePlanningScene(collision_operations, link_padding)) return;
+  boost::recursive_mutex::scoped_lock scene_lock(planning_scene_mutex_);
+  boost::uint64_t key = 0;
+  unsigned int world_revision = 0;
+  if (cache_planning_scene_)
+  {
+    key = planningSceneKey(collision_operations, link_padding, world_revision);
+    if (cachePlanningScene(key)) return;
+  }
   arm_navigation_msgs::SetPlanningSceneDiff::Request planning_scene_req;
   planning_scene_req.planning_scene_diff.link_padding = link_padding;
   planning_scene_req.operations = collision_operations;
@@ -228,19 +414,124 @@ void MechanismInterface::getPlanningScene(const arm_navigation_msgs::OrderedColl
   //PROF_COUNT(SET_PLANNING_SCENE);
   //PROF_START_TIMER(SET_PLANNING_SCENE);
   //ROS_INFO("mechanism_interface: setting the planning scene diff");
-  if(!set_planning_scene_diff_service_.client().call(planning_scene_req, planning_scene_res)) 
+  if(!set_planning_scene_diff_service_.call(planning_scene_req, planning_scene_res)) 
   {
     ROS_ERROR("Failed to set planning scene diff");
     throw MechanismException("Failed to set planning scene diff");
   }
   
-  if(planning_scene_state_ != NULL) {
-    cm_.revertPlanningScene(planning_scene_state_);
-  }
-  planning_scene_state_ = cm_.setPlanningScene(planning_scene_res.planning_scene);
+  installPlanningScene(planning_scene_res.planning_scene, key, world_revision);
   //PROF_STOP_TIMER(SET_PLANNING_SCENE);
 }
 
+PlanningSceneFetch 
+MechanismInterface::startPlanningSceneFetch(const arm_navigation_msgs::OrderedCollisionOperations& collision_operations,
+                                            const std::vector<arm_navigation_msgs::LinkPadding> &link_padding)
+{
+  PlanningSceneFetch fetch;
+  if (cache_planning_scene_)
+  {
+    fetch.key_ = planningSceneKey(collision_operations, link_padding, fetch.world_revision_);
+    boost::recursive_mutex::scoped_lock scene_lock(planning_scene_mutex_);
+    fetch.cached_ = cachePlanningScene(fetch.key_);
+    if (fetch.cached_) return fetch;
+  }
+  arm_navigation_msgs::SetPlanningSceneDiff::Request planning_scene_req;
+  planning_scene_req.planning_scene_diff.link_padding = link_padding;
+  planning_scene_req.operations = collision_operations;
+  fetch.call_ = set_planning_scene_diff_service_.callAsync(planning_scene_req);
+  return fetch;
+}
+
+void MechanismInterface::finishPlanningSceneFetch(const PlanningSceneFetch &fetch)
+{
+  if (fetch.cached_) return;
+  if (!fetch.call_.isValid() || !fetch.call_.succeeded())
+  {
+    std::string error = fetch.call_.isValid() ? fetch.call_.error() : "no call was made";
+    ROS_ERROR("Failed to set planning scene diff: %s", error.c_str());
+    throw MechanismException("Failed to set planning scene diff: " + error);
+  }
+  boost::recursive_mutex::scoped_lock scene_lock(planning_scene_mutex_);
+  installPlanningScene(fetch.call_.response().planning_scene, fetch.key_, fetch.world_revision_);
+}
+
+void MechanismInterface::installPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene,
+                                              boost::uint64_t key, unsigned int world_revision)
+{
+  bool incremental = false;
+  PlanningSceneSnapshot incremental_snapshot;
+  if (incremental_planning_scene_ && planning_scene_state_ != NULL)
+  {
+    incremental = applyPlanningSceneDiff(cm_, *planning_scene_state_, planning_scene_, planning_scene);
+    if (incremental && verify_planning_scene_diff_) 
+      takePlanningSceneSnapshot(cm_, *planning_scene_state_, incremental_snapshot);
+  }
+  if (!incremental || verify_planning_scene_diff_)
+  {
+    if(planning_scene_state_ != NULL) {
+      cm_.revertPlanningScene(planning_scene_state_);
+    }
+    planning_scene_state_ = cm_.setPlanningScene(planning_scene);
+  }
+  if (incremental && verify_planning_scene_diff_ && planning_scene_state_ != NULL)
+  {
+    //the full rebuild stays installed, so a mismatch is reported but does no harm
+    PlanningSceneSnapshot full_snapshot;
+    takePlanningSceneSnapshot(cm_, *planning_scene_state_, full_snapshot);
+    std::string differences;
+    if (!comparePlanningSceneSnapshots(incremental_snapshot, full_snapshot, differences))
+      ROS_ERROR("Incremental planning scene update differs from a full rebuild in:%s", differences.c_str());
+    else
+      ROS_DEBUG_NAMED("manipulation", "Incremental planning scene update matches a full rebuild");
+  }
+  if (incremental) incremental_planning_scene_installs_++;
+  else full_planning_scene_installs_++;
+  ROS_DEBUG_NAMED("manipulation", "Planning scene installed %s (incremental: %zu/%zu).", 
+                  incremental ? "as a diff" : "with a full rebuild", incremental_planning_scene_installs_, 
+                  incremental_planning_scene_installs_ + full_planning_scene_installs_);
+  planning_scene_ = planning_scene;
+  planning_scene_revision_++;
+  planning_scene_hash_ = hashPlanningScene(planning_scene_);
+  collision_map_hash_ = hashCollisionMap(planning_scene_.collision_map);
+  if (cache_planning_scene_)
+  {
+    //anything that changed since the key was computed, including an invalidation while we were 
+    //waiting for the environment server, means this planning scene may already be stale
+    boost::mutex::scoped_lock lock(planning_scene_cache_mutex_);
+    planning_scene_key_ = key;
+    planning_scene_key_valid_ = (world_revision == world_revision_);
+  }
+}
+
+boost::uint64_t MechanismInterface::hashPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene)
+{
+  arm_navigation_msgs::PlanningScene scene = planning_scene;
+  //the robot state and the sensed collision map are different in every planning scene
+  scene.robot_state = arm_navigation_msgs::RobotState();
+  scene.collision_map = arm_navigation_msgs::CollisionMap();
+  for (size_t i=0; i<scene.fixed_frame_transforms.size(); i++) {
+    scene.fixed_frame_transforms[i].header.stamp = ros::Time();
+  }
+  for (size_t i=0; i<scene.collision_objects.size(); i++) {
+    scene.collision_objects[i].header.stamp = ros::Time();
+  }
+  for (size_t i=0; i<scene.attached_collision_objects.size(); i++) {
+    scene.attached_collision_objects[i].object.header.stamp = ros::Time();
+  }
+  MessageHasher hasher;
+  hasher.addMessage(scene);
+  return hasher.getHash();
+}
+
+boost::uint64_t MechanismInterface::hashCollisionMap(const arm_navigation_msgs::CollisionMap &collision_map)
+{
+  MessageHasher hasher;
+  hasher.add(collision_map.header.frame_id);
+  hasher.addMessage(collision_map.boxes);
+  return hasher.getHash();
+}
+
 trajectory_msgs::JointTrajectory MechanismInterface::assembleJointTrajectory(std::string arm_name, 
 					   const std::vector< std::vector<double> > &positions, 
 					   float time_per_segment)
@@ -372,7 +663,7 @@ bool MechanismInterface::getFK(std::string arm_name,
  fk_request.fk_link_names[0] = handDescription().gripperFrame(arm_name);
  fk_request.robot_state.joint_state.position = positions;
  fk_request.robot_state.joint_state.name = getJointNames(arm_name);
- if( !fk_service_client_.client(arm_name).call(fk_request,fk_response) ) 
+ if( !fk_service_client_.call(arm_name, fk_request, fk_response) ) 
    {
      ROS_ERROR("FK Service Call failed altogether");
      throw MechanismException("FK Service Call failed altogether");
@@ -402,7 +693,7 @@ bool MechanismInterface::getIKForPose(std::string arm_name, const geometry_msgs:
   ik_request.ik_request.ik_seed_state.joint_state.name = getJointNames(arm_name);
   ik_request.ik_request.ik_seed_state.joint_state.position.resize(7, 0.0);
   ik_request.timeout = ros::Duration(2.0);
-  if( !ik_service_client_.client(arm_name).call(ik_request,ik_response) ) 
+  if( !ik_service_client_.call(arm_name, ik_request, ik_response) ) 
   {
     ROS_ERROR("IK Service Call failed altogether");
     throw MechanismException("IK Service Call failed altogether");
@@ -419,8 +710,96 @@ bool MechanismInterface::checkStateValidity(std::string arm_name, const std::vec
                                           const arm_navigation_msgs::OrderedCollisionOperations &collision_operations,
                                             const std::vector<arm_navigation_msgs::LinkPadding> &link_padding)
 {
+  std::vector< std::vector<double> > states(1, joint_values);
+  std::vector<bool> valid;
+  return checkStateValidity(arm_name, states, collision_operations, link_padding, valid);
+}
+
+bool MechanismInterface::checkStateValidity(std::string arm_name, 
+                                            const std::vector< std::vector<double> > &joint_values,
+                                          const arm_navigation_msgs::OrderedCollisionOperations &collision_operations,
+                                            const std::vector<arm_navigation_msgs::LinkPadding> &link_padding,
+                                            std::vector<bool> &valid)
+{
+  boost::recursive_mutex::scoped_lock scene_lock(planning_scene_mutex_);
   //prepare the planning scene
   getPlanningScene(collision_operations, link_padding);
+  valid.assign(joint_values.size(), false);
+  if (!check_state_validity_locally_ || !checkStateValidityLocally(arm_name, joint_values, valid))
+  {
+    for (size_t i=0; i<joint_values.size(); i++)
+    {
+      valid[i] = checkStateValidityRemotely(arm_name, joint_values[i]);
+    }
+  }
+  return std::find(valid.begin(), valid.end(), false) == valid.end();
+}
+
+const std::vector<std::string>& MechanismInterface::getArmJointNames(const std::string &arm_name)
+{
+  std::map<std::string, std::vector<std::string> >::iterator it = arm_joint_names_.find(arm_name);
+  if (it == arm_joint_names_.end())
+  {
+    it = arm_joint_names_.insert(std::make_pair(arm_name, getJointNames(arm_name))).first;
+  }
+  return it->second;
+}
+
+/*! Does what the state validity service does for a request with check_collisions set: the arm joints 
+  are set on top of the robot state of the planning scene, then the joint limits of the arm and 
+  collisions are checked. The planning scene state is restored afterwards.
+*/
+bool MechanismInterface::checkStateValidityLocally(const std::string &arm_name, 
+                                                   const std::vector< std::vector<double> > &joint_values,
+                                                   std::vector<bool> &valid)
+{
+  if (planning_scene_state_ == NULL) return false;
+  if (!cm_.getKinematicModel()->hasModelGroup(handDescription().armGroup(arm_name)))
+  {
+    ROS_WARN("Mechanism interface: group %s not found in the collision models, checking state validity remotely", 
+             handDescription().armGroup(arm_name).c_str());
+    return false;
+  }
+  const std::vector<std::string> &joint_names = getArmJointNames(arm_name);
+  for (size_t i=0; i<joint_values.size(); i++)
+  {
+    if (!joint_values[i].empty() && joint_values[i].size() != joint_names.size())
+    {
+      throw MechanismException("Wrong number of joint values for checkStateValidity");
+    }
+  }
+
+  //fast testers working directly on cm_ leave it with the default link padding
+  cm_.revertCollisionSpacePaddingToDefault();
+  cm_.applyLinkPaddingToCollisionSpace(planning_scene_.link_padding);
+  if (planning_scene_.allowed_collision_matrix.link_names.empty()) {
+    cm_.revertAllowedCollisionToDefault();
+  } else {
+    cm_.setAlteredAllowedCollisionMatrix(
+      planning_environment::convertFromACMMsgToACM(planning_scene_.allowed_collision_matrix));
+  }
+
+  PosturePlan posture_plan;
+  posture_plan.init(*planning_scene_state_);
+  size_t arm_joints = posture_plan.addJoints(joint_names);
+  std::vector<double> values;
+  for (size_t i=0; i<joint_values.size(); i++)
+  {
+    posture_plan.applyBase(*planning_scene_state_);
+    if (!joint_values[i].empty())
+    {
+      posture_plan.applyJoints(arm_joints, joint_values[i], *planning_scene_state_, values);
+    }
+    valid[i] = planning_scene_state_->areJointsWithinBounds(joint_names) && 
+      !cm_.isKinematicStateInCollision(*planning_scene_state_);
+  }
+  posture_plan.applyBase(*planning_scene_state_);
+  return true;
+}
+
+bool MechanismInterface::checkStateValidityRemotely(const std::string &arm_name, 
+                                                    const std::vector<double> &joint_values)
+{
   //call check state validity
   arm_navigation_msgs::GetStateValidity::Request req;
   arm_navigation_msgs::GetStateValidity::Response res;
@@ -436,7 +815,7 @@ bool MechanismInterface::checkStateValidity(std::string arm_name, const std::vec
     req.robot_state.joint_state.header.stamp = ros::Time::now();
   }
   req.check_collisions = true;
-  if(!check_state_validity_client_.client().call(req,res))
+  if(!check_state_validity_client_.call(req,res))
   {
     throw MechanismException("Call to check state validity client failed");
   }
@@ -738,6 +1117,8 @@ bool MechanismInterface::attemptMoveArmToGoal(std::string arm_name, const std::v
   while(num_tries < max_tries)
   {
     move_arm_action_client_.client(arm_name).sendGoal(move_arm_goal);
+    //move_arm sends the environment server its own planning scene diff
+    invalidatePlanningSceneCache();
     bool withinWait = move_arm_action_client_.client(arm_name).waitForResult(ros::Duration(timeout));
     if(!withinWait) 
     {
@@ -775,6 +1156,7 @@ bool MechanismInterface::attemptMoveArmToGoal(std::string arm_name, const std::v
         {
           ROS_ERROR("Mechanism interface: reset collision map service call failed");
         }
+        invalidatePlanningSceneCache();
         //tried to reset and repopulate twice already; just reset and try again right away
         if(num_tries <= 2){
           ros::Duration(5.0).sleep();
@@ -937,6 +1319,8 @@ bool MechanismInterface::moveArmConstrained(std::string arm_name, const geometry
   while(num_tries < max_tries)
   {
     move_arm_action_client_.client(arm_name).sendGoal(move_arm_goal);
+    //move_arm sends the environment server its own planning scene diff
+    invalidatePlanningSceneCache();
     bool withinWait = move_arm_action_client_.client(arm_name).waitForResult(ros::Duration(60.0));
     if(!withinWait) 
     {
@@ -1196,6 +1580,7 @@ void MechanismInterface::attachObjectToGripper(std::string arm_name, std::string
   obj.link_name = handDescription().attachLinkName(arm_name);
   obj.touch_links = handDescription().gripperTouchLinkNames(arm_name);
   attached_object_pub_.publish(obj);
+  invalidatePlanningSceneCache();
 }
  
 void MechanismInterface::detachAndAddBackObjectsAttachedToGripper(std::string arm_name, 
@@ -1208,6 +1593,7 @@ void MechanismInterface::detachAndAddBackObjectsAttachedToGripper(std::string ar
   att.object.id = collision_object_name;
   att.object.operation.operation = arm_navigation_msgs::CollisionObjectOperation::DETACH_AND_ADD_AS_OBJECT;
   attached_object_pub_.publish(att);
+  invalidatePlanningSceneCache();
 }
 
 void MechanismInterface::detachAllObjectsFromGripper(std::string arm_name)
@@ -1218,6 +1604,7 @@ void MechanismInterface::detachAllObjectsFromGripper(std::string arm_name)
   att.link_name = handDescription().attachLinkName(arm_name);
   att.object.operation.operation = arm_navigation_msgs::CollisionObjectOperation::REMOVE;
   attached_object_pub_.publish(att);
+  invalidatePlanningSceneCache();
 }
 
 void MechanismInterface::handPostureGraspAction(std::string arm_name, 
@@ -0,0 +1,260 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/planning_scene_diff.h"
+
+#include <map>
+#include <set>
+#include <utility>
+
+#include <planning_environment/models/model_utils.h>
+
+#include "object_manipulator/tools/message_hash.h"
+
+namespace object_manipulator {
+
+namespace {
+
+void clearStamps(arm_navigation_msgs::CollisionObject &object) {object.header.stamp = ros::Time();}
+
+void clearStamps(arm_navigation_msgs::AttachedCollisionObject &object) {object.object.header.stamp = ros::Time();}
+
+void clearStamps(arm_navigation_msgs::CollisionMap &collision_map) {collision_map.header.stamp = ros::Time();}
+
+void clearStamps(geometry_msgs::TransformStamped &transform) {transform.header.stamp = ros::Time();}
+
+void clearStamps(arm_navigation_msgs::AllowedContactSpecification &contact) 
+{
+  contact.pose_stamped.header.stamp = ros::Time();
+}
+
+void clearStamps(arm_navigation_msgs::RobotState &robot_state)
+{
+  robot_state.joint_state.header.stamp = ros::Time();
+  robot_state.multi_dof_joint_state.stamp = ros::Time();
+}
+
+//! Hashes the contents of a message, ignoring its time stamps
+template <class M>
+boost::uint64_t hashContents(M msg)
+{
+  clearStamps(msg);
+  MessageHasher hasher;
+  hasher.addMessage(msg);
+  return hasher.getHash();
+}
+
+//! Hashes the contents of a list of messages, ignoring their time stamps
+template <class M>
+boost::uint64_t hashAllContents(const std::vector<M> &msgs)
+{
+  MessageHasher hasher;
+  hasher.add(static_cast<boost::uint64_t>(msgs.size()));
+  for (size_t i=0; i<msgs.size(); i++) hasher.add(hashContents(msgs[i]));
+  return hasher.getHash();
+}
+
+typedef std::pair<std::string, std::string> AttachedObjectKey;
+
+AttachedObjectKey attachedObjectKey(const arm_navigation_msgs::AttachedCollisionObject &object)
+{
+  return AttachedObjectKey(object.link_name, object.object.id);
+}
+
+template <class K, class V>
+boost::uint64_t hashMap(const std::map<K, V> &values)
+{
+  MessageHasher hasher;
+  hasher.add(static_cast<boost::uint64_t>(values.size()));
+  for (typename std::map<K, V>::const_iterator it = values.begin(); it != values.end(); it++) {
+    hasher.add(it->first);
+    hasher.add(it->second);
+  }
+  return hasher.getHash();
+}
+
+} //namespace
+
+bool applyPlanningSceneDiff(planning_environment::CollisionModels &cm,
+                            planning_models::KinematicState &state,
+                            const arm_navigation_msgs::PlanningScene &from,
+                            const arm_navigation_msgs::PlanningScene &to)
+{
+  //first decide if the diff can be applied at all, so that we never leave the models half-updated
+  if (hashAllContents(from.fixed_frame_transforms) != hashAllContents(to.fixed_frame_transforms)) {
+    ROS_DEBUG_NAMED("manipulation", "Planning scene diff: fixed frame transforms changed");
+    return false;
+  }
+  if (hashAllContents(from.allowed_contacts) != hashAllContents(to.allowed_contacts)) {
+    ROS_DEBUG_NAMED("manipulation", "Planning scene diff: allowed contacts changed");
+    return false;
+  }
+  const std::string &world_frame = cm.getWorldFrameId();
+  bool map_changed = (hashContents(from.collision_map) != hashContents(to.collision_map));
+  bool robot_moved = (hashContents(from.robot_state) != hashContents(to.robot_state));
+  if ((map_changed || robot_moved) && !to.collision_map.boxes.empty() && 
+      to.collision_map.header.frame_id != world_frame) {
+    ROS_DEBUG_NAMED("manipulation", "Planning scene diff: collision map is not in the world frame and has "
+                    "changed or the robot moved");
+    return false;
+  }
+
+  //attached objects can only go away
+  std::map<AttachedObjectKey, boost::uint64_t> from_attached;
+  for (size_t i=0; i<from.attached_collision_objects.size(); i++) {
+    from_attached[attachedObjectKey(from.attached_collision_objects[i])] = 
+      hashContents(from.attached_collision_objects[i]);
+  }
+  for (size_t i=0; i<to.attached_collision_objects.size(); i++) {
+    std::map<AttachedObjectKey, boost::uint64_t>::iterator it = 
+      from_attached.find(attachedObjectKey(to.attached_collision_objects[i]));
+    if (it == from_attached.end() || it->second != hashContents(to.attached_collision_objects[i])) {
+      ROS_DEBUG_NAMED("manipulation", "Planning scene diff: attached object %s is new or has changed",
+                      to.attached_collision_objects[i].object.id.c_str());
+      return false;
+    }
+    from_attached.erase(it);
+  }
+
+  //the map is masked by the attached objects when it is set, so it must follow any change to them
+  bool reset_map = map_changed || (!to.collision_map.boxes.empty() && 
+    (!from_attached.empty() || (robot_moved && !to.attached_collision_objects.empty())));
+
+  //collision objects can come, go or change, as long as they are in the world frame
+  std::map<std::string, boost::uint64_t> from_objects;
+  for (size_t i=0; i<from.collision_objects.size(); i++) {
+    from_objects[from.collision_objects[i].id] = hashContents(from.collision_objects[i]);
+  }
+  std::vector<size_t> added_objects;
+  for (size_t i=0; i<to.collision_objects.size(); i++) {
+    const arm_navigation_msgs::CollisionObject &object = to.collision_objects[i];
+    if (object.operation.operation != arm_navigation_msgs::CollisionObjectOperation::ADD ||
+        object.header.frame_id != world_frame) {
+      ROS_DEBUG_NAMED("manipulation", "Planning scene diff: collision object %s is not a plain addition in the "
+                      "world frame", object.id.c_str());
+      return false;
+    }
+    std::map<std::string, boost::uint64_t>::iterator it = from_objects.find(object.id);
+    if (it == from_objects.end()) {
+      added_objects.push_back(i);
+    } else {
+      //objects left in from_objects get deleted below, which is also what a changed one needs
+      if (it->second == hashContents(object)) from_objects.erase(it);
+      else added_objects.push_back(i);
+    }
+  }
+
+  //setting the state is the only step that can fail, and it only touches the state
+  if (!planning_environment::setRobotStateAndComputeTransforms(to.robot_state, state)) {
+    ROS_WARN("Planning scene diff: could not set the robot state");
+    return false;
+  }
+  for (std::map<AttachedObjectKey, boost::uint64_t>::iterator it = from_attached.begin(); 
+       it != from_attached.end(); it++) {
+    cm.deleteAttachedObject(it->first.second, it->first.first);
+  }
+  for (std::map<std::string, boost::uint64_t>::iterator it = from_objects.begin(); it != from_objects.end(); it++) {
+    cm.deleteStaticObject(it->first);
+  }
+  for (size_t i=0; i<added_objects.size(); i++) {
+    cm.addStaticObject(to.collision_objects[added_objects[i]]);
+  }
+  if (reset_map) cm.setCollisionMap(to.collision_map, true);
+  cm.revertCollisionSpacePaddingToDefault();
+  cm.applyLinkPaddingToCollisionSpace(to.link_padding);
+  //the matrix must be set after adding objects, as it has entries for them
+  if (to.allowed_collision_matrix.link_names.empty()) {
+    cm.revertAllowedCollisionToDefault();
+  } else {
+    cm.setAlteredAllowedCollisionMatrix(planning_environment::convertFromACMMsgToACM(to.allowed_collision_matrix));
+  }
+  ROS_DEBUG_NAMED("manipulation", "Planning scene diff: removed %zu attached objects, removed or replaced %zu "
+                  "collision objects, added %zu, %s the collision map", from_attached.size(), from_objects.size(), 
+                  added_objects.size(), reset_map ? "reset" : "kept");
+  return true;
+}
+
+void takePlanningSceneSnapshot(planning_environment::CollisionModels &cm,
+                               const planning_models::KinematicState &state,
+                               PlanningSceneSnapshot &snapshot)
+{
+  //keyed by name, so that the order in which things were added does not matter
+  std::vector<arm_navigation_msgs::CollisionObject> objects;
+  cm.getCollisionSpaceCollisionObjects(objects);
+  std::map<std::string, boost::uint64_t> object_hashes;
+  for (size_t i=0; i<objects.size(); i++) object_hashes[objects[i].id] = hashContents(objects[i]);
+  snapshot.collision_objects_ = hashMap(object_hashes);
+
+  std::vector<arm_navigation_msgs::AttachedCollisionObject> attached;
+  cm.getAttachedCollisionObjects(attached);
+  std::map<std::string, boost::uint64_t> attached_hashes;
+  for (size_t i=0; i<attached.size(); i++) {
+    attached_hashes[attached[i].link_name + "/" + attached[i].object.id] = hashContents(attached[i]);
+  }
+  snapshot.attached_objects_ = hashMap(attached_hashes);
+
+  arm_navigation_msgs::CollisionMap collision_map;
+  cm.getCollisionSpaceCollisionMap(collision_map);
+  snapshot.collision_map_ = hashContents(collision_map);
+
+  arm_navigation_msgs::AllowedCollisionMatrix acm;
+  cm.getCollisionSpaceAllowedCollisions(acm);
+  std::map<std::string, bool> allowed;
+  for (size_t i=0; i<acm.link_names.size() && i<acm.entries.size(); i++) {
+    for (size_t j=0; j<acm.link_names.size() && j<acm.entries[i].enabled.size(); j++) {
+      allowed[acm.link_names[i] + " " + acm.link_names[j]] = acm.entries[i].enabled[j];
+    }
+  }
+  snapshot.allowed_collisions_ = hashMap(allowed);
+
+  snapshot.link_padding_ = hashMap(cm.getCurrentLinkPaddingMap());
+
+  std::map<std::string, double> state_values;
+  state.getKinematicStateValues(state_values);
+  snapshot.state_values_ = hashMap(state_values);
+}
+
+bool comparePlanningSceneSnapshots(const PlanningSceneSnapshot &first, const PlanningSceneSnapshot &second,
+                                   std::string &differences)
+{
+  differences.clear();
+  if (first.collision_objects_ != second.collision_objects_) differences += " collision_objects";
+  if (first.attached_objects_ != second.attached_objects_) differences += " attached_objects";
+  if (first.collision_map_ != second.collision_map_) differences += " collision_map";
+  if (first.allowed_collisions_ != second.allowed_collisions_) differences += " allowed_collisions";
+  if (first.link_padding_ != second.link_padding_) differences += " link_padding";
+  if (first.state_values_ != second.state_values_) differences += " state_values";
+  return differences.empty();
+}
+
+} //namespace object_manipulator
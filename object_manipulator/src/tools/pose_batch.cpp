@@ -0,0 +1,387 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/pose_batch.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace object_manipulator {
+
+namespace {
+
+//! One pose per pack, for the entries left over at the end of a batch and for machines without SIMD
+struct ScalarPack
+{
+  typedef double T;
+  static const size_t N = 1;
+  static T load(const double *p) {return *p;}
+  static T set1(double v) {return v;}
+  static void store(double *p, T v) {*p = v;}
+};
+
+//the GCC vector extensions give us +, - and * on the SIMD types, so the kernels can be written once
+#if defined(__AVX__)
+struct SimdPack
+{
+  typedef __m256d T;
+  static const size_t N = 4;
+  static T load(const double *p) {return _mm256_loadu_pd(p);}
+  static T set1(double v) {return _mm256_set1_pd(v);}
+  static void store(double *p, T v) {_mm256_storeu_pd(p, v);}
+};
+const char *SIMD_NAME = "AVX";
+#elif defined(__SSE2__)
+struct SimdPack
+{
+  typedef __m128d T;
+  static const size_t N = 2;
+  static T load(const double *p) {return _mm_loadu_pd(p);}
+  static T set1(double v) {return _mm_set1_pd(v);}
+  static void store(double *p, T v) {_mm_storeu_pd(p, v);}
+};
+const char *SIMD_NAME = "SSE2";
+#else
+typedef ScalarPack SimdPack;
+const char *SIMD_NAME = "scalar";
+#endif
+
+//! The components of P::N consecutive poses of a batch, or of one pose repeated P::N times
+template <class P>
+struct PosePack
+{
+  typename P::T x, y, z, qx, qy, qz, qw;
+
+  void load(const PoseBatch &b, size_t i)
+  {
+    x = P::load(b.component(PoseBatch::X) + i);
+    y = P::load(b.component(PoseBatch::Y) + i);
+    z = P::load(b.component(PoseBatch::Z) + i);
+    qx = P::load(b.component(PoseBatch::QX) + i);
+    qy = P::load(b.component(PoseBatch::QY) + i);
+    qz = P::load(b.component(PoseBatch::QZ) + i);
+    qw = P::load(b.component(PoseBatch::QW) + i);
+  }
+
+  void broadcast(const double *v)
+  {
+    x = P::set1(v[PoseBatch::X]);
+    y = P::set1(v[PoseBatch::Y]);
+    z = P::set1(v[PoseBatch::Z]);
+    qx = P::set1(v[PoseBatch::QX]);
+    qy = P::set1(v[PoseBatch::QY]);
+    qz = P::set1(v[PoseBatch::QZ]);
+    qw = P::set1(v[PoseBatch::QW]);
+  }
+
+  void store(PoseBatch &b, size_t i) const
+  {
+    P::store(b.component(PoseBatch::X) + i, x);
+    P::store(b.component(PoseBatch::Y) + i, y);
+    P::store(b.component(PoseBatch::Z) + i, z);
+    P::store(b.component(PoseBatch::QX) + i, qx);
+    P::store(b.component(PoseBatch::QY) + i, qy);
+    P::store(b.component(PoseBatch::QZ) + i, qz);
+    P::store(b.component(PoseBatch::QW) + i, qw);
+  }
+
+  //! Rotates v by our quaternion: v + 2w (u x v) + 2u x (u x v)
+  void rotate(typename P::T vx, typename P::T vy, typename P::T vz,
+              typename P::T &ox, typename P::T &oy, typename P::T &oz) const
+  {
+    typename P::T two = P::set1(2.0);
+    typename P::T tx = two * (qy*vz - qz*vy);
+    typename P::T ty = two * (qz*vx - qx*vz);
+    typename P::T tz = two * (qx*vy - qy*vx);
+    ox = vx + qw*tx + (qy*tz - qz*ty);
+    oy = vy + qw*ty + (qz*tx - qx*tz);
+    oz = vz + qw*tz + (qx*ty - qy*tx);
+  }
+};
+
+//! out = a * b
+template <class P>
+inline void composePack(const PosePack<P> &a, const PosePack<P> &b, PosePack<P> &out)
+{
+  typename P::T rx, ry, rz;
+  a.rotate(b.x, b.y, b.z, rx, ry, rz);
+  typename P::T qw = a.qw*b.qw - a.qx*b.qx - a.qy*b.qy - a.qz*b.qz;
+  typename P::T qx = a.qw*b.qx + a.qx*b.qw + a.qy*b.qz - a.qz*b.qy;
+  typename P::T qy = a.qw*b.qy - a.qx*b.qz + a.qy*b.qw + a.qz*b.qx;
+  typename P::T qz = a.qw*b.qz + a.qx*b.qy - a.qy*b.qx + a.qz*b.qw;
+  out.x = a.x + rx;
+  out.y = a.y + ry;
+  out.z = a.z + rz;
+  out.qx = qx;
+  out.qy = qy;
+  out.qz = qz;
+  out.qw = qw;
+}
+
+//! Runs op on SimdPack::N poses at a time, then on the rest one by one
+template <class Op>
+void runKernel(size_t n, Op &op)
+{
+  size_t i = 0;
+  for (; i + SimdPack::N <= n; i += SimdPack::N) op.template apply<SimdPack>(i);
+  for (; i < n; i++) op.template apply<ScalarPack>(i);
+}
+
+struct ComposeOp
+{
+  const PoseBatch &a, &b;
+  PoseBatch &out;
+  ComposeOp(const PoseBatch &a_, const PoseBatch &b_, PoseBatch &out_) : a(a_), b(b_), out(out_) {}
+  template <class P> void apply(size_t i)
+  {
+    PosePack<P> pa, pb, po;
+    pa.load(a, i);
+    pb.load(b, i);
+    composePack(pa, pb, po);
+    po.store(out, i);
+  }
+};
+
+struct ComposeLeftOp
+{
+  const double *a;
+  const PoseBatch &b;
+  PoseBatch &out;
+  ComposeLeftOp(const double *a_, const PoseBatch &b_, PoseBatch &out_) : a(a_), b(b_), out(out_) {}
+  template <class P> void apply(size_t i)
+  {
+    PosePack<P> pa, pb, po;
+    pa.broadcast(a);
+    pb.load(b, i);
+    composePack(pa, pb, po);
+    po.store(out, i);
+  }
+};
+
+struct ComposeRightOp
+{
+  const PoseBatch &a;
+  const double *b;
+  PoseBatch &out;
+  ComposeRightOp(const PoseBatch &a_, const double *b_, PoseBatch &out_) : a(a_), b(b_), out(out_) {}
+  template <class P> void apply(size_t i)
+  {
+    PosePack<P> pa, pb, po;
+    pa.load(a, i);
+    pb.broadcast(b);
+    composePack(pa, pb, po);
+    po.store(out, i);
+  }
+};
+
+struct InvertOp
+{
+  const PoseBatch &a;
+  PoseBatch &out;
+  InvertOp(const PoseBatch &a_, PoseBatch &out_) : a(a_), out(out_) {}
+  template <class P> void apply(size_t i)
+  {
+    PosePack<P> p;
+    p.load(a, i);
+    //the inverse rotation is the conjugate, and the position is rotated back and negated
+    typename P::T zero = P::set1(0.0);
+    p.qx = zero - p.qx;
+    p.qy = zero - p.qy;
+    p.qz = zero - p.qz;
+    typename P::T rx, ry, rz;
+    p.rotate(p.x, p.y, p.z, rx, ry, rz);
+    p.x = zero - rx;
+    p.y = zero - ry;
+    p.z = zero - rz;
+    p.store(out, i);
+  }
+};
+
+struct OffsetOp
+{
+  const PoseBatch &a;
+  double dx, dy, dz;
+  bool local;
+  PoseBatch &out;
+  OffsetOp(const PoseBatch &a_, const tf::Vector3 &d, bool local_, PoseBatch &out_) : 
+    a(a_), dx(d.x()), dy(d.y()), dz(d.z()), local(local_), out(out_) {}
+  template <class P> void apply(size_t i)
+  {
+    PosePack<P> p;
+    p.load(a, i);
+    typename P::T ox = P::set1(dx), oy = P::set1(dy), oz = P::set1(dz);
+    if (local) p.rotate(ox, oy, oz, ox, oy, oz);
+    p.x = p.x + ox;
+    p.y = p.y + oy;
+    p.z = p.z + oz;
+    p.store(out, i);
+  }
+};
+
+void toArray(const tf::Transform &t, double *v)
+{
+  tf::Quaternion q = t.getRotation();
+  v[PoseBatch::X] = t.getOrigin().x();
+  v[PoseBatch::Y] = t.getOrigin().y();
+  v[PoseBatch::Z] = t.getOrigin().z();
+  v[PoseBatch::QX] = q.x();
+  v[PoseBatch::QY] = q.y();
+  v[PoseBatch::QZ] = q.z();
+  v[PoseBatch::QW] = q.w();
+}
+
+//! Copies a pose into an array of components, normalizing the quaternion
+void toArray(const geometry_msgs::Pose &pose, double *v)
+{
+  const geometry_msgs::Quaternion &q = pose.orientation;
+  double norm = sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+  double s = norm > 0 ? 1.0 / norm : 0.0;
+  v[PoseBatch::X] = pose.position.x;
+  v[PoseBatch::Y] = pose.position.y;
+  v[PoseBatch::Z] = pose.position.z;
+  v[PoseBatch::QX] = q.x * s;
+  v[PoseBatch::QY] = q.y * s;
+  v[PoseBatch::QZ] = q.z * s;
+  v[PoseBatch::QW] = norm > 0 ? q.w * s : 1.0;
+}
+
+} //namespace
+
+void PoseBatch::resize(size_t size)
+{
+  for (int c=0; c<NUM_COMPONENTS; c++) data_[c].resize(size, c == QW ? 1.0 : 0.0);
+  size_ = size;
+}
+
+void PoseBatch::set(size_t i, const geometry_msgs::Pose &pose)
+{
+  double v[NUM_COMPONENTS];
+  toArray(pose, v);
+  for (int c=0; c<NUM_COMPONENTS; c++) data_[c][i] = v[c];
+}
+
+void PoseBatch::set(size_t i, const tf::Transform &transform)
+{
+  double v[NUM_COMPONENTS];
+  toArray(transform, v);
+  for (int c=0; c<NUM_COMPONENTS; c++) data_[c][i] = v[c];
+}
+
+void PoseBatch::get(size_t i, geometry_msgs::Pose &pose) const
+{
+  pose.position.x = data_[X][i];
+  pose.position.y = data_[Y][i];
+  pose.position.z = data_[Z][i];
+  pose.orientation.x = data_[QX][i];
+  pose.orientation.y = data_[QY][i];
+  pose.orientation.z = data_[QZ][i];
+  pose.orientation.w = data_[QW][i];
+}
+
+tf::Transform PoseBatch::getTransform(size_t i) const
+{
+  return tf::Transform(tf::Quaternion(data_[QX][i], data_[QY][i], data_[QZ][i], data_[QW][i]),
+                       tf::Vector3(data_[X][i], data_[Y][i], data_[Z][i]));
+}
+
+void PoseBatch::compose(const PoseBatch &a, const PoseBatch &b, PoseBatch &out)
+{
+  out.resize(a.size());
+  ComposeOp op(a, b, out);
+  runKernel(a.size(), op);
+}
+
+void PoseBatch::compose(const tf::Transform &a, const PoseBatch &b, PoseBatch &out)
+{
+  out.resize(b.size());
+  double v[NUM_COMPONENTS];
+  toArray(a, v);
+  ComposeLeftOp op(v, b, out);
+  runKernel(b.size(), op);
+}
+
+void PoseBatch::compose(const PoseBatch &a, const tf::Transform &b, PoseBatch &out)
+{
+  out.resize(a.size());
+  double v[NUM_COMPONENTS];
+  toArray(b, v);
+  ComposeRightOp op(a, v, out);
+  runKernel(a.size(), op);
+}
+
+void PoseBatch::invert(const PoseBatch &a, PoseBatch &out)
+{
+  out.resize(a.size());
+  InvertOp op(a, out);
+  runKernel(a.size(), op);
+}
+
+void PoseBatch::applyOffset(const PoseBatch &a, const tf::Vector3 &offset, bool local, PoseBatch &out)
+{
+  out.resize(a.size());
+  OffsetOp op(a, offset, local, out);
+  runKernel(a.size(), op);
+}
+
+const char* PoseBatch::instructionSet()
+{
+  return SIMD_NAME;
+}
+
+geometry_msgs::Pose composePoses(const geometry_msgs::Pose &a, const geometry_msgs::Pose &b)
+{
+  //a batch of one costs a few allocations, so this one goes through the kernel directly
+  double va[PoseBatch::NUM_COMPONENTS], vb[PoseBatch::NUM_COMPONENTS];
+  toArray(a, va);
+  toArray(b, vb);
+  PosePack<ScalarPack> pa, pb, result;
+  pa.broadcast(va);
+  pb.broadcast(vb);
+  composePack(pa, pb, result);
+  geometry_msgs::Pose pose;
+  pose.position.x = result.x;
+  pose.position.y = result.y;
+  pose.position.z = result.z;
+  pose.orientation.x = result.qx;
+  pose.orientation.y = result.qy;
+  pose.orientation.z = result.qz;
+  pose.orientation.w = result.qw;
+  return pose;
+}
+
+} //namespace object_manipulator
@@ -0,0 +1,158 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/posture_plan.h"
+
+#include <algorithm>
+
+#include <ros/ros.h>
+
+namespace object_manipulator {
+
+void PosturePlan::init(const planning_models::KinematicState &state)
+{
+  joint_index_.clear();
+  const std::vector<planning_models::KinematicState::JointState*> &joint_states = state.getJointStateVector();
+  unsigned int index = 0;
+  for (size_t i=0; i<joint_states.size(); i++) {
+    const std::vector<std::string> &names = joint_states[i]->getJointStateNameOrder();
+    for (size_t j=0; j<names.size(); j++) {
+      joint_index_[names[j]] = index++;
+    }
+  }
+  state.getKinematicStateValues(base_values_);
+  if (base_values_.size() != index) {
+    ROS_ERROR("Posture plan: state has %zd values but %u joint names", base_values_.size(), index);
+  }
+
+  begin_.assign(1, 0);
+  indices_.clear();
+  values_.clear();
+  set_begin_.assign(1, 0);
+  set_indices_.clear();
+}
+
+unsigned int PosturePlan::resolve(const std::string &name) const
+{
+  std::map<std::string, unsigned int>::const_iterator it = joint_index_.find(name);
+  if (it == joint_index_.end()) {
+    ROS_DEBUG_NAMED("manipulation", "Posture plan: joint %s is not part of the model", name.c_str());
+    return UNKNOWN_JOINT;
+  }
+  return it->second;
+}
+
+size_t PosturePlan::addPosture(const sensor_msgs::JointState &posture)
+{
+  for (size_t j=0; j<posture.name.size() && j<posture.position.size(); j++) {
+    unsigned int index = resolve(posture.name[j]);
+    if (index == UNKNOWN_JOINT) continue;
+    indices_.push_back(index);
+    values_.push_back(posture.position[j]);
+  }
+  begin_.push_back(indices_.size());
+  return begin_.size() - 2;
+}
+
+size_t PosturePlan::addBasePosture(const std::vector<std::string> &joint_names)
+{
+  for (size_t j=0; j<joint_names.size(); j++) {
+    unsigned int index = resolve(joint_names[j]);
+    if (index == UNKNOWN_JOINT) continue;
+    indices_.push_back(index);
+    values_.push_back(base_values_[index]);
+  }
+  begin_.push_back(indices_.size());
+  return begin_.size() - 2;
+}
+
+size_t PosturePlan::addJoints(const std::vector<std::string> &joint_names)
+{
+  for (size_t j=0; j<joint_names.size(); j++) {
+    set_indices_.push_back(resolve(joint_names[j]));
+  }
+  set_begin_.push_back(set_indices_.size());
+  return set_begin_.size() - 2;
+}
+
+void PosturePlan::setPosture(size_t posture, std::vector<double> &values) const
+{
+  for (size_t k=begin_[posture]; k<begin_[posture+1]; k++) {
+    values[indices_[k]] = values_[k];
+  }
+}
+
+void PosturePlan::setJoints(size_t joints, const std::vector<double> &joint_values, 
+                            std::vector<double> &values) const
+{
+  size_t begin = set_begin_[joints];
+  size_t count = std::min(set_begin_[joints+1] - begin, joint_values.size());
+  for (size_t j=0; j<count; j++) {
+    if (set_indices_[begin+j] == UNKNOWN_JOINT) continue;
+    values[set_indices_[begin+j]] = joint_values[j];
+  }
+}
+
+void PosturePlan::getJoints(size_t joints, const std::vector<double> &values, 
+                            std::vector<double> &joint_values) const
+{
+  size_t begin = set_begin_[joints];
+  joint_values.resize(set_begin_[joints+1] - begin);
+  for (size_t j=0; j<joint_values.size(); j++) {
+    if (set_indices_[begin+j] == UNKNOWN_JOINT) joint_values[j] = 0.0;
+    else joint_values[j] = values[set_indices_[begin+j]];
+  }
+}
+
+void PosturePlan::applyBase(planning_models::KinematicState &state) const
+{
+  state.setKinematicState(base_values_);
+}
+
+void PosturePlan::applyPosture(size_t posture, planning_models::KinematicState &state, 
+                               std::vector<double> &values) const
+{
+  state.getKinematicStateValues(values);
+  setPosture(posture, values);
+  state.setKinematicState(values);
+}
+
+void PosturePlan::applyJoints(size_t joints, const std::vector<double> &joint_values, 
+                              planning_models::KinematicState &state, std::vector<double> &values) const
+{
+  state.getKinematicStateValues(values);
+  setJoints(joints, joint_values, values);
+  state.setKinematicState(values);
+}
+
+} //namespace object_manipulator
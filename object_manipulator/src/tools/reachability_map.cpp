@@ -0,0 +1,312 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/reachability_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+namespace object_manipulator {
+
+static const char REACHABILITY_MAP_FILE_MAGIC[8] = "OMREACH";
+static const boost::uint32_t REACHABILITY_MAP_FILE_VERSION = 2;
+
+//! The fixed-size header at the start of a map file, followed directly by the voxel masks
+struct ReachabilityMapFileHeader
+{
+  char magic_[8];
+  boost::uint32_t version_;
+  boost::uint32_t num_bins_;
+  boost::uint32_t dims_[3];
+  boost::uint32_t padding_;
+  double origin_[3];
+  double resolution_;
+  double approach_axis_[3];
+  char group_name_[64];
+  char base_frame_[64];
+};
+
+ReachabilityMap::ReachabilityMap() :
+  approach_axis_(1.0, 0.0, 0.0),
+  origin_(0.0, 0.0, 0.0),
+  resolution_(1.0),
+  cells_(NULL),
+  mapping_(NULL),
+  mapping_size_(0)
+{
+  dims_[0] = dims_[1] = dims_[2] = 0;
+}
+
+ReachabilityMap::~ReachabilityMap()
+{
+  release();
+}
+
+void ReachabilityMap::release()
+{
+  if (mapping_) munmap(mapping_, mapping_size_);
+  mapping_ = NULL;
+  mapping_size_ = 0;
+  owned_cells_.clear();
+  cells_ = NULL;
+}
+
+const std::vector<tf::Vector3>& ReachabilityMap::binDirections()
+{
+  //points on a Fibonacci spiral are spread close to evenly over the sphere
+  static std::vector<tf::Vector3> directions;
+  if (directions.empty()) {
+    double golden_angle = M_PI * (3.0 - sqrt(5.0));
+    for (unsigned int i=0; i<NUM_ORIENTATION_BINS; i++) {
+      double z = 1.0 - (2.0*i + 1.0) / NUM_ORIENTATION_BINS;
+      double r = sqrt(1.0 - z*z);
+      directions.push_back(tf::Vector3(r * cos(golden_angle*i), r * sin(golden_angle*i), z));
+    }
+  }
+  return directions;
+}
+
+const std::vector<boost::uint32_t>& ReachabilityMap::binNeighbours()
+{
+  static std::vector<boost::uint32_t> neighbours;
+  if (neighbours.empty()) {
+    const std::vector<tf::Vector3> &directions = binDirections();
+    double min_dot = cos(neighbourAngle());
+    neighbours.assign(NUM_ORIENTATION_BINS, 0);
+    for (unsigned int a=0; a<NUM_ORIENTATION_BINS; a++) {
+      for (unsigned int b=0; b<NUM_ORIENTATION_BINS; b++) {
+        if (directions[a].dot(directions[b]) >= min_dot) neighbours[a] |= ((boost::uint32_t) 1 << b);
+      }
+    }
+  }
+  return neighbours;
+}
+
+void ReachabilityMap::create(const std::string &group_name, const std::string &base_frame, 
+                             const tf::Vector3 &approach_axis,
+                             const tf::Vector3 &min, const tf::Vector3 &max, double resolution)
+{
+  release();
+  group_name_ = group_name;
+  base_frame_ = base_frame;
+  approach_axis_ = approach_axis.normalized();
+  origin_ = min;
+  resolution_ = resolution;
+  for (int i=0; i<3; i++) {
+    dims_[i] = std::max(1, (int) ceil((max.m_floats[i] - min.m_floats[i]) / resolution));
+  }
+  owned_cells_.assign(numVoxels(), 0);
+  cells_ = &owned_cells_[0];
+  //make sure the directions are initialized before any concurrent queries
+  binDirections();
+  binNeighbours();
+}
+
+bool ReachabilityMap::load(const std::string &filename)
+{
+  release();
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ROS_ERROR("Could not open reachability map %s", filename.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ReachabilityMapFileHeader)) {
+    ROS_ERROR("Reachability map %s is too short", filename.c_str());
+    close(fd);
+    return false;
+  }
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    ROS_ERROR("Could not map reachability map %s into memory", filename.c_str());
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = st.st_size;
+
+  const ReachabilityMapFileHeader *header = (const ReachabilityMapFileHeader*) mapping_;
+  if (memcmp(header->magic_, REACHABILITY_MAP_FILE_MAGIC, sizeof(header->magic_)) != 0 ||
+      header->version_ != REACHABILITY_MAP_FILE_VERSION || header->num_bins_ != NUM_ORIENTATION_BINS) {
+    ROS_ERROR("%s is not a reachability map, or was written by an incompatible version", filename.c_str());
+    release();
+    return false;
+  }
+  for (int i=0; i<3; i++) dims_[i] = header->dims_[i];
+  if (mapping_size_ != sizeof(ReachabilityMapFileHeader) + numVoxels() * sizeof(boost::uint32_t)) {
+    ROS_ERROR("Reachability map %s has the wrong size", filename.c_str());
+    release();
+    return false;
+  }
+  group_name_ = std::string(header->group_name_, strnlen(header->group_name_, sizeof(header->group_name_)));
+  base_frame_ = std::string(header->base_frame_, strnlen(header->base_frame_, sizeof(header->base_frame_)));
+  origin_ = tf::Vector3(header->origin_[0], header->origin_[1], header->origin_[2]);
+  resolution_ = header->resolution_;
+  approach_axis_ = tf::Vector3(header->approach_axis_[0], header->approach_axis_[1], header->approach_axis_[2]);
+  cells_ = (const boost::uint32_t*) ((const char*) mapping_ + sizeof(ReachabilityMapFileHeader));
+  binDirections();
+  return true;
+}
+
+bool ReachabilityMap::save(const std::string &filename) const
+{
+  if (empty()) return false;
+  if (group_name_.size() >= 64 || base_frame_.size() >= 64) {
+    ROS_ERROR("Group or frame name too long to save reachability map");
+    return false;
+  }
+  ReachabilityMapFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, REACHABILITY_MAP_FILE_MAGIC, sizeof(header.magic_));
+  header.version_ = REACHABILITY_MAP_FILE_VERSION;
+  header.num_bins_ = NUM_ORIENTATION_BINS;
+  for (int i=0; i<3; i++) {
+    header.dims_[i] = dims_[i];
+    header.origin_[i] = origin_.m_floats[i];
+    header.approach_axis_[i] = approach_axis_.m_floats[i];
+  }
+  header.resolution_ = resolution_;
+  strncpy(header.group_name_, group_name_.c_str(), sizeof(header.group_name_));
+  strncpy(header.base_frame_, base_frame_.c_str(), sizeof(header.base_frame_));
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (!f) {
+    ROS_ERROR("Could not open %s for writing", filename.c_str());
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+    fwrite(cells_, sizeof(boost::uint32_t), numVoxels(), f) == numVoxels();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) ROS_ERROR("Failed to write reachability map to %s", filename.c_str());
+  return ok;
+}
+
+long ReachabilityMap::voxelIndex(const tf::Vector3 &position) const
+{
+  long index = 0;
+  for (int i=2; i>=0; i--) {
+    double c = floor((position.m_floats[i] - origin_.m_floats[i]) / resolution_);
+    if (c < 0 || c >= dims_[i]) return -1;
+    index = index * dims_[i] + (long) c;
+  }
+  return index;
+}
+
+tf::Vector3 ReachabilityMap::voxelCenter(size_t i) const
+{
+  size_t x = i % dims_[0];
+  size_t y = (i / dims_[0]) % dims_[1];
+  size_t z = i / ((size_t)dims_[0] * dims_[1]);
+  return origin_ + tf::Vector3((x + 0.5) * resolution_, (y + 0.5) * resolution_, (z + 0.5) * resolution_);
+}
+
+unsigned int ReachabilityMap::orientationBin(const tf::Quaternion &orientation) const
+{
+  tf::Vector3 axis = tf::quatRotate(orientation, approach_axis_);
+  const std::vector<tf::Vector3> &directions = binDirections();
+  unsigned int best = 0;
+  double best_dot = -2.0;
+  for (unsigned int b=0; b<NUM_ORIENTATION_BINS; b++) {
+    double dot = directions[b].dot(axis);
+    if (dot > best_dot) {
+      best_dot = dot;
+      best = b;
+    }
+  }
+  return best;
+}
+
+void ReachabilityMap::markReachable(size_t i, unsigned int bin)
+{
+  if (owned_cells_.empty()) {
+    ROS_ERROR("Attempting to modify a reachability map that was loaded from a file");
+    return;
+  }
+  owned_cells_[i] |= ((boost::uint32_t) 1 << bin);
+}
+
+void ReachabilityMap::dilate()
+{
+  if (owned_cells_.empty()) {
+    ROS_ERROR("Attempting to modify a reachability map that was loaded from a file");
+    return;
+  }
+  std::vector<boost::uint32_t> dilated(owned_cells_);
+  for (long z=0; z<(long)dims_[2]; z++) {
+    for (long y=0; y<(long)dims_[1]; y++) {
+      for (long x=0; x<(long)dims_[0]; x++) {
+        boost::uint32_t mask = 0;
+        for (long dz=std::max(z-1, 0L); dz<=std::min(z+1, (long)dims_[2]-1); dz++) {
+          for (long dy=std::max(y-1, 0L); dy<=std::min(y+1, (long)dims_[1]-1); dy++) {
+            for (long dx=std::max(x-1, 0L); dx<=std::min(x+1, (long)dims_[0]-1); dx++) {
+              mask |= owned_cells_[(dz*dims_[1] + dy)*dims_[0] + dx];
+            }
+          }
+        }
+        dilated[(z*dims_[1] + y)*dims_[0] + x] = mask;
+      }
+    }
+  }
+  const std::vector<boost::uint32_t> &neighbours = binNeighbours();
+  for (size_t i=0; i<dilated.size(); i++) {
+    boost::uint32_t mask = dilated[i];
+    for (unsigned int b=0; b<NUM_ORIENTATION_BINS; b++) {
+      if ((dilated[i] >> b) & 1) mask |= neighbours[b];
+    }
+    dilated[i] = mask;
+  }
+  owned_cells_.swap(dilated);
+  cells_ = &owned_cells_[0];
+}
+
+bool ReachabilityMap::isReachable(const geometry_msgs::Pose &base_frame_pose) const
+{
+  if (empty()) return true;
+  long index = voxelIndex(tf::Vector3(base_frame_pose.position.x, base_frame_pose.position.y, 
+                                      base_frame_pose.position.z));
+  if (index < 0) return false;
+  tf::Quaternion orientation;
+  tf::quaternionMsgToTF(base_frame_pose.orientation, orientation);
+  return (cells_[index] >> orientationBin(orientation)) & 1;
+}
+
+} //namespace object_manipulator
@@ -0,0 +1,122 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/reachability_map_builder.h"
+
+#include <planning_environment/models/model_utils.h>
+
+#include "object_manipulator/tools/hand_description.h"
+
+namespace object_manipulator {
+
+ReachabilityMapBuilder::ReachabilityMapBuilder(planning_environment::CollisionModels* cm,
+                         arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware* solver,
+                         const std::vector<std::string> &free_links) :
+  cm_(cm), solver_(solver)
+{
+  planning_models::KinematicState default_state(cm_->getKinematicModel());
+  default_state.setKinematicStateToDefault();
+  arm_navigation_msgs::PlanningScene planning_scene;
+  planning_environment::convertKinematicStateToRobotState(default_state, ros::Time::now(), 
+                                                          cm_->getWorldFrameId(), planning_scene.robot_state);
+  state_ = cm_->setPlanningScene(planning_scene);
+  state_->getKinematicStateValues(default_values_);
+
+  collision_space::EnvironmentModel::AllowedCollisionMatrix acm = cm_->getCurrentAllowedCollisionMatrix();
+  for (size_t i=0; i<free_links.size(); i++) {
+    acm.changeEntry(free_links[i], true);
+  }
+  cm_->setAlteredAllowedCollisionMatrix(acm);
+}
+
+ReachabilityMapBuilder::~ReachabilityMapBuilder()
+{
+  cm_->revertAllowedCollisionToDefault();
+  cm_->revertPlanningScene(state_);
+}
+
+std::vector<std::string> ReachabilityMapBuilder::armAndGripperLinks(planning_environment::CollisionModels* cm,
+                                                                   const std::string &arm_name)
+{
+  std::vector<std::string> links;
+  const planning_models::KinematicModel::JointModelGroup* arm_group = 
+    cm->getKinematicModel()->getModelGroup(handDescription().armGroup(arm_name));
+  const planning_models::KinematicModel::JointModelGroup* gripper_group = 
+    cm->getKinematicModel()->getModelGroup(handDescription().gripperCollisionName(arm_name));
+  if (arm_group) links = arm_group->getGroupLinkNames();
+  if (gripper_group) {
+    const std::vector<std::string> &gripper_links = gripper_group->getGroupLinkNames();
+    links.insert(links.end(), gripper_links.begin(), gripper_links.end());
+  }
+  return links;
+}
+
+bool ReachabilityMapBuilder::checkIK(const geometry_msgs::Pose &base_frame_pose)
+{
+  state_->setKinematicState(default_values_);
+  arm_navigation_msgs::Constraints emp;
+  sensor_msgs::JointState solution;
+  arm_navigation_msgs::ArmNavigationErrorCodes error_code;
+  return solver_->findConstraintAwareSolution(base_frame_pose, emp, state_, solution, error_code, false);
+}
+
+size_t ReachabilityMapBuilder::build(ReachabilityMap &map, unsigned int num_rolls)
+{
+  num_rolls = std::max(num_rolls, 1u);
+  size_t reachable = 0;
+  ros::WallTime start = ros::WallTime::now();
+  for (size_t i=0; i<map.numVoxels() && ros::ok(); i++) {
+    geometry_msgs::Pose pose;
+    tf::pointTFToMsg(map.voxelCenter(i), pose.position);
+    for (unsigned int b=0; b<ReachabilityMap::NUM_ORIENTATION_BINS; b++) {
+      const tf::Vector3 &direction = ReachabilityMap::binDirection(b);
+      tf::Quaternion align = tf::shortestArcQuat(map.getApproachAxis(), direction);
+      for (unsigned int r=0; r<num_rolls; r++) {
+        tf::Quaternion roll(direction, 2.0 * M_PI * r / num_rolls);
+        tf::quaternionTFToMsg(roll * align, pose.orientation);
+        if (checkIK(pose)) {
+          map.markReachable(i, b);
+          reachable++;
+          break;
+        }
+      }
+    }
+    if ((i+1) % 1000 == 0) {
+      ROS_INFO("Sampled %zu of %zu voxels in %.1f s; %zu reachable voxel orientations so far", 
+               i+1, map.numVoxels(), (ros::WallTime::now() - start).toSec(), reachable);
+    }
+  }
+  return reachable;
+}
+
+} //namespace object_manipulator
@@ -0,0 +1,206 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/tester_stats.h"
+
+#include <cmath>
+#include <sstream>
+
+namespace object_manipulator {
+
+const char* TesterStats::stageName(int stage)
+{
+  switch (stage)
+  {
+  case COLLISION: return "collision";
+  case LIFT: return "lift";
+  case PREGRASP: return "pregrasp";
+  case IK: return "ik";
+  case INTERPOLATED_IK: return "interpolated_ik";
+  case FINAL_CHECK: return "final_check";
+  }
+  return "unknown";
+}
+
+const char* TesterStats::counterName(int counter)
+{
+  switch (counter)
+  {
+  case IK_CACHE_HIT: return "ik_cache_hits";
+  case IK_CACHE_MISS: return "ik_cache_misses";
+  case IK_CACHE_STALE: return "ik_cache_stale_entries";
+  case REACHABILITY_REJECTION: return "reachability_rejections";
+  case COLLISION_MATRICES_CACHE_HIT: return "collision_matrices_cache_hits";
+  case COLLISION_MATRICES_CACHE_MISS: return "collision_matrices_cache_misses";
+  case IK_SEEDED: return "ik_seeded_from_neighbours";
+  }
+  return "unknown";
+}
+
+int TesterStats::bucket(double seconds)
+{
+  double us = seconds * 1.0e6;
+  if (us < 2.0) return 0;
+  return std::min(NUM_BUCKETS-1, (int) floor(log(us) / log(2.0)));
+}
+
+double TesterStats::bucketLimit(int bucket)
+{
+  return ldexp(1.0e-6, bucket+1);
+}
+
+double TesterStats::percentile(const size_t *histogram, double fraction)
+{
+  size_t total = 0;
+  for (int b=0; b<NUM_BUCKETS; b++) total += histogram[b];
+  if (total == 0) return 0.0;
+  size_t count = 0;
+  for (int b=0; b<NUM_BUCKETS; b++) {
+    count += histogram[b];
+    if (count >= fraction * total) return bucketLimit(b);
+  }
+  return bucketLimit(NUM_BUCKETS-1);
+}
+
+void TesterStats::clear()
+{
+  for (int s=0; s<NUM_STAGES; s++) {
+    stage_time_[s] = 0.0;
+    stage_count_[s] = 0;
+    for (int b=0; b<NUM_BUCKETS; b++) stage_histogram_[s][b] = 0;
+  }
+  for (int c=0; c<NUM_COUNTERS; c++) counters_[c] = 0;
+  outcomes_.clear();
+  calls_ = 0;
+  candidates_ = 0;
+  wall_time_ = 0.0;
+  for (int b=0; b<NUM_BUCKETS; b++) call_histogram_[b] = 0;
+}
+
+double TesterStats::collisionChecksPerCandidate() const
+{
+  if (candidates_ == 0) return 0.0;
+  return (double)(stage_count_[COLLISION] + stage_count_[LIFT] + stage_count_[PREGRASP] + 
+                  stage_count_[FINAL_CHECK]) / candidates_;
+}
+
+//! Adds a key-value pair to a diagnostic status
+template <typename T>
+static void addValue(diagnostic_msgs::DiagnosticStatus &status, const std::string &key, const T &value)
+{
+  std::ostringstream ss;
+  ss << value;
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  kv.value = ss.str();
+  status.values.push_back(kv);
+}
+
+void TesterStats::toDiagnosticStatus(diagnostic_msgs::DiagnosticStatus &status) const
+{
+  status.values.clear();
+  addValue(status, "calls", calls_);
+  addValue(status, "candidates", candidates_);
+  addValue(status, "wall_time_s", wall_time_);
+  if (wall_time_ > 0) addValue(status, "candidates_per_s", candidates_ / wall_time_);
+  addValue(status, "call_p50_ms", 1.0e3 * percentile(call_histogram_, 0.5));
+  addValue(status, "call_p90_ms", 1.0e3 * percentile(call_histogram_, 0.9));
+  addValue(status, "call_p99_ms", 1.0e3 * percentile(call_histogram_, 0.99));
+  addValue(status, "collision_checks_per_candidate", collisionChecksPerCandidate());
+  for (int s=0; s<NUM_STAGES; s++) {
+    if (stage_count_[s] == 0) continue;
+    std::string name = stageName(s);
+    addValue(status, name + "_runs", stage_count_[s]);
+    addValue(status, name + "_mean_ms", 1.0e3 * stage_time_[s] / stage_count_[s]);
+    addValue(status, name + "_p50_ms", 1.0e3 * percentile(stage_histogram_[s], 0.5));
+    addValue(status, name + "_p99_ms", 1.0e3 * percentile(stage_histogram_[s], 0.99));
+  }
+  for (int c=0; c<NUM_COUNTERS; c++) {
+    if (counters_[c] != 0) addValue(status, counterName(c), counters_[c]);
+  }
+  size_t ik_lookups = counters_[IK_CACHE_HIT] + counters_[IK_CACHE_MISS];
+  if (ik_lookups > 0) addValue(status, "ik_cache_hit_rate", (double)counters_[IK_CACHE_HIT] / ik_lookups);
+  size_t matrix_lookups = counters_[COLLISION_MATRICES_CACHE_HIT] + counters_[COLLISION_MATRICES_CACHE_MISS];
+  if (matrix_lookups > 0) {
+    addValue(status, "collision_matrices_cache_hit_rate", 
+             (double)counters_[COLLISION_MATRICES_CACHE_HIT] / matrix_lookups);
+  }
+  for (std::map<int, size_t>::const_iterator it = outcomes_.begin(); it != outcomes_.end(); it++) {
+    std::ostringstream key;
+    key << "outcome_" << it->first;
+    addValue(status, key.str(), it->second);
+  }
+}
+
+void TesterStatsRecorder::addStageTime(TesterStats::Stage stage, double seconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.stage_time_[stage] += seconds;
+  stats_.stage_count_[stage]++;
+  stats_.stage_histogram_[stage][TesterStats::bucket(seconds)]++;
+}
+
+void TesterStatsRecorder::increment(TesterStats::Counter counter)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.counters_[counter]++;
+}
+
+void TesterStatsRecorder::addOutcome(int result_code, size_t count)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.outcomes_[result_code] += count;
+}
+
+void TesterStatsRecorder::addCall(size_t candidates, double seconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.calls_++;
+  stats_.candidates_ += candidates;
+  stats_.wall_time_ += seconds;
+  stats_.call_histogram_[TesterStats::bucket(seconds)]++;
+}
+
+TesterStats TesterStatsRecorder::getStats() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void TesterStatsRecorder::reset()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.clear();
+}
+
+} //namespace object_manipulator
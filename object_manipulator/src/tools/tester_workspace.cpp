@@ -0,0 +1,247 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include "object_manipulator/tools/tester_workspace.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "object_manipulator/tools/exceptions.h"
+#include "object_manipulator/tools/planning_scene_diff.h"
+
+namespace object_manipulator {
+
+bool createIKSolvers(planning_environment::CollisionModels* cm,
+                     pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader,
+                     const std::string &plugin_name,
+                     IKSolverMap &ik_solver_map)
+{
+  const std::map<std::string, planning_models::KinematicModel::GroupConfig>& group_config_map = 
+    cm->getKinematicModel()->getJointModelGroupConfigMap();
+
+  for(std::map<std::string, planning_models::KinematicModel::GroupConfig>::const_iterator it = group_config_map.begin();
+      it != group_config_map.end();
+      it++) {
+    if(it->second.base_link_.empty() || it->second.tip_link_.empty()) continue;
+    kinematics::KinematicsBase* kinematics_solver = NULL;
+    try
+    {
+      kinematics_solver = kinematics_loader.createClassInstance(plugin_name);
+    }
+    catch(pluginlib::PluginlibException& ex)
+    {
+      ROS_ERROR("The plugin failed to load. Error1: %s", ex.what());    //handle the class failing to load
+      return false;
+    }
+    ik_solver_map[it->first] = new arm_kinematics_constraint_aware::ArmKinematicsSolverConstraintAware(kinematics_solver,
+                                                                                                        cm,
+                                                                                                        it->first);
+    ik_solver_map[it->first]->setSearchDiscretization(.025);
+  }
+  return true;
+}
+
+ReachabilityMaps selectReachabilityMaps(const ReachabilityMaps &maps, const IKSolverMap &ik_solver_map)
+{
+  ReachabilityMaps selected;
+  for (ReachabilityMaps::const_iterator it = maps.begin(); it != maps.end(); it++) {
+    IKSolverMap::const_iterator solver = ik_solver_map.find(it->first);
+    if (solver == ik_solver_map.end()) {
+      ROS_ERROR("No IK solver for arm %s; ignoring its reachability map", it->first.c_str());
+    } else if (solver->second->getBaseName() != it->second->getBaseFrame()) {
+      ROS_ERROR("Reachability map for arm %s is in frame %s, but IK is solved in frame %s; ignoring it",
+                it->first.c_str(), it->second->getBaseFrame().c_str(), solver->second->getBaseName().c_str());
+    } else {
+      selected.insert(*it);
+    }
+  }
+  return selected;
+}
+
+TesterWorkspace::TesterWorkspace(planning_environment::CollisionModels* cm,
+                                 planning_models::KinematicState* state,
+                                 const IKSolverMap &ik_solver_map) :
+  owns_models_(false),
+  scene_revision_(0),
+  scene_set_(false),
+  cm_(cm),
+  state_(state),
+  ik_solver_map_(ik_solver_map),
+  configuration_(-1)
+{
+}
+
+TesterWorkspace::TesterWorkspace(pluginlib::ClassLoader<kinematics::KinematicsBase> &kinematics_loader,
+                                 const std::string &plugin_name) :
+  owns_models_(true),
+  scene_revision_(0),
+  scene_set_(false),
+  cm_(new planning_environment::CollisionModels("robot_description")),
+  state_(NULL),
+  configuration_(-1)
+{
+  createIKSolvers(cm_, kinematics_loader, plugin_name, ik_solver_map_);
+}
+
+TesterWorkspace::~TesterWorkspace()
+{
+  if (!owns_models_) return;
+  for(IKSolverMap::iterator it = ik_solver_map_.begin(); it != ik_solver_map_.end(); it++) {
+    delete it->second;
+  }
+  if (state_ != NULL) {
+    cm_->revertPlanningScene(state_);
+  }
+  delete cm_;
+}
+
+void TesterWorkspace::syncPlanningScene(const arm_navigation_msgs::PlanningScene &planning_scene, 
+                                        unsigned int revision)
+{
+  if (!owns_models_) return;
+  if (scene_set_ && revision == scene_revision_) return;
+  if (state_ == NULL || !applyPlanningSceneDiff(*cm_, *state_, scene_, planning_scene)) {
+    if (state_ != NULL) {
+      cm_->revertPlanningScene(state_);
+    }
+    state_ = cm_->setPlanningScene(planning_scene);
+    if (state_ == NULL) {
+      ROS_ERROR("Tester workspace: failed to set planning scene");
+      throw MechanismException("Tester workspace: failed to set planning scene");
+    }
+  }
+  scene_ = planning_scene;
+  scene_revision_ = revision;
+  scene_set_ = true;
+  configuration_ = -1;
+}
+
+TesterWorkerPool::~TesterWorkerPool()
+{
+  clear();
+}
+
+void TesterWorkerPool::clear()
+{
+  for (size_t i=0; i<workspaces_.size(); i++) delete workspaces_[i];
+  workspaces_.clear();
+}
+
+std::vector<TesterWorkspace*> 
+TesterWorkerPool::getWorkspaces(size_t num_workers,
+                                const arm_navigation_msgs::PlanningScene &planning_scene,
+                                unsigned int revision)
+{
+  while (workspaces_.size() < num_workers) {
+    ROS_DEBUG_NAMED("manipulation", "Creating tester workspace %zd", workspaces_.size());
+    workspaces_.push_back(new TesterWorkspace(kinematics_loader_, plugin_name_));
+  }
+  std::vector<TesterWorkspace*> ret(workspaces_.begin(), workspaces_.begin() + num_workers);
+  for (size_t i=0; i<ret.size(); i++) {
+    ret[i]->syncPlanningScene(planning_scene, revision);
+  }
+  return ret;
+}
+
+namespace {
+
+//! Shared bookkeeping for the threads started by runInWorkspaces
+struct JobQueue
+{
+  boost::mutex mutex_;
+  size_t next_job_;
+  size_t num_jobs_;
+  bool failed_;
+  std::string error_;
+
+  //! Hands out the next job index; returns false when there is nothing left to do
+  bool next(size_t &job)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (failed_ || next_job_ >= num_jobs_) return false;
+    job = next_job_++;
+    return true;
+  }
+
+  void fail(const std::string &error)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!failed_) error_ = error;
+    failed_ = true;
+  }
+};
+
+void workerThread(TesterWorkspace *workspace, JobQueue *queue,
+                  const boost::function<void(TesterWorkspace&)> *setup,
+                  const boost::function<void(TesterWorkspace&, size_t)> *job)
+{
+  try
+  {
+    if (*setup) (*setup)(*workspace);
+    size_t i;
+    while (queue->next(i)) (*job)(*workspace, i);
+  }
+  catch (std::exception &ex)
+  {
+    queue->fail(ex.what());
+  }
+}
+
+} //namespace
+
+void runInWorkspaces(const std::vector<TesterWorkspace*> &workspaces, size_t num_jobs,
+                     boost::function<void(TesterWorkspace&)> setup,
+                     boost::function<void(TesterWorkspace&, size_t)> job)
+{
+  if (workspaces.empty()) throw MechanismException("no tester workspaces available");
+  if (workspaces.size() == 1) {
+    if (setup) setup(*workspaces[0]);
+    for (size_t i=0; i<num_jobs; i++) job(*workspaces[0], i);
+    return;
+  }
+  if (num_jobs == 0) return;
+
+  JobQueue queue;
+  queue.next_job_ = 0;
+  queue.num_jobs_ = num_jobs;
+  queue.failed_ = false;
+  boost::thread_group threads;
+  for (size_t w=0; w<workspaces.size() && w<num_jobs; w++) {
+    threads.create_thread(boost::bind(&workerThread, workspaces[w], &queue, &setup, &job));
+  }
+  threads.join_all();
+  if (queue.failed_) throw MechanismException("tester worker failed: " + queue.error_);
+}
+
+} //namespace object_manipulator
@@ -0,0 +1,121 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "object_manipulator/object_manipulator.h"
+
+using object_manipulation_msgs::Grasp;
+using object_manipulator::GraspBatch;
+using object_manipulator::GraspContainer;
+
+namespace {
+
+//! Grasps numbered by their success probability, from first to first + count - 1
+std::vector<Grasp> numberedGrasps(size_t first, size_t count)
+{
+  std::vector<Grasp> grasps(count);
+  for (size_t i=0; i<count; i++) grasps[i].success_probability = first + i;
+  return grasps;
+}
+
+void expectNumbered(const GraspBatch &batch, size_t first, size_t count)
+{
+  EXPECT_EQ(first, batch.firstIndex());
+  ASSERT_EQ(count, batch.size());
+  for (size_t i=0; i<count; i++) EXPECT_EQ((double)(first + i), batch.grasps()[i].success_probability);
+}
+
+} //namespace
+
+TEST(GraspContainer, OnlyAddsTheNewTail)
+{
+  GraspContainer container;
+  unsigned int generation = container.clear();
+  container.addGrasps(numberedGrasps(0, 3), generation);
+  //planners report all their grasps so far with every update
+  container.addGrasps(numberedGrasps(0, 5), generation);
+  container.addGrasps(numberedGrasps(0, 5), generation);
+  EXPECT_EQ(5u, container.size());
+  expectNumbered(container.getGrasps(0), 0, 5);
+  expectNumbered(container.getGrasps(2), 2, 3);
+  expectNumbered(container.getGrasps(3), 3, 2);
+  EXPECT_TRUE(container.getGrasps(5).empty());
+}
+
+TEST(GraspContainer, DropsGraspsFromAnOldGeneration)
+{
+  GraspContainer container;
+  unsigned int old_generation = container.clear();
+  container.addGrasps(numberedGrasps(0, 2), old_generation);
+  unsigned int generation = container.clear();
+  EXPECT_EQ(0u, container.size());
+  container.addGrasps(numberedGrasps(0, 4), old_generation);
+  EXPECT_EQ(0u, container.size());
+  container.close(old_generation);
+  EXPECT_FALSE(container.isClosed());
+  container.addGrasps(numberedGrasps(0, 1), generation);
+  EXPECT_EQ(1u, container.size());
+  container.close(generation);
+  EXPECT_TRUE(container.isClosed());
+}
+
+TEST(GraspContainer, BatchesOutliveClear)
+{
+  GraspContainer container;
+  unsigned int generation = container.clear();
+  container.addGrasps(numberedGrasps(0, 3), generation);
+  GraspBatch batch = container.getGrasps(0);
+  container.clear();
+  expectNumbered(batch, 0, 3);
+}
+
+TEST(GraspContainer, WaitReturnsWhenClosed)
+{
+  GraspContainer container;
+  unsigned int generation = container.clear();
+  container.close(generation);
+  //would wait for a minute if closing did not count
+  ros::WallTime start = ros::WallTime::now();
+  EXPECT_TRUE(container.waitForGrasps(0, ros::Duration(60.0)).empty());
+  EXPECT_LT((ros::WallTime::now() - start).toSec(), 10.0);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::Time::init();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,195 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <ros/ros.h>
+
+#include "object_manipulator/grasp_execution/grasp_tester_fast.h"
+#include "object_manipulator/tools/hand_description.h"
+#include "object_manipulator/tools/ik_cache.h"
+#include "object_manipulator/tools/mechanism_interface.h"
+
+using object_manipulation_msgs::Grasp;
+using object_manipulation_msgs::PickupGoal;
+using object_manipulator::GraspExecutionInfo;
+using object_manipulator::GraspTesterFast;
+using object_manipulator::IKCache;
+using object_manipulator::handDescription;
+using object_manipulator::mechInterface;
+
+namespace {
+
+const std::string ARM_NAME = "right_arm";
+const unsigned int NUM_THREADS = 4;
+
+PickupGoal makePickupGoal()
+{
+  PickupGoal goal;
+  goal.arm_name = ARM_NAME;
+  goal.target.reference_frame_id = "base_link";
+  goal.lift.direction.header.frame_id = "base_link";
+  goal.lift.direction.vector.z = 1.0;
+  goal.lift.desired_distance = 0.1;
+  goal.lift.min_distance = 0.05;
+  return goal;
+}
+
+//! Grasps approaching along x on a grid in front of the robot, from easily reachable to out of reach
+/*! Every grasp is followed by a copy of itself moved by much less than the IK cache resolution, so 
+  that pairs of grasps share a cache entry. */
+std::vector<Grasp> makeGrasps()
+{
+  std::vector<std::string> hand_joints = handDescription().handJointNames(ARM_NAME);
+  Grasp grasp;
+  grasp.pre_grasp_posture.name = hand_joints;
+  grasp.pre_grasp_posture.position.assign(hand_joints.size(), 0.05);
+  grasp.grasp_posture.name = hand_joints;
+  grasp.grasp_posture.position.assign(hand_joints.size(), 0.0);
+  grasp.grasp_pose.orientation.w = 1.0;
+  grasp.desired_approach_distance = 0.1;
+  grasp.min_approach_distance = 0.05;
+
+  std::vector<Grasp> grasps;
+  for (double x = 0.4; x < 0.95; x += 0.1) {
+    for (double y = -0.45; y < 0.3; y += 0.15) {
+      for (double z = 0.5; z < 1.05; z += 0.25) {
+        grasp.grasp_pose.position.x = x;
+        grasp.grasp_pose.position.y = y;
+        grasp.grasp_pose.position.z = z;
+        grasps.push_back(grasp);
+        grasp.grasp_pose.position.x += 1.0e-5;
+        grasps.push_back(grasp);
+      }
+    }
+  }
+  return grasps;
+}
+
+void expectSameResults(const std::vector<GraspExecutionInfo> &serial, const std::vector<GraspExecutionInfo> &parallel)
+{
+  ASSERT_EQ(serial.size(), parallel.size());
+  for (size_t i=0; i<serial.size(); i++)
+  {
+    EXPECT_EQ(serial[i].result_.result_code, parallel[i].result_.result_code) << "grasp " << i;
+    EXPECT_EQ(serial[i].approach_trajectory_.points.size(), parallel[i].approach_trajectory_.points.size()) 
+      << "grasp " << i;
+    EXPECT_EQ(serial[i].lift_trajectory_.points.size(), parallel[i].lift_trajectory_.points.size()) 
+      << "grasp " << i;
+  }
+}
+
+class GraspTesterParallelTest : public testing::Test
+{
+protected:
+  PickupGoal goal_;
+  std::vector<Grasp> grasps_;
+
+  virtual void SetUp()
+  {
+    ASSERT_TRUE(ros::service::waitForService("environment_server/set_planning_scene_diff", ros::Duration(60.0)));
+    mechInterface().getPlanningScene(arm_navigation_msgs::OrderedCollisionOperations(), 
+                                     std::vector<arm_navigation_msgs::LinkPadding>());
+    goal_ = makePickupGoal();
+    grasps_ = makeGrasps();
+  }
+
+  //! Tests the grasps serially and in parallel with the same tester, and compares the results
+  void compare(GraspTesterFast &tester, bool return_on_first_hit, std::vector<GraspExecutionInfo> &serial)
+  {
+    std::vector<GraspExecutionInfo> parallel;
+    tester.setNumThreads(1);
+    tester.testGrasps(goal_, grasps_, serial, return_on_first_hit);
+    tester.setNumThreads(NUM_THREADS);
+    tester.testGrasps(goal_, grasps_, parallel, return_on_first_hit);
+    expectSameResults(serial, parallel);
+  }
+};
+
+} //namespace
+
+TEST_F(GraspTesterParallelTest, AllGrasps)
+{
+  GraspTesterFast tester;
+  std::vector<GraspExecutionInfo> serial;
+  compare(tester, false, serial);
+  //the comparison only means something if some grasps made it as far as IK
+  EXPECT_GT(tester.getStats().stage_count_[object_manipulator::TesterStats::IK], 0u);
+}
+
+TEST_F(GraspTesterParallelTest, FirstHit)
+{
+  GraspTesterFast tester;
+  std::vector<GraspExecutionInfo> serial;
+  compare(tester, true, serial);
+}
+
+TEST_F(GraspTesterParallelTest, WithIKCache)
+{
+  //each run starts from an empty cache, so that neither sees entries the other added
+  GraspTesterFast tester;
+  std::vector<GraspExecutionInfo> serial, parallel;
+  boost::shared_ptr<IKCache> serial_cache(new IKCache(1000));
+  tester.setIKCache(serial_cache);
+  tester.setNumThreads(1);
+  tester.testGrasps(goal_, grasps_, serial, false);
+  boost::shared_ptr<IKCache> parallel_cache(new IKCache(1000));
+  tester.setIKCache(parallel_cache);
+  tester.setNumThreads(NUM_THREADS);
+  tester.testGrasps(goal_, grasps_, parallel, false);
+  expectSameResults(serial, parallel);
+  EXPECT_EQ(serial_cache->size(), parallel_cache->size());
+
+  //and again, now that the caches are warm
+  std::vector<GraspExecutionInfo> warm;
+  tester.testGrasps(goal_, grasps_, warm, false);
+  expectSameResults(serial, warm);
+  tester.setIKCache(serial_cache);
+  tester.setNumThreads(1);
+  tester.testGrasps(goal_, grasps_, warm, false);
+  expectSameResults(serial, warm);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_grasp_tester_parallel");
+  ros::NodeHandle nh;
+  return RUN_ALL_TESTS();
+}
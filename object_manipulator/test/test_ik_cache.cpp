@@ -0,0 +1,335 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include "object_manipulator/tools/ik_cache.h"
+
+using object_manipulator::IKCache;
+
+namespace {
+
+std::string tempFilename(const std::string &name)
+{
+  return "/tmp/test_ik_cache_" + boost::lexical_cast<std::string>(getpid()) + "_" + name;
+}
+
+geometry_msgs::Pose makePose(double x, double y, double z)
+{
+  geometry_msgs::Pose pose;
+  pose.position.x = x;
+  pose.position.y = y;
+  pose.position.z = z;
+  pose.orientation.w = 1.0;
+  return pose;
+}
+
+IKCache::Entry makeEntry(int result_code, double offset)
+{
+  IKCache::Entry entry;
+  entry.result_code_ = result_code;
+  entry.collision_map_hash_ = 1000 + result_code;
+  for (int i=0; i<7; i++)
+  {
+    entry.seed_.push_back(offset + 0.1 * i);
+    entry.solution_.push_back(offset - 0.1 * i);
+  }
+  entry.first_trajectory_.joint_names.push_back("joint_a");
+  entry.first_trajectory_.joint_names.push_back("joint_b");
+  trajectory_msgs::JointTrajectoryPoint point;
+  point.positions.push_back(offset);
+  point.positions.push_back(-offset);
+  point.time_from_start = ros::Duration(1.5);
+  entry.first_trajectory_.points.push_back(point);
+  entry.second_trajectory_.joint_names.push_back("joint_c");
+  return entry;
+}
+
+void expectEntriesEqual(const IKCache::Entry &expected, const IKCache::Entry &actual)
+{
+  EXPECT_EQ(expected.result_code_, actual.result_code_);
+  EXPECT_EQ(expected.collision_map_hash_, actual.collision_map_hash_);
+  EXPECT_EQ(expected.seed_, actual.seed_);
+  EXPECT_EQ(expected.solution_, actual.solution_);
+  EXPECT_EQ(expected.first_trajectory_.joint_names, actual.first_trajectory_.joint_names);
+  ASSERT_EQ(expected.first_trajectory_.points.size(), actual.first_trajectory_.points.size());
+  for (size_t i=0; i<expected.first_trajectory_.points.size(); i++)
+  {
+    EXPECT_EQ(expected.first_trajectory_.points[i].positions, actual.first_trajectory_.points[i].positions);
+    EXPECT_EQ(expected.first_trajectory_.points[i].time_from_start, 
+              actual.first_trajectory_.points[i].time_from_start);
+  }
+  EXPECT_EQ(expected.second_trajectory_.joint_names, actual.second_trajectory_.joint_names);
+}
+
+} //namespace
+
+TEST(IKCache, LookupFindsInsertedEntry)
+{
+  IKCache cache(10);
+  IKCache::Key key = cache.makeKey("right_arm", makePose(0.5, 0.0, 0.8), 1, 2);
+  IKCache::Entry entry;
+  EXPECT_FALSE(cache.lookup(key, entry));
+  cache.insert(key, makeEntry(0, 1.0));
+  ASSERT_TRUE(cache.lookup(key, entry));
+  expectEntriesEqual(makeEntry(0, 1.0), entry);
+
+  size_t hits, misses;
+  cache.getStats(hits, misses);
+  EXPECT_EQ(1u, hits);
+  EXPECT_EQ(1u, misses);
+}
+
+TEST(IKCache, KeyDependsOnGroupSceneAndContext)
+{
+  IKCache cache(10);
+  geometry_msgs::Pose pose = makePose(0.5, 0.0, 0.8);
+  cache.insert(cache.makeKey("right_arm", pose, 1, 2), makeEntry(0, 1.0));
+  IKCache::Entry entry;
+  EXPECT_FALSE(cache.lookup(cache.makeKey("left_arm", pose, 1, 2), entry));
+  EXPECT_FALSE(cache.lookup(cache.makeKey("right_arm", pose, 3, 2), entry));
+  EXPECT_FALSE(cache.lookup(cache.makeKey("right_arm", pose, 1, 3), entry));
+}
+
+TEST(IKCache, PendingEntriesOnlyShowOnceInserted)
+{
+  IKCache cache(10);
+  IKCache::Key key = cache.makeKey("right_arm", makePose(0.5, 0.0, 0.8), 1, 2);
+  IKCache::Key other = cache.makeKey("right_arm", makePose(0.6, 0.0, 0.8), 1, 2);
+  IKCache::Pending pending;
+  pending.reset(4);
+  //two candidates in the same cell, filled out of order as workers would
+  pending.set(2, key, makeEntry(0, 2.0));
+  pending.set(0, key, makeEntry(0, 1.0));
+  pending.set(3, other, makeEntry(0, 3.0));
+  IKCache::Entry entry;
+  EXPECT_FALSE(cache.lookup(key, entry));
+  EXPECT_EQ(0u, cache.size());
+
+  cache.insert(pending);
+  EXPECT_EQ(2u, cache.size());
+  //added in candidate order, whatever order the slots were filled in
+  ASSERT_TRUE(cache.lookup(key, entry));
+  expectEntriesEqual(makeEntry(0, 2.0), entry);
+  ASSERT_TRUE(cache.lookup(other, entry));
+  expectEntriesEqual(makeEntry(0, 3.0), entry);
+
+  //the slots are emptied, so inserting again adds nothing
+  size_t revision = cache.getRevision();
+  cache.insert(pending);
+  EXPECT_EQ(revision, cache.getRevision());
+}
+
+TEST(IKCache, NearbyPosesShareACell)
+{
+  IKCache cache(10, 0.001, 0.01);
+  IKCache::Key key = cache.makeKey("right_arm", makePose(0.5, 0.0, 0.8), 1, 2);
+  IKCache::Key near = cache.makeKey("right_arm", makePose(0.5002, 0.0, 0.8), 1, 2);
+  IKCache::Key far = cache.makeKey("right_arm", makePose(0.505, 0.0, 0.8), 1, 2);
+  EXPECT_FALSE(key < near || near < key);
+  EXPECT_TRUE(key < far || far < key);
+
+  //q and -q are the same rotation
+  geometry_msgs::Pose flipped = makePose(0.5, 0.0, 0.8);
+  flipped.orientation.w = -1.0;
+  IKCache::Key flipped_key = cache.makeKey("right_arm", flipped, 1, 2);
+  EXPECT_FALSE(key < flipped_key || flipped_key < key);
+}
+
+TEST(IKCache, SceneHashIgnoresJointNoise)
+{
+  IKCache cache(10, 0.001, 0.01, 0.01);
+  std::vector<double> joints(7, 0.3);
+  std::vector<double> noisy = joints;
+  noisy[2] += 0.001;
+  std::vector<double> moved = joints;
+  moved[2] += 0.1;
+  EXPECT_EQ(cache.sceneHash(5, joints), cache.sceneHash(5, noisy));
+  EXPECT_NE(cache.sceneHash(5, joints), cache.sceneHash(5, moved));
+  EXPECT_NE(cache.sceneHash(5, joints), cache.sceneHash(6, joints));
+}
+
+TEST(IKCache, EvictsLeastRecentlyUsed)
+{
+  IKCache cache(2);
+  IKCache::Key a = cache.makeKey("right_arm", makePose(0.1, 0.0, 0.0), 1, 2);
+  IKCache::Key b = cache.makeKey("right_arm", makePose(0.2, 0.0, 0.0), 1, 2);
+  IKCache::Key c = cache.makeKey("right_arm", makePose(0.3, 0.0, 0.0), 1, 2);
+  cache.insert(a, makeEntry(0, 1.0));
+  cache.insert(b, makeEntry(0, 2.0));
+  IKCache::Entry entry;
+  //a becomes the most recently used, so b goes
+  EXPECT_TRUE(cache.lookup(a, entry));
+  cache.insert(c, makeEntry(0, 3.0));
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_TRUE(cache.lookup(a, entry));
+  EXPECT_FALSE(cache.lookup(b, entry));
+  EXPECT_TRUE(cache.lookup(c, entry));
+}
+
+TEST(IKCache, RevisionChangesOnlyWithEntries)
+{
+  IKCache cache(10);
+  size_t revision = cache.getRevision();
+  IKCache::Key key = cache.makeKey("right_arm", makePose(0.5, 0.0, 0.8), 1, 2);
+  IKCache::Entry entry;
+  cache.lookup(key, entry);
+  EXPECT_EQ(revision, cache.getRevision());
+  cache.insert(key, makeEntry(0, 1.0));
+  EXPECT_NE(revision, cache.getRevision());
+  revision = cache.getRevision();
+  cache.clear();
+  EXPECT_NE(revision, cache.getRevision());
+}
+
+TEST(IKCache, SaveAndLoadRoundTrip)
+{
+  std::string filename = tempFilename("round_trip");
+  IKCache cache(10);
+  std::vector<IKCache::Key> keys;
+  for (int i=0; i<5; i++)
+  {
+    keys.push_back(cache.makeKey(i % 2 ? "right_arm" : "left_arm", makePose(0.1 * i, 0.2, 0.3), 10 + i, 20 + i));
+    cache.insert(keys.back(), makeEntry(i, 0.5 * i));
+  }
+  ASSERT_TRUE(cache.save(filename));
+
+  IKCache loaded(10);
+  ASSERT_TRUE(loaded.load(filename));
+  EXPECT_EQ(cache.size(), loaded.size());
+  for (int i=0; i<5; i++)
+  {
+    IKCache::Entry entry;
+    ASSERT_TRUE(loaded.lookup(keys[i], entry));
+    expectEntriesEqual(makeEntry(i, 0.5 * i), entry);
+  }
+  remove(filename.c_str());
+}
+
+TEST(IKCache, LoadKeepsRecencyOrder)
+{
+  std::string filename = tempFilename("recency");
+  IKCache cache(3);
+  IKCache::Key a = cache.makeKey("right_arm", makePose(0.1, 0.0, 0.0), 1, 2);
+  IKCache::Key b = cache.makeKey("right_arm", makePose(0.2, 0.0, 0.0), 1, 2);
+  IKCache::Key c = cache.makeKey("right_arm", makePose(0.3, 0.0, 0.0), 1, 2);
+  cache.insert(a, makeEntry(0, 1.0));
+  cache.insert(b, makeEntry(0, 2.0));
+  cache.insert(c, makeEntry(0, 3.0));
+  ASSERT_TRUE(cache.save(filename));
+
+  //with room for two, the least recently used entry is the one dropped while loading
+  IKCache loaded(2);
+  ASSERT_TRUE(loaded.load(filename));
+  IKCache::Entry entry;
+  EXPECT_FALSE(loaded.lookup(a, entry));
+  EXPECT_TRUE(loaded.lookup(b, entry));
+  EXPECT_TRUE(loaded.lookup(c, entry));
+  remove(filename.c_str());
+}
+
+TEST(IKCache, RejectsTruncatedFile)
+{
+  std::string filename = tempFilename("truncated");
+  IKCache cache(10);
+  for (int i=0; i<3; i++)
+  {
+    cache.insert(cache.makeKey("right_arm", makePose(0.1 * i, 0.0, 0.0), 1, 2), makeEntry(0, i));
+  }
+  ASSERT_TRUE(cache.save(filename));
+
+  std::string contents;
+  {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  ASSERT_GT(contents.size(), 10u);
+  //every possible cut must be rejected without reading past the end
+  for (size_t cut = 0; cut < contents.size(); cut += 7)
+  {
+    {
+      std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+      out.write(contents.data(), cut);
+    }
+    IKCache loaded(10);
+    EXPECT_FALSE(loaded.load(filename)) << "file cut at " << cut << " of " << contents.size() << " bytes";
+  }
+  remove(filename.c_str());
+}
+
+TEST(IKCache, RejectsOversizedLengths)
+{
+  std::string filename = tempFilename("oversized");
+  IKCache cache(10);
+  cache.insert(cache.makeKey("right_arm", makePose(0.1, 0.0, 0.0), 1, 2), makeEntry(0, 1.0));
+  ASSERT_TRUE(cache.save(filename));
+
+  std::string contents;
+  {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  //the group name length follows the magic, the version and the entry count
+  size_t length_offset = sizeof("OMIKCACHE") + sizeof(boost::uint32_t) + sizeof(boost::uint64_t);
+  ASSERT_GT(contents.size(), length_offset + sizeof(boost::uint32_t));
+  boost::uint32_t huge = 0xfffffff0u;
+  contents.replace(length_offset, sizeof(huge), reinterpret_cast<const char*>(&huge), sizeof(huge));
+  {
+    std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size());
+  }
+  IKCache loaded(10);
+  EXPECT_FALSE(loaded.load(filename));
+  EXPECT_EQ(0u, loaded.size());
+  remove(filename.c_str());
+}
+
+TEST(IKCache, RejectsMissingFile)
+{
+  IKCache cache(10);
+  EXPECT_FALSE(cache.load(tempFilename("missing")));
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,283 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <ros/ros.h>
+
+#include <planning_environment/models/collision_models.h>
+#include <planning_environment/models/model_utils.h>
+
+#include "object_manipulator/tools/planning_scene_diff.h"
+
+using arm_navigation_msgs::PlanningScene;
+using object_manipulator::PlanningSceneSnapshot;
+using object_manipulator::applyPlanningSceneDiff;
+using object_manipulator::comparePlanningSceneSnapshots;
+using object_manipulator::takePlanningSceneSnapshot;
+
+namespace {
+
+const std::string ATTACH_LINK = "r_gripper_palm_link";
+
+arm_navigation_msgs::Shape makeBox(double x, double y, double z)
+{
+  arm_navigation_msgs::Shape box;
+  box.type = arm_navigation_msgs::Shape::BOX;
+  box.dimensions.push_back(x);
+  box.dimensions.push_back(y);
+  box.dimensions.push_back(z);
+  return box;
+}
+
+geometry_msgs::Pose makePose(double x, double y, double z)
+{
+  geometry_msgs::Pose pose;
+  pose.position.x = x;
+  pose.position.y = y;
+  pose.position.z = z;
+  pose.orientation.w = 1.0;
+  return pose;
+}
+
+arm_navigation_msgs::OrientedBoundingBox makeMapBox(double x, double y, double z)
+{
+  arm_navigation_msgs::OrientedBoundingBox box;
+  box.center.x = x;
+  box.center.y = y;
+  box.center.z = z;
+  box.extents.x = box.extents.y = box.extents.z = 0.02;
+  box.axis.z = 1.0;
+  return box;
+}
+
+class PlanningSceneDiffTest : public testing::Test
+{
+protected:
+  planning_environment::CollisionModels *cm_;
+  std::string world_frame_;
+  PlanningScene scene_;
+
+  virtual void SetUp()
+  {
+    cm_ = new planning_environment::CollisionModels("robot_description");
+    ASSERT_TRUE(cm_->loadedModels());
+    world_frame_ = cm_->getWorldFrameId();
+
+    //the robot alone, in its default state
+    planning_models::KinematicState state(cm_->getKinematicModel());
+    state.setKinematicStateToDefault();
+    planning_environment::convertKinematicStateToRobotState(state, ros::Time(), world_frame_, scene_.robot_state);
+    scene_.collision_map.header.frame_id = world_frame_;
+  }
+
+  virtual void TearDown()
+  {
+    delete cm_;
+  }
+
+  arm_navigation_msgs::CollisionObject makeObject(const std::string &id, double x, double y, double z)
+  {
+    arm_navigation_msgs::CollisionObject object;
+    object.header.frame_id = world_frame_;
+    object.id = id;
+    object.operation.operation = arm_navigation_msgs::CollisionObjectOperation::ADD;
+    object.shapes.push_back(makeBox(0.1, 0.1, 0.2));
+    object.poses.push_back(makePose(x, y, z));
+    return object;
+  }
+
+  arm_navigation_msgs::AttachedCollisionObject makeAttachedObject(const std::string &id)
+  {
+    arm_navigation_msgs::AttachedCollisionObject attached;
+    attached.link_name = ATTACH_LINK;
+    attached.touch_links.push_back("r_end_effector");
+    attached.object.header.frame_id = ATTACH_LINK;
+    attached.object.id = id;
+    attached.object.operation.operation = arm_navigation_msgs::CollisionObjectOperation::ADD;
+    attached.object.shapes.push_back(makeBox(0.05, 0.05, 0.1));
+    attached.object.poses.push_back(makePose(0.15, 0.0, 0.0));
+    return attached;
+  }
+
+  //! Installs from, applies the diff to to, and checks the result against a full rebuild from to
+  void expectSameAsRebuild(const PlanningScene &from, const PlanningScene &to)
+  {
+    planning_models::KinematicState *state = cm_->setPlanningScene(from);
+    ASSERT_TRUE(state != NULL);
+    bool incremental = applyPlanningSceneDiff(*cm_, *state, from, to);
+    PlanningSceneSnapshot incremental_snapshot;
+    takePlanningSceneSnapshot(*cm_, *state, incremental_snapshot);
+    cm_->revertPlanningScene(state);
+    ASSERT_TRUE(incremental);
+
+    state = cm_->setPlanningScene(to);
+    ASSERT_TRUE(state != NULL);
+    PlanningSceneSnapshot full_snapshot;
+    takePlanningSceneSnapshot(*cm_, *state, full_snapshot);
+    cm_->revertPlanningScene(state);
+
+    std::string differences;
+    EXPECT_TRUE(comparePlanningSceneSnapshots(incremental_snapshot, full_snapshot, differences))
+      << "differences:" << differences;
+  }
+
+  //! Checks that applyPlanningSceneDiff() refuses a change, leaving it to a full rebuild
+  void expectFallback(const PlanningScene &from, const PlanningScene &to)
+  {
+    planning_models::KinematicState *state = cm_->setPlanningScene(from);
+    ASSERT_TRUE(state != NULL);
+    EXPECT_FALSE(applyPlanningSceneDiff(*cm_, *state, from, to));
+    cm_->revertPlanningScene(state);
+  }
+};
+
+} //namespace
+
+TEST_F(PlanningSceneDiffTest, Unchanged)
+{
+  scene_.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  expectSameAsRebuild(scene_, scene_);
+}
+
+TEST_F(PlanningSceneDiffTest, PaddingChanged)
+{
+  PlanningScene to = scene_;
+  arm_navigation_msgs::LinkPadding padding;
+  padding.link_name = ATTACH_LINK;
+  padding.padding = 0.05;
+  to.link_padding.push_back(padding);
+  expectSameAsRebuild(scene_, to);
+  expectSameAsRebuild(to, scene_);
+}
+
+TEST_F(PlanningSceneDiffTest, ObjectAdded)
+{
+  PlanningScene to = scene_;
+  to.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  expectSameAsRebuild(scene_, to);
+}
+
+TEST_F(PlanningSceneDiffTest, ObjectReplaced)
+{
+  PlanningScene from = scene_;
+  from.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  from.collision_objects.push_back(makeObject("box", 0.6, 0.3, 0.8));
+  PlanningScene to = scene_;
+  to.collision_objects.push_back(makeObject("table", 0.9, 0.1, 0.5));
+  to.collision_objects.push_back(from.collision_objects[1]);
+  expectSameAsRebuild(from, to);
+}
+
+TEST_F(PlanningSceneDiffTest, ObjectRemoved)
+{
+  PlanningScene from = scene_;
+  from.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  from.collision_objects.push_back(makeObject("box", 0.6, 0.3, 0.8));
+  PlanningScene to = scene_;
+  to.collision_objects.push_back(from.collision_objects[1]);
+  expectSameAsRebuild(from, to);
+}
+
+TEST_F(PlanningSceneDiffTest, AttachedObjectDetached)
+{
+  PlanningScene from = scene_;
+  from.attached_collision_objects.push_back(makeAttachedObject("graspable"));
+  expectSameAsRebuild(from, scene_);
+}
+
+TEST_F(PlanningSceneDiffTest, CollisionMapChanged)
+{
+  PlanningScene from = scene_;
+  from.collision_map.boxes.push_back(makeMapBox(0.8, 0.0, 0.7));
+  PlanningScene to = scene_;
+  to.collision_map.boxes.push_back(makeMapBox(0.8, 0.2, 0.7));
+  to.collision_map.boxes.push_back(makeMapBox(0.8, 0.4, 0.7));
+  expectSameAsRebuild(from, to);
+  expectSameAsRebuild(to, scene_);
+}
+
+TEST_F(PlanningSceneDiffTest, DetachedWithCollisionMap)
+{
+  //the map has to be masked again once the attached object is gone
+  PlanningScene to = scene_;
+  to.collision_map.boxes.push_back(makeMapBox(0.8, 0.0, 0.7));
+  PlanningScene from = to;
+  from.attached_collision_objects.push_back(makeAttachedObject("graspable"));
+  expectSameAsRebuild(from, to);
+}
+
+TEST_F(PlanningSceneDiffTest, EverythingAtOnce)
+{
+  PlanningScene from = scene_;
+  from.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  from.collision_objects.push_back(makeObject("box", 0.6, 0.3, 0.8));
+  from.attached_collision_objects.push_back(makeAttachedObject("graspable"));
+  from.collision_map.boxes.push_back(makeMapBox(0.8, 0.0, 0.7));
+  PlanningScene to = scene_;
+  to.collision_objects.push_back(makeObject("table", 0.9, 0.1, 0.5));
+  to.collision_objects.push_back(makeObject("shelf", 0.7, -0.4, 1.0));
+  to.collision_map.boxes.push_back(makeMapBox(0.8, 0.2, 0.7));
+  arm_navigation_msgs::LinkPadding padding;
+  padding.link_name = ATTACH_LINK;
+  padding.padding = 0.05;
+  to.link_padding.push_back(padding);
+  expectSameAsRebuild(from, to);
+}
+
+TEST_F(PlanningSceneDiffTest, AttachedObjectAddedFallsBack)
+{
+  PlanningScene to = scene_;
+  to.attached_collision_objects.push_back(makeAttachedObject("graspable"));
+  expectFallback(scene_, to);
+}
+
+TEST_F(PlanningSceneDiffTest, ObjectOutsideWorldFrameFallsBack)
+{
+  if (world_frame_ == "base_link") return;
+  PlanningScene to = scene_;
+  to.collision_objects.push_back(makeObject("table", 0.8, 0.0, 0.5));
+  to.collision_objects.back().header.frame_id = "base_link";
+  expectFallback(scene_, to);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::init(argc, argv, "test_planning_scene_diff");
+  ros::NodeHandle nh;
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,224 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "object_manipulator/tools/pose_batch.h"
+
+using object_manipulator::PoseBatch;
+
+namespace {
+
+const double TOLERANCE = 1e-9;
+
+//! Sizes that leave a tail after any vector width, as well as empty and single pose batches
+const size_t BATCH_SIZES[] = {0, 1, 2, 3, 4, 5, 7, 8, 13, 64};
+const size_t NUM_BATCH_SIZES = sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]);
+
+double randomValue(double min, double max)
+{
+  return min + (max - min) * (rand() / (double) RAND_MAX);
+}
+
+tf::Transform randomTransform()
+{
+  tf::Quaternion q(randomValue(-1, 1), randomValue(-1, 1), randomValue(-1, 1), randomValue(-1, 1));
+  if (q.length() < 1e-3) q = tf::Quaternion(0, 0, 0, 1);
+  q.normalize();
+  return tf::Transform(q, tf::Vector3(randomValue(-2, 2), randomValue(-2, 2), randomValue(-2, 2)));
+}
+
+PoseBatch randomBatch(size_t size, std::vector<tf::Transform> &transforms)
+{
+  PoseBatch batch(size);
+  transforms.resize(size);
+  for (size_t i=0; i<size; i++)
+  {
+    transforms[i] = randomTransform();
+    batch.set(i, transforms[i]);
+  }
+  return batch;
+}
+
+//! Compares two transforms by what they do to a few points, so that q and -q are the same
+void expectTransformsNear(const tf::Transform &expected, const tf::Transform &actual)
+{
+  const tf::Vector3 points[] = {tf::Vector3(0, 0, 0), tf::Vector3(1, 0, 0), 
+                                tf::Vector3(0, 1, 0), tf::Vector3(0, 0, 1)};
+  for (size_t p=0; p<4; p++)
+  {
+    tf::Vector3 e = expected * points[p];
+    tf::Vector3 a = actual * points[p];
+    EXPECT_NEAR(e.x(), a.x(), TOLERANCE);
+    EXPECT_NEAR(e.y(), a.y(), TOLERANCE);
+    EXPECT_NEAR(e.z(), a.z(), TOLERANCE);
+  }
+  EXPECT_NEAR(1.0, actual.getRotation().length(), TOLERANCE);
+}
+
+} //namespace
+
+TEST(PoseBatch, NewEntriesAreIdentity)
+{
+  PoseBatch batch(3);
+  batch.resize(5);
+  for (size_t i=0; i<5; i++) expectTransformsNear(tf::Transform::getIdentity(), batch.getTransform(i));
+}
+
+TEST(PoseBatch, SetNormalizesAndGetRoundTrips)
+{
+  PoseBatch batch(1);
+  geometry_msgs::Pose pose;
+  pose.position.x = 1.0;
+  pose.position.y = -2.0;
+  pose.position.z = 3.0;
+  pose.orientation.x = 0.0;
+  pose.orientation.y = 0.0;
+  pose.orientation.z = 2.0;
+  pose.orientation.w = 2.0;
+  batch.set(0, pose);
+  geometry_msgs::Pose result;
+  batch.get(0, result);
+  EXPECT_DOUBLE_EQ(1.0, result.position.x);
+  EXPECT_DOUBLE_EQ(-2.0, result.position.y);
+  EXPECT_DOUBLE_EQ(3.0, result.position.z);
+  EXPECT_NEAR(sqrt(0.5), result.orientation.z, TOLERANCE);
+  EXPECT_NEAR(sqrt(0.5), result.orientation.w, TOLERANCE);
+}
+
+TEST(PoseBatch, ComposeBatchesMatchesTransforms)
+{
+  srand(1);
+  for (size_t s=0; s<NUM_BATCH_SIZES; s++)
+  {
+    std::vector<tf::Transform> ta, tb;
+    PoseBatch a = randomBatch(BATCH_SIZES[s], ta);
+    PoseBatch b = randomBatch(BATCH_SIZES[s], tb);
+    PoseBatch out;
+    PoseBatch::compose(a, b, out);
+    ASSERT_EQ(BATCH_SIZES[s], out.size());
+    for (size_t i=0; i<out.size(); i++) expectTransformsNear(ta[i] * tb[i], out.getTransform(i));
+  }
+}
+
+TEST(PoseBatch, ComposeWithSingleTransformMatchesTransforms)
+{
+  srand(2);
+  for (size_t s=0; s<NUM_BATCH_SIZES; s++)
+  {
+    std::vector<tf::Transform> tb;
+    PoseBatch b = randomBatch(BATCH_SIZES[s], tb);
+    tf::Transform t = randomTransform();
+    PoseBatch left, right;
+    PoseBatch::compose(t, b, left);
+    PoseBatch::compose(b, t, right);
+    ASSERT_EQ(BATCH_SIZES[s], left.size());
+    ASSERT_EQ(BATCH_SIZES[s], right.size());
+    for (size_t i=0; i<b.size(); i++)
+    {
+      expectTransformsNear(t * tb[i], left.getTransform(i));
+      expectTransformsNear(tb[i] * t, right.getTransform(i));
+    }
+  }
+}
+
+TEST(PoseBatch, InvertMatchesTransforms)
+{
+  srand(3);
+  for (size_t s=0; s<NUM_BATCH_SIZES; s++)
+  {
+    std::vector<tf::Transform> ta;
+    PoseBatch a = randomBatch(BATCH_SIZES[s], ta);
+    PoseBatch out;
+    PoseBatch::invert(a, out);
+    ASSERT_EQ(BATCH_SIZES[s], out.size());
+    for (size_t i=0; i<out.size(); i++) expectTransformsNear(ta[i].inverse(), out.getTransform(i));
+  }
+}
+
+TEST(PoseBatch, ApplyOffsetMatchesTranslations)
+{
+  srand(4);
+  tf::Vector3 offset(0.1, -0.2, 0.3);
+  tf::Transform translation(tf::Quaternion(0, 0, 0, 1), offset);
+  for (size_t s=0; s<NUM_BATCH_SIZES; s++)
+  {
+    std::vector<tf::Transform> ta;
+    PoseBatch a = randomBatch(BATCH_SIZES[s], ta);
+    PoseBatch fixed, local;
+    PoseBatch::applyOffset(a, offset, false, fixed);
+    PoseBatch::applyOffset(a, offset, true, local);
+    for (size_t i=0; i<a.size(); i++)
+    {
+      expectTransformsNear(translation * ta[i], fixed.getTransform(i));
+      expectTransformsNear(ta[i] * translation, local.getTransform(i));
+    }
+  }
+}
+
+TEST(PoseBatch, OutputMayBeAnInput)
+{
+  srand(5);
+  std::vector<tf::Transform> ta, tb;
+  PoseBatch a = randomBatch(13, ta);
+  PoseBatch b = randomBatch(13, tb);
+  PoseBatch::compose(a, b, a);
+  for (size_t i=0; i<a.size(); i++) expectTransformsNear(ta[i] * tb[i], a.getTransform(i));
+  PoseBatch::invert(b, b);
+  for (size_t i=0; i<b.size(); i++) expectTransformsNear(tb[i].inverse(), b.getTransform(i));
+}
+
+TEST(PoseBatch, ComposePosesMatchesTransforms)
+{
+  srand(6);
+  for (int n=0; n<20; n++)
+  {
+    tf::Transform ta = randomTransform(), tb = randomTransform();
+    geometry_msgs::Pose a, b;
+    tf::poseTFToMsg(ta, a);
+    tf::poseTFToMsg(tb, b);
+    tf::Transform result;
+    tf::poseMsgToTF(object_manipulator::composePoses(a, b), result);
+    expectTransformsNear(ta * tb, result);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
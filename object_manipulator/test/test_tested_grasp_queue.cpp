@@ -0,0 +1,152 @@
+/*********************************************************************
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "object_manipulator/object_manipulator.h"
+
+using object_manipulation_msgs::Grasp;
+using object_manipulation_msgs::GraspResult;
+using object_manipulator::GraspBatch;
+using object_manipulator::GraspContainer;
+using object_manipulator::GraspExecutionInfo;
+using object_manipulator::TestedGrasp;
+using object_manipulator::TestedGraspQueue;
+
+namespace {
+
+//! Grasps numbered by their success probability, from first to first + count - 1
+std::vector<Grasp> numberedGrasps(size_t first, size_t count)
+{
+  std::vector<Grasp> grasps(count);
+  for (size_t i=0; i<count; i++) grasps[i].success_probability = first + i;
+  return grasps;
+}
+
+GraspExecutionInfo executionInfo(int result_code)
+{
+  GraspExecutionInfo info;
+  info.result_.result_code = result_code;
+  return info;
+}
+
+//! Pushes every grasp of the batch as a success, then finishes
+void pushAll(TestedGraspQueue *queue, GraspBatch batch)
+{
+  for (size_t i=0; i<batch.size(); i++) queue->push(batch, i, executionInfo(GraspResult::SUCCESS));
+  queue->finish(TestedGraspQueue::DONE);
+}
+
+//! Keeps going until told to stop, then reports it
+void runUntilInterrupted(TestedGraspQueue *queue)
+{
+  while (!queue->interrupted()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  queue->finish(TestedGraspQueue::INTERRUPTED);
+}
+
+bool alwaysInterrupt() {return true;}
+
+} //namespace
+
+TEST(TestedGraspQueue, PopsGraspsInTheOrderTheyWerePushed)
+{
+  GraspContainer container;
+  unsigned int generation = container.clear();
+  container.addGrasps(numberedGrasps(0, 20), generation);
+  TestedGraspQueue queue((boost::function<bool()>()));
+  queue.start(boost::bind(&pushAll, &queue, container.getGrasps(0)));
+
+  std::deque<TestedGrasp> tested;
+  std::string error;
+  while (queue.popAll(tested, ros::Duration(1.0)) || queue.getOutcome(error) == TestedGraspQueue::TESTING) {}
+  EXPECT_EQ(TestedGraspQueue::DONE, queue.getOutcome(error));
+  ASSERT_EQ(20u, tested.size());
+  for (size_t i=0; i<tested.size(); i++)
+  {
+    EXPECT_EQ(i, tested[i].index_);
+    EXPECT_EQ((double)i, tested[i].grasp().success_probability);
+    EXPECT_EQ(GraspResult::SUCCESS, tested[i].execution_info_.result_.result_code);
+  }
+}
+
+TEST(TestedGraspQueue, PopReturnsFalseWhenEmptyAndDone)
+{
+  TestedGraspQueue queue((boost::function<bool()>()));
+  queue.finish(TestedGraspQueue::ERROR, "broken");
+  std::deque<TestedGrasp> tested;
+  EXPECT_FALSE(queue.popAll(tested, ros::Duration(60.0)));
+  std::string error;
+  EXPECT_EQ(TestedGraspQueue::ERROR, queue.getOutcome(error));
+  EXPECT_EQ("broken", error);
+}
+
+TEST(TestedGraspQueue, StopInterruptsTheTestingThread)
+{
+  TestedGraspQueue queue((boost::function<bool()>()));
+  EXPECT_FALSE(queue.interrupted());
+  queue.start(boost::bind(&runUntilInterrupted, &queue));
+  queue.stop();
+  std::deque<TestedGrasp> tested;
+  std::string error;
+  while (queue.getOutcome(error) == TestedGraspQueue::TESTING) queue.popAll(tested, ros::Duration(0.1));
+  EXPECT_EQ(TestedGraspQueue::INTERRUPTED, queue.getOutcome(error));
+  EXPECT_TRUE(tested.empty());
+}
+
+TEST(TestedGraspQueue, InterruptFunctionInterrupts)
+{
+  TestedGraspQueue queue(boost::bind(&alwaysInterrupt));
+  EXPECT_TRUE(queue.interrupted());
+}
+
+TEST(TestedGraspQueue, DestructorStopsAndJoinsTheTestingThread)
+{
+  //would hang here if the destructor did not stop the thread
+  TestedGraspQueue *queue = new TestedGraspQueue((boost::function<bool()>()));
+  queue->start(boost::bind(&runUntilInterrupted, queue));
+  delete queue;
+  SUCCEED();
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  ros::Time::init();
+  return RUN_ALL_TESTS();
+}